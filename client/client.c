@@ -14,16 +14,22 @@
 #include <stdbool.h>
 #include <string.h>
 #include "message.h"
+#include "wire.h"
 #include "graphics.h"
 #include "senders.h"
 #include "handlers.h"
 #include "validators.h"
+#include "prediction.h"
+#include "headless.h"
+#include "hud.h"
 #include "clientdata.h"
 
 // function prototypes
 static void parseArgs(int argc, char* argv[], addr_t* serverp);
 static bool respondToInput(void* server);
+static bool respondToTimeout(void* server);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
+static void finishBatch(void* server);
 static void setPlayerName(const int argc, char* argv[]);
 
 #ifdef MINISERVER_TEST
@@ -36,13 +42,25 @@ void unitTest(const addr_t from);
 const int MAXIMUM_NAME_LENGTH = 50;
 const int MAXIMUM_GOLD = 1000;
 const int MAXIMUM_MAP_SIZE = 2500;
+const float KEY_WINDOW = 0.1;
 const int FOREGROUND_COLOR = 7;
 const int BACKGROUND_COLOR = 0;
 const char* PLAYER_KEYSTROKES = "qQhHlLjJkKyYuUnNbB";
 const char* SPECTATOR_KEYSTROKES = "qQ";
 
+// seconds of quiet from the server after which a headless client checks on its key in flight
+static const float HEADLESS_TIMEOUT = 0.25;
+
+// key that shows or hides the HUD (never sent to the server), and seconds of quiet after which the HUD
+// is refreshed anyway, so the frame rate falls to zero when nothing moves
+static const char HUD_TOGGLE_KEY = 'i';
+static const float HUD_TIMEOUT = 0.5;
+
+// key that asks the server to walk a player to the nearest gold in sight
+static const char GOTO_GOLD_KEY = 'g';
+
 // project-wide global client struct; see .h for more details.
-ClientData client = {NULL, '\0', 0, 0, 0, 0, MAXIMUM_GOLD, PRE_INIT};
+ClientData client = {NULL, '\0', 0, 0, 0, 0, MAXIMUM_GOLD, PRE_INIT, false, 0, false, 1, "", false, false, false, false};
 
 int 
 main(int argc, char* argv[]) 
@@ -50,8 +68,14 @@ main(int argc, char* argv[])
     addr_t server;
     parseArgs(argc, argv, &server); // sets up server and sets player name
 
-    // uses message module to start a communicaation loop with the server
-    bool messageLoopExitStatus = message_loop(&server, 0, NULL, respondToInput, handleMessage);
+    // uses message module to start a communicaation loop with the server; a headless client reads no
+    // keyboard, but checks on its key in flight whenever the server goes quiet
+    bool messageLoopExitStatus;
+    if (client.headless) {
+        messageLoopExitStatus = message_loop(&server, HEADLESS_TIMEOUT, headless_timeout, NULL, handleMessage);
+    } else {
+        messageLoopExitStatus = message_loop(&server, HUD_TIMEOUT, respondToTimeout, respondToInput, handleMessage);
+    }
 
     // shut down message module
     message_done();
@@ -69,15 +93,50 @@ main(int argc, char* argv[])
 void 
 parseArgs(int argc, char* argv[], addr_t* serverp) 
 {    
-    // verifies correct number of arguments 
+    // optional leading arguments turn on movement prediction or headless play; drop them so the rest are
+    // where expected
     const char* program = argv[0];
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s hostname port [player name]\n", program);
+    const char* keySource = NULL;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        int used = 1; // arguments this option takes up
+        if (strcmp(argv[1], "--predict") == 0) {
+            client.predict = true;
+        } else if (strcmp(argv[1], "--headless") == 0 && argc > 2) {
+            client.headless = true;
+            keySource = argv[2];
+            used = 2;
+        } else if (strcmp(argv[1], "--text") == 0) {
+            client.text = true;
+        } else if (strcmp(argv[1], "--frames") == 0) {
+            client.frames = true;
+        } else if (strcmp(argv[1], "--udp") == 0) {
+            client.udp = true;
+        } else if (strcmp(argv[1], "--session") == 0 && argc > 2 && validate_session(argv[2])) {
+            strcpy(client.session, argv[2]);
+            used = 2;
+        } else {
+            break;
+        }
+        argv[used] = argv[0];
+        argv += used;
+        argc -= used;
+    }
+
+    // verifies correct number of arguments (a headless client, or one coming back to a session, must be a
+    // player)
+    if (argc < 3 || ((client.headless || client.session[0] != '\0') && argc < 4)) {
+        fprintf(stderr, "Usage: %s [--predict] [--headless script|random:N[:seed]] [--session token] [--text] [--frames] [--udp] hostname port [player name]\n", program);
         exit(2);
     }
 
-    // attempts initialize message module, errors and exits if it cannot
-    if (message_init(NULL) == 0) {
+    // loads the keys a headless client will play
+    if (client.headless && !headless_init(keySource)) {
+        exit(6);
+    }
+
+    // attempts initialize message module, errors and exits if it cannot; a server on this host is
+    // reached through shared memory unless --udp
+    if ((client.udp ? message_init(NULL) : message_initShared(NULL, 0)) == 0) {
         fprintf(stderr, "Could not initialize message module\n");
         exit(3);
     }
@@ -137,18 +196,61 @@ respondToInput(void* server)
         send_key(serverp, 'q');
         return false; // continue message loop (we stop when we receive QUIT, not by our own volition)
     }
+
+    // the HUD key is the client's own business
+    if (input == HUD_TOGGLE_KEY) {
+        hud_toggle();
+        update_display();
+        return false; // continue message loop
+    }
+
+    // the server plans the walk to gold, with one update at the end
+    if (input == GOTO_GOLD_KEY && client.playerName != NULL) {
+        send_goto_gold(serverp);
+        remove_indicator();
+        update_display();
+        return false; // continue message loop
+    }
     
     // if keystroke does something, send it to server, else indicate that it is invalid
     if (strchr(functionalInputs, input) != NULL) {
-        send_key(serverp, input);
+        // when predicting, a step is shown right away and tagged so the server's answer can be matched;
+        // only in play, since before the first DISPLAY (or between rounds) the key is not sent at all
+        bool predicting = client.predict && client.playerName != NULL && client.state == PLAY;
+        int seq = predicting ? prediction_move(input) : -1;
+        if (seq >= 0) {
+            display_map(prediction_map());
+        }
+
+        // a held key's repeats go together; come back to send them once their window is over
+        if (send_key_coalesced(serverp, input, seq)) {
+            message_setTimeout(KEY_WINDOW);
+        }
         remove_indicator(); // removes any indicator present on banner line
     } else if (client.playerName != NULL) {
         indicate_invalid_key(input);
     }
 
+    // show any banner changes
+    update_display();
+
     return false; // continue message loop 
 }
 
+/*
+ * Sends held keys and refreshes the HUD when nothing has happened for a while
+ */
+static bool
+respondToTimeout(void* server)
+{
+    if (!send_held_keys(server)) {
+        message_setTimeout(HUD_TIMEOUT); // nothing left to come back for soon
+    }
+    hud_update();
+    update_display();
+    return false; // continue message loop
+}
+
 /*
  * Responds to server messages
  */
@@ -162,12 +264,25 @@ handleMessage(void* arg, const addr_t from, const char* message)
         return false; // continue message loop 
     }
     
+    // a binary message (see wire.h) goes straight to its handler by opcode
+    if (wire_isBinary(message, message_length())) {
+        handle_binary(message, message_length());
+        if (!message_pending()) {
+            finishBatch(arg);
+        }
+        send_receipt((addr_t *)&from);
+        return false; // continue message loop 
+    }
+    
     // extract the message header (the first word) and everything else
     char messageHeader[25];
     char remainder[100];
     if (sscanf(message, "%24s %99[^\n]", messageHeader, remainder) != 2) {
         fprintf(stderr, "Received message with invalid format\n");
         send_receipt((addr_t *)&from);
+        if (!message_pending()) {
+            finishBatch(arg); // show what earlier messages in the batch brought
+        }
         return false; // continue message loop 
     }
 
@@ -192,6 +307,15 @@ handleMessage(void* arg, const addr_t from, const char* message)
         } else {
             fprintf(stderr, "Malformed QUIT message\n");
         }
+    } else if (strcmp(messageHeader, "ROUND") == 0) {
+        // like QUIT, the summary is too long for "remaining"
+        char* skip = "ROUND ";
+        char* found = strstr(message, skip);
+        if (found != NULL) {
+            handle_round(found + strlen(skip));
+        } else {
+            fprintf(stderr, "Malformed ROUND message\n");
+        }
     } else if (strcmp(messageHeader, "ERROR") == 0) {
         handle_error(remainder);
     } else if (strcmp(messageHeader, "SPECTATOR_GOLD") == 0) {
@@ -232,18 +356,49 @@ handleMessage(void* arg, const addr_t from, const char* message)
             fprintf(stderr, "Malformed DISPLAY message\n");
         }
         #endif
+    } else if (strcmp(messageHeader, "TERRAIN") == 0) {
+        // like DISPLAY, too long for "remaining", and over many lines
+        handle_terrain((char*) message + strlen("TERRAIN "));
+    } else if (strcmp(messageHeader, "VIEW") == 0) {
+        // with everything in sight, it can be too long for "remaining" too
+        handle_view((char*) message + strlen("VIEW "));
     } else if (strcmp(messageHeader, "GOLD_REMAINING") == 0) {
         handle_gold_remaining(remainder);
     } else if (strcmp(messageHeader, "STOLEN") == 0) {
         handle_stolen(remainder);
+    } else if (strcmp(messageHeader, "SEQ") == 0) {
+        handle_seq(remainder);
+    } else if (strcmp(messageHeader, "SESSION") == 0) {
+        handle_session(remainder);
     } else {
         fprintf(stderr, "%s is an invalid message header\n", messageHeader); // bad message header
     }
+
+    // draw once per batch of messages, after the last one, with only the newest map
+    if (!message_pending()) {
+        finishBatch(arg);
+    }
     
     send_receipt((addr_t *)&from);
     return false; // continue message loop 
 }
 
+/*
+ * Runs after the last message of a batch: draws the newest map and the HUD, and sends any held keys
+ * whose window is over (or, for a headless client, its next key)
+ */
+static void
+finishBatch(void* server)
+{
+    draw_display();
+    hud_update();
+    update_display();
+    send_held_keys(server);
+    if (client.headless) {
+        headless_next(server);
+    }
+}
+
 #include <stdlib.h> // for malloc and free
 
 /*
@@ -38,6 +38,15 @@ typedef struct {
     int ncolsScreen; // number of column of the screen (terminal window)
     int maximumGold; // maximum possible gold count in this game
     int state; // state the client is currently in (one of the enum values above)
+    bool predict; // whether to show moves before the server confirms them (--predict)
+    int framesSkipped; // DISPLAYs never drawn because a newer one arrived in the same batch
+    bool headless; // whether keys come from a script instead of the keyboard, with no display (--headless)
+    int round; // round being played (from 1); a persistent server starts a new one after each ROUND
+    char session[17]; // token from SESSION, to come back as the same player with --session ("" if none)
+    bool text; // whether to keep to the text protocol, never asking the server for binary messages (--text)
+    bool binary; // whether the server has answered in binary, so takes KEY and GOTO in binary too (see wire.h)
+    bool frames; // whether to take the whole map in each DISPLAY, not build it from TERRAIN and VIEW (--frames)
+    bool udp; // whether to reach a server on this host by UDP, not through shared memory (--udp)
 } ClientData;
 
 extern ClientData client; // globally-scoped client data
@@ -45,6 +54,7 @@ extern ClientData client; // globally-scoped client data
 extern const int MAXIMUM_NAME_LENGTH; // maximum length of player name
 extern const int MAXIMUM_GOLD; // maximum possible gold count in general for any game for this client
 extern const int MAXIMUM_MAP_SIZE; // maximum size of map
+extern const float KEY_WINDOW; // seconds within which repeats of a step are sent to the server together
 
 extern const int BACKGROUND_COLOR; // color of display background
 extern const int FOREGROUND_COLOR; // color of display foreground
@@ -5,12 +5,17 @@
  * curses, ensuring valid dimensions, displays information on a top banner depending on whether the client
  * is a spectator or player. It also displays various notifications on the banner (directly after it). It
  * reads keyboard input and provdes an exit function.
+ *
+ * The map is drawn into a curses pad as large as the map; the screen shows a viewport onto it, below
+ * the banner, that follows the player's '@'. Maps larger than the terminal are thus playable.
  * 
  * Author: Joseph Hirsh
  * Date: March 1st, 2024
  * 
  */
 
+#define _POSIX_C_SOURCE 200809L // for sigaction and sigsuspend
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,10 +26,43 @@
 #include "graphics.h"
 #include "clientdata.h"
 
+// the map as last drawn, so each DISPLAY only redraws what changed (NULL until the first one)
+static char* lastFrame = NULL;
+static int lastFrameSize = 0;
+
+// whether curses is running, so updates are not pushed before init or after end
+static bool cursesStarted = false;
+
+// the whole map, and the part of it shown (its top-left cell) below the banner
+static WINDOW* pad = NULL;
+static int viewTop = 0;
+static int viewLeft = 0;
+
+// where the player's '@' was last drawn (-1 until seen; spectators never see one)
+static int playerRow = -1;
+static int playerCol = -1;
+
+// set by the SIGWINCH handler; the resize is applied on the next update_display
+static volatile sig_atomic_t resizePending = false;
+
+// text shown at the right end of the banner line ('\0' if none), and the column it was drawn at (-1 if not)
+static char hudText[80] = "";
+static int hudColumn = -1;
+
+// smallest viewport worth playing in (or the whole map, if it is smaller)
+static const int MIN_VIEW_ROWS = 10;
+static const int MIN_VIEW_COLS = 40;
+
 // function prototypes
 static void setupScreenSize(int nrows, int ncols);
+static bool getScreenSize(int* nrows, int* ncols);
+static void handleWindowChange(int signal);
+static void applyResize();
+static bool followPlayer();
 static void appendToBanner(char* message);
 static void moveToNormalBannerEnd();
+static void drawHud();
+static void eraseHud();
 
 /*
  * Initialize curses; see .h for more details. 
@@ -32,35 +70,69 @@ static void moveToNormalBannerEnd();
 void
 init_curses(int nrows, int ncols)
 {
-    // ensures window size is large enough, prompts user to expand it and waits if not
-    setupScreenSize(nrows, ncols);
+    // headless clients never start curses, which makes every display function do nothing
+    if (client.headless) {
+        return;
+    }
+
+    // a new round (possibly on a map of another size) only needs a new pad, on a cleared screen
+    if (cursesStarted) {
+        clear();
+        hudColumn = -1;
+    } else {
+        // ensures window size is large enough, prompts user to expand it and waits if not
+        setupScreenSize(nrows, ncols);
     
-    // initialize the curses library
-    initscr();
+        // initialize the curses library
+        initscr();
+
+        // enable character input to be read one character at a time
+        cbreak();
 
-    // enable character input to be read one character at a time
-    cbreak();
+        // disable automatic echoing of characters typed by the user
+        noecho();
 
-    // disable automatic echoing of characters typed by the user
-    noecho();
+        // enable non-blocking input mode
+        nodelay(stdscr, TRUE);
 
-    // enable non-blocking input mode
-    nodelay(stdscr, TRUE);
+        // enable the keypad for interpreting special keys
+        keypad(stdscr, TRUE);
 
-    // enable the keypad for interpreting special keys
-    keypad(stdscr, TRUE);
+        // flush any pending input
+        flushinp();
 
-    // flush any pending input
-    flushinp();
+        // start color mode
+        start_color();
 
-    // start color mode
-    start_color();
+        // initialize color pair one with white foreground and black background
+        init_pair(1, FOREGROUND_COLOR, BACKGROUND_COLOR);
 
-    // initialize color pair one with white foreground and black background
-    init_pair(1, FOREGROUND_COLOR, BACKGROUND_COLOR);
+        // enable attributes with color pair 1
+        attron(COLOR_PAIR(1));
+    }
 
-    // enable attributes with color pair 1
-    attron(COLOR_PAIR(1));
+    // create the pad holding the whole map; one spare column, so writing the last cell cannot fail
+    if (pad != NULL) {
+        delwin(pad);
+    }
+    pad = newpad(nrows, ncols + 1);
+    if (pad == NULL) {
+        endwin();
+        fprintf(stderr, "Could not create a %d by %d map display\n", nrows, ncols);
+        exit(6);
+    }
+    wattron(pad, COLOR_PAIR(1));
+    viewTop = 0;
+    viewLeft = 0;
+    playerRow = -1;
+    playerCol = -1;
+
+    // forget any earlier frame; the next map is drawn in full
+    free(lastFrame);
+    lastFrame = NULL;
+    lastFrameSize = 0;
+
+    cursesStarted = true;
 }
 
 /*
@@ -69,35 +141,98 @@ init_curses(int nrows, int ncols)
 void 
 display_map(char* map) 
 {
-    // starting cursor location
-    int x = 0;
-    int y = 1; // leaves top row for banner
+    // nothing to draw on without curses (headless mode)
+    if (!cursesStarted) {
+        return;
+    }
+
+    int ncols = client.ncolsMap;
+    int size = client.nrowsMap * ncols;
 
-    // iterates over map
-    for (int i = 0; i < strlen(map); i++) {
-        // gets current character
-        char c = map[i];
+    // a malformed map may be shorter than the grid; draw only what is there
+    char* end = memchr(map, '\0', size);
+    int length = (end == NULL) ? size : end - map;
+
+    // (re)allocate the last frame when the map size changes; zeros never match a map cell,
+    // so the first frame is drawn in full
+    if (lastFrame == NULL || lastFrameSize != size) {
+        free(lastFrame);
+        lastFrame = calloc(size, sizeof(char));
+        lastFrameSize = (lastFrame == NULL) ? 0 : size;
+    }
 
-        // if end of row reached, return
-        if (x >= client.ncolsMap) {
-            x = 0;
-            y++;
+    // compare row by row, writing only the runs of cells that changed
+    for (int row = 0; row * ncols < length; row++) {
+        const char* newRow = map + row * ncols;
+        int rowLength = (length - row * ncols < ncols) ? length - row * ncols : ncols;
+
+        // without a last frame (out of memory) every row is a change
+        if (lastFrame == NULL) {
+            mvwaddnstr(pad, row, 0, newRow, rowLength);
+            char* at = memchr(newRow, '@', rowLength);
+            if (at != NULL) {
+                playerRow = row;
+                playerCol = at - newRow;
+            }
+            continue;
         }
 
-        // if end of available board space reached, end
-        if (y >= client.nrowsMap + 1) {
-            break;
+        char* oldRow = lastFrame + row * ncols;
+        if (memcmp(newRow, oldRow, rowLength) == 0) {
+            continue; // unchanged row
         }
 
-        // print character
-        mvaddch(y, x, c);
+        int col = 0;
+        while (col < rowLength) {
+            if (newRow[col] == oldRow[col]) {
+                col++;
+                continue;
+            }
+            int start = col;
+            while (col < rowLength && newRow[col] != oldRow[col]) {
+                col++;
+            }
+            mvwaddnstr(pad, row, start, newRow + start, col - start);
+
+            // the '@' only needs looking for where something changed
+            char* at = memchr(newRow + start, '@', col - start);
+            if (at != NULL) {
+                playerRow = row;
+                playerCol = at - newRow;
+            }
+        }
+        memcpy(oldRow, newRow, rowLength);
+    }
+    // update_display copies the visible part of the pad to the screen
+}
 
-        // advance
-        x++;
+/*
+ * Push staged changes to the terminal; see .h for more details.
+ */
+void
+update_display()
+{
+    if (!cursesStarted) {
+        return;
+    }
+    if (resizePending) {
+        applyResize();
     }
 
-    // update display with new changes
-    refresh();
+    // the banner first, then the map viewport over the rest of the screen
+    wnoutrefresh(stdscr);
+    if (pad != NULL) {
+        // a moved viewport shows lines the screen does not have yet
+        if (followPlayer()) {
+            touchwin(pad);
+        }
+        int viewRows = (client.nrowsMap < LINES - 1) ? client.nrowsMap : LINES - 1;
+        int viewCols = (client.ncolsMap < COLS) ? client.ncolsMap : COLS;
+        if (viewRows > 0 && viewCols > 0) {
+            pnoutrefresh(pad, viewTop, viewLeft, 1, 0, viewRows, viewCols - 1);
+        }
+    }
+    doupdate();
 }
 
 /*
@@ -106,6 +241,11 @@ display_map(char* map)
 void
 display_player_banner(char playerSymbol, int playerNuggets, int unclaimedNuggets)
 {
+    // nothing to draw on without curses (headless mode)
+    if (!cursesStarted) {
+        return;
+    }
+
     // ensure the player symbol is not the null terminator (this should really never happen due to other 
     // defensive code)
     if (playerSymbol == '\0') {
@@ -115,6 +255,7 @@ display_player_banner(char playerSymbol, int playerNuggets, int unclaimedNuggets
     
     move(0, 0); // move to top left of the screen
     clrtoeol(); // clear to end of line
+    hudColumn = -1; // cleared with the rest of the line
     
     // create banner string
     char banner[client.ncolsScreen];
@@ -122,9 +263,10 @@ display_player_banner(char playerSymbol, int playerNuggets, int unclaimedNuggets
     
     // print banner string 
     mvprintw(0, 0, "%s", banner);
+    drawHud();
     
-    // update display with new changes
-    refresh(); 
+    // stage new changes
+    wnoutrefresh(stdscr); 
 }
 
 /*
@@ -133,11 +275,17 @@ display_player_banner(char playerSymbol, int playerNuggets, int unclaimedNuggets
 void 
 display_spectator_banner(const int unclaimedNuggets)
 {
-    
+    // nothing to draw on without curses (headless mode)
+    if (!cursesStarted) {
+        return;
+    }
+
     move(0, 0); // move to top left of the screen
     clrtoeol(); // clear to end of line
+    hudColumn = -1; // cleared with the rest of the line
     mvprintw(0, 0, "Spectating: %d nuggets unclaimed.", unclaimedNuggets); // print banner string 
-    refresh(); // update display with new changes
+    drawHud();
+    wnoutrefresh(stdscr); // stage new changes
 }
 
 /*
@@ -231,22 +379,59 @@ indicate_nuggets_stolen_spectator(const char stolenPlayerSymbol, const char stea
     appendToBanner(message);
 }
 
+/*
+ * Displays message after basic banner indicating a new round has begun; see .h for more details. 
+ */
+void
+indicate_new_round(const int round)
+{
+    // create new round indicator message
+    char message[50];
+    snprintf(message, sizeof(message), "Round %d begins!", round);
+
+    // display it on first line after the basic banner
+    remove_indicator();  // clears any current indicator messages
+    appendToBanner(message);
+}
+
+/*
+ * Displays text at the right end of the banner line; see .h for more details.
+ */
+void
+display_hud(const char* text)
+{
+    snprintf(hudText, sizeof(hudText), "%s", (text != NULL) ? text : "");
+    if (!cursesStarted) {
+        return;
+    }
+    eraseHud();
+    drawHud();
+    wnoutrefresh(stdscr);
+}
+
 /*
  * Removes whatever special indicator message is added after basic banner; see .h for more details.
  */
 void 
 remove_indicator()
 {
+    // nothing to draw on without curses (headless mode)
+    if (!cursesStarted) {
+        return;
+    }
+
     // moves cursor to banner end
     moveToNormalBannerEnd();
     
-    // deletes everything after until end of screen
+    // deletes everything after until end of screen, HUD included, then puts the HUD back
     for (int i = 0; i <= client.ncolsScreen; i++) {
         delch();
     }
+    hudColumn = -1;
+    drawHud();
     
-    // update display with new changes
-    refresh();
+    // stage new changes
+    wnoutrefresh(stdscr);
 }
 
 /*
@@ -264,56 +449,185 @@ get_character()
 void
 end_curses() 
 {
+    if (!cursesStarted) {
+        return;
+    }
     endwin();
+    cursesStarted = false;
+    if (pad != NULL) {
+        delwin(pad);
+        pad = NULL;
+    }
+    free(lastFrame);
+    lastFrame = NULL;
+    lastFrameSize = 0;
 }
 
 /*
- * Ensures window size is sufficently large to accomodate the board, prompts user to expand window and
- * waits if not.
+ * Ensures the window is large enough for a useful viewport onto the board, prompts user to expand window
+ * and waits if not. Also installs the SIGWINCH handler that tracks later resizes; curses leaves it in place.
  */
 static void 
 setupScreenSize(int nrows, int ncols)
 {
-    // checks the size of the terminal window
-    struct winsize w;
-    ioctl(0, TIOCGWINSZ, &w); // aquire the terminal window size
-    int nrowsScreen = w.ws_row; // number of rows in the terminal window
-    int ncolsScreen = w.ws_col; // number of columns in the terminal window
-
-    // If the expected size is larger than the actual terminal window size, print a message
-    if (nrows > nrowsScreen || ncols > ncolsScreen) {
-        printf("Expand window to %d rows by %d columns (current: %d x %d)\n",
-               nrows, ncols, nrowsScreen, ncolsScreen); // prompts user to expand window
+    // note window size changes from now on
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleWindowChange;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, NULL);
+
+    // block SIGWINCH while checking, so a resize just after a check still ends the wait
+    sigset_t windowChange, oldMask;
+    sigemptyset(&windowChange);
+    sigaddset(&windowChange, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &windowChange, &oldMask);
+
+    // the viewport needs a few rows and columns of map, plus the banner row
+    int minRows = ((nrows < MIN_VIEW_ROWS) ? nrows : MIN_VIEW_ROWS) + 1;
+    int minCols = (ncols < MIN_VIEW_COLS) ? ncols : MIN_VIEW_COLS;
+
+    // without a terminal to ask, there is nothing to wait for
+    int nrowsScreen = minRows;
+    int ncolsScreen = minCols;
+    getScreenSize(&nrowsScreen, &ncolsScreen);
+
+    // If the window is too small, print a message
+    if (nrowsScreen < minRows || ncolsScreen < minCols) {
+        printf("Expand window to at least %d rows by %d columns (current: %d x %d)\n",
+               minRows, minCols, nrowsScreen, ncolsScreen); // prompts user to expand window
         fflush(stdout); // flush the output buffer
     }
 
-    // loop continuously checking the window size until it is large enough
-    while (nrows >= nrowsScreen || ncols >= ncolsScreen) {
-        struct winsize w;
-        ioctl(0, TIOCGWINSZ, &w); // reaquire the terminal window size
-        nrowsScreen = w.ws_row; // update nrowsScreen for next check
-        ncolsScreen = w.ws_col; // update ncolsScreen for next check
+    // sleep until the window is resized, checking again each time, until it is large enough
+    while (nrowsScreen < minRows || ncolsScreen < minCols) {
+        sigsuspend(&oldMask); // unblocks SIGWINCH while asleep
+        getScreenSize(&nrowsScreen, &ncolsScreen);
     }
+    resizePending = false;
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
 
     // after the loop, update the screen dimensions in the client structure
     client.nrowsScreen = nrowsScreen;
     client.ncolsScreen = ncolsScreen;
 }
 
+/*
+ * Gets the terminal window size.
+ *
+ * Returns false, leaving nrows and ncols alone, if stdin is not a terminal.
+ */
+static bool
+getScreenSize(int* nrows, int* ncols)
+{
+    struct winsize w;
+    if (ioctl(0, TIOCGWINSZ, &w) < 0 || w.ws_row == 0 || w.ws_col == 0) {
+        return false;
+    }
+    *nrows = w.ws_row;
+    *ncols = w.ws_col;
+    return true;
+}
+
+/*
+ * SIGWINCH handler: just notes the resize.
+ */
+static void
+handleWindowChange(int signal)
+{
+    resizePending = true;
+}
+
+/*
+ * Resizes curses to the new window size; the whole screen is redrawn on the next update.
+ */
+static void
+applyResize()
+{
+    resizePending = false;
+
+    int nrowsScreen, ncolsScreen;
+    if (!getScreenSize(&nrowsScreen, &ncolsScreen)) {
+        return;
+    }
+    eraseHud(); // right-aligned for the old width
+    resizeterm(nrowsScreen, ncolsScreen);
+    client.nrowsScreen = nrowsScreen;
+    client.ncolsScreen = ncolsScreen;
+    drawHud();
+
+    // stdscr is redrawn by resizeterm; the map must be redrawn over it
+    if (pad != NULL) {
+        touchwin(pad);
+    }
+}
+
+/*
+ * Moves the viewport, if needed, to keep the player's '@' away from its edges. The map is centered on
+ * the '@' when it gets within a quarter of the viewport of an edge; a viewport never extends past the map.
+ *
+ * Returns true if the viewport moved.
+ */
+static bool
+followPlayer()
+{
+    int viewRows = LINES - 1; // leaves top row for banner
+    int viewCols = COLS;
+    int top = viewTop;
+    int left = viewLeft;
+
+    if (playerRow >= 0) {
+        int rowMargin = viewRows / 4;
+        if (playerRow < top + rowMargin || playerRow >= top + viewRows - rowMargin) {
+            top = playerRow - viewRows / 2;
+        }
+        int colMargin = viewCols / 4;
+        if (playerCol < left + colMargin || playerCol >= left + viewCols - colMargin) {
+            left = playerCol - viewCols / 2;
+        }
+    }
+
+    // keep the viewport on the map
+    if (top > client.nrowsMap - viewRows) {
+        top = client.nrowsMap - viewRows;
+    }
+    if (top < 0) {
+        top = 0;
+    }
+    if (left > client.ncolsMap - viewCols) {
+        left = client.ncolsMap - viewCols;
+    }
+    if (left < 0) {
+        left = 0;
+    }
+
+    bool moved = (top != viewTop || left != viewLeft);
+    viewTop = top;
+    viewLeft = left;
+    return moved;
+}
+
 /*
  * Adds text to the end of the banner.
  */
 static void 
 appendToBanner(char* message) 
 {
-    // moves cursor to banner end
+    // nothing to draw on without curses (headless mode)
+    if (!cursesStarted) {
+        return;
+    }
+
+    // moves cursor to banner end, out of the way of the HUD
+    eraseHud();
     moveToNormalBannerEnd();
 
-    // prints message there
+    // prints message there, with the HUD after it if there is room
     printw("%s", message);
+    drawHud();
 
-    // update display with new changes
-    refresh();
+    // stage new changes
+    wnoutrefresh(stdscr);
 }
 
 /*
@@ -339,4 +653,47 @@ moveToNormalBannerEnd()
     // take another two steps forward;
     x++;
     move(y, ++x);
-}
\ No newline at end of file
+}
+/*
+ * Draws the HUD text right-aligned on the banner line, if it fits after what is already there.
+ */
+static void
+drawHud()
+{
+    int length = strlen(hudText);
+    if (length == 0) {
+        return;
+    }
+
+    // find the end of the banner and indicator, leaving the cursor where it was
+    int y, x;
+    getyx(stdscr, y, x);
+    int used = COLS;
+    while (used > 0 && (mvinch(0, used - 1) & A_CHARTEXT) == ' ') {
+        used--;
+    }
+
+    int column = COLS - length;
+    if (column > used) {
+        mvaddstr(0, column, hudText);
+        hudColumn = column;
+    }
+    move(y, x);
+}
+
+/*
+ * Clears the HUD text off the banner line, if drawn.
+ */
+static void
+eraseHud()
+{
+    if (hudColumn < 0) {
+        return;
+    }
+    int y, x;
+    getyx(stdscr, y, x);
+    move(0, hudColumn);
+    clrtoeol();
+    hudColumn = -1;
+    move(y, x);
+}
@@ -15,8 +15,9 @@
  * Initializes curses.
  * 
  * First, it sets up the screen size by calling a helper function setupScreenSize. This ensures that the
- * terminal window is the correct size for the game. It also calls various ncurses functions to set the
- * colors, keystroke settings, and other display settings.
+ * terminal window can show a useful part of the map, sleeping until a SIGWINCH if it cannot; the map itself
+ * may be larger than the window. It also calls various ncurses functions to set the colors, keystroke
+ * settings, and other display settings, and creates the pad the map is drawn into.
  * 
  * Requires nrows and ncols parameters, the number of rows of the board and the number of cols of the board 
  * respectively.
@@ -28,9 +29,22 @@ void init_curses(int nrows, int ncols);
  *
  * Requires map parameter. This map is just a string with no new line characters. This function knows the
  * map dimensions, so it knows when to return to the next line.
+ * 
+ * The map is drawn into a pad as large as the map. The map last drawn is kept, so only the runs of cells
+ * that changed since then are written. Nothing reaches the screen until update_display, which shows the
+ * part of the pad around the player's '@'.
  */
 void display_map(char* map);
 
+/*
+ * Pushes all staged changes to the terminal at once.
+ *
+ * The display functions in this module only stage their changes (wnoutrefresh), so that a whole batch
+ * of messages or a keystroke costs one terminal update (doupdate). Also applies any pending window resize,
+ * and moves the map viewport to follow the player. Does nothing before init_curses.
+ */
+void update_display();
+
 /*
  * Displays banner for client in player mode.
  *
@@ -61,6 +75,15 @@ void display_spectator_banner(const int unclaimedNuggets);
  */
 void indicate_invalid_key(const char key);
 
+/*
+ * Displays mesage at banner end indicating that a new round has begun.
+ *
+ * Require round parameter, the number of the round (the first is 1).
+ * 
+ * This function displays an indicator of the following form "Round [round] begins!" 
+ */
+void indicate_new_round(const int round);
+
 /*
  * Displays mesage at banner end indicating that the client player collected nuggets.
  *
@@ -114,6 +137,14 @@ void indicate_someone_stole_nuggets_from_you(const char stealerPlayerSymbol, con
  */
 void indicate_nuggets_stolen_spectator(const char stolenPlayerSymbol, const char stealerPlayerSymbol, const int stolenAmount);
 
+/*
+ * Displays text at the right end of the banner line, or hides it if text is NULL.
+ *
+ * The text is kept and drawn again whenever the banner or an indicator message is redrawn, so it stays
+ * put. It is not drawn where it would overlap the banner or indicator. Used for the HUD (see hud.h).
+ */
+void display_hud(const char* text);
+
 /*
  * Removes indicator message.
  *
@@ -1,8 +1,8 @@
 /*
  * handlers.c
  *
- * Description: contains functions that handle individual commands, namely OK, GRID, GOLD, DISPLAY, QUIT,
- * and ERROR.
+ * Description: contains functions that handle individual commands, namely OK, GRID, GOLD, DISPLAY, TERRAIN,
+ * VIEW, QUIT, ROUND, and ERROR, in text or, for those that have one, in binary.
  * 
  * Author: Joseph Hirsh
  * Date: March 1st, 2024
@@ -17,31 +17,91 @@
 #include "handlers.h"
 #include "graphics.h"
 #include "validators.h"
+#include "prediction.h"
+#include "headless.h"
+#include "hud.h"
+#include "latency.h"
+#include "wire.h"
+
+// the newest map received but not yet drawn; see handle_display and draw_display
+static char* pendingMap = NULL;
+static bool displayPending = false;
+
+// the terrain the server has sent (TERRAIN), ' ' where unknown, and the map built on it from each VIEW
+static char* terrain = NULL;
+static char* viewMap = NULL;
+
+// function prototypes; each message with a binary form is handled, from either form, by one function taking
+// its fields, in the order of wire.h
+static void onOkay(const long long* fields);
+static void onGrid(const long long* fields);
+static void onGoldRemaining(const long long* fields);
+static void onPlayerGold(const long long* fields);
+static void onSpectatorGold(const long long* fields);
+static void onStolen(const long long* fields);
+static void onSeq(const long long* fields);
+static void onSession(const long long* fields);
+static int validateGoldCounts(int collected, int current, int remaining);
+
+// binary messages, by opcode; the ones the server never sends (KEY, GOTO) are NULL
+static void (*const binaryHandlers[wire_NumOps])(const long long* fields) = {
+    [WIRE_OK] = onOkay,
+    [WIRE_GRID] = onGrid,
+    [WIRE_GOLD_REMAINING] = onGoldRemaining,
+    [WIRE_GOLD] = onPlayerGold,
+    [WIRE_SPECTATOR_GOLD] = onSpectatorGold,
+    [WIRE_STOLEN] = onStolen,
+    [WIRE_SEQ] = onSeq,
+    [WIRE_SESSION] = onSession,
+};
 
-// function prototype
-int parseGoldCounts(char* counts, int* collected, int* current, int* remaining); 
+/*
+ * Runs upon receiving a binary message from server; see .h for more details.
+ */
+void
+handle_binary(const char* message, int length)
+{
+    long long fields[wire_MaxFields];
+    wireOp_t op = wire_decode(message, length, fields);
+    if (binaryHandlers[op] == NULL) {
+        fprintf(stderr, "Received malformed binary message\n");
+        return;
+    }
+
+    // the server answers in binary only if asked, so from now on it takes binary too
+    client.binary = true;
+    binaryHandlers[op](fields);
+}
 
 /*
  * Runs upon receiving message from server with the OK header; see .h for more details.
  */
 void 
 handle_okay(char* symbol) 
+{
+    // logs warning if the symbol received from server is more than one character
+    if (strlen(symbol) > 1) {
+        fprintf(stderr, "Received player symbol with multiple characters, attempting to use first\n");
+    }
+
+    // grabs the first character off the symbol string (which ideally would already be one character)
+    onOkay((long long[]) {*symbol});
+}
+
+/*
+ * OK, with the player symbol.
+ */
+static void
+onOkay(const long long* fields)
 {
     int errors = 0; // stores number of errors so function can accumulate multiple errors before exiting
+    char symbolCharacter = fields[0];
     
     // errors if client attempts to handle OK before it sends START 
     if (client.state != START_SENT) {
         fprintf(stderr, "Received OK again or prior to sending START\n");
         errors++;
     }
-
-    // logs warning if the symbol received from server is more than one character
-    if (strlen(symbol) > 1) {
-        fprintf(stderr, "Received player symbol with multiple characters, attempting to use first\n");
-    }
-
-    // grabs the first character off the symbol string (which ideally would already be one character)
-    char symbolCharacter = *symbol;
     
     // validates the symbol (ensures that it is alphabetic and captitalized)
     if (!validate_player_symbol(symbolCharacter)) {
@@ -67,34 +127,57 @@ handle_okay(char* symbol)
 void 
 handle_grid(char* coordinates) 
 {
-    int errors = 0; // stores number of errors so function can accumulate multiple errors before exiting
-    
-    // errors if client attempts to handle GRID before it handles OK 
-    if (client.state != OK_RECEIVED) {
-        fprintf(stderr, "Received GRID prior to receiving OK or for a second time\n");
-        errors++;
-    }
-
-    int nrows, ncols; // nrows = number of rows of game map, ncols = number of columns of game map
-    
     // extracts values from the coordinates string, and ensures that two values were extracted, erroring if not
-    if (sscanf(coordinates, "%d %d", &nrows, &ncols) != 2) {
+    long long fields[2];
+    if (sscanf(coordinates, "%lld %lld", &fields[0], &fields[1]) != 2) {
         fprintf(stderr, "GRID message bad data\n");
-        errors++;
+        return;
     }
+    onGrid(fields);
+}
 
-    // ceases execution if error encountered
-    if (errors != 0) {
+/*
+ * GRID, with the number of rows and of columns of the map.
+ */
+static void
+onGrid(const long long* fields)
+{
+    int nrows = fields[0]; // number of rows of game map
+    int ncols = fields[1]; // number of columns of game map
+
+    // errors if client attempts to handle GRID before it handles OK 
+    if (client.state != OK_RECEIVED) {
+        fprintf(stderr, "Received GRID prior to receiving OK or for a second time\n");
         return;
     }
 
     // otherwise, it initializes curses
     init_curses(nrows, ncols);
 
+    // prepares prediction, if asked for; without memory for it, plays on without
+    if (client.predict && client.playerName != NULL && !prediction_init(nrows, ncols)) {
+        fprintf(stderr, "Could not set up prediction, continuing without it\n");
+        client.predict = false;
+    }
+
     // sets client nrows and client ncols which are global and used elswhere 
     client.nrowsMap = nrows;
     client.ncolsMap = ncols;
 
+    // room to hold a map until the end of its batch; without it, maps are drawn as they come
+    free(pendingMap);
+    pendingMap = malloc(nrows * ncols + 1);
+    displayPending = false;
+
+    // nothing known of a new map; a server building the display with us sends it as it is seen
+    free(terrain);
+    free(viewMap);
+    terrain = malloc(nrows * ncols);
+    viewMap = malloc(nrows * ncols + 1);
+    if (terrain != NULL) {
+        memset(terrain, ' ', nrows * ncols);
+    }
+
     // advance game state
     client.state = GRID_RECEIVED;
 }
@@ -104,21 +187,30 @@ handle_grid(char* coordinates)
  */
 void
 handle_gold_remaining(char* startingGoldRemainingString)
+{
+    // extract gold remaining number
+    long long fields[1];
+    if (sscanf(startingGoldRemainingString, "%lld", &fields[0]) != 1) {
+        fprintf(stderr, "GOLD_REMAINING message bad data\n");
+        return;
+    }
+    onGoldRemaining(fields);
+}
+
+/*
+ * GOLD_REMAINING, with the gold in the game at the start.
+ */
+static void
+onGoldRemaining(const long long* fields)
 {
     int errors = 0; // stores number of errors so function can accumulate multiple errors before exiting
+    int startingGoldRemaining = fields[0];
     
     // ensure that client already received GRID
     if (client.state != GRID_RECEIVED) {
         fprintf(stderr, "Received GOLD_REMAINING prior to GRID or for a second time\n");
         errors++;
     }
-    
-    // extract gold remaining number
-    int startingGoldRemaining;
-    if (sscanf(startingGoldRemainingString, "%d", &startingGoldRemaining) != 1) {
-        fprintf(stderr, "GOLD_REMAINING message bad data\n");
-        errors++;
-    }
 
     if (!validate_gold_count(startingGoldRemaining, MAXIMUM_GOLD)) {
         fprintf(stderr, "Invalid 'startingGoldRemaining' gold count");
@@ -136,6 +228,9 @@ handle_gold_remaining(char* startingGoldRemainingString)
     } else {
         display_spectator_banner(startingGoldRemaining);
     }
+    if (client.round > 1) {
+        indicate_new_round(client.round);
+    }
     
     // advance client state
     client.state = GOLD_REMAINING_RECEIVED;
@@ -146,8 +241,24 @@ handle_gold_remaining(char* startingGoldRemainingString)
  */
 void 
 handle_player_gold(char* counts) 
+{
+    // extracts values from the gold data string, and ensures that three values were extracted, erroring if not
+    long long fields[3];
+    if (sscanf(counts, "%lld %lld %lld", &fields[0], &fields[1], &fields[2]) != 3) {
+        fprintf(stderr, "Gold data missing\n");
+        return;
+    }
+    onPlayerGold(fields);
+}
+
+/*
+ * GOLD, with the gold collected, the player's purse, and the gold remaining.
+ */
+static void
+onPlayerGold(const long long* fields)
 {
     int errors = 0; // stores number of errors so function can accumulate multiple errors before exiting
+    int collected = fields[0], current = fields[1], remaining = fields[2];
 
     // ensure that client is currently running a game session (not initializing)
     if (client.state != PLAY) {
@@ -161,9 +272,8 @@ handle_player_gold(char* counts)
         errors++;
     }
 
-    // extracts values from the gold data string, and ensures that three values were extracted, erroring if not
-    int collected, current, remaining;
-    errors += parseGoldCounts(counts, &collected, &current, &remaining);
+    // ensures the gold counts are realistic
+    errors += validateGoldCounts(collected, current, remaining);
 
     // ceases execution if error occured
     if (errors > 0) {
@@ -184,8 +294,27 @@ handle_player_gold(char* counts)
  */
 void
 handle_spectator_gold(char* collectionData)
+{
+    // extract symbol and the gold counts
+    char collectorSymbol;
+    long long fields[4];
+    if (sscanf(collectionData, "%c %lld %lld %lld", &collectorSymbol, &fields[1], &fields[2], &fields[3]) != 4) {
+        fprintf(stderr, "SPECTATOR_GOLD message bad data\n");
+        return;
+    }
+    fields[0] = collectorSymbol;
+    onSpectatorGold(fields);
+}
+
+/*
+ * SPECTATOR_GOLD, with the collector's symbol, the gold collected, their purse, and the gold remaining.
+ */
+static void
+onSpectatorGold(const long long* fields)
 {
     int errors = 0; // stores number of errors so function can accumulate multiple errors before exiting
+    char collectorSymbol = fields[0];
+    int collected = fields[1], current = fields[2], remaining = fields[3];
 
     // ensure that client is currently running a game session (not initializing)
     if (client.state != PLAY) {
@@ -199,23 +328,14 @@ handle_spectator_gold(char* collectionData)
         errors++;
     }
 
-    // extract symbol and everything else
-    char counts[100];
-    char collectorSymbol;
-    if (sscanf(collectionData, "%c%[^\n]", &collectorSymbol, counts) != 2) {
-        fprintf(stderr, "SPECTATOR_GOLD message bad data\n");
-        return;
-    }
-
     // ensure that the symbol is valid (capital and alphabetical)
     if (!validate_player_symbol(collectorSymbol)) {
         fprintf(stderr, "SPECTATOR_GOLD message contains invalid player symbol\n");
         errors++;
     }
 
-    // extracts values from the gold data string, and ensures that three values were extracted, erroring if not
-    int collected, current, remaining;
-    errors += parseGoldCounts(counts, &collected, &current, &remaining);
+    // ensures the gold counts are realistic
+    errors += validateGoldCounts(collected, current, remaining);
 
     // ceases execution if error occured
     if (errors > 0) {
@@ -233,22 +353,35 @@ handle_spectator_gold(char* collectionData)
  */
 void 
 handle_stolen(char* stealData)
+{
+    // extract stolenPlayerSymbol, stealerPlayerSymbol, amountStolen, playerGold, and goldRemaining from stealData
+    char stolenPlayerSymbol, stealerPlayerSymbol;
+    long long fields[5];
+    if (sscanf(stealData, " %c %c %lld %lld %lld", &stolenPlayerSymbol, &stealerPlayerSymbol, &fields[2], &fields[3], &fields[4]) != 5) {
+        fprintf(stderr, "STOLEN message bad data\n");
+        return;
+    }
+    fields[0] = stolenPlayerSymbol;
+    fields[1] = stealerPlayerSymbol;
+    onStolen(fields);
+}
+
+/*
+ * STOLEN, with the symbols of the player stolen from and of the stealer, the amount, the receiver's purse,
+ * and the gold remaining.
+ */
+static void
+onStolen(const long long* fields)
 {
     int errors = 0; // stores number of errors so function can accumulate multiple errors before exiting
+    char stolenPlayerSymbol = fields[0], stealerPlayerSymbol = fields[1];
+    int amountStolen = fields[2], playerGold = fields[3], goldRemaining = fields[4];
 
     // ensure that client is currently running a game session (not initializing)
     if (client.state != PLAY) {
         fprintf(stderr, "Received STOLEN prior to PLAY\n");
         errors++;
     }
-    
-    // extract stolenPlayerSymbol, stealerPlayerSymbol, amountStolen, playerGold, and goldRemaining from stealData
-    char stolenPlayerSymbol, stealerPlayerSymbol;
-    int amountStolen, playerGold, goldRemaining;
-    if (sscanf(stealData, " %c %c %d %d %d", &stolenPlayerSymbol, &stealerPlayerSymbol, &amountStolen, &playerGold, &goldRemaining) != 5) {
-        fprintf(stderr, "STOLEN message bad data\n");
-        return;
-    }
 
     // ensure amountStolen is valid
     if (!validate_gold_count(amountStolen, client.maximumGold)) {
@@ -319,8 +452,33 @@ handle_display(char* map)
         return;
     }
 
-    // prints map to display
-    display_map(map);
+    // match it to the key that brought it about, for the HUD
+    hud_display_received();
+
+    // a map still waiting to be drawn is now stale; it will never be shown
+    if (displayPending) {
+        client.framesSkipped++;
+    }
+
+    // keeps the map to draw at the end of the batch (draw_display), with any moves the server has not 
+    // answered yet when predicting
+    if (client.predict && client.playerName != NULL) {
+        prediction_frame(map);
+        displayPending = true;
+    } else if (pendingMap != NULL) {
+        int size = client.nrowsMap * client.ncolsMap;
+        strncpy(pendingMap, map, size);
+        pendingMap[size] = '\0';
+        displayPending = true;
+    } else {
+        display_map(map);
+        hud_display_drawn();
+    }
+
+    // a headless client times the key it is waiting on
+    if (client.headless) {
+        headless_display();
+    }
 
     // advance client status iff game not yet started
     if (client.state != PLAY) {
@@ -328,6 +486,146 @@ handle_display(char* map)
     }
 }
 
+/*
+ * Runs upon receiving message from server with the TERRAIN header; see .h for more details.
+ */
+void
+handle_terrain(char* runs)
+{
+    // ensure that the map has been set up
+    if ((client.state != GOLD_REMAINING_RECEIVED && client.state != PLAY) || terrain == NULL) {
+        fprintf(stderr, "Received TERRAIN prior to receiving GOLD_REMAINING\n");
+        return;
+    }
+
+    // each line is a run of cells along a row
+    char* line = runs;
+    while (*line != '\0') {
+        int row, col, skip;
+        if (sscanf(line, "%d %d %n", &row, &col, &skip) != 2) {
+            fprintf(stderr, "TERRAIN message bad data\n");
+            return;
+        }
+        char* cells = line + skip;
+        int length = strcspn(cells, "\n");
+
+        // ensure the run lies on the map
+        if (row < 0 || row >= client.nrowsMap || col < 0 || col + length > client.ncolsMap) {
+            fprintf(stderr, "TERRAIN run off the map\n");
+            return;
+        }
+        memcpy(terrain + row * client.ncolsMap + col, cells, length);
+
+        // on to the next line, if any
+        line = cells + length;
+        if (*line == '\n') {
+            line++;
+        }
+    }
+}
+
+/*
+ * Runs upon receiving message from server with the VIEW header; see .h for more details.
+ */
+void
+handle_view(char* view)
+{
+    // ensure that the map has been set up
+    if ((client.state != GOLD_REMAINING_RECEIVED && client.state != PLAY) || viewMap == NULL) {
+        fprintf(stderr, "Received VIEW prior to receiving GOLD_REMAINING\n");
+        return;
+    }
+
+    // extract the box in sight and its mask
+    int top, left, rows, cols, maskStart, maskEnd;
+    if (sscanf(view, "%d %d %d %d %n%*[0-9a-f]%n", &top, &left, &rows, &cols, &maskStart, &maskEnd) != 4
+        || top < 0 || left < 0 || rows < 1 || cols < 1
+        || top + rows > client.nrowsMap || left + cols > client.ncolsMap
+        || maskEnd - maskStart != (rows * cols + 3) / 4) {
+        fprintf(stderr, "VIEW message bad data\n");
+        return;
+    }
+    const char* mask = view + maskStart;
+
+    // the terrain, with what is in sight laid over it
+    int size = client.nrowsMap * client.ncolsMap;
+    memcpy(viewMap, terrain, size);
+    viewMap[size] = '\0';
+    char* entities = view + maskEnd;
+    char glyph;
+    int row, col, skip;
+    while (sscanf(entities, " %c %d %d%n", &glyph, &row, &col, &skip) == 3) {
+        // ensure it is in sight: in the box, at a set bit of the mask
+        bool inBox = row >= top && row < top + rows && col >= left && col < left + cols;
+        int bit = inBox ? (row - top) * cols + (col - left) : 0;
+        int nibble = (mask[bit / 4] <= '9') ? mask[bit / 4] - '0' : mask[bit / 4] - 'a' + 10;
+        if (!inBox || !(nibble & (8 >> (bit % 4)))) {
+            fprintf(stderr, "VIEW shows %c out of sight\n", glyph);
+            return;
+        }
+        viewMap[row * client.ncolsMap + col] = glyph;
+        entities += skip;
+    }
+
+    // the rest is as for a whole map
+    handle_display(viewMap);
+}
+
+/*
+ * Runs upon receiving message from server with the SEQ header; see .h for more details.
+ */
+void
+handle_seq(char* seqString)
+{
+    long long fields[1];
+    if (sscanf(seqString, "%lld", &fields[0]) != 1) {
+        fprintf(stderr, "SEQ message bad data\n");
+        return;
+    }
+    onSeq(fields);
+}
+
+/*
+ * SEQ, with the tag of the key answered.
+ */
+static void
+onSeq(const long long* fields)
+{
+    int seq = fields[0];
+
+    // ensure that SEQ is expected
+    if (client.state != PLAY || (!client.predict && !client.headless)) {
+        fprintf(stderr, "Received unexpected SEQ\n");
+        return;
+    }
+
+    // a headless client times its keys by the answers
+    if (client.headless) {
+        headless_answered(seq);
+    }
+
+    // drop the answered keys, and redraw with the ones left at the end of the batch
+    if (client.predict) {
+        hud_seq_received(seq);
+        prediction_ack(seq);
+        displayPending = true;
+    }
+}
+
+/*
+ * Draws the newest map received, if not drawn yet; see .h for more details.
+ */
+void
+draw_display()
+{
+    if (!displayPending) {
+        return;
+    }
+    display_map((client.predict && client.playerName != NULL) ? prediction_map() : pendingMap);
+    hud_display_drawn();
+    displayPending = false;
+}
+
 /*
  * Runs upon receiving message from server with the QUIT header; see .h for more details.
  */
@@ -335,12 +633,76 @@ void
 handle_quit(char* explanation) 
 {
     end_curses();
+    prediction_done();
+    free(pendingMap);
+    pendingMap = NULL;
+    free(terrain);
+    terrain = NULL;
+    free(viewMap);
+    viewMap = NULL;
+    fprintf(stderr, "Skipped %d stale frames\n", client.framesSkipped);
+    if (client.headless) {
+        headless_done(stdout);
+    }
+    latency_done();
     printf("%s\n", explanation);
     fflush(stdout);
     free(client.playerName); // free client.playerName which we allocated via the set name function
     exit(EXIT_SUCCESS);
 }
 
+/*
+ * Runs upon receiving message from server with the ROUND header; see .h for more details.
+ */
+void
+handle_round(char* summary)
+{
+    // a headless client logs the summary with its keys
+    if (client.headless) {
+        printf("round %d %s", client.round, summary);
+        fflush(stdout);
+    }
+
+    // the map of this round will never be drawn now
+    displayPending = false;
+
+    // the server starts the next round right away, with OK, GRID, and GOLD_REMAINING as on joining
+    client.round++;
+    client.state = START_SENT;
+}
+
+/*
+ * Runs upon receiving message from server with the SESSION header; see .h for more details.
+ */
+void
+handle_session(char* token)
+{
+    if (!validate_session(token)) {
+        fprintf(stderr, "Received invalid session token\n");
+        return;
+    }
+    strcpy(client.session, token);
+
+    // the player needs the token to come back from another client
+    if (client.headless) {
+        printf("session %s\n", client.session);
+        fflush(stdout);
+    } else {
+        fprintf(stderr, "SESSION %s\n", client.session);
+    }
+}
+
+/*
+ * SESSION in binary, with the token as a number; handled as its text form.
+ */
+static void
+onSession(const long long* fields)
+{
+    char token[wire_MaxText];
+    snprintf(token, sizeof(token), "%016llx", (unsigned long long) fields[0]);
+    handle_session(token);
+}
+
 /*
  * Runs upon receiving message from server with the ERROR header; see .h for more details.
  */
@@ -350,35 +712,31 @@ handle_error(char* error)
     fprintf(stderr, "ERROR %s\n", error);
 }
 
-int 
-parseGoldCounts(char* counts, int* collected, int* current, int* remaining) 
+/*
+ * Checks the gold counts of a GOLD or SPECTATOR_GOLD message, returning the number that are unrealistic.
+ */
+static int
+validateGoldCounts(int collected, int current, int remaining)
 {
     int errors = 0; // stores number of errors so function can accumulate multiple errors before exiting
-
-    // extracts collected, current, and remaining from counts into "collected", "current", and "remaining" parameters
-    if (sscanf(counts, "%d %d %d", collected, current, remaining) != 3) {
-        fprintf(stderr, "Gold data missing\n");
-        errors++;
-        return errors;
-    }
     
     // errors if the collected gold count received is unrealistic 
-    if (!validate_gold_count(*collected, client.maximumGold)) {
+    if (!validate_gold_count(collected, client.maximumGold)) {
         fprintf(stderr, "Invalid 'collected' gold count\n");
         errors++;
     }
 
     // errors if the current gold count received is unrealistic  
-    if (!validate_gold_count(*current, client.maximumGold)) {
+    if (!validate_gold_count(current, client.maximumGold)) {
         fprintf(stderr, "Invalid 'current' gold count\n");
         errors++;
     }
 
     // errors if the remaining gold count received is unrealistic 
-    if (!validate_gold_count(*remaining, client.maximumGold)) {
+    if (!validate_gold_count(remaining, client.maximumGold)) {
         fprintf(stderr, "Invalid 'remaining' gold count\n");
         errors++;
     }
 
     return errors;
-}
\ No newline at end of file
+}
@@ -68,10 +68,42 @@ void handle_spectator_gold(char* collectionData);
  *
  * Runs in PLAY or GRID_RECEIVED states. 
  * 
- * Handler displays map and advances state if the current state is not already PLAY. 
+ * Handler keeps the map, for draw_display to show at the end of the batch of messages it came in, and 
+ * advances state if the current state is not already PLAY. A kept map that is replaced before being drawn
+ * is counted in client.framesSkipped.
  */
 void handle_display(char* map); 
 
+/*
+ * Handles messages of the form "TERRAIN [row] [col] [cells]", with a line "[row] [col] [cells]" for each
+ * more run of cells, from a server building the display with the client
+ *
+ * Runs in GOLD_REMAINING_RECEIVED or PLAY states. 
+ * 
+ * Handler keeps the terrain of each run, the cells from (row, col) along the row, which the server sends
+ * only once, as the player first sees it; VIEW lays what is in sight over it.
+ */
+void handle_terrain(char* runs);
+
+/*
+ * Handles messages of the form "VIEW [row] [col] [rows] [cols] [mask] [glyph] [row] [col] ...", from a
+ * server building the display with the client
+ *
+ * Runs in GOLD_REMAINING_RECEIVED or PLAY states. 
+ * 
+ * Handler builds the map from the terrain kept by handle_terrain, with each player or gold pile given 
+ * (and the player, as '@') on it; they must lie in sight: in the box of rows by cols from (row, col), at a
+ * bit of mask (hex, row by row) that is set. The map is then handled as a DISPLAY of it.
+ */
+void handle_view(char* view);
+
+/*
+ * Draws the newest map kept by handle_display (or handle_seq), if it has not been drawn yet.
+ *
+ * Called once per batch of messages, after the last one.
+ */
+void draw_display();
+
 /*
  * Handles messages of the form "STOLEN [stealerPlayerID] [stolenPlayerID] [amount]"
  *
@@ -82,6 +114,27 @@ void handle_display(char* map);
  */
 void handle_stolen(char* stealData);
 
+/*
+ * Handles messages of the form "SEQ [seq]"
+ *
+ * Runs in PLAY state, in prediction mode. 
+ * 
+ * Handler notes that the server has applied every key tagged up to seq; the predicted map is redrawn by 
+ * draw_display. 
+ */
+void handle_seq(char* seqString);
+
+/*
+ * Handles a binary message (see wire.h): OK, GRID, GOLD_REMAINING, GOLD, SPECTATOR_GOLD, STOLEN, SEQ, or
+ * SESSION, with length bytes, as message_length gives them.
+ *
+ * Runs in any state; each message is then handled as its text form would be. 
+ * 
+ * Handler notes that the server speaks binary, so KEY and GOTO go to it in binary from then on, and logs
+ * a message that is not well formed.
+ */
+void handle_binary(const char* message, int length);
+
 /*
  * Handles messages of the form "QUIT [explanation]"
  *
@@ -91,6 +144,27 @@ void handle_stolen(char* stealData);
  */
 void handle_quit(char* explanation);
 
+/*
+ * Handles messages of the form "SESSION [token]"
+ *
+ * Runs in any state, as a player. 
+ * 
+ * Handler keeps the token, which the server takes in "RESUME [token]" to give the player back to a client
+ * at another address (client --session token); a headless client prints it, any other logs it to stderr.
+ */
+void handle_session(char* token);
+
+/*
+ * Handles messages of the form "ROUND [summary]", from a server that plays round after round
+ *
+ * Runs in any state. 
+ * 
+ * Handler counts the round as over (a headless client prints the summary) and returns the client to the 
+ * START_SENT state, since the server goes on at once with OK, GRID, and GOLD_REMAINING for the next round; 
+ * GOLD_REMAINING then announces the new round in the banner.
+ */
+void handle_round(char* summary);
+
 /*
  * Handles messages of the form "ERROR [explanation]"
  *
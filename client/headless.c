@@ -0,0 +1,236 @@
+/*
+ * headless.c
+ *
+ * Description: contains the headless module. It keeps the keys to play, and the one key in flight: only
+ * once that key is done with is the next one sent, so each latency measured is that of a single key on
+ * an otherwise idle connection. A line per key goes to stdout:
+ *
+ *   seq [n] key [k] rtt [milliseconds] ms    its DISPLAY arrived
+ *   seq [n] key [k] no display               answered, but nothing changed (e.g. walked into a wall)
+ *   seq [n] key [k] lost                     not answered within KEY_TIMEOUT
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime and getpid
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "headless.h"
+#include "latency.h"
+#include "senders.h"
+#include "clientdata.h"
+
+// seconds to wait for the answer to a key before counting it lost and sending the next
+static const double KEY_TIMEOUT = 1.0;
+
+// keys a random source picks from: single steps, so the player wanders rather than runs
+static const char* RANDOM_KEYSTROKES = "hjklyubn";
+
+// the keys to play, and the next one to send
+static char* keys = NULL;
+static int numKeys = 0;
+static int nextKey = 0;
+
+// the key in flight (seq -1 if none), whether its SEQ has come, and when it was sent
+static int awaitingSeq = -1;
+static char awaitingKey = '\0';
+static bool answered = false;
+static struct timespec sentAt;
+static int lastSeq = 0;
+
+// keys never answered, and whether the closing 'Q' has gone out
+static int lost = 0;
+static bool quitSent = false;
+
+// function prototypes
+static bool loadScript(const char* path);
+static bool loadRandom(const char* spec);
+static double secondsSince(const struct timespec* then);
+
+/*
+ * Loads the keys to play; see .h for more details.
+ */
+bool
+headless_init(const char* source)
+{
+    if (strncmp(source, "random:", strlen("random:")) == 0) {
+        return loadRandom(source + strlen("random:"));
+    }
+    return loadScript(source);
+}
+
+/*
+ * Notes a SEQ answer; see .h for more details.
+ */
+void
+headless_answered(int seq)
+{
+    if (seq == awaitingSeq) {
+        answered = true;
+    }
+}
+
+/*
+ * Notes a DISPLAY; see .h for more details.
+ */
+void
+headless_display()
+{
+    if (awaitingSeq < 0 || !answered) {
+        return; // some other player's doing
+    }
+    double rtt = latency_answered(awaitingSeq);
+    printf("seq %d key %c rtt %.3f ms\n", awaitingSeq, awaitingKey, rtt);
+    awaitingSeq = -1;
+    answered = false;
+}
+
+/*
+ * Sends the next key; see .h for more details.
+ */
+void
+headless_next(addr_t* serverp)
+{
+    if (client.state != PLAY) {
+        return;
+    }
+
+    // finish with the key in flight, or keep waiting for it
+    if (awaitingSeq >= 0) {
+        if (answered) {
+            printf("seq %d key %c no display\n", awaitingSeq, awaitingKey);
+        } else if (secondsSince(&sentAt) >= KEY_TIMEOUT) {
+            printf("seq %d key %c lost\n", awaitingSeq, awaitingKey);
+            lost++;
+        } else {
+            return;
+        }
+        awaitingSeq = -1;
+        answered = false;
+    }
+
+    // out of keys: quit, again if the server seems not to have heard
+    if (nextKey == numKeys) {
+        if (!quitSent || secondsSince(&sentAt) >= KEY_TIMEOUT) {
+            send_key(serverp, 'Q');
+            clock_gettime(CLOCK_MONOTONIC, &sentAt);
+            quitSent = true;
+        }
+        return;
+    }
+
+    awaitingKey = keys[nextKey++];
+    awaitingSeq = ++lastSeq;
+    latency_sent(awaitingSeq);
+    clock_gettime(CLOCK_MONOTONIC, &sentAt);
+    send_key_tagged(serverp, awaitingKey, awaitingSeq);
+}
+
+/*
+ * Timeout handler; see .h for more details.
+ */
+bool
+headless_timeout(void* arg)
+{
+    headless_next(arg);
+    fflush(stdout);
+    return false; // keep looping
+}
+
+/*
+ * Writes the summary and frees; see .h for more details.
+ */
+void
+headless_done(FILE* fp)
+{
+    latency_report(fp, lost);
+    latency_done();
+    free(keys);
+    keys = NULL;
+    numKeys = 0;
+    nextKey = 0;
+}
+
+/*
+ * Reads the player keys of a script file, in order.
+ */
+static bool
+loadScript(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open key script %s\n", path);
+        return false;
+    }
+
+    int capacity = 256;
+    keys = malloc(capacity);
+    if (keys == NULL) {
+        fprintf(stderr, "Memory allocation failed");
+        fclose(fp);
+        return false;
+    }
+
+    // keep the keys a player could press, growing as needed; 'q' and 'Q' are left to the end
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        if (c == 'q' || c == 'Q' || strchr(PLAYER_KEYSTROKES, c) == NULL) {
+            continue;
+        }
+        if (numKeys == capacity) {
+            char* newKeys = realloc(keys, 2 * capacity);
+            if (newKeys == NULL) {
+                fprintf(stderr, "Memory allocation failed");
+                fclose(fp);
+                return false;
+            }
+            keys = newKeys;
+            capacity *= 2;
+        }
+        keys[numKeys++] = c;
+    }
+    fclose(fp);
+    return true;
+}
+
+/*
+ * Makes "N" or "N:SEED" random single-step keys.
+ */
+static bool
+loadRandom(const char* spec)
+{
+    int count;
+    unsigned int seed = getpid(); // differs between clients run side by side
+    int fields = sscanf(spec, "%d:%u", &count, &seed);
+    if (fields < 1 || count < 0) {
+        fprintf(stderr, "Bad random key source random:%s; expected random:N or random:N:SEED\n", spec);
+        return false;
+    }
+
+    keys = malloc(count + 1);
+    if (keys == NULL) {
+        fprintf(stderr, "Memory allocation failed");
+        return false;
+    }
+    srand(seed);
+    int numChoices = strlen(RANDOM_KEYSTROKES);
+    for (numKeys = 0; numKeys < count; numKeys++) {
+        keys[numKeys] = RANDOM_KEYSTROKES[rand() % numChoices];
+    }
+    return true;
+}
+
+/*
+ * Seconds elapsed since then, on the monotonic clock.
+ */
+static double
+secondsSince(const struct timespec* then)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - then->tv_sec) + (now.tv_nsec - then->tv_nsec) / 1e9;
+}
@@ -0,0 +1,55 @@
+/*
+ * headless.h
+ *
+ * Description: contains interface for the headless module, which plays a client from a script instead of
+ * the keyboard, without curses, to measure latency. Keys are sent one at a time, each tagged with a
+ * sequence number; the server answers "SEQ [number]" ahead of the DISPLAY the key brings about, and the
+ * time from sending the key to receiving that DISPLAY is logged to stdout. When the keys run out the
+ * client quits, and a summary of the times is written once the server says goodbye.
+ *
+ */
+
+#ifndef _HEADLESS_H_
+#define _HEADLESS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "message.h"
+
+/*
+ * Loads the keys to play from source, which is either "random:N" (N random movement keys) or
+ * "random:N:SEED" (the same, repeatably), or else the name of a script file whose movement and
+ * other player keys are sent in order (anything else in the file is ignored).
+ *
+ * Returns false, after logging why, if the source cannot be read.
+ */
+bool headless_init(const char* source);
+
+/*
+ * Notes the server's "SEQ [seq]" answer to a key.
+ */
+void headless_answered(int seq);
+
+/*
+ * Notes a DISPLAY; if it follows the answer to the key being timed, logs that key's latency.
+ */
+void headless_display();
+
+/*
+ * Sends the next key once the last one is done with (its DISPLAY arrived, or none came with its answer,
+ * or it went unanswered too long), or 'Q' once there are no more. Call it after each batch of messages.
+ */
+void headless_next(addr_t* serverp);
+
+/*
+ * Timeout handler for message_loop, calling headless_next when the server has gone quiet; arg is the
+ * server's address. Always returns false (keep looping).
+ */
+bool headless_timeout(void* arg);
+
+/*
+ * Writes the summary of latencies to fp and frees everything the module allocated.
+ */
+void headless_done(FILE* fp);
+
+#endif /* _HEADLESS_H_ */
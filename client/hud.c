@@ -0,0 +1,177 @@
+/*
+ * hud.c
+ *
+ * Description: contains the HUD module. Send times wait in the latency module's queue until an answer
+ * comes; round trip times and draw times are kept in rings of the most recent ones, so each refresh of the
+ * HUD costs the same however long the game has gone on.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "hud.h"
+#include "latency.h"
+#include "graphics.h"
+#include "clientdata.h"
+
+// round trips the percentile is taken over
+#define RECENT_RTTS 128
+
+// draws the frame rate is counted from (more than any terminal shows in a second)
+#define RECENT_DRAWS 256
+
+// a key older than this when a DISPLAY comes is taken to have brought none (e.g. walked into a wall)
+static const double STALE_KEY_SECONDS = 1.0;
+
+// seconds between refreshes of the HUD, so it costs little and stays readable
+static const double REFRESH_SECONDS = 0.25;
+
+// module-wide state
+static bool shown = false;
+static int untaggedSeq = 0; // numbers the keys sent untagged, for the latency module's queue
+static double rtts[RECENT_RTTS]; // milliseconds, circular
+static int numRtts = 0; // total measured; the latest is at (numRtts - 1) % RECENT_RTTS
+static double draws[RECENT_DRAWS]; // draw times, circular
+static int numDraws = 0;
+static double lastRefresh = 0;
+
+// function prototypes
+static double now();
+static void addRtt(double rtt);
+
+/*
+ * Notes a KEY sent; see .h for more details.
+ */
+void
+hud_key_sent(int seq)
+{
+    // the headless client times its own keys
+    if (client.headless) {
+        return;
+    }
+
+    // when predicting, keys are tagged, and the SEQ answering each is matched to it; otherwise the keys
+    // are numbered here, to be matched to DISPLAYs in the order sent
+    if (client.predict) {
+        if (seq >= 0) {
+            latency_sent(seq);
+        }
+    } else {
+        latency_sent(untaggedSeq++);
+    }
+}
+
+/*
+ * Notes a SEQ received; see .h for more details.
+ */
+void
+hud_seq_received(int seq)
+{
+    if (!client.headless && client.predict) {
+        addRtt(latency_answered(seq));
+    }
+}
+
+/*
+ * Notes a DISPLAY received; see .h for more details.
+ */
+void
+hud_display_received()
+{
+    if (client.headless || client.predict) {
+        return; // timed by the SEQ tags instead
+    }
+
+    // forget keys that brought no DISPLAY, then match the oldest left
+    latency_expire(STALE_KEY_SECONDS);
+    int seq = latency_oldest();
+    if (seq >= 0) {
+        addRtt(latency_answered(seq));
+    }
+}
+
+/*
+ * Notes a map drawn; see .h for more details.
+ */
+void
+hud_display_drawn()
+{
+    draws[numDraws % RECENT_DRAWS] = now();
+    numDraws++;
+}
+
+/*
+ * Toggles the HUD; see .h for more details.
+ */
+void
+hud_toggle()
+{
+    shown = !shown;
+    if (shown) {
+        lastRefresh = 0; // refresh right away
+        hud_update();
+    } else {
+        display_hud(NULL);
+    }
+}
+
+/*
+ * Refreshes the HUD; see .h for more details.
+ */
+void
+hud_update()
+{
+    double time = now();
+    if (!shown || time - lastRefresh < REFRESH_SECONDS) {
+        return;
+    }
+    lastRefresh = time;
+
+    // the 95th percentile of the recent round trips
+    int count = (numRtts < RECENT_RTTS) ? numRtts : RECENT_RTTS;
+    double p95 = latency_percentileOf(rtts, count, 95);
+    double last = (count > 0) ? rtts[(numRtts - 1) % RECENT_RTTS] : 0;
+
+    // maps drawn in the last second
+    int fps = 0;
+    int recentDraws = (numDraws < RECENT_DRAWS) ? numDraws : RECENT_DRAWS;
+    for (int i = 1; i <= recentDraws; i++) {
+        if (time - draws[(numDraws - i) % RECENT_DRAWS] > 1.0) {
+            break;
+        }
+        fps++;
+    }
+
+    char text[80];
+    snprintf(text, sizeof(text), "rtt %.1fms p95 %.1fms %dfps %d skipped",
+             last, p95, fps, client.framesSkipped);
+    display_hud(text);
+}
+
+/*
+ * Seconds on the monotonic clock.
+ */
+static double
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * Keeps a round trip time in the ring of recent ones, unless it is -1 (no key was waiting).
+ */
+static void
+addRtt(double rtt)
+{
+    if (rtt < 0) {
+        return;
+    }
+    rtts[numRtts % RECENT_RTTS] = rtt;
+    numRtts++;
+}
@@ -0,0 +1,54 @@
+/*
+ * hud.h
+ *
+ * Description: contains interface for the HUD module, which measures how the game feels to play and
+ * shows it at the right end of the banner when toggled on: the round trip time of the last key (from
+ * sending its KEY to receiving the server's answer), the 95th percentile of recent round trips, maps drawn
+ * per second, and maps skipped as stale. The keys are timed with the latency module.
+ *
+ * When predicting, keys are tagged, and each is matched to the SEQ that answers it, so the numbers are
+ * exact. Otherwise keys are matched to DISPLAYs in the order sent, which is the order the server answers
+ * them; a DISPLAY brought about by another player can be matched to a key of ours if it arrives first, so
+ * the numbers are an estimate. The headless client times its keys itself, and the HUD leaves them be.
+ *
+ */
+
+#ifndef _HUD_H_
+#define _HUD_H_
+
+#include <stdbool.h>
+
+/*
+ * Notes that a KEY tagged with seq (-1 if untagged) was just sent. Only takes the time; cheap enough for
+ * the input path.
+ */
+void hud_key_sent(int seq);
+
+/*
+ * Notes that the SEQ answering the key tagged seq arrived, when predicting.
+ */
+void hud_seq_received(int seq);
+
+/*
+ * Notes that a DISPLAY arrived, matching it to the oldest key awaiting one, when not predicting.
+ */
+void hud_display_received();
+
+/*
+ * Notes that a map was drawn.
+ */
+void hud_display_drawn();
+
+/*
+ * Turns the HUD on or off, showing or hiding it at once.
+ */
+void hud_toggle();
+
+/*
+ * Refreshes the HUD, if it is on and last refreshed long enough ago to be worth it. Call it after a batch
+ * of messages, or when nothing has happened for a while, never right after a key; it only stages the
+ * change, for update_display.
+ */
+void hud_update();
+
+#endif /* _HUD_H_ */
@@ -0,0 +1,226 @@
+/*
+ * latency.c
+ *
+ * Description: contains the latency module. Send times are kept for the keys still awaiting an answer;
+ * each answer turns one into a round trip time, and every round trip time is kept for the summary.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "latency.h"
+
+// most keys awaiting an answer at once; beyond this the oldest is forgotten
+#define MAX_OUTSTANDING 64
+
+// a key sent but not yet answered
+typedef struct {
+    int seq;
+    struct timespec sentAt;
+} SentKey;
+
+// module-wide state
+static SentKey outstanding[MAX_OUTSTANDING];
+static int numOutstanding = 0;
+static double* samples = NULL; // every round trip time, in milliseconds
+static int numSamples = 0;
+static int samplesCapacity = 0;
+
+// function prototypes
+static int compareDoubles(const void* a, const void* b);
+static double percentileOfSorted(double* sorted, int count, double p);
+
+/*
+ * Notes a send time; see .h for more details.
+ */
+void
+latency_sent(int seq)
+{
+    if (numOutstanding == MAX_OUTSTANDING) {
+        memmove(outstanding, outstanding + 1, (MAX_OUTSTANDING - 1) * sizeof(SentKey));
+        numOutstanding--;
+    }
+    outstanding[numOutstanding].seq = seq;
+    clock_gettime(CLOCK_MONOTONIC, &outstanding[numOutstanding].sentAt);
+    numOutstanding++;
+}
+
+/*
+ * Turns a send time into a round trip time; see .h for more details.
+ */
+double
+latency_answered(int seq)
+{
+    // find the key; keys sent before it have been passed over
+    int index = 0;
+    while (index < numOutstanding && outstanding[index].seq != seq) {
+        index++;
+    }
+    if (index == numOutstanding) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double rtt = (now.tv_sec - outstanding[index].sentAt.tv_sec) * 1e3
+        + (now.tv_nsec - outstanding[index].sentAt.tv_nsec) / 1e6;
+
+    // forget this key and every one before it
+    numOutstanding -= index + 1;
+    memmove(outstanding, outstanding + index + 1, numOutstanding * sizeof(SentKey));
+
+    // keep the sample, growing the array as needed
+    if (numSamples == samplesCapacity) {
+        int newCapacity = (samplesCapacity == 0) ? 256 : 2 * samplesCapacity;
+        double* newSamples = realloc(samples, newCapacity * sizeof(double));
+        if (newSamples == NULL) {
+            return rtt; // measured, just not kept
+        }
+        samples = newSamples;
+        samplesCapacity = newCapacity;
+    }
+    samples[numSamples++] = rtt;
+    return rtt;
+}
+
+/*
+ * Forgets keys long unanswered; see .h for more details.
+ */
+void
+latency_expire(double seconds)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int expired = 0;
+    while (expired < numOutstanding
+           && (now.tv_sec - outstanding[expired].sentAt.tv_sec)
+              + (now.tv_nsec - outstanding[expired].sentAt.tv_nsec) / 1e9 > seconds) {
+        expired++;
+    }
+    numOutstanding -= expired;
+    memmove(outstanding, outstanding + expired, numOutstanding * sizeof(SentKey));
+}
+
+/*
+ * Returns the oldest key awaiting an answer; see .h for more details.
+ */
+int
+latency_oldest()
+{
+    return (numOutstanding > 0) ? outstanding[0].seq : -1;
+}
+
+/*
+ * Returns the sample count; see .h for more details.
+ */
+int
+latency_count()
+{
+    return numSamples;
+}
+
+/*
+ * Returns a percentile; see .h for more details.
+ */
+double
+latency_percentile(double p)
+{
+    return latency_percentileOf(samples, numSamples, p);
+}
+
+/*
+ * Returns a percentile of the caller's round trips; see .h for more details.
+ */
+double
+latency_percentileOf(const double* rtts, int count, double p)
+{
+    if (count == 0) {
+        return 0;
+    }
+    double* sorted = malloc(count * sizeof(double));
+    if (sorted == NULL) {
+        return 0;
+    }
+    memcpy(sorted, rtts, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compareDoubles);
+    double value = percentileOfSorted(sorted, count, p);
+    free(sorted);
+    return value;
+}
+
+/*
+ * Writes the summary; see .h for more details.
+ */
+void
+latency_report(FILE* fp, int unanswered)
+{
+    fprintf(fp, "keys answered: %d, unanswered: %d\n", numSamples, unanswered);
+    if (numSamples == 0) {
+        return;
+    }
+
+    // sort once for every percentile
+    double* sorted = malloc(numSamples * sizeof(double));
+    if (sorted == NULL) {
+        fprintf(stderr, "Memory allocation failed");
+        return;
+    }
+    memcpy(sorted, samples, numSamples * sizeof(double));
+    qsort(sorted, numSamples, sizeof(double), compareDoubles);
+
+    double total = 0;
+    for (int i = 0; i < numSamples; i++) {
+        total += sorted[i];
+    }
+    fprintf(fp, "rtt ms: min %.3f mean %.3f p50 %.3f p90 %.3f p95 %.3f p99 %.3f max %.3f\n",
+            sorted[0], total / numSamples,
+            percentileOfSorted(sorted, numSamples, 50), percentileOfSorted(sorted, numSamples, 90),
+            percentileOfSorted(sorted, numSamples, 95), percentileOfSorted(sorted, numSamples, 99),
+            sorted[numSamples - 1]);
+    free(sorted);
+}
+
+/*
+ * Frees the module's memory; see .h for more details.
+ */
+void
+latency_done()
+{
+    free(samples);
+    samples = NULL;
+    numSamples = 0;
+    samplesCapacity = 0;
+    numOutstanding = 0;
+}
+
+/*
+ * qsort comparison for doubles, ascending.
+ */
+static int
+compareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Nearest-rank percentile of a sorted, non-empty array.
+ */
+static double
+percentileOfSorted(double* sorted, int count, double p)
+{
+    int rank = (int)(p / 100 * count + 0.999999); // ceiling
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+    return sorted[rank - 1];
+}
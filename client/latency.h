@@ -0,0 +1,66 @@
+/*
+ * latency.h
+ *
+ * Description: contains interface for the latency module, which times keystrokes from the moment their KEY
+ * is sent until the server's answer arrives, and summarizes those round trip times.
+ *
+ */
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * Notes the time a key tagged with seq was sent.
+ */
+void latency_sent(int seq);
+
+/*
+ * Notes that the answer to the key tagged with seq has arrived. Keys sent before it that were never
+ * answered are forgotten.
+ *
+ * Returns the round trip time in milliseconds, or -1 if no key tagged seq is awaiting an answer.
+ */
+double latency_answered(int seq);
+
+/*
+ * Forgets the keys that have awaited an answer for longer than seconds; they are taken never to be answered.
+ */
+void latency_expire(double seconds);
+
+/*
+ * Returns the seq of the oldest key awaiting an answer, or -1 if there is none. For a caller that pairs keys
+ * with answers in the order sent, having no tags to go by.
+ */
+int latency_oldest();
+
+/*
+ * Returns the number of round trip times measured so far.
+ */
+int latency_count();
+
+/*
+ * Returns the p-th percentile (0 to 100) of the round trip times measured so far, in milliseconds, or 0 if
+ * there are none.
+ */
+double latency_percentile(double p);
+
+/*
+ * Returns the p-th percentile (0 to 100, nearest rank) of count round trip times, in any order, or 0 if
+ * count is 0. For a caller that keeps its own window of recent ones; the values are not changed.
+ */
+double latency_percentileOf(const double* rtts, int count, double p);
+
+/*
+ * Writes a summary of the round trip times to fp: count, keys never answered, mean, and percentiles.
+ */
+void latency_report(FILE* fp, int unanswered);
+
+/*
+ * Frees everything the module allocated.
+ */
+void latency_done();
+
+#endif /* _LATENCY_H_ */
@@ -0,0 +1,214 @@
+/*
+ * prediction.c
+ *
+ * Description: contains the client-side movement prediction. It keeps the last map the server sent (the
+ * authoritative frame), the movement keys sent since then that the server has not yet answered, and what
+ * it has learned of the terrain. The map shown is the authoritative frame with those keys applied.
+ *
+ * A predicted step only ever moves the '@' onto a cell it has seen to be room, passage, or gold; anything
+ * else (walls, rock, other players) is left for the server to decide.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "prediction.h"
+
+// most keys awaiting an answer; beyond this the oldest is forgotten
+#define MAX_PENDING 64
+
+// a key sent with a sequence number but not yet answered
+typedef struct {
+    int seq;
+    char key;
+} PendingKey;
+
+// module-wide state (NULL maps until prediction_init)
+static char* authoritative = NULL; // last map the server sent
+static char* predicted = NULL; // authoritative with the pending keys applied
+static char* terrain = NULL; // room or passage seen at each cell; ' ' if never seen
+static int nrowsMap = 0;
+static int ncolsMap = 0;
+static PendingKey pending[MAX_PENDING];
+static int numPending = 0;
+static int nextSeq = 1;
+
+// function prototypes
+static void rebuild();
+static void applyKey(char key);
+
+/*
+ * Sets up prediction; see .h for more details.
+ */
+bool
+prediction_init(int nrows, int ncols)
+{
+    prediction_done(); // in case of a second GRID
+
+    int size = nrows * ncols;
+    authoritative = malloc(size + 1);
+    predicted = malloc(size + 1);
+    terrain = malloc(size);
+    if (authoritative == NULL || predicted == NULL || terrain == NULL) {
+        prediction_done();
+        return false;
+    }
+
+    // nothing seen yet
+    memset(authoritative, ' ', size);
+    authoritative[size] = '\0';
+    memset(terrain, ' ', size);
+    nrowsMap = nrows;
+    ncolsMap = ncols;
+    numPending = 0;
+    rebuild();
+    return true;
+}
+
+/*
+ * Records an authoritative frame; see .h for more details.
+ */
+void
+prediction_frame(const char* map)
+{
+    if (authoritative == NULL) {
+        return;
+    }
+
+    int size = nrowsMap * ncolsMap;
+    for (int i = 0; i < size; i++) {
+        // a short (malformed) map leaves the rest of the frame blank
+        char c = (*map != '\0') ? *map++ : ' ';
+        authoritative[i] = c;
+
+        // remember open ground, to know what an '@' leaves behind when it moves off
+        if (c == '.' || c == '#') {
+            terrain[i] = c;
+        }
+    }
+    rebuild();
+}
+
+/*
+ * Predicts a move; see .h for more details.
+ */
+int
+prediction_move(char key)
+{
+    if (predicted == NULL || key == '\0' || strchr("hjklyubn", key) == NULL) {
+        return -1;
+    }
+
+    // forget the oldest key if the server has gone quiet for a long time
+    if (numPending == MAX_PENDING) {
+        memmove(pending, pending + 1, (MAX_PENDING - 1) * sizeof(PendingKey));
+        numPending--;
+    }
+    pending[numPending].seq = nextSeq++;
+    pending[numPending].key = key;
+    numPending++;
+
+    applyKey(key);
+    return pending[numPending - 1].seq;
+}
+
+/*
+ * Drops answered keys; see .h for more details.
+ */
+void
+prediction_ack(int seq)
+{
+    int answered = 0;
+    while (answered < numPending && pending[answered].seq <= seq) {
+        answered++;
+    }
+    if (answered == 0) {
+        return;
+    }
+    memmove(pending, pending + answered, (numPending - answered) * sizeof(PendingKey));
+    numPending -= answered;
+    rebuild();
+}
+
+/*
+ * Returns the predicted map; see .h for more details.
+ */
+char*
+prediction_map()
+{
+    return predicted;
+}
+
+/*
+ * Frees the module's memory; see .h for more details.
+ */
+void
+prediction_done()
+{
+    free(authoritative);
+    free(predicted);
+    free(terrain);
+    authoritative = NULL;
+    predicted = NULL;
+    terrain = NULL;
+}
+
+/*
+ * Recomputes the predicted map from the authoritative frame and the pending keys.
+ */
+static void
+rebuild()
+{
+    if (predicted == NULL) {
+        return;
+    }
+    memcpy(predicted, authoritative, nrowsMap * ncolsMap + 1);
+    for (int i = 0; i < numPending; i++) {
+        applyKey(pending[i].key);
+    }
+}
+
+/*
+ * Moves the '@' one step in the predicted map, if the step is onto ground known to be open.
+ */
+static void
+applyKey(char key)
+{
+    // find the '@'; a player who cannot see themself has nothing to predict
+    char* at = strchr(predicted, '@');
+    if (at == NULL) {
+        return;
+    }
+    int position = at - predicted;
+    int row = position / ncolsMap;
+    int col = position % ncolsMap;
+
+    // direction of the step
+    int dr = 0;
+    int dc = 0;
+    switch (key) {
+        case 'h': dc = -1; break;
+        case 'l': dc = 1; break;
+        case 'j': dr = 1; break;
+        case 'k': dr = -1; break;
+        case 'y': dr = -1; dc = -1; break;
+        case 'u': dr = -1; dc = 1; break;
+        case 'b': dr = 1; dc = -1; break;
+        case 'n': dr = 1; dc = 1; break;
+    }
+    int newRow = row + dr;
+    int newCol = col + dc;
+    if (newRow < 0 || newRow >= nrowsMap || newCol < 0 || newCol >= ncolsMap) {
+        return;
+    }
+
+    // only step onto room, passage, or gold
+    char* target = predicted + newRow * ncolsMap + newCol;
+    if (*target != '.' && *target != '#' && *target != '*') {
+        return;
+    }
+    *target = '@';
+    *at = (terrain[position] != ' ') ? terrain[position] : '.';
+}
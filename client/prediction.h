@@ -0,0 +1,52 @@
+/*
+ * prediction.h
+ *
+ * Description: contains interface for the prediction module, which lets a player's '@' move as soon as a
+ * key is pressed instead of a round trip later. Each predicted key is tagged with a sequence number; the
+ * server answers "SEQ [number]" ahead of the DISPLAY that includes that key, and the client then shows
+ * that DISPLAY with only the still-unanswered keys applied on top.
+ *
+ */
+
+#ifndef _PREDICTION_H_
+#define _PREDICTION_H_
+
+#include <stdbool.h>
+
+/*
+ * Sets up prediction for a map of nrows by ncols.
+ *
+ * Returns false if memory could not be allocated, in which case prediction stays off.
+ */
+bool prediction_init(int nrows, int ncols);
+
+/*
+ * Records a map received in a DISPLAY message as the authoritative frame, also learning the terrain it
+ * shows, and reapplies the unanswered keys to it.
+ */
+void prediction_frame(const char* map);
+
+/*
+ * Predicts the move for a key the player pressed, if it is a single-step movement key.
+ *
+ * Returns the sequence number to tag the key with, or -1 if the key is not predicted (send it untagged).
+ */
+int prediction_move(char key);
+
+/*
+ * Notes that the server has applied every key tagged up to and including seq.
+ */
+void prediction_ack(int seq);
+
+/*
+ * Returns the map to show: the authoritative frame with unanswered keys applied (NULL before init).
+ * The string belongs to this module and changes with the calls above.
+ */
+char* prediction_map();
+
+/*
+ * Frees everything the module allocated.
+ */
+void prediction_done();
+
+#endif /* _PREDICTION_H_ */
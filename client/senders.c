@@ -8,17 +8,36 @@
  * 
  */
 
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include "message.h"
+#include "wire.h"
 #include "clientdata.h"
 #include "senders.h"
+#include "hud.h"
+
+// single steps, which are worth sending together when repeated
+static const char* STEP_KEYSTROKES = "hjklyubn";
+
+// the step whose repeats are being held, how many are held, the tag of the newest (-1 if untagged), and
+// when the window they are held in opened
+static char heldKey = '\0';
+static int heldCount = 0;
+static int heldSeq = -1;
+static double windowStart = 0;
 
 // function prototypes
 static void sendPlay(addr_t* serverp);
 static void sendSpectate(addr_t* serverp);  
+static void sendKey(addr_t* serverp, char key, int count, int seq);
+static void sendHeld(addr_t* serverp);
+static void addOffers(char* message, size_t size);
+static double now();
 
 /*
  * Sends "RECEIVED" to server; see .h for more details. 
@@ -67,20 +86,142 @@ send_start(addr_t* serverp)
  */
 void
 send_key(addr_t* serverp, char key) 
+{
+    sendKey(serverp, key, 1, -1);
+}
+
+/*
+ * Sends key tagged with a sequence number to server; see .h for more details. 
+ */
+void
+send_key_tagged(addr_t* serverp, char key, int seq) 
+{
+    sendKey(serverp, key, 1, seq);
+}
+
+/*
+ * Sends key, or holds it to send with its repeats; see .h for more details. 
+ */
+bool
+send_key_coalesced(addr_t* serverp, char key, int seq) 
+{
+    double time = now();
+    bool step = (key != '\0' && strchr(STEP_KEYSTROKES, key) != NULL);
+
+    // a repeat of the step last sent: hold it, or send it with the others held once the window is over
+    if (step && key == heldKey) {
+        heldCount++;
+        heldSeq = seq;
+        if (time - windowStart >= KEY_WINDOW) {
+            send_held_keys(serverp);
+        }
+        return heldCount > 0;
+    }
+
+    // anything else goes now, after whatever was held
+    sendHeld(serverp);
+    sendKey(serverp, key, 1, seq);
+    heldKey = step ? key : '\0';
+    windowStart = time;
+    return false;
+}
+
+/*
+ * Sends held repeats once their window is over; see .h for more details. 
+ */
+bool
+send_held_keys(addr_t* serverp) 
+{
+    double time = now();
+    if (heldCount > 0 && time - windowStart >= KEY_WINDOW) {
+        sendHeld(serverp);
+        windowStart = time; // repeats still coming are held for another window
+    }
+    return heldCount > 0;
+}
+
+/*
+ * Asks the server to walk the player to the nearest gold; see .h for more details. 
+ */
+void
+send_goto_gold(addr_t* serverp) 
+{
+    // ensures client is currently running a game session
+    if (client.state != PLAY) {
+        return;
+    }
+
+    // held steps were typed first, so they go first
+    sendHeld(serverp);
+    hud_key_sent(-1);
+    if (client.binary) {
+        char message[wire_MaxBytes];
+        int length = wire_encode(message, WIRE_GOTO, (long long[]) {-1, -1});
+        message_sendn(*serverp, message, length);
+    } else {
+        message_send(*serverp, "GOTO GOLD");
+    }
+}
+
+/*
+ * Sends "KEY [key]", "KEY [key] [count]" or "KEY [key] [count] [seq]" (seq -1 for none), as needed, or the
+ * binary KEY to a server that speaks binary.
+ */
+static void
+sendKey(addr_t* serverp, char key, int count, int seq) 
 {
     // ensures client is currently running a game session
     if (client.state != PLAY) {
         return;
     }
 
+    // a server that speaks binary takes every key as one fixed-size message
+    if (client.binary) {
+        char message[wire_MaxBytes];
+        int length = wire_encode(message, WIRE_KEY, (long long[]) {key, count, seq});
+        hud_key_sent(seq);
+        message_sendn(*serverp, message, length);
+        return;
+    }
+
     // create key send message
-    char message[6];
-    snprintf(message, sizeof(message), "KEY %c", key);
+    char message[30];
+    if (seq >= 0) {
+        snprintf(message, sizeof(message), "KEY %c %d %d", key, count, seq);
+    } else if (count > 1) {
+        snprintf(message, sizeof(message), "KEY %c %d", key, count);
+    } else {
+        snprintf(message, sizeof(message), "KEY %c", key);
+    }
     
-    // send message to server
+    // send message to server, timing it for the HUD
+    hud_key_sent(seq);
     message_send(*serverp, message);
 }
 
+/*
+ * Sends the held repeats of a step, if any, as one key.
+ */
+static void
+sendHeld(addr_t* serverp) 
+{
+    if (heldCount > 0) {
+        sendKey(serverp, heldKey, heldCount, heldSeq);
+        heldCount = 0;
+    }
+}
+
+/*
+ * Seconds on the monotonic clock.
+ */
+static double
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
 /*
  * Sends play message to server (the player start message); see .h for more details. 
  */
@@ -100,9 +241,14 @@ sendPlay(addr_t* serverp)
         return;
     }
 
-    // create PLAY message
-    char message[MAXIMUM_NAME_LENGTH + 10];
-    snprintf(message, sizeof(message), "PLAY %s", client.playerName);
+    // create PLAY message, or RESUME to come back as the player of an earlier session
+    char message[MAXIMUM_NAME_LENGTH + 30];
+    if (client.session[0] != '\0') {
+        snprintf(message, sizeof(message), "RESUME %s", client.session);
+    } else {
+        snprintf(message, sizeof(message), "PLAY %s", client.playerName);
+    }
+    addOffers(message, sizeof(message));
     
     // send message to server
     message_send(*serverp, message);
@@ -115,5 +261,25 @@ static void
 sendSpectate(addr_t* serverp) 
 {
     // send spectator start message to server
-    message_send(*serverp, "SPECTATE");
+    char message[20] = "SPECTATE";
+    addOffers(message, sizeof(message));
+    message_send(*serverp, message);
+}
+
+/*
+ * Adds the lines offering what the client can take (see wire.h) to a PLAY, RESUME, or SPECTATE: binary
+ * messages, unless the client keeps to text (--text), and for a player, building the display from TERRAIN
+ * and VIEW, unless it takes whole maps (--frames).
+ */
+static void
+addOffers(char* message, size_t size)
+{
+    if (!client.text) {
+        size_t length = strlen(message);
+        snprintf(message + length, size - length, "\n%s", wire_OfferBinary);
+    }
+    if (!client.frames && client.playerName != NULL) {
+        size_t length = strlen(message);
+        snprintf(message + length, size - length, "\n%s", wire_OfferOverlay);
+    }
 }
@@ -29,7 +29,8 @@ void send_receipt(addr_t* serverp);
 /*
  * Runs in CLIENT_PRE_INIT state.
  * 
- * Sends "PLAY [playerName]" or "SPECTATE" according to client type and advances client state. 
+ * Sends "PLAY [playerName]" or "SPECTATE" according to client type and advances client state; a player
+ * given a --session token sends "RESUME [token]" instead, to be taken back as that player. 
  *
  * Requires serverp and returns void
  */
@@ -44,5 +45,43 @@ void send_start(addr_t* serverp);
  */
 void send_key(addr_t* serverp, char key); 
 
+/*
+ * Runs in CLIENT_PLAY state, in prediction mode.
+ *
+ * Sends "KEY [keystroke] 1 [seq]", asking the server to answer "SEQ [seq]" ahead of the resulting DISPLAY.
+ *
+ * Requires serverp and returns void
+ */
+void send_key_tagged(addr_t* serverp, char key, int seq); 
+
+/*
+ * Runs in CLIENT_PLAY state, for keys typed by the player.
+ *
+ * Like send_key (or send_key_tagged, if seq is not -1), except that repeats of a single step typed within
+ * KEY_WINDOW of the last send, as when the key is held down, are held and sent together as
+ * "KEY [keystroke] [count]" (tagged with the newest seq), once the window is over. Any other key first
+ * sends what is held.
+ *
+ * Returns true if keys are held; the caller must then call send_held_keys within KEY_WINDOW.
+ */
+bool send_key_coalesced(addr_t* serverp, char key, int seq); 
+
+/*
+ * Sends the held repeats of a step, if their window is over.
+ *
+ * Returns true if keys are still held.
+ */
+bool send_held_keys(addr_t* serverp); 
+
+/*
+ * Runs in CLIENT_PLAY state.
+ *
+ * Sends "GOTO GOLD", asking the server to walk the player to the nearest gold they can see, in one
+ * action. Any held keys are sent first.
+ *
+ * Requires serverp and returns void
+ */
+void send_goto_gold(addr_t* serverp); 
+
 #endif /* _SENDERS_H_ */
 
@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
 #include "validators.h"
 
 /*
@@ -39,4 +41,22 @@ bool
 validate_stdin_character(const char stdinCharacter)
 {
     return stdinCharacter != EOF;
-}
\ No newline at end of file
+}
+
+/*
+ * Ensure session token is one to sixteen hexadecimal digits
+ */
+bool
+validate_session(const char* session)
+{
+    size_t length = strlen(session);
+    if (length < 1 || length > 16) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!isxdigit((unsigned char) session[i])) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -28,4 +28,9 @@ bool validate_player_symbol(const char symbol);
  */
 bool validate_stdin_character(const char stdinCharacter);
 
+/*
+ * Ensure session token is one to sixteen hexadecimal digits
+ */
+bool validate_session(const char* session);
+
 #endif /* _VALIDATORS_H_ */
\ No newline at end of file
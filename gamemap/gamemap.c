@@ -4,19 +4,40 @@
  * defines the struct and functions related to storing and processing the game map
  */
 
+#define _POSIX_C_SOURCE 200809L // for fileno
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <sys/stat.h>
 
 #include "file.h"
+#include "gamemap.h"
 
 /* Local types */
-typedef struct GameMap {
+// terrain of a map file and what is derived from it; it never changes
+// once loaded, so every GameMap_t on the same file shares one
+typedef struct MapTerrain {
+  dev_t device; ino_t inode; // the file it was loaded from
+  int refs; // GameMap_ts using it
   int numRows, numCols; // size of map
   char** grid; // terrain features
-  char** gameGrid; // spectator view with players and gold
+  int* roomCells; // every room cell ('.'), as row * numCols + col
+  int numRoomCells;
+  int** distanceFields; // cached BFS distance fields (NULL until first used)
+  int* fieldTargets; // target cell (row * numCols + col) of each field, -1 if none
+  int nextField; // the cached field the next new one replaces
+  struct MapTerrain* next; // next in the list of loaded terrains
+} MapTerrain_t;
+
+typedef struct GameMap {
+  MapTerrain_t* terrain; // shared, read-only
+  int numRows, numCols; // terrain's size, copied for speed
+  char** grid; // terrain's features, likewise
+  char** gameGrid; // spectator view with players and gold; this game's own
+  int* occupants; // ID of the player on each cell (row * numCols + col), -1 if none
 } GameMap_t;
 
 /* Local consts */
@@ -25,12 +46,19 @@ typedef struct GameMap {
 static const int dr[] = {0, 1, 0, -1};
 static const int dc[] = {1, 0, -1, 0};
 
-// players can only see up to sightRadius units away, with diagonals
-// counting as 1 unit (such that a visible cell is at most
-// sightRadius cells away in either direction)
-static const int sightRadius = 5;
+// number of distance fields kept per map; each is numRows x numCols ints
+#define DistanceCacheSize 16
+
+// the eight steps a player can take, for distance fields
+static const int stepDr[] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const int stepDc[] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+// every terrain currently loaded
+static MapTerrain_t* loadedTerrains = NULL;
 
 // Helper functions
+static MapTerrain_t* loadTerrain(FILE* fp, dev_t device, ino_t inode);
+static void releaseTerrain(MapTerrain_t* terrain);
 void deleteGrid(char** grid, int numRows);
 void delete2DIntArr(int** arr, int numRows);
 int checkSquare(GameMap_t* map, int** visibleRegion, int idx,
@@ -38,6 +66,8 @@ int checkSquare(GameMap_t* map, int** visibleRegion, int idx,
 static bool isVisible(GameMap_t* map, int r1, int c1, int r2, int c2);
 static bool outOfMap(GameMap_t* map, int row, int col);
 bool isWall(char type);
+static bool isWalkable(GameMap_t* map, int row, int col);
+static bool fillDistanceField(GameMap_t* map, int* field, int target);
 
 // Getters
 int getNumRows(GameMap_t* map)
@@ -72,6 +102,22 @@ char** getGameGrid(GameMap_t* map)
   return map->gameGrid;
 }
 
+const char* getGameFrame(GameMap_t* map)
+{
+  if (map == NULL) {
+    return NULL;
+  }
+  return getFrame(map->gameGrid);
+}
+
+int getFrameLength(GameMap_t* map)
+{
+  if (map == NULL) {
+    return 0;
+  }
+  return FrameHeaderLength + map->numRows * map->numCols;
+}
+
 char getCellType(GameMap_t* map, int row, int col)
 {
   if (outOfMap(map, row, col)) {
@@ -101,6 +147,26 @@ void setCellType(GameMap_t* map, char type, int row, int col)
     return;
   }
   map->gameGrid[row][col] = type;
+  map->occupants[row * map->numCols + col] = -1;
+}
+
+int getCellOccupant(GameMap_t* map, int row, int col)
+{
+  if (outOfMap(map, row, col)) {
+    return -1;
+  }
+  return map->occupants[row * map->numCols + col];
+}
+
+void setCellOccupant(GameMap_t* map, int id, char glyph, int row, int col)
+{
+  // players only stand where the terrain lets them
+  if (outOfMap(map, row, col) || map->grid[row][col] == ' '
+      || isWall(map->grid[row][col])) {
+    return;
+  }
+  map->gameGrid[row][col] = glyph;
+  map->occupants[row * map->numCols + col] = id;
 }
 
 void restoreCell(GameMap_t* map, int row, int col)
@@ -109,6 +175,20 @@ void restoreCell(GameMap_t* map, int row, int col)
     return;
   }
   map->gameGrid[row][col] = map->grid[row][col];
+  map->occupants[row * map->numCols + col] = -1;
+}
+
+void resetGameGrid(GameMap_t* map)
+{
+  if (map == NULL) {
+    return;
+  }
+  for (int row = 0; row < map->numRows; row++) {
+    memcpy(map->gameGrid[row], map->grid[row], map->numCols);
+  }
+  for (int cell = 0; cell < map->numRows * map->numCols; cell++) {
+    map->occupants[cell] = -1;
+  }
 }
 
 GameMap_t* loadMapFile(char* mapFilePath)
@@ -117,53 +197,151 @@ GameMap_t* loadMapFile(char* mapFilePath)
   if (fp == NULL) {
     return NULL;
   }
+  struct stat status;
+  if (fstat(fileno(fp), &status) != 0) {
+    fclose(fp);
+    return NULL;
+  }
+
+  // share the terrain if this file is already loaded
+  MapTerrain_t* terrain = loadedTerrains;
+  while (terrain != NULL
+         && (terrain->device != status.st_dev || terrain->inode != status.st_ino)) {
+    terrain = terrain->next;
+  }
+  if (terrain == NULL) {
+    terrain = loadTerrain(fp, status.st_dev, status.st_ino);
+  }
+  fclose(fp);
+  if (terrain == NULL) {
+    return NULL;
+  }
+  terrain->refs++;
+
   GameMap_t* map = malloc(sizeof(GameMap_t));
   if (map == NULL) {
-    fclose(fp);
+    releaseTerrain(terrain);
+    return NULL;
+  }
+  map->terrain = terrain;
+  map->numRows = terrain->numRows;
+  map->numCols = terrain->numCols;
+  map->grid = terrain->grid;
+
+  // gameGrid doubles as the spectator's DISPLAY message
+  // when loading a file, grid and gameGrid are the same
+  // after the game starts, only gameGrid stores the players and gold
+  map->gameGrid = newFrameGrid(map->numRows, map->numCols, ' ');
+  map->occupants = malloc(map->numRows * map->numCols * sizeof(int));
+  if (map->gameGrid == NULL || map->occupants == NULL) {
+    if (map->gameGrid != NULL) {
+      deleteFrameGrid(map->gameGrid);
+    }
+    free(map->occupants);
+    releaseTerrain(terrain);
+    free(map);
     return NULL;
   }
+  resetGameGrid(map);
+  return map;
+}
 
-  // initialize map variables
+/*
+ * Helper function to read a map file's terrain and add it to
+ * loadedTerrains, with no references yet
+ *
+ * Inputs:
+ *   fp: the open map file
+ *   device, inode: identify the file
+ *
+ * Returns:
+ *   the terrain
+ *   NULL if the file is empty or memory allocation error
+ */
+static MapTerrain_t* loadTerrain(FILE* fp, dev_t device, ino_t inode)
+{
   int numRows = file_numLines(fp);
   char* line = file_readLine(fp);
+  if (numRows < 1 || line == NULL) {
+    free(line);
+    return NULL;
+  }
   int numCols = strlen(line);
   free(line);
   rewind(fp);
 
-  map->numRows = numRows;
-  map->numCols = numCols;
-
-  // malloc grid and gameGrid
-  map->grid = malloc(numRows * sizeof(char*));
-  if (map->grid == NULL) {
+  MapTerrain_t* terrain = calloc(1, sizeof(MapTerrain_t));
+  if (terrain == NULL) {
     return NULL;
   }
-  map->gameGrid = malloc(numRows * sizeof(char*));
-  if (map->gameGrid == NULL) {
+  terrain->device = device;
+  terrain->inode = inode;
+  terrain->numRows = numRows;
+  terrain->numCols = numCols;
+
+  // calloc, so a partly filled grid can be freed
+  terrain->grid = calloc(numRows, sizeof(char*));
+  terrain->roomCells = malloc(numRows * numCols * sizeof(int));
+  if (terrain->grid == NULL || terrain->roomCells == NULL) {
+    free(terrain->grid);
+    free(terrain->roomCells);
+    free(terrain);
     return NULL;
   }
 
   for (int row = 0; row < numRows; row++) {
     char* line = file_readLine(fp);
-    map->grid[row] = malloc(numCols * sizeof(char));
-    if (map->grid[row] == NULL) {
-      break;
-    }
-    map->gameGrid[row] = malloc(numCols * sizeof(char));
-    if (map->gameGrid[row] == NULL) {
-      break;
+    terrain->grid[row] = malloc(numCols * sizeof(char));
+    if (terrain->grid[row] == NULL) {
+      free(line);
+      deleteGrid(terrain->grid, numRows);
+      free(terrain->roomCells);
+      free(terrain);
+      return NULL;
     }
 
+    // rows shorter than the first are padded with solid rock
+    int length = (line == NULL) ? 0 : strlen(line);
     for (int col = 0; col < numCols; col++) {
-      // when loading a file, grid and gameGrid are the same
-      // after the game starts, only gameGrid stores the players and gold
-      map->grid[row][col] = line[col];
-      map->gameGrid[row][col] = line[col];
+      terrain->grid[row][col] = (col < length) ? line[col] : ' ';
+      if (terrain->grid[row][col] == '.') {
+        terrain->roomCells[terrain->numRoomCells++] = row * numCols + col;
+      }
     }
     free(line);
   }
-  fclose(fp);
-  return map;
+
+  terrain->next = loadedTerrains;
+  loadedTerrains = terrain;
+  return terrain;
+}
+
+/*
+ * Helper function: drop a reference to a terrain, freeing it (and
+ * taking it out of loadedTerrains) when it was the last
+ */
+static void releaseTerrain(MapTerrain_t* terrain)
+{
+  if (--terrain->refs > 0) {
+    return;
+  }
+  for (MapTerrain_t** link = &loadedTerrains; *link != NULL; link = &(*link)->next) {
+    if (*link == terrain) {
+      *link = terrain->next;
+      break;
+    }
+  }
+
+  deleteGrid(terrain->grid, terrain->numRows);
+  free(terrain->roomCells);
+  if (terrain->distanceFields != NULL) {
+    for (int i = 0; i < DistanceCacheSize; i++) {
+      free(terrain->distanceFields[i]);
+    }
+  }
+  free(terrain->distanceFields);
+  free(terrain->fieldTargets);
+  free(terrain);
 }
 
 void deleteGameMap(GameMap_t* map)
@@ -172,11 +350,51 @@ void deleteGameMap(GameMap_t* map)
     return;
   }
 
-  deleteGrid(map->grid, map->numRows);
-  deleteGrid(map->gameGrid, map->numRows);
+  deleteFrameGrid(map->gameGrid);
+  free(map->occupants);
+  releaseTerrain(map->terrain);
   free(map);
 }
 
+char** newFrameGrid(int numRows, int numCols, char fill)
+{
+  char** grid = malloc(numRows * sizeof(char*));
+  if (grid == NULL) {
+    return NULL;
+  }
+  // header, then every row back to back, then '\0' so it is also a string
+  char* frame = malloc(FrameHeaderLength + numRows * numCols + 1);
+  if (frame == NULL) {
+    free(grid);
+    return NULL;
+  }
+  memcpy(frame, FrameHeader, FrameHeaderLength);
+  memset(frame + FrameHeaderLength, fill, numRows * numCols);
+  frame[FrameHeaderLength + numRows * numCols] = '\0';
+
+  for (int row = 0; row < numRows; row++) {
+    grid[row] = frame + FrameHeaderLength + row * numCols;
+  }
+  return grid;
+}
+
+const char* getFrame(char** grid)
+{
+  if (grid == NULL) {
+    return NULL;
+  }
+  return grid[0] - FrameHeaderLength;
+}
+
+void deleteFrameGrid(char** grid)
+{
+  if (grid == NULL) {
+    return;
+  }
+  free(grid[0] - FrameHeaderLength);
+  free(grid);
+}
+
 void deleteGrid(char** grid, int numRows)
 {
   if (grid == NULL) {
@@ -217,7 +435,7 @@ int** getVisibleRegion(GameMap_t* map, int row, int col)
   int idx = 0; // start filling in later visible cells from 1
   int found = 1; // visible cells found in the previous checkSquare call
   // expand radius to check until no new visible cells are found
-  for (int radius = 1; radius <= sightRadius && found > 0; radius++) {
+  for (int radius = 1; radius <= SightRadius && found > 0; radius++) {
     // check square around (row, col) of `radius`
     found = checkSquare(map, visibleRegion, idx, row, col, radius);
     // checkSquare returns -1 on memory allocation error
@@ -364,9 +582,9 @@ int** getRoomCells(GameMap_t* map)
     return NULL;
   }
 
-  // at most map size x 2 if every cell is room cell, +1 for (-1, -1)
+  // at most one per terrain room cell, +1 for (-1, -1)
   // to mark the end of the array
-  int totalLength = map->numRows * map->numCols + 1;
+  int totalLength = map->terrain->numRoomCells + 1;
   int** res = malloc(totalLength * sizeof(int*));
   if (res == NULL) {
     return NULL;
@@ -374,19 +592,20 @@ int** getRoomCells(GameMap_t* map)
 
   int idx = 0;
 
-  // loop through the room
-  for (int row = 0; row < map->numRows; row++) {
-    for (int col = 0; col < map->numCols; col++) {
-      if (map->gameGrid[row][col] == '.') {
-        // each row has two ints for (row, col)
-        res[idx] = malloc(2 * sizeof(int));
-        if (res[idx] == NULL) {
-          delete2DIntArr(res, totalLength);
-          return NULL;
-        }
-        res[idx][0] = row;
-        res[idx++][1] = col;
+  // only terrain room cells can be room cells in the game
+  MapTerrain_t* terrain = map->terrain;
+  for (int i = 0; i < terrain->numRoomCells; i++) {
+    int row = terrain->roomCells[i] / map->numCols;
+    int col = terrain->roomCells[i] % map->numCols;
+    if (map->gameGrid[row][col] == '.') {
+      // each row has two ints for (row, col)
+      res[idx] = malloc(2 * sizeof(int));
+      if (res[idx] == NULL) {
+        delete2DIntArr(res, totalLength);
+        return NULL;
       }
+      res[idx][0] = row;
+      res[idx++][1] = col;
     }
   }
   res[idx] = malloc(2 * sizeof(int));
@@ -399,6 +618,70 @@ int** getRoomCells(GameMap_t* map)
   return res;
 }
 
+const int* getDistanceField(GameMap_t* map, int row, int col)
+{
+  if (map == NULL || outOfMap(map, row, col) || !isWalkable(map, row, col)) {
+    return NULL;
+  }
+  int target = row * map->numCols + col;
+  MapTerrain_t* terrain = map->terrain; // every game on the map shares the cache
+
+  // set up the cache on first use
+  if (terrain->distanceFields == NULL) {
+    terrain->distanceFields = calloc(DistanceCacheSize, sizeof(int*));
+    terrain->fieldTargets = malloc(DistanceCacheSize * sizeof(int));
+    if (terrain->distanceFields == NULL || terrain->fieldTargets == NULL) {
+      free(terrain->distanceFields);
+      free(terrain->fieldTargets);
+      terrain->distanceFields = NULL;
+      terrain->fieldTargets = NULL;
+      return NULL;
+    }
+    for (int i = 0; i < DistanceCacheSize; i++) {
+      terrain->fieldTargets[i] = -1;
+    }
+  }
+
+  // the terrain never changes, so a cached field stays good
+  for (int i = 0; i < DistanceCacheSize; i++) {
+    if (terrain->fieldTargets[i] == target) {
+      return terrain->distanceFields[i];
+    }
+  }
+
+  // otherwise compute it in place of the oldest
+  int slot = terrain->nextField;
+  if (terrain->distanceFields[slot] == NULL) {
+    terrain->distanceFields[slot] = malloc(map->numRows * map->numCols * sizeof(int));
+    if (terrain->distanceFields[slot] == NULL) {
+      return NULL;
+    }
+  }
+  terrain->fieldTargets[slot] = -1; // not cached unless the fill succeeds
+  if (!fillDistanceField(map, terrain->distanceFields[slot], target)) {
+    return NULL;
+  }
+  terrain->fieldTargets[slot] = target;
+  terrain->nextField = (slot + 1) % DistanceCacheSize;
+  return terrain->distanceFields[slot];
+}
+
+int* newDistanceField(GameMap_t* map, int row, int col)
+{
+  if (map == NULL || outOfMap(map, row, col) || !isWalkable(map, row, col)) {
+    return NULL;
+  }
+  int* field = malloc(map->numRows * map->numCols * sizeof(int));
+  if (field == NULL) {
+    return NULL;
+  }
+  if (!fillDistanceField(map, field, row * map->numCols + col)) {
+    free(field);
+    return NULL;
+  }
+  return field;
+}
+
 void delete2DIntArr(int** arr, int numRows)
 {
   if (arr == NULL) {
@@ -449,6 +732,56 @@ bool outOfMap(GameMap_t* map, int row, int col)
   return (row < 0 || row >= map->numRows || col < 0 || col >= map->numCols);
 }
 
+/*
+ * Helper function: can a player stand on a cell (room or passage)?
+ */
+static bool isWalkable(GameMap_t* map, int row, int col)
+{
+  char terrain = map->grid[row][col];
+  return terrain == '.' || terrain == '#';
+}
+
+/*
+ * Helper function: breadth-first search out from the target cell over
+ * walkable cells, taking the same eight steps a player can, writing each
+ * cell's number of steps from the target (-1 if it cannot be reached);
+ * false if there is no memory for the search, and the field is no good
+ */
+static bool fillDistanceField(GameMap_t* map, int* field, int target)
+{
+  int size = map->numRows * map->numCols;
+  for (int i = 0; i < size; i++) {
+    field[i] = -1;
+  }
+
+  // every cell is queued at most once
+  int* queue = malloc(size * sizeof(int));
+  if (queue == NULL) {
+    return false;
+  }
+  int head = 0, tail = 0;
+  field[target] = 0;
+  queue[tail++] = target;
+
+  while (head < tail) {
+    int cell = queue[head++];
+    int row = cell / map->numCols, col = cell % map->numCols;
+    for (int i = 0; i < 8; i++) {
+      int nextRow = row + stepDr[i], nextCol = col + stepDc[i];
+      if (outOfMap(map, nextRow, nextCol) || !isWalkable(map, nextRow, nextCol)) {
+        continue;
+      }
+      int next = nextRow * map->numCols + nextCol;
+      if (field[next] == -1) {
+        field[next] = field[cell] + 1;
+        queue[tail++] = next;
+      }
+    }
+  }
+  free(queue);
+  return true;
+}
+
 bool isWall(char type)
 {
   return (type == '|' || type == '-' || type == '+' || type == ' ');
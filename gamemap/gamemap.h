@@ -17,12 +17,33 @@
 /* Local types */
 typedef struct GameMap GameMap_t;
 
+// players can only see up to SightRadius units away, with diagonals
+// counting as 1 unit (such that a visible cell is at most
+// SightRadius cells away in either direction)
+#define SightRadius 5
+
 // Getters and setters
 int getNumRows(GameMap_t* map);
 int getNumCols(GameMap_t* map);
+// the terrain, shared with every map loaded from the same file: do not modify
 char** getGrid(GameMap_t* map);
 char** getGameGrid(GameMap_t* map);
 
+/*
+ * The spectator view as a complete DISPLAY message, ready to send.
+ * It is the same memory as getGameGrid, so it is always up to date.
+ *
+ * Returns:
+ *   the message, of getFrameLength(map) bytes (plus a terminating '\0')
+ *   NULL if map is NULL
+ */
+const char* getGameFrame(GameMap_t* map);
+
+/*
+ * Length in bytes of a DISPLAY message for a grid the size of the map
+ */
+int getFrameLength(GameMap_t* map);
+
 /*
  * Get the type of cell at a coordinate
  *
@@ -51,7 +72,8 @@ char getCellType(GameMap_t* map, int row, int col);
 char getCellTerrain(GameMap_t* map, int row, int col);
 
 /*
- * Set the type of cell at a coordinate
+ * Set the type of cell at a coordinate (not for players: see
+ * setCellOccupant); the cell no longer has a player on it
  *
  * Inputs:
  *   map to update
@@ -60,9 +82,36 @@ char getCellTerrain(GameMap_t* map, int row, int col);
  */
 void setCellType(GameMap_t* map, char type, int row, int col);
 
+/*
+ * Get the ID of the player on a cell. Players are kept by ID, apart
+ * from the letter they are drawn as in the gameGrid, since many players
+ * can share a letter.
+ *
+ * Inputs:
+ *   map to look in
+ *   row, col: coordinates of target cell
+ *
+ * Returns:
+ *   the player's ID (0 or more)
+ *   -1 if no player is there, or (row, col) is not in the map
+ */
+int getCellOccupant(GameMap_t* map, int row, int col);
+
+/*
+ * Put a player on a cell: its ID in the occupants, and glyph, the
+ * letter it is drawn as, in the gameGrid
+ *
+ * Inputs:
+ *   map to update
+ *   id: the player's ID (0 or more)
+ *   glyph: the player's letter
+ *   row, col: coordinates of target cell
+ */
+void setCellOccupant(GameMap_t* map, int id, char glyph, int row, int col);
+
 /*
  * (For use after a player moves from a cell)
- * Restore a cell type to the map terrain at the cell
+ * Restore a cell type to the map terrain at the cell, with no player
  *
  * Inputs:
  *   map to update
@@ -70,8 +119,23 @@ void setCellType(GameMap_t* map, char type, int row, int col);
  */
 void restoreCell(GameMap_t* map, int row, int col);
 
+/*
+ * (For use between rounds)
+ * Restore every cell to the map terrain, clearing players and gold,
+ * as loadMapFile left it; cached distance fields stay valid
+ *
+ * Inputs:
+ *   map to reset
+ */
+void resetGameGrid(GameMap_t* map);
+
 /*
  * Loads a map file into a GameMap_t
+ *
+ * The terrain (and what is worked out from it, like distance fields)
+ * never changes, so it is read once and shared, counting references,
+ * by every GameMap_t loaded from the same file (by any path) while one
+ * is still around; each GameMap_t only has its own gameGrid.
  * 
  * Inputs:
  *   mapFilePath: path to file to load
@@ -80,12 +144,13 @@ void restoreCell(GameMap_t* map, int row, int col);
  *   an initialized GameMap_t*
  *   NULL if errors reading mapFilePath or allocating memory
  * 
- * Caller needs to later GameMap_t_delete the returned pointer
+ * Caller needs to later deleteGameMap the returned pointer
  */
 GameMap_t* loadMapFile(char* mapFilePath);
 
 /*
  * Frees all memory allocated for a GameMap_t
+ * (the terrain only once no other GameMap_t shares it)
  *
  * Inputs:
  *   map: the GameMap_t to delete 
@@ -101,6 +166,36 @@ void deleteGameMap(GameMap_t* map);
  */
 void deleteGrid(char** grid, int numRows);
 
+/*
+ * Frame grids: a grid whose rows sit end to end in one buffer, just
+ * after the DISPLAY message header. Writing to the grid updates the
+ * message in place, so it can be sent without encoding or copying.
+ */
+#define FrameHeader "DISPLAY\n"
+#define FrameHeaderLength 8
+
+/*
+ * Allocate a frame grid with every cell set to `fill`
+ *
+ * Returns:
+ *   the grid, indexed grid[row][col] like any other grid
+ *   NULL if memory allocation error
+ *
+ * Caller needs to later call deleteFrameGrid on the returned pointer
+ */
+char** newFrameGrid(int numRows, int numCols, char fill);
+
+/*
+ * The DISPLAY message a frame grid lives in (see getFrameLength)
+ * Only valid for grids made by newFrameGrid
+ */
+const char* getFrame(char** grid);
+
+/*
+ * Frees all memory allocated for a frame grid
+ */
+void deleteFrameGrid(char** grid);
+
 /*
  * For a given coordinate, get a boolean version of the map.
  * true means visible, false means not visible
@@ -160,6 +255,43 @@ int** getVisibleRegion(GameMap_t* map, int row, int col);
  */
 int** getRoomCells(GameMap_t* map);
 
+/*
+ * Get the distance field toward a cell: for every cell, the fewest
+ * steps (any of the eight directions, over room and passage cells) it
+ * takes to reach the target, or -1 if it cannot be reached. Players and
+ * gold are not obstacles; only the terrain counts.
+ *
+ * The most recently used fields are cached with the terrain, since it
+ * never changes, so every map loaded from the same file shares them;
+ * asking again for the same target is free.
+ *
+ * Inputs:
+ *   map: GameMap_t*
+ *   row, col: coordinates of the target cell
+ * 
+ * Returns:
+ *   numRows * numCols ints, indexed [row * numCols + col]
+ *   NULL if map is NULL, the target is not a room or passage cell,
+ *   or memory allocation error
+ * 
+ * The field belongs to the terrain and stays valid until the next call
+ * on any map sharing it; do not free it.
+ */
+const int* getDistanceField(GameMap_t* map, int row, int col);
+
+/*
+ * Compute a distance field as getDistanceField does, but without caching
+ * it: for a search from a cell unlikely to be asked about again, such as
+ * wherever a player stands, so it does not push a useful field out.
+ *
+ * Returns:
+ *   numRows * numCols ints, indexed [row * numCols + col]
+ *   NULL as for getDistanceField
+ *
+ * Caller needs to later free the returned pointer
+ */
+int* newDistanceField(GameMap_t* map, int row, int col);
+
 /*
  * Equivalent of deleteGrid, but for a 2d int array.
  * Helper function to free the 2d array returned by getRoomCells
@@ -0,0 +1,361 @@
+/*
+ * Relay - re-broadcasts one 'nuggets' server's spectator stream
+ * to any number of spectator clients.
+ *
+ * The relay joins the server as a single spectator, caches the
+ * latest frame as a keyframe for late joiners, and forwards
+ * everything else to its own audience with batched sends.
+ *
+ * CS 50, Winter 2024
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "../support/message.h"
+#include "../support/log.h"
+
+static const int LogTruncate = 200;    // bytes of a string kept in the --log file
+
+/****************** local types *********************/
+typedef struct relay {
+  addr_t server;          // the game server we watch
+  char* gridMessage;      // cached "GRID r c"; NULL until it arrives
+  char* keyframe;         // cached latest "DISPLAY\n..."; NULL until it arrives
+  int goldRemaining;      // latest gold-remaining count seen in the stream
+  addr_t* audience;       // greeted spectators, who get every message
+  int numAudience;
+  int audienceCapacity;
+  addr_t* waiting;        // spectators who joined before the first keyframe
+  int numWaiting;
+  int waitingCapacity;
+} relay_t;
+
+//function prototypes
+static bool handleMessage(void* arg, const addr_t from, const char* message);
+static bool handleServerMessage(relay_t* relay, const char* message);
+static void spectatorJoin(relay_t* relay, addr_t address);
+static void spectatorQuit(relay_t* relay, addr_t address);
+static void greet(relay_t* relay, addr_t address);
+static void greetWaiting(relay_t* relay);
+static void nextRound(relay_t* relay);
+static bool addAddress(addr_t** list, int* count, int* capacity, addr_t address);
+static bool removeAddress(addr_t* list, int* count, addr_t address);
+static int findAddress(addr_t* list, int count, addr_t address);
+static char* copyString(const char* string);
+static void cleanUpRelay(relay_t* relay);
+
+int
+main(int argc, char* argv[])
+{
+  // check arguments: [--log FILE] [--log-level N] hostname port
+  const char* program = argv[0];
+  char* logName = NULL;
+  int logLevel = LOG_INFO;
+  int arg = 1;
+  while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+    char extra;
+    if (strcmp(argv[arg], "--log") == 0 && arg + 1 < argc) {
+      logName = argv[arg+1];
+      arg += 2;
+    } else if (strcmp(argv[arg], "--log-level") == 0 && arg + 1 < argc
+               && sscanf(argv[arg+1], "%d%c", &logLevel, &extra) == 1
+               && logLevel >= LOG_ERROR && logLevel <= LOG_TRACE) {
+      arg += 2;
+    } else {
+      break;
+    }
+  }
+  if (argc - arg != 2) {
+    fprintf(stderr, "usage: %s [--log FILE] [--log-level N] hostname port\n", program);
+    return 3; // bad commandline
+  }
+  const char* serverHost = argv[arg];
+  const char* serverPort = argv[arg+1];
+
+  // with --log, the message module logs into the file through a
+  // background thread (see log_async)
+  FILE* logOut = NULL;
+  if (logName != NULL) {
+    if ((logOut = fopen(logName, "a")) == NULL) {
+      fprintf(stderr, "Could not open %s for logging\n", logName);
+      return 3; // bad commandline
+    }
+    log_setLevel(logLevel);
+    if (!log_async(LogTruncate)) {
+      fprintf(stderr, "Could not start the log writer; logging as it happens\n");
+    }
+  }
+
+  // initialize the message module (logging only with --log), sharing
+  // memory with a server, or an audience, on this host
+  int myPort = message_initShared(logOut, 0);
+  if (myPort == 0) {
+    return 2; // failure to initialize message module
+  }
+
+  relay_t relay = { .gridMessage = NULL, .keyframe = NULL, .goldRemaining = 0,
+                    .audience = NULL, .numAudience = 0, .audienceCapacity = 0,
+                    .waiting = NULL, .numWaiting = 0, .waitingCapacity = 0 };
+  if (!message_setAddr(serverHost, serverPort, &relay.server)) {
+    fprintf(stderr, "can't form address from %s %s\n", serverHost, serverPort);
+    message_done();
+    return 4; // bad hostname/port
+  }
+  printf("relayPort=%d\n", myPort);
+  fflush(stdout);
+
+  // subscribe to the server's spectator stream
+  message_send(relay.server, "SPECTATE");
+
+  // Loop, waiting for messages; the loop ends when the server quits
+  bool ok = message_loop(&relay, 0, NULL, NULL, handleMessage);
+
+  cleanUpRelay(&relay);
+  message_done();
+  if (logOut != NULL) {
+    log_syncDone();   // the writer is done with the file
+    fclose(logOut);
+  }
+
+  return ok? 0 : 1; // status code depends on result of message_loop
+}
+
+/*
+ * Handles messages from the server and from our spectators
+ */
+static bool
+handleMessage(void* arg, const addr_t from, const char* message)
+{
+  relay_t* relay = arg;
+
+  if (message_eqAddr(from, relay->server)) {
+    return handleServerMessage(relay, message);
+  }
+
+  // a spectator's offer of binary messages, on a second line, is turned down by answering in text
+  if (strncmp(message, "SPECTATE", 8) == 0 && (message[8] == '\0' || message[8] == '\n')) {
+    spectatorJoin(relay, from);
+  } else if (strcmp(message, "KEY Q") == 0 || strcmp(message, "KEY q") == 0) {
+    spectatorQuit(relay, from);
+  }
+  //anything else from a spectator is ignored; spectators can only quit
+  return false;
+}
+
+/*
+ * Updates the cache from one server message and forwards it
+ * Returns true when the server has ended the game
+ */
+static bool
+handleServerMessage(relay_t* relay, const char* message)
+{
+  int remaining;
+
+  if (strncmp(message, "OK ", 3) == 0) {
+    return false; //addressed to the relay itself
+  } else if (strncmp(message, "GRID ", 5) == 0) {
+    free(relay->gridMessage);
+    relay->gridMessage = copyString(message);
+    return false; //spectators get it when they are greeted
+  } else if (sscanf(message, "GOLD_REMAINING %d", &remaining) == 1) {
+    relay->goldRemaining = remaining;
+    return false; //spectators get it when they are greeted
+  } else if (strncmp(message, "DISPLAY\n", 8) == 0) {
+    //the bundle being built may still refer to the old keyframe
+    message_flush();
+    free(relay->keyframe);
+    relay->keyframe = copyString(message);
+    if (relay->keyframe == NULL) {
+      return false;
+    }
+    //forward before greeting newcomers, who get the keyframe in their greeting
+    message_sendFrame(relay->audience, relay->numAudience,
+                      relay->keyframe, strlen(relay->keyframe));
+    greetWaiting(relay);
+    return false;
+  } else if (sscanf(message, "SPECTATOR_GOLD %*c %*d %*d %d", &remaining) == 1
+             || sscanf(message, "STOLEN %*c %*c %*d %*d %d", &remaining) == 1) {
+    relay->goldRemaining = remaining;
+  } else if (strncmp(message, "QUIT ", 5) == 0) {
+    message_sendBatch(relay->audience, relay->numAudience, message);
+    relay->numAudience = 0;
+    return true; //the game is over
+  } else if (strncmp(message, "ROUND ", 6) == 0) {
+    //a persistent server starts the next round: the audience sees the
+    //summary, then waits to be greeted again with its GRID, gold and keyframe
+    message_sendBatch(relay->audience, relay->numAudience, message);
+    nextRound(relay);
+    return false;
+  }
+
+  message_sendBatch(relay->audience, relay->numAudience, message);
+  return false;
+}
+
+/*
+ * Adds a spectator; greets them now if we have a keyframe to show,
+ * otherwise as soon as one arrives
+ */
+static void
+spectatorJoin(relay_t* relay, addr_t address)
+{
+  if (relay->keyframe == NULL || relay->gridMessage == NULL) {
+    if (findAddress(relay->waiting, relay->numWaiting, address) < 0) {
+      addAddress(&relay->waiting, &relay->numWaiting, &relay->waitingCapacity, address);
+    }
+    return;
+  }
+  if (findAddress(relay->audience, relay->numAudience, address) < 0) {
+    if (!addAddress(&relay->audience, &relay->numAudience,
+                    &relay->audienceCapacity, address)) {
+      return;
+    }
+  }
+  greet(relay, address);
+}
+
+/*
+ * Removes a spectator and sends the quit message
+ */
+static void
+spectatorQuit(relay_t* relay, addr_t address)
+{
+  if (removeAddress(relay->audience, &relay->numAudience, address)
+      || removeAddress(relay->waiting, &relay->numWaiting, address)) {
+    message_send(address, "QUIT Thanks for watching!");
+  }
+}
+
+/*
+ * Sends a spectator the whole handshake, ending with the cached keyframe
+ */
+static void
+greet(relay_t* relay, addr_t address)
+{
+  char goldMessage[30];
+  sprintf(goldMessage, "GOLD_REMAINING %d", relay->goldRemaining);
+
+  message_send(address, "OK A");
+  message_send(address, relay->gridMessage);
+  message_send(address, goldMessage);
+  message_sendFrame(&address, 1, relay->keyframe, strlen(relay->keyframe));
+}
+
+/*
+ * Moves everyone waiting for the round's first keyframe into the audience
+ */
+static void
+greetWaiting(relay_t* relay)
+{
+  if (relay->gridMessage == NULL) {
+    return;
+  }
+  for (int i = 0; i < relay->numWaiting; i++) {
+    addr_t address = relay->waiting[i];
+    if (addAddress(&relay->audience, &relay->numAudience,
+                   &relay->audienceCapacity, address)) {
+      greet(relay, address);
+    }
+  }
+  relay->numWaiting = 0;
+}
+
+/*
+ * Forgets the round that ended: its keyframe is no use to anyone, and the
+ * audience goes back to waiting for the first keyframe of the next
+ */
+static void
+nextRound(relay_t* relay)
+{
+  //the bundle being built may still refer to the old keyframe
+  message_flush();
+  free(relay->keyframe);
+  relay->keyframe = NULL;
+  for (int i = 0; i < relay->numAudience; i++) {
+    if (findAddress(relay->waiting, relay->numWaiting, relay->audience[i]) < 0) {
+      addAddress(&relay->waiting, &relay->numWaiting, &relay->waitingCapacity,
+                 relay->audience[i]);
+    }
+  }
+  relay->numAudience = 0;
+}
+
+/*
+ * Appends an address to a growable list
+ * Returns false if out of memory
+ */
+static bool
+addAddress(addr_t** list, int* count, int* capacity, addr_t address)
+{
+  if (*count == *capacity) {
+    int newCapacity = (*capacity == 0) ? 16 : 2 * *capacity;
+    addr_t* newList = realloc(*list, newCapacity * sizeof(addr_t));
+    if (newList == NULL) {
+      fprintf(stderr, "Error growing spectator list\n");
+      return false;
+    }
+    *list = newList;
+    *capacity = newCapacity;
+  }
+  (*list)[(*count)++] = address;
+  return true;
+}
+
+/*
+ * Removes an address from a list, filling the hole with the last entry
+ * Returns true if it was there
+ */
+static bool
+removeAddress(addr_t* list, int* count, addr_t address)
+{
+  int index = findAddress(list, *count, address);
+  if (index < 0) {
+    return false;
+  }
+  list[index] = list[--(*count)];
+  return true;
+}
+
+/*
+ * Returns the index of an address in a list, or -1
+ */
+static int
+findAddress(addr_t* list, int count, addr_t address)
+{
+  for (int i = 0; i < count; i++) {
+    if (message_eqAddr(list[i], address)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Returns a malloc'd copy of a string, or NULL if out of memory
+ */
+static char*
+copyString(const char* string)
+{
+  char* copy = malloc(strlen(string) + 1);
+  if (copy == NULL) {
+    fprintf(stderr, "Error allocating memory for message\n");
+    return NULL;
+  }
+  strcpy(copy, string);
+  return copy;
+}
+
+/*
+ * Frees everything the relay allocated
+ */
+static void
+cleanUpRelay(relay_t* relay)
+{
+  free(relay->gridMessage);
+  free(relay->keyframe);
+  free(relay->audience);
+  free(relay->waiting);
+}
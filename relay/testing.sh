@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+# testing.sh - runs a relay in front of a persistent server for two rounds
+#
+# A player (support/miniclient) walks to the gold in sight with GOTO GOLD,
+# and runs about at random to find more, until two rounds are over; a
+# spectator (miniclient too) watches through the relay.
+# After each ROUND the spectator must be greeted again, with OK, GRID and
+# GOLD_REMAINING before the next DISPLAY, or a real client drops every
+# DISPLAY of the new round.
+#
+# usage: ./testing.sh    (from relay/, after make at the top; exit 0 if it passes)
+
+SERVER=../server/server
+MINICLIENT=../support/miniclient
+MAP=../maps/small.txt
+TMP=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$TMP"' EXIT
+
+# wait until a file has a line matching a pattern, or give up
+waitFor() {
+  for i in $(seq 50); do
+    grep -q "$2" "$1" 2>/dev/null && return 0
+    sleep 0.1
+  done
+  echo "FAIL: no '$2' in $1"
+  exit 1
+}
+
+stdbuf -oL $SERVER --persist $MAP 7 > "$TMP/server" 2>/dev/null &
+waitFor "$TMP/server" serverPort=
+serverPort=$(sed -n 's/serverPort=//p' "$TMP/server")
+
+./relay localhost "$serverPort" > "$TMP/relay" &
+waitFor "$TMP/relay" relayPort=
+relayPort=$(sed -n 's/relayPort=//p' "$TMP/relay")
+
+# the spectator joins the relay before the player joins the server
+mkfifo "$TMP/spectate"
+$MINICLIENT localhost "$relayPort" < "$TMP/spectate" > "$TMP/spectator" &
+exec 3> "$TMP/spectate"
+echo SPECTATE >&3
+
+# the player takes the gold, a pile at a time, until two rounds are over;
+# GOTO GOLD only goes to gold in sight, so it runs somewhere now and then
+RANDOM=7
+runs=(H J K L Y U B N)
+{
+  echo "PLAY bot"
+  for i in $(seq 1000); do
+    sleep 0.03
+    echo "GOTO GOLD"
+    [ $((i % 3)) -eq 0 ] && echo "KEY ${runs[RANDOM % 8]}"
+    [ "$(grep -c "^'ROUND" "$TMP/spectator")" -ge 2 ] && break
+  done
+  echo "KEY Q"
+} | $MINICLIENT localhost "$serverPort" > /dev/null
+waitFor "$TMP/spectator" "^'DISPLAY"
+sleep 0.5
+echo "KEY Q" >&3
+
+# after each ROUND: OK, GRID and GOLD_REMAINING, then a DISPLAY
+awk '
+  /^'"'"'ROUND/          { rounds++; state = "round"; next }
+  state == "round" && /^'"'"'OK /            { state = "ok"; next }
+  state == "ok"    && /^'"'"'GRID /          { state = "grid"; next }
+  state == "grid"  && /^'"'"'GOLD_REMAINING / { state = "gold"; next }
+  state == "gold"  && /^'"'"'DISPLAY/        { greeted++; state = ""; next }
+  state != "" && /^'"'"'DISPLAY/              { early++ }
+  END {
+    printf "rounds %d, greeted again %d, displays before the greeting %d\n", rounds, greeted, early
+    exit !(rounds >= 2 && greeted >= 2 && early == 0)
+  }' "$TMP/spectator"
+status=$?
+[ $status -eq 0 ] && echo "relay across rounds: passed" || echo "relay across rounds: FAILED"
+exit $status
@@ -0,0 +1,2388 @@
+/*
+ * Game core - the rules of the 'nuggets' game: players joining,
+ * moving, collecting and stealing gold, and spectators watching.
+ * Everything about a game lives in its game_t, and every message goes
+ * out through its sink, so any number of games can run side by side,
+ * over the network or in memory; see gamecore.h
+ *
+ * Author: Jaysen Quan, Dartmouth CS 50, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime, mmap and ftruncate
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../support/message.h"
+#include "../support/wire.h"
+#include "../gamemap/gamemap.h"
+#include "player/player.h"
+#include "gamecore.h"
+
+static const int MaxPlayers = 500;     // maximum number of players (IDs 0 to 499)
+static const int IndexSize = 1024;     // slots in the address index; a power of two, over 2 * MaxPlayers
+static const int BucketSize = 2 * SightRadius + 1; // side of a square of the map players are kept by
+static const int GoldTotal = 250;      // amount of gold in the game
+static const int GoldMinNumPiles = 10; // minimum number of gold piles
+static const int GoldMaxNumPiles = 30; // maximum number of gold piles
+static const int MaxKeyRepeat = 100;   // most steps one "KEY k count" may ask for
+static const int SnapshotVersion = 5;  // layout of snapshot files written
+static const int SnapshotSpectators = 64; // most spectators a snapshot remembers
+static const int SnapshotPlayerRoom = 8;  // players' maps a new snapshot has room for
+static const size_t SnapshotMaxBytes = SIZE_MAX / 2; // so a size is an off_t too
+static const char SnapshotMagic[8] = "NUGSNAP"; // starts every snapshot file
+static const unsigned char BothSlots = 3; // dirty marks: bit s for snapshot slot s
+static const int TerrainMessageSize = 1024; // most bytes in one TERRAIN message
+static const int TerrainMaxRun = 256;  // most cells in one run of a TERRAIN message
+static const int ViewMessageSize = 64 + 16 * BucketSize * BucketSize; // room for any VIEW
+
+/****************** local types *********************/
+typedef struct goldPile {
+  int row;
+  int col;
+  int amount;
+} goldPile_t;
+
+// what the game keeps for each player ID, to find players fast
+typedef struct playerSlot {
+  int bucket;                  // square of the map the player is in; -1 if not active
+  int next, prev;              // other players in that square, -1 at the ends
+  int activeSlot;              // place in the game's active list; -1 if not active
+  unsigned int displayPass;    // last pass of updateNearbyVision to send them a display
+  int dirtyFirst[2], dirtyLast[2]; // rows of their map (and their record) snapshot
+                               // slot s lacks; none if dirtyFirst[s] > dirtyLast[s]
+} playerSlot_t;
+
+struct game {
+  int currentNumPlayers;
+  int numGoldPiles;
+  int goldRemaining;
+  player_t** players;          // by ID: a player's ID is its index
+  playerSlot_t* slots;         // by ID, MaxPlayers of them
+  int* index;                  // player IDs by address (hashed, open addressing), -1 if empty
+  int* active;                 // IDs of the active players, in no particular order
+  int numActive;
+  int* buckets;                // first player ID in each BucketSize square, -1 if none
+  int bucketCapacity;          // allocated length of buckets, for the rotation's largest map
+  int* touched;                // cells (row * numCols + col) changed since the last displays
+  int numTouched;
+  int touchedCapacity;         // allocated length of touched
+  bool touchedAll;             // more than touched could hold: everyone gets a display
+  unsigned int displayPass;    // passes of updateNearbyVision so far
+  goldPile_t* goldPiles;       // room for GoldMaxNumPiles, reused every round
+  GameMap_t* map;              // the map of this round, one of maps
+  GameMap_t** maps;            // the rotation, all loaded up front
+  int numMaps;
+  int round;                   // rounds started, so this one is maps[(round - 1) % numMaps]
+  bool persistent;             // start a new round when one ends?
+  addr_t* spectators;          // everyone watching, in no particular order
+  bool* spectatorBinary;       // by place in spectators: takes binary framing?
+  int numSpectators;
+  int spectatorCapacity;       // allocated length of spectators and spectatorBinary
+  float spectatorInterval;     // least seconds between spectator frames; 0 = no cap
+  bool spectatorFramePending;  // has the game changed since the last frame?
+  struct timespec lastSpectatorFrame;
+  bool over;                   // all gold collected and the summary sent
+  gameSink_t sink;             // where every message goes
+  char* snapshot;              // the mmap'd snapshot file, NULL if none
+  size_t snapshotSize;
+  int snapshotFd;              // the file, kept open to grow it; -1 if none
+  bool snapshotDirty;          // any message since the last checkpoint?
+  unsigned char* dirtyRows;    // by gameGrid row: bit s if snapshot slot s lacks it
+  int dirtyRowCapacity;        // allocated length of dirtyRows, for the largest map
+};
+
+/*
+ * A snapshot file: a header, then two slots, each with room for the
+ * game on the largest map of the rotation, then the players' maps.
+ * A checkpoint goes to the slot not holding the last one, and only then
+ * is `current` turned to it, so a crash partway leaves the last
+ * checkpoint whole. Each slot is laid out as (see snapshotSlot)
+ *   snapshotGame_t
+ *   snapshotPlayer_t[MaxPlayers]
+ *   addr_t[SnapshotSpectators]
+ *   goldPile_t[GoldMaxNumPiles]
+ *   char gameGrid[maxCells]
+ * and after both come playerRoom pairs of maps, char[2][maxCells]: player
+ * i's map in slot 0, then in slot 1. The grids are numRows * numCols, row
+ * after row. The file starts with room for SnapshotPlayerRoom players'
+ * maps and doubles it as more join (see growSnapshot); nothing in it
+ * moves, so growing leaves the last checkpoint as it was.
+ */
+typedef struct snapshotHeader {
+  char magic[8];
+  int version;
+  int port;                    // the server's, to listen on again
+  int numMaps;                 // of the rotation, to check a resume by
+  int current;                 // slot of the last checkpoint; -1 if none yet
+  size_t maxCells;             // numRows * numCols of the largest map
+  size_t slotSize;             // bytes in each slot
+  int playerRoom;              // players the file has room for the maps of
+} snapshotHeader_t;
+
+typedef struct snapshotGame {
+  long generation;             // checkpoints before this one
+  int round;
+  int numRows, numCols;
+  int numGoldPiles;
+  int goldRemaining;
+  int currentNumPlayers;
+  int numSpectators;           // at most SnapshotSpectators kept
+  bool over;
+} snapshotGame_t;
+
+// players are kept in ID order, so the ID is the place in the slot
+typedef struct snapshotPlayer {
+  bool active;
+  bool binary;                 // does the client take binary framing?
+  bool overlay;                // does the client build its display (TERRAIN and VIEW)?
+  int gold;
+  int row, col;
+  char name[30];
+  addr_t address;
+  unsigned long long session;
+} snapshotPlayer_t;
+
+// where each part of one slot of the snapshot is
+typedef struct snapshotSlot {
+  snapshotGame_t* game;
+  snapshotPlayer_t* players;
+  addr_t* spectators;
+  goldPile_t* goldPiles;
+  char* gameGrid;
+  char* playerMaps;            // player i's map at 2 * i * maxCells
+} snapshotSlot_t;
+
+//function prototypes
+static void updateSpectatorDisplay(game_t* game);
+static void sendSpectatorFrame(game_t* game);
+static void sendToSpectators(game_t* game, const char* message);
+static void sendFields(game_t* game, addr_t to, bool binary, wireOp_t op,
+                       const long long fields[]);
+static void sendFieldsToSpectators(game_t* game, wireOp_t op, const long long fields[]);
+static void keyCommand(game_t* game, addr_t from, char key, int count, int seq);
+static void gotoCommand(game_t* game, addr_t from, int row, int col);
+static void binaryKey(game_t* game, addr_t from, const long long fields[]);
+static void binaryGoto(game_t* game, addr_t from, const long long fields[]);
+static bool distributeGold(game_t* game);
+static void startRound(game_t* game);
+static bool randomRoomCell(game_t* game, int* row, int* col);
+static void sendStartingGold(game_t* game, addr_t address, bool binary);
+static void collectGold(game_t* game, player_t* player);
+static void sendGoldUpdate(game_t* game, player_t* player, int pileAmount);
+static void spawnGold(game_t* game, int rol, int col);
+static void spawnPlayer(game_t* game, player_t* player, int row, int col);
+static void callCommand(game_t* game, player_t* player, char key, int count);
+static int moveOnce(game_t* game, player_t* player, char direction, player_t** victim);
+static void afterStep(game_t* game, player_t* player, int atGold, player_t* victim);
+static void gotoCell(game_t* game, player_t* player, int row, int col);
+static void gotoNearestGold(game_t* game, player_t* player);
+static void sendGrid(game_t* game, addr_t address, bool binary);
+static void sendDisplay(game_t* game, player_t* player);
+static void sendTerrain(game_t* game, player_t* player);
+static void sendView(game_t* game, player_t* player);
+static char** initializePlayerMap(game_t* game, int row, int col, char** grid);
+static void updateCurrentPlayerVision(game_t* game);
+static void updateNearbyVision(game_t* game);
+static void touchCell(game_t* game, int row, int col);
+static void markPlayerDirty(game_t* game, player_t* player, int firstRow, int lastRow);
+static void markAllDirty(game_t* game);
+static void spectatorJoin(game_t* game, addr_t address, bool binary);
+static int findSpectator(game_t* game, addr_t address);
+static player_t* playerJoin(game_t* game, addr_t address, char* name);
+static player_t* checkPlayerJoined(game_t* game, addr_t address);
+static void indexPlayer(game_t* game, player_t* player);
+static void activatePlayer(game_t* game, player_t* player);
+static void deactivatePlayer(game_t* game, player_t* player);
+static void placeInBucket(game_t* game, player_t* player);
+static void removeFromBucket(game_t* game, int id);
+static int bucketColumns(game_t* game);
+static void clearPlayerLookups(game_t* game);
+static void rebuildPlayerLookups(game_t* game);
+static void playerQuit(game_t* game, player_t* player);
+static void spectatorQuit(game_t* game, int index);
+static void sendGameSummary(game_t* game);
+static unsigned long long newSession(void);
+static void resumeSession(game_t* game, addr_t address, unsigned long long session,
+                          const char* offers);
+static void takeOffers(player_t* player, const char* offers);
+static void sendPlayerStart(game_t* game, player_t* player);
+static size_t snapshotMaxCells(game_t* game);
+static size_t snapshotSlotSize(size_t maxCells);
+static bool snapshotFileSize(size_t maxCells, int playerRoom, size_t* size);
+static bool growSnapshot(game_t* game, int numPlayers);
+static snapshotSlot_t snapshotSlot(game_t* game, int slot);
+static bool snapshotPlacesValid(GameMap_t* map, snapshotSlot_t from);
+static void detachSnapshot(game_t* game);
+static void copyChanged(char* to, const char* from, size_t length);
+
+// the client commands that have a binary form, by opcode (see wire.h)
+static void (*const binaryCommands[wire_NumOps])(game_t* game, addr_t from,
+                                                 const long long fields[]) = {
+  [WIRE_KEY] = binaryKey,
+  [WIRE_GOTO] = binaryGoto,
+};
+
+/*
+ * Initialize the main elements of the game; see gamecore.h
+ */
+game_t*
+game_new(char* mapFile, float spectatorFps, gameSink_t sink)
+{
+  if (mapFile == NULL) {
+    fprintf(stderr, "mapFile is NULL\n");
+    return NULL;
+  }
+  game_t* game = malloc(sizeof(game_t));
+  if (game == NULL) {
+    fprintf(stderr, "Error allocating memory for game\n");
+    return NULL;
+  }
+  game->sink = sink;
+  game->snapshot = NULL;
+  game->snapshotSize = 0;
+  game->snapshotFd = -1;
+  game->snapshotDirty = false;
+  game->dirtyRows = NULL;
+  game->dirtyRowCapacity = 0;
+  game->players = NULL;
+  game->currentNumPlayers = 0;
+  game->spectators = NULL;
+  game->spectatorBinary = NULL;
+  game->slots = NULL;
+  game->index = NULL;
+  game->active = NULL;
+  game->numActive = 0;
+  game->buckets = NULL;
+  game->bucketCapacity = 0;
+  game->touched = NULL;
+  game->numTouched = 0;
+  game->touchedCapacity = 0;
+  game->touchedAll = false;
+  game->displayPass = 0;
+  game->numGoldPiles = 0;
+  game->numMaps = 0;
+  game->round = 1;
+  game->persistent = false;
+  game->goldPiles = malloc(GoldMaxNumPiles * sizeof(goldPile_t));
+  game->maps = malloc(sizeof(GameMap_t*));
+  if (game->goldPiles == NULL || game->maps == NULL) {
+    fprintf(stderr, "Error allocating memory for game\n");
+    game_delete(game);
+    return NULL;
+  }
+  if (!game_addMap(game, mapFile)) {
+    game_delete(game);
+    return NULL;
+  }
+  game->map = game->maps[0];
+  game->players = malloc(MaxPlayers * sizeof(player_t*));
+  game->slots = malloc(MaxPlayers * sizeof(playerSlot_t));
+  game->index = malloc(IndexSize * sizeof(int));
+  game->active = malloc(MaxPlayers * sizeof(int));
+  if (game->players == NULL || game->slots == NULL
+      || game->index == NULL || game->active == NULL) {
+    fprintf(stderr, "Error creating player array\n");
+    game_delete(game);
+    return NULL;
+  }
+  //initialize all players as null, with nothing for a snapshot to catch up on
+  for (int i = 0; i < MaxPlayers; i++) {
+    game->players[i] = NULL;
+    for (int slot = 0; slot < 2; slot++) {
+      game->slots[i].dirtyFirst[slot] = INT_MAX;
+      game->slots[i].dirtyLast[slot] = -1;
+    }
+  }
+  clearPlayerLookups(game);
+  game->numSpectators = 0;
+  game->spectatorCapacity = 0;
+  game->spectatorInterval = (spectatorFps > 0) ? 1 / spectatorFps : 0;
+  game->spectatorFramePending = false;
+  game->lastSpectatorFrame.tv_sec = 0;
+  game->lastSpectatorFrame.tv_nsec = 0;
+  game->over = false;
+  if (!distributeGold(game)) {
+    game_delete(game);
+    return NULL;
+  }
+  return game;
+}
+
+/*
+ * Loads another map into the rotation; see gamecore.h
+ */
+bool
+game_addMap(game_t* game, char* mapFile)
+{
+  GameMap_t* map = loadMapFile(mapFile);
+  if (map == NULL) {
+    fprintf(stderr, "Error loading map %s\n", mapFile);
+    return false;
+  }
+  GameMap_t** maps = realloc(game->maps, (game->numMaps + 1) * sizeof(GameMap_t*));
+  if (maps == NULL) {
+    fprintf(stderr, "Error growing map rotation\n");
+    deleteGameMap(map);
+    return false;
+  }
+  game->maps = maps;
+  game->maps[game->numMaps++] = map;
+
+  //room to keep players by square on the largest map
+  int numBuckets = ((getNumRows(map) + BucketSize - 1) / BucketSize)
+                   * ((getNumCols(map) + BucketSize - 1) / BucketSize);
+  if (numBuckets > game->bucketCapacity) {
+    int* buckets = realloc(game->buckets, numBuckets * sizeof(int));
+    if (buckets == NULL) {
+      fprintf(stderr, "Error growing player buckets\n");
+      game->numMaps--;
+      deleteGameMap(map);
+      return false;
+    }
+    //the new squares are empty; players are only ever in the current map's
+    for (int bucket = game->bucketCapacity; bucket < numBuckets; bucket++) {
+      buckets[bucket] = -1;
+    }
+    game->buckets = buckets;
+    game->bucketCapacity = numBuckets;
+  }
+
+  //and to mark the rows of the largest map a checkpoint must write
+  if (getNumRows(map) > game->dirtyRowCapacity) {
+    unsigned char* dirtyRows = realloc(game->dirtyRows, getNumRows(map));
+    if (dirtyRows == NULL) {
+      fprintf(stderr, "Error growing dirty rows\n");
+      game->numMaps--;
+      deleteGameMap(map);
+      return false;
+    }
+    memset(dirtyRows + game->dirtyRowCapacity, BothSlots,
+           getNumRows(map) - game->dirtyRowCapacity);
+    game->dirtyRows = dirtyRows;
+    game->dirtyRowCapacity = getNumRows(map);
+  }
+  return true;
+}
+
+/*
+ * Whether the game goes on to a new round when one ends; see gamecore.h
+ */
+void
+game_setPersistent(game_t* game, bool persistent)
+{
+  game->persistent = persistent;
+}
+
+/*
+ * The round being played, from 1; see gamecore.h
+ */
+int
+game_round(game_t* game)
+{
+  return game->round;
+}
+
+/*
+ * Has a player joined from the address; see gamecore.h
+ */
+bool
+game_isPlayer(game_t* game, const addr_t address)
+{
+  return checkPlayerJoined(game, address) != NULL;
+}
+
+/*
+ * Handles a message from a client; see gamecore.h
+ */
+bool
+game_handleMessage(game_t* game, const addr_t from, const char* message)
+{
+  char command[20]; //store the command
+  char name[30]; //store the player name
+
+  player_t* player;
+  if (game->over) {
+    return true;
+  }
+  game->snapshotDirty = true; //the next checkpoint looks for what changed
+  if (sscanf(message, "PLAY %29s", name) == 1) {
+    char* playerName = malloc(30 * sizeof(char));
+    if (playerName == NULL) {
+      fprintf(stderr, "Error allocating memory to player name\n");
+      return false;
+    }
+    strcpy(playerName, name);
+    player = playerJoin(game, from, playerName);
+    if (player == NULL) {
+      free(playerName);
+      game->sink.send(game->sink.arg, from, "QUIT Game is full: no more players can join.");
+      return false;
+    }
+    //send OK, GRID and GOLD_REMAINING, then the token to come back with;
+    //a client that offers binary framing gets them in binary
+    takeOffers(player, message);
+    sendPlayerStart(game, player);
+    sendFields(game, from, getPlayerBinary(player), WIRE_SESSION,
+               (long long[]) { getPlayerSession(player) });
+
+    //update the players who can see the newcomer, and the newcomer
+    updateNearbyVision(game);
+    updateSpectatorDisplay(game);
+  } else if (sscanf(message, "KEY %19s", command) == 1) {
+    //"KEY k count" repeats a step; a predicting client also tags its
+    //keys, "KEY k count seq"
+    int count = 1;
+    int seq;
+    int fields = sscanf(message, "KEY %*s %d %d", &count, &seq);
+    keyCommand(game, from, command[0], (fields >= 1) ? count : 1, (fields == 2) ? seq : -1);
+  } else if (strncmp(message, "GOTO ", strlen("GOTO ")) == 0) {
+    //"GOTO row col" or "GOTO GOLD" walks a player there in one action
+    int row, col;
+    if (strcmp(message, "GOTO GOLD") == 0) {
+      gotoCommand(game, from, -1, -1);
+    } else if (sscanf(message, "GOTO %d %d", &row, &col) == 2) {
+      gotoCommand(game, from, row, col);
+    } else if (checkPlayerJoined(game, from) != NULL) {
+      game->sink.send(game->sink.arg, from, "ERROR usage: GOTO row col | GOTO GOLD");
+    }
+  } else if (strcmp(message, "SPECTATE") == 0
+             || strncmp(message, "SPECTATE\n", strlen("SPECTATE\n")) == 0) {
+    //a spectator is always sent whole frames, so only binary is taken up
+    spectatorJoin(game, from, wire_offered(message, wire_OfferBinary));
+  } else if (strncmp(message, "RESUME ", strlen("RESUME ")) == 0) {
+    //a player's client come back, maybe from another address
+    unsigned long long session;
+    char extra;
+    int fields = sscanf(message, "RESUME %16llx%c", &session, &extra);
+    if (fields == 1 || (fields == 2 && extra == '\n')) {
+      resumeSession(game, from, session, message);
+    } else {
+      game->sink.send(game->sink.arg, from, "ERROR usage: RESUME token");
+    }
+  } else {
+    char invalidMessage[100];
+    snprintf(invalidMessage, sizeof(invalidMessage), "Invalid message format: %s", message);
+    game->sink.send(game->sink.arg, from, invalidMessage);
+  }
+  //a persistent game goes straight on to the next round
+  if (game->over && game->persistent) {
+    startRound(game);
+  }
+  return game->over;
+}
+
+/*
+ * Handles a binary message from a client; see gamecore.h
+ */
+bool
+game_handleBinary(game_t* game, const addr_t from, const char* message, int length)
+{
+  if (game->over) {
+    return true;
+  }
+  game->snapshotDirty = true; //the next checkpoint looks for what changed
+  long long fields[wire_MaxFields];
+  wireOp_t op = wire_decode(message, length, fields);
+  if (binaryCommands[op] != NULL) {
+    binaryCommands[op](game, from, fields);
+  } else {
+    game->sink.send(game->sink.arg, from, "ERROR malformed binary message");
+  }
+  //a persistent game goes straight on to the next round
+  if (game->over && game->persistent) {
+    startRound(game);
+  }
+  return game->over;
+}
+
+/*
+ * The game has been quiet for a frame interval; send any spectator
+ * frame the frame-rate cap held back
+ */
+void
+game_tick(game_t* game)
+{
+  if (!game->over && game->spectatorFramePending && game->numSpectators > 0) {
+    sendSpectatorFrame(game);
+  }
+}
+
+/*
+ * Least seconds between spectator frames; see gamecore.h
+ */
+float
+game_spectatorInterval(game_t* game)
+{
+  return game->spectatorInterval;
+}
+
+/*
+ * Keep a snapshot of the game in a new file; see gamecore.h
+ */
+bool
+game_snapshot(game_t* game, const char* path, int port)
+{
+  //it must be able to grow to every player without overflowing
+  size_t maxCells = snapshotMaxCells(game);
+  size_t size;
+  if (!snapshotFileSize(maxCells, MaxPlayers, &size)
+      || !snapshotFileSize(maxCells, SnapshotPlayerRoom, &size)) {
+    fprintf(stderr, "The maps are too big for snapshot %s\n", path);
+    return false;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Could not create snapshot %s\n", path);
+    return false;
+  }
+  char* snapshot = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    snapshot = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (snapshot == MAP_FAILED) {
+    fprintf(stderr, "Could not map snapshot %s\n", path);
+    close(fd);
+    return false;
+  }
+
+  snapshotHeader_t* header = (snapshotHeader_t*) snapshot;
+  memcpy(header->magic, SnapshotMagic, sizeof(header->magic));
+  header->version = SnapshotVersion;
+  header->port = port;
+  header->numMaps = game->numMaps;
+  header->maxCells = maxCells;
+  header->slotSize = snapshotSlotSize(maxCells);
+  header->playerRoom = SnapshotPlayerRoom;
+  header->current = -1;
+
+  detachSnapshot(game);
+  game->snapshot = snapshot;
+  game->snapshotSize = size;
+  game->snapshotFd = fd;
+  game->snapshotDirty = true;
+  markAllDirty(game); //both slots are empty
+  game_checkpoint(game);
+  return true;
+}
+
+/*
+ * The port recorded in a snapshot file; see gamecore.h
+ */
+int
+game_snapshotPort(const char* path)
+{
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    return 0;
+  }
+  snapshotHeader_t header;
+  bool read = (fread(&header, sizeof(header), 1, fp) == 1);
+  fclose(fp);
+  if (!read || memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) != 0
+      || header.version != SnapshotVersion) {
+    return 0;
+  }
+  return header.port;
+}
+
+/*
+ * Restore the game from its last checkpoint; see gamecore.h
+ */
+bool
+game_resume(game_t* game, const char* path)
+{
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    fprintf(stderr, "Could not open snapshot %s\n", path);
+    return false;
+  }
+  struct stat status;
+  char* snapshot = MAP_FAILED;
+  if (fstat(fd, &status) == 0 && status.st_size >= (off_t) sizeof(snapshotHeader_t)) {
+    snapshot = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (snapshot == MAP_FAILED) {
+    fprintf(stderr, "Could not map snapshot %s\n", path);
+    close(fd);
+    return false;
+  }
+
+  //it must be of a game on these maps, with a checkpoint in it
+  snapshotHeader_t* header = (snapshotHeader_t*) snapshot;
+  size_t maxCells = snapshotMaxCells(game);
+  size_t size = 0;
+  if (memcmp(header->magic, SnapshotMagic, sizeof(header->magic)) != 0
+      || header->version != SnapshotVersion
+      || header->numMaps != game->numMaps
+      || header->maxCells != maxCells || header->slotSize != snapshotSlotSize(maxCells)
+      || header->playerRoom < 1 || header->playerRoom > MaxPlayers
+      || !snapshotFileSize(maxCells, header->playerRoom, &size)
+      || (size_t) status.st_size < size
+      || (header->current != 0 && header->current != 1)) {
+    fprintf(stderr, "%s is not a snapshot of a game on these maps\n", path);
+    munmap(snapshot, status.st_size);
+    close(fd);
+    return false;
+  }
+  detachSnapshot(game);
+  game->snapshot = snapshot;
+  game->snapshotSize = status.st_size;
+  game->snapshotFd = fd;
+
+  snapshotSlot_t from = snapshotSlot(game, header->current);
+  snapshotGame_t* state = from.game;
+  GameMap_t* map = (state->round >= 1) ? game->maps[(state->round - 1) % game->numMaps] : NULL;
+  if (map == NULL || state->over
+      || state->numRows != getNumRows(map) || state->numCols != getNumCols(map)
+      || state->numGoldPiles < 0 || state->numGoldPiles > GoldMaxNumPiles
+      || state->currentNumPlayers < 0 || state->currentNumPlayers > header->playerRoom
+      || state->numSpectators < 0 || state->numSpectators > SnapshotSpectators
+      || !snapshotPlacesValid(map, from)) {
+    fprintf(stderr, "%s has no game to resume\n", path);
+    detachSnapshot(game);
+    return false;
+  }
+  int numRows = state->numRows;
+  int numCols = state->numCols;
+
+  //the map and its gold
+  game->round = state->round;
+  game->map = map;
+  resetGameGrid(map); //no one on it, until the players are back
+  char** gameGrid = getGameGrid(map);
+  for (int row = 0; row < numRows; row++) {
+    memcpy(gameGrid[row], from.gameGrid + row * numCols, numCols);
+  }
+  game->numGoldPiles = state->numGoldPiles;
+  memcpy(game->goldPiles, from.goldPiles, state->numGoldPiles * sizeof(goldPile_t));
+  game->goldRemaining = state->goldRemaining;
+
+  //the players, with all they have seen
+  for (int i = 0; i < game->currentNumPlayers; i++) {
+    player_delete(game->players[i]);
+    game->players[i] = NULL;
+  }
+  game->currentNumPlayers = 0;
+  for (int i = 0; i < state->currentNumPlayers; i++) {
+    snapshotPlayer_t* saved = &from.players[i];
+    char* name = malloc(sizeof(saved->name));
+    char** grid = newFrameGrid(numRows, numCols, ' ');
+    player_t* player = NULL;
+    if (name != NULL && grid != NULL) {
+      memcpy(name, saved->name, sizeof(saved->name));
+      name[sizeof(saved->name) - 1] = '\0';
+      for (int row = 0; row < numRows; row++) {
+        memcpy(grid[row], from.playerMaps + 2 * i * maxCells + row * numCols, numCols);
+      }
+      player = player_new(i, map, grid, saved->gold, name,
+                          saved->row, saved->col, saved->address);
+    }
+    if (player == NULL) {
+      fprintf(stderr, "Error allocating memory for players\n");
+      free(name);
+      deleteFrameGrid(grid);
+      detachSnapshot(game);
+      return false;
+    }
+    if (!saved->active) {
+      setPlayerInactive(player);
+    } else {
+      setCellOccupant(map, i, getCharacterID(player), saved->row, saved->col);
+    }
+    setPlayerSession(player, saved->session);
+    setPlayerBinary(player, saved->binary);
+    setPlayerOverlay(player, saved->overlay); //sent all they know again, in case
+    game->players[game->currentNumPlayers++] = player;
+  }
+  rebuildPlayerLookups(game);
+
+  //the spectators
+  if (state->numSpectators > game->spectatorCapacity) {
+    addr_t* spectators = realloc(game->spectators, state->numSpectators * sizeof(addr_t));
+    bool* spectatorBinary = realloc(game->spectatorBinary, state->numSpectators * sizeof(bool));
+    if (spectators != NULL) {
+      game->spectators = spectators;
+    }
+    if (spectatorBinary != NULL) {
+      game->spectatorBinary = spectatorBinary;
+    }
+    if (spectators == NULL || spectatorBinary == NULL) {
+      fprintf(stderr, "Error growing spectator list\n");
+      detachSnapshot(game);
+      return false;
+    }
+    game->spectatorCapacity = state->numSpectators;
+  }
+  game->numSpectators = state->numSpectators;
+  memcpy(game->spectators, from.spectators, state->numSpectators * sizeof(addr_t));
+  for (int i = 0; i < state->numSpectators; i++) {
+    game->spectatorBinary[i] = false; //until they come back with SPECTATE
+  }
+  game->over = false;
+  game->snapshotDirty = false;
+  markAllDirty(game); //the other slot is older than this
+
+  //the clients never left, only missed what happened while the server
+  //was down: bring their gold and displays up to date
+  for (int i = 0; i < game->numActive; i++) {
+    player_t* player = game->players[game->active[i]];
+    sendFields(game, getPlayerAddress(player), getPlayerBinary(player), WIRE_GOLD,
+               (long long[]) { 0, getPlayerGold(player), game->goldRemaining });
+    sendDisplay(game, player);
+  }
+  if (game->numSpectators > 0) {
+    sendSpectatorFrame(game);
+  }
+  return true;
+}
+
+/*
+ * Write what changed since the last checkpoint; see gamecore.h
+ */
+void
+game_checkpoint(game_t* game)
+{
+  if (game->snapshot == NULL || !game->snapshotDirty) {
+    return;
+  }
+  if (game->currentNumPlayers > ((snapshotHeader_t*) game->snapshot)->playerRoom
+      && !growSnapshot(game, game->currentNumPlayers)) {
+    //the last checkpoint stays good to resume from
+    fprintf(stderr, "Could not grow the snapshot; no longer checkpointing\n");
+    detachSnapshot(game);
+    return;
+  }
+  snapshotHeader_t* header = (snapshotHeader_t*) game->snapshot;
+  int last = header->current;
+  int slot = (last == 0) ? 1 : 0;
+  snapshotSlot_t to = snapshotSlot(game, slot);
+  size_t maxCells = header->maxCells;
+  int numRows = getNumRows(game->map);
+  int numCols = getNumCols(game->map);
+
+  //the slot holds the checkpoint before last: only what differs is
+  //written, so only pages that changed need going back to the file.
+  //The grids are too big to compare; rows (and players) changed since
+  //are marked for each slot, and only those are written
+  snapshotGame_t state;
+  memset(&state, 0, sizeof(state)); //padding too, so it compares equal
+  state.generation = (last < 0) ? 0 : snapshotSlot(game, last).game->generation + 1;
+  state.round = game->round;
+  state.numRows = numRows;
+  state.numCols = numCols;
+  state.numGoldPiles = game->numGoldPiles;
+  state.goldRemaining = game->goldRemaining;
+  state.currentNumPlayers = game->currentNumPlayers;
+  state.numSpectators = (game->numSpectators < SnapshotSpectators)
+                        ? game->numSpectators : SnapshotSpectators;
+  state.over = game->over;
+  copyChanged((char*) to.game, (char*) &state, sizeof(state));
+
+  copyChanged((char*) to.goldPiles, (char*) game->goldPiles,
+              game->numGoldPiles * sizeof(goldPile_t));
+  copyChanged((char*) to.spectators, (char*) game->spectators,
+              state.numSpectators * sizeof(addr_t));
+  unsigned char bit = 1 << slot;
+  char** gameGrid = getGameGrid(game->map);
+  for (int row = 0; row < numRows; row++) {
+    if (game->dirtyRows[row] & bit) {
+      memcpy(to.gameGrid + row * numCols, gameGrid[row], numCols);
+      game->dirtyRows[row] &= ~bit;
+    }
+  }
+
+  for (int i = 0; i < game->currentNumPlayers; i++) {
+    playerSlot_t* dirty = &game->slots[i];
+    if (dirty->dirtyFirst[slot] > dirty->dirtyLast[slot]) {
+      continue;
+    }
+    player_t* player = game->players[i];
+    snapshotPlayer_t saved;
+    memset(&saved, 0, sizeof(saved));
+    saved.active = getPlayerActive(player);
+    saved.gold = getPlayerGold(player);
+    saved.row = getPlayerRow(player);
+    saved.col = getPlayerCol(player);
+    strncpy(saved.name, getPlayerName(player), sizeof(saved.name) - 1);
+    saved.address = getPlayerAddress(player);
+    saved.session = getPlayerSession(player);
+    saved.binary = getPlayerBinary(player);
+    saved.overlay = getPlayerOverlay(player);
+    memcpy(&to.players[i], &saved, sizeof(saved));
+
+    //marks may be left from a round on a bigger map
+    char** playerMap = getPlayerMap(player);
+    int lastRow = (dirty->dirtyLast[slot] < numRows) ? dirty->dirtyLast[slot] : numRows - 1;
+    for (int row = dirty->dirtyFirst[slot]; row <= lastRow; row++) {
+      memcpy(to.playerMaps + 2 * i * maxCells + row * numCols, playerMap[row], numCols);
+    }
+    dirty->dirtyFirst[slot] = INT_MAX;
+    dirty->dirtyLast[slot] = -1;
+  }
+
+  //all of it written before the slot is made current
+  atomic_thread_fence(memory_order_release);
+  header->current = slot;
+  game->snapshotDirty = false;
+}
+
+/*
+ * KEY from the client at from: key, count times (1 to MaxKeyRepeat), and
+ * if seq is not -1, first "SEQ seq" to match the answer to the key.
+ * A spectator's key can only quit
+ */
+static void
+keyCommand(game_t* game, addr_t from, char key, int count, int seq)
+{
+  player_t* player = checkPlayerJoined(game, from);
+  if (player == NULL) {
+    int spectator = findSpectator(game, from);
+    if (spectator >= 0 && (key == 'Q' || key == 'q')) {
+      spectatorQuit(game, spectator);
+    }
+    return;
+  }
+  if (count < 1) {
+    count = 1;
+  } else if (count > MaxKeyRepeat) {
+    count = MaxKeyRepeat;
+  }
+  if (seq != -1) {
+    sendFields(game, from, getPlayerBinary(player), WIRE_SEQ, (long long[]) { seq });
+  }
+  callCommand(game, player, key, count);
+}
+
+/*
+ * GOTO from the client at from: walk its player to (row, col), or with
+ * row -1, to the nearest gold in sight
+ */
+static void
+gotoCommand(game_t* game, addr_t from, int row, int col)
+{
+  player_t* player = checkPlayerJoined(game, from);
+  if (player == NULL) {
+    return;
+  } else if (row == -1) {
+    gotoNearestGold(game, player);
+  } else {
+    gotoCell(game, player, row, col);
+  }
+}
+
+/*
+ * Binary KEY and GOTO; their fields are as in wire.h
+ */
+static void
+binaryKey(game_t* game, addr_t from, const long long fields[])
+{
+  keyCommand(game, from, fields[0], fields[1], fields[2]);
+}
+
+static void
+binaryGoto(game_t* game, addr_t from, const long long fields[])
+{
+  gotoCommand(game, from, fields[0], fields[1]);
+}
+
+/*
+ * Carries out a player's key: a step repeated count times (stopping at
+ * a wall), a run as far as it goes, or quitting. The display of everyone
+ * near where anything changed is updated once, after all the steps,
+ * unless the last step ended the game
+ */
+static void
+callCommand(game_t* game, player_t* player, char key, int count)
+{
+  if (key == 'Q') {
+    playerQuit(game, player);
+    return;
+  }
+  if (strchr("hljkyubnHLJKYUBN", key) == NULL) {
+    return; //not a valid command
+  }
+  if (!getPlayerActive(player)) {
+    return; //a player who quit stays put (and would never hit a wall)
+  }
+
+  if (isupper(key)) {
+    //a capital runs until it hits a wall
+    char direction = tolower(key);
+    int atGold;
+    player_t* victim;
+    while (!game->over && (atGold = moveOnce(game, player, direction, &victim)) != 3) {
+      afterStep(game, player, atGold, victim);
+    }
+  } else {
+    for (int i = 0; i < count && !game->over; i++) {
+      player_t* victim;
+      int atGold = moveOnce(game, player, key, &victim);
+      if (atGold == 3) {
+        break;
+      }
+      afterStep(game, player, atGold, victim);
+    }
+  }
+
+  if (!game->over) {
+    updateNearbyVision(game);
+    updateSpectatorDisplay(game);
+  }
+}
+
+/*
+ * Moves a player one step in direction (one of hljkyubn); returns the
+ * player module's move result: 0 moved, 1 onto gold, 2 stole, 3 blocked.
+ * After a theft, victim is the player stolen from (else NULL). Both
+ * cells of the step are noted for updateNearbyVision
+ */
+static int
+moveOnce(game_t* game, player_t* player, char direction, player_t** victim)
+{
+  int fromRow = getPlayerRow(player);
+  int fromCol = getPlayerCol(player);
+  int atGold = 3;
+  switch (direction) {
+    case 'h': atGold = moveLeft(player, game->players, game->goldRemaining); break;
+    case 'l': atGold = moveRight(player, game->players, game->goldRemaining); break;
+    case 'j': atGold = moveDown(player, game->players, game->goldRemaining); break;
+    case 'k': atGold = moveUp(player, game->players, game->goldRemaining); break;
+    case 'y': atGold = moveUpLeft(player, game->players, game->goldRemaining); break;
+    case 'u': atGold = moveUpRight(player, game->players, game->goldRemaining); break;
+    case 'b': atGold = moveDownLeft(player, game->players, game->goldRemaining); break;
+    case 'n': atGold = moveDownRight(player, game->players, game->goldRemaining); break;
+  }
+
+  *victim = NULL;
+  if (atGold != 3) {
+    touchCell(game, fromRow, fromCol);
+    touchCell(game, getPlayerRow(player), getPlayerCol(player));
+    placeInBucket(game, player);
+    //what they see changed around both cells
+    int firstRow = (fromRow < getPlayerRow(player)) ? fromRow : getPlayerRow(player);
+    int lastRow = (fromRow > getPlayerRow(player)) ? fromRow : getPlayerRow(player);
+    markPlayerDirty(game, player, firstRow - SightRadius, lastRow + SightRadius);
+    if (atGold == 2) {
+      //the two swapped places, so the victim stands where the thief was
+      *victim = getPlayerByID(game->players, getCellOccupant(game->map, fromRow, fromCol));
+      if (*victim != NULL) {
+        placeInBucket(game, *victim);
+        markPlayerDirty(game, *victim, firstRow - SightRadius, lastRow + SightRadius);
+      }
+    }
+  }
+  return atGold;
+}
+
+/*
+ * Settles the result of one step: collect the gold stepped on, or tell
+ * both sides of a theft (and spectators) about the gold stolen
+ */
+static void
+afterStep(game_t* game, player_t* player, int atGold, player_t* victim)
+{
+  //if atGold == 1, then a player picked up gold
+  if (atGold == 1) {
+    collectGold(game, player);
+  //if atGold == 2, a player has stolen gold
+  } else if (atGold == 2 && victim != NULL) {
+    //"STOLEN victim thief amount purse remaining": each side learns its
+    //own purse, and the thief's message goes to the spectators too
+    long long fields[] = { getCharacterID(victim), getCharacterID(player),
+                           getStolenGold(player), getPlayerGold(player),
+                           game->goldRemaining };
+    sendFields(game, getPlayerAddress(player), getPlayerBinary(player), WIRE_STOLEN, fields);
+    sendFieldsToSpectators(game, WIRE_STOLEN, fields);
+    fields[3] = getPlayerGold(victim);
+    sendFields(game, getPlayerAddress(victim), getPlayerBinary(victim), WIRE_STOLEN, fields);
+  }
+}
+
+/*
+ * Walks a player along a shortest path (by the map's distance field)
+ * toward a cell, as one action: it stops on arrival, or early if the
+ * way is blocked, and the displays near the way are updated once at the end
+ */
+static void
+gotoCell(game_t* game, player_t* player, int row, int col)
+{
+  const int* field = getDistanceField(game->map, row, col);
+  if (field == NULL) {
+    return; //not a cell anyone could stand on
+  }
+  int numCols = getNumCols(game->map);
+  static const char keys[] = "lnjbhyku"; //same order as the offsets below
+  static const int dr[] = {0, 1, 1, 1, 0, -1, -1, -1};
+  static const int dc[] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+  while (!game->over) {
+    int here = getPlayerRow(player);
+    int hereCol = getPlayerCol(player);
+    int distance = field[here * numCols + hereCol];
+    if (distance <= 0) {
+      break; //arrived, or no way there
+    }
+
+    //take any step that gets one closer
+    int step = -1;
+    for (int i = 0; i < 8 && step < 0; i++) {
+      int nextRow = here + dr[i], nextCol = hereCol + dc[i];
+      if (nextRow >= 0 && nextRow < getNumRows(game->map)
+          && nextCol >= 0 && nextCol < numCols
+          && field[nextRow * numCols + nextCol] == distance - 1) {
+        step = i;
+      }
+    }
+    if (step < 0) {
+      break;
+    }
+    player_t* victim;
+    int atGold = moveOnce(game, player, keys[step], &victim);
+    if (atGold == 3) {
+      break;
+    }
+    afterStep(game, player, atGold, victim);
+    if (getPlayerRow(player) == here && getPlayerCol(player) == hereCol) {
+      break; //did not move, so would not next time either
+    }
+  }
+
+  if (!game->over) {
+    updateNearbyVision(game);
+    updateSpectatorDisplay(game);
+  }
+}
+
+/*
+ * Walks a player to the nearest gold pile they can see, if any
+ */
+static void
+gotoNearestGold(game_t* game, player_t* player)
+{
+  //distances from the player to everywhere (BFS steps are symmetric);
+  //not cached, since hardly anyone will stand just here again, while
+  //the field toward the gold chosen is, for whoever goes for it next
+  int* field = newDistanceField(game->map, getPlayerRow(player),
+                                getPlayerCol(player));
+  if (field == NULL) {
+    return;
+  }
+  char** playerMap = getPlayerMap(player);
+  int numRows = getNumRows(game->map);
+  int numCols = getNumCols(game->map);
+  int bestRow = -1, bestCol = -1, bestDistance = -1;
+  for (int row = 0; row < numRows; row++) {
+    for (int col = 0; col < numCols; col++) {
+      int distance = field[row * numCols + col];
+      if (playerMap[row][col] == '*' && distance > 0
+          && (bestDistance < 0 || distance < bestDistance)) {
+        bestRow = row;
+        bestCol = col;
+        bestDistance = distance;
+      }
+    }
+  }
+  free(field);
+  if (bestDistance > 0) {
+    gotoCell(game, player, bestRow, bestCol);
+  }
+}
+
+/*
+ * Note that the spectators' display has changed, and send the new
+ * frame unless one went out less than spectatorInterval ago; in that
+ * case it goes out with a later update, or from game_tick
+ */
+static void
+updateSpectatorDisplay(game_t* game)
+{
+  if (game->numSpectators == 0) {
+    return;
+  }
+  game->spectatorFramePending = true;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - game->lastSpectatorFrame.tv_sec)
+    + (now.tv_nsec - game->lastSpectatorFrame.tv_nsec) / 1e9;
+  if (elapsed >= game->spectatorInterval) {
+    sendSpectatorFrame(game);
+  }
+}
+
+/*
+ * Encode the spectator view once and send it to every spectator
+ */
+static void
+sendSpectatorFrame(game_t* game)
+{
+  //the game grid is kept as a ready-to-send DISPLAY message
+  game->sink.sendFrame(game->sink.arg, game->spectators, game->numSpectators,
+                       getGameFrame(game->map), getFrameLength(game->map));
+
+  game->spectatorFramePending = false;
+  clock_gettime(CLOCK_MONOTONIC, &game->lastSpectatorFrame);
+}
+
+/*
+ * Send a message to every spectator
+ */
+static void
+sendToSpectators(game_t* game, const char* message)
+{
+  for (int i = 0; i < game->numSpectators; i++) {
+    game->sink.send(game->sink.arg, game->spectators[i], message);
+  }
+}
+
+/*
+ * Send a client a message that has a binary form (see wire.h): in binary
+ * if the client takes it, else as the text it always was
+ */
+static void
+sendFields(game_t* game, addr_t to, bool binary, wireOp_t op, const long long fields[])
+{
+  char message[wire_MaxText];
+  if (binary) {
+    game->sink.sendBytes(game->sink.arg, to, message, wire_encode(message, op, fields));
+  } else {
+    wire_format(message, op, fields);
+    game->sink.send(game->sink.arg, to, message);
+  }
+}
+
+/*
+ * sendFields to every spectator; each form is made once
+ */
+static void
+sendFieldsToSpectators(game_t* game, wireOp_t op, const long long fields[])
+{
+  char text[wire_MaxText];
+  char binary[wire_MaxBytes];
+  int length = 0;
+  text[0] = '\0';
+  for (int i = 0; i < game->numSpectators; i++) {
+    if (!game->spectatorBinary[i]) {
+      if (text[0] == '\0') {
+        wire_format(text, op, fields);
+      }
+      game->sink.send(game->sink.arg, game->spectators[i], text);
+    } else {
+      if (length == 0) {
+        length = wire_encode(binary, op, fields);
+      }
+      game->sink.sendBytes(game->sink.arg, game->spectators[i], binary, length);
+    }
+  }
+}
+
+/*
+ * Randomly distributes the gold throughout the map;
+ * returns false if the map has too little room for it
+ */
+static bool
+distributeGold(game_t* game)
+{
+  //generate random number of gold piles
+  game->numGoldPiles = GoldMinNumPiles + rand() % (GoldMaxNumPiles - GoldMinNumPiles + 1);
+
+  //reservoir sampling
+  //get valid "room" (.) cells
+  int** roomCells = getRoomCells(game->map);
+  int size = 0;
+  // get number of room cells
+  for (size = 0; roomCells[size][0] != -1; size++) {
+  }
+  if (size < game->numGoldPiles) {
+    fprintf(stderr, "not enough room cells to distribute gold\n");
+    delete2DIntArr(roomCells, size+1);
+    return false;
+  }
+  // reservoir sampling to get indices
+  int* indices = malloc(game->numGoldPiles * sizeof(int));
+  if (indices == NULL) {
+    fprintf(stderr, "distributeGold memory allocation failed\n");
+    delete2DIntArr(roomCells, size+1);
+    return false;
+  }
+  //set the indices to temp placeholder i
+  for (int i = 0; i < game->numGoldPiles; i++) {
+    indices[i] = i;
+  }
+  //update each index with a random number
+  for (int i = game->numGoldPiles; i < size; i++) {
+    int j = rand() % (i + 1);
+
+    if (j < game->numGoldPiles) {
+        indices[j] = i;
+    }
+  }
+
+  // go through indices and spawn gold piles at roomCells[indices[i]] = (row, col)
+  for (int i = 0; i < game->numGoldPiles; i++) {
+    int roomCellIndex = indices[i];
+    int row = roomCells[roomCellIndex][0];
+    int col = roomCells[roomCellIndex][1];
+
+    //set up the goldpile
+    goldPile_t* goldPile = &game->goldPiles[i];
+    goldPile->amount = 0;
+    goldPile->row = row;
+    goldPile->col = col;
+
+    //update the map
+    spawnGold(game, row, col);
+  }
+
+  // distribute the gold fairly
+  // for every piece of gold, randomly choose
+  // a pile to put it in
+  game->goldRemaining = GoldTotal;
+  for (int i = 0; i < GoldTotal; i++) {
+    int index = rand() % game->numGoldPiles;
+    game->goldPiles[index].amount++;
+  }
+
+  free(indices);
+  delete2DIntArr(roomCells, size+1);
+  return true;
+}
+
+/*
+ * Send the starting amount of gold to client
+ */
+static void
+sendStartingGold(game_t* game, addr_t playerAddress, bool binary)
+{
+  sendFields(game, playerAddress, binary, WIRE_GOLD_REMAINING,
+             (long long[]) { game->goldRemaining });
+}
+
+/*
+ * Method that updates the player's gold and gold remaining
+ * when a player picks up gold
+ */
+static void
+collectGold(game_t* game, player_t* player)
+{
+  //loop through the piles to see which one was collected
+  int row = getPlayerRow(player);
+  int col = getPlayerCol(player);
+
+  for (int i = 0; i < game->numGoldPiles; i++) {
+    goldPile_t* goldPile = &game->goldPiles[i];
+    int pileAmount = goldPile->amount;
+    int goldRow = goldPile->row;
+    int goldCol = goldPile->col;
+    if (row == goldRow && col == goldCol) {
+      addGold(player, pileAmount); //update player gold amount
+      int currPlayerGold = getPlayerGold(player);
+      game->goldRemaining -= pileAmount;
+      sendGoldUpdate(game, player, pileAmount);
+      //spectators need to update their banner
+      if (game->numSpectators > 0) {
+        sendFieldsToSpectators(game, WIRE_SPECTATOR_GOLD,
+                               (long long[]) { getCharacterID(player), pileAmount,
+                                               currPlayerGold, game->goldRemaining });
+      }
+      //check if all piles have been collected
+      //if so, game is over, send the summary
+      if (game->goldRemaining == 0) {
+        sendGameSummary(game);
+      }
+      break;
+    }
+  }
+}
+
+/*
+ * Updates all player's displays to reflect any gold changes
+ */
+static void
+sendGoldUpdate(game_t* game, player_t* player, int pileAmount)
+{
+  for (int i = 0; i < game->numActive; i++) {
+    player_t* otherPlayer = game->players[game->active[i]];
+    //the player who collected learns how much; the others, what is left
+    int collected = (otherPlayer == player) ? pileAmount : 0;
+    sendFields(game, getPlayerAddress(otherPlayer), getPlayerBinary(otherPlayer), WIRE_GOLD,
+               (long long[]) { collected, getPlayerGold(otherPlayer), game->goldRemaining });
+  }
+}
+
+/*
+ * Given a row and col, put gold on the map
+ * We assume that row col are valid "room cells" that are within
+ * the bounds of the map
+ */
+static void
+spawnGold(game_t* game, int row, int col)
+{
+  // get the current map
+  setCellType(game->map, '*', row, col);
+}
+
+/*
+ * Spawns a player at a specified row, col
+ * Puts them on the gameGrid (their letter) and in the game's lookups,
+ * and puts '@' on their map
+ */
+static void
+spawnPlayer(game_t* game, player_t* player, int row, int col)
+{
+  setCellOccupant(game->map, getPlayerID(player), getCharacterID(player), row, col);
+  activatePlayer(game, player);
+  touchCell(game, row, col);
+  char** playerMap = getPlayerMap(player);
+  playerMap[row][col] = '@';
+  markPlayerDirty(game, player, 0, getNumRows(game->map) - 1); //a new map
+}
+
+/*
+ * Sends the size of the grid to the client
+ */
+static void
+sendGrid(game_t* game, addr_t address, bool binary)
+{
+  sendFields(game, address, binary, WIRE_GRID,
+             (long long[]) { getNumRows(game->map), getNumCols(game->map) });
+}
+
+/*
+ * Sends every active player their display, as at the start of a round
+ */
+static void
+updateCurrentPlayerVision(game_t* game)
+{
+  for (int i = 0; i < game->numActive; i++) {
+    sendDisplay(game, game->players[game->active[i]]);
+  }
+  game->numTouched = 0;
+  game->touchedAll = false;
+}
+
+/*
+ * Sends a display to each active player within SightRadius of a cell
+ * touched since the last time (see touchCell), once each; no one
+ * further away could see anything different. The players are found by
+ * the BucketSize squares they are kept in, so only those near the
+ * changes are looked at, however many are in the game
+ */
+static void
+updateNearbyVision(game_t* game)
+{
+  if (game->touchedAll) {
+    updateCurrentPlayerVision(game);
+    return;
+  }
+  game->displayPass++;
+  int numRows = getNumRows(game->map);
+  int numCols = getNumCols(game->map);
+  int bucketCols = bucketColumns(game);
+  for (int i = 0; i < game->numTouched; i++) {
+    int row = game->touched[i] / numCols;
+    int col = game->touched[i] % numCols;
+    //squares this side of BucketSize: at most two each way are in sight
+    int firstRow = ((row > SightRadius) ? row - SightRadius : 0) / BucketSize;
+    int lastRow = ((row + SightRadius < numRows) ? row + SightRadius : numRows - 1) / BucketSize;
+    int firstCol = ((col > SightRadius) ? col - SightRadius : 0) / BucketSize;
+    int lastCol = ((col + SightRadius < numCols) ? col + SightRadius : numCols - 1) / BucketSize;
+    for (int bucketRow = firstRow; bucketRow <= lastRow; bucketRow++) {
+      for (int bucketCol = firstCol; bucketCol <= lastCol; bucketCol++) {
+        int id = game->buckets[bucketRow * bucketCols + bucketCol];
+        for (; id >= 0; id = game->slots[id].next) {
+          player_t* player = game->players[id];
+          if (game->slots[id].displayPass != game->displayPass
+              && abs(getPlayerRow(player) - row) <= SightRadius
+              && abs(getPlayerCol(player) - col) <= SightRadius) {
+            game->slots[id].displayPass = game->displayPass;
+            sendDisplay(game, player);
+          }
+        }
+      }
+    }
+  }
+  game->numTouched = 0;
+}
+
+/*
+ * Note that a cell of the gameGrid changed (a player came or went), for
+ * updateNearbyVision and the next checkpoints; if there is no room to
+ * note it, everyone's display will be sent instead
+ */
+static void
+touchCell(game_t* game, int row, int col)
+{
+  game->dirtyRows[row] = BothSlots;
+  if (game->touchedAll) {
+    return;
+  }
+  if (game->numTouched == game->touchedCapacity) {
+    int capacity = (game->touchedCapacity == 0) ? 64 : 2 * game->touchedCapacity;
+    int* touched = realloc(game->touched, capacity * sizeof(int));
+    if (touched == NULL) {
+      game->touchedAll = true;
+      return;
+    }
+    game->touched = touched;
+    game->touchedCapacity = capacity;
+  }
+  game->touched[game->numTouched++] = row * getNumCols(game->map) + col;
+}
+
+/*
+ * Note that a player changed: their record, and the rows firstRow to
+ * lastRow of their map (clipped to it), for both slots of the snapshot
+ */
+static void
+markPlayerDirty(game_t* game, player_t* player, int firstRow, int lastRow)
+{
+  playerSlot_t* slot = &game->slots[getPlayerID(player)];
+  if (firstRow < 0) {
+    firstRow = 0;
+  }
+  if (lastRow > getNumRows(game->map) - 1) {
+    lastRow = getNumRows(game->map) - 1;
+  }
+  for (int s = 0; s < 2; s++) {
+    if (firstRow < slot->dirtyFirst[s]) {
+      slot->dirtyFirst[s] = firstRow;
+    }
+    if (lastRow > slot->dirtyLast[s]) {
+      slot->dirtyLast[s] = lastRow;
+    }
+  }
+}
+
+/*
+ * Note that everything changed, as after a new round or a resume
+ */
+static void
+markAllDirty(game_t* game)
+{
+  memset(game->dirtyRows, BothSlots, game->dirtyRowCapacity);
+  for (int i = 0; i < game->currentNumPlayers; i++) {
+    markPlayerDirty(game, game->players[i], 0, getNumRows(game->map) - 1);
+  }
+}
+
+/*
+ * Sends the map to the client (player): the whole map, or to a client
+ * that builds its display, the terrain it lacks and what is in sight
+ */
+static void
+sendDisplay(game_t* game, player_t* player)
+{
+  //update the player's position on the map: what they see, around them
+  updatePlayerPosition(player);
+  markPlayerDirty(game, player, getPlayerRow(player) - SightRadius,
+                  getPlayerRow(player) + SightRadius);
+
+  if (getPlayerOverlay(player)) {
+    sendTerrain(game, player);
+    sendView(game, player);
+    return;
+  }
+
+  //the player map is kept as a ready-to-send DISPLAY message
+  addr_t address = getPlayerAddress(player);
+  game->sink.sendFrame(game->sink.arg, &address, 1, getFrame(getPlayerMap(player)),
+                       getFrameLength(game->map));
+}
+
+/*
+ * Sends a player's client the terrain it has not been sent, as
+ * "TERRAIN row col cells", then a line "row col cells" for each more run
+ * of cells along a row, in messages of at most TerrainMessageSize
+ */
+static void
+sendTerrain(game_t* game, player_t* player)
+{
+  const int* cells;
+  int count = takeDiscovered(player, &cells);
+  int numCols = getNumCols(game->map);
+  addr_t address = getPlayerAddress(player);
+  char message[TerrainMessageSize];
+  int length = 0;
+  for (int i = 0; i < count; ) {
+    //a run: cells one after another along one row
+    int row = cells[i] / numCols;
+    int col = cells[i] % numCols;
+    int run = 1;
+    while (i + run < count && run < TerrainMaxRun && cells[i + run] == cells[i] + run
+           && cells[i + run] / numCols == row) {
+      run++;
+    }
+    //a run with its row and column always fits in an empty message
+    if (length > 0 && length + run + 32 > TerrainMessageSize) {
+      game->sink.send(game->sink.arg, address, message);
+      length = 0;
+    }
+    length += snprintf(message + length, TerrainMessageSize - length,
+                       (length == 0) ? "TERRAIN %d %d " : "\n%d %d ", row, col);
+    for (int j = 0; j < run; j++) {
+      message[length++] = getCellTerrain(game->map, row, col + j);
+    }
+    message[length] = '\0';
+    i += run;
+  }
+  if (length > 0) {
+    game->sink.send(game->sink.arg, address, message);
+  }
+}
+
+/*
+ * Sends a player's client what the player sees, to lay over the terrain
+ * it has: "VIEW row col rows cols mask", the smallest box around the
+ * cells in sight, which are the set bits of mask (hex, row by row, from
+ * the top left, 4 to a digit), then "glyph row col" for each player or
+ * gold pile in sight, and the player as '@'
+ */
+static void
+sendView(game_t* game, player_t* player)
+{
+  int top, left;
+  const unsigned short* sight = getPlayerSight(player, &top, &left);
+
+  //the box around what is in sight
+  int firstRow = -1, lastRow = -1, firstCol = BucketSize, lastCol = -1;
+  for (int r = 0; r < BucketSize; r++) {
+    for (int c = 0; c < BucketSize; c++) {
+      if (sight[r] & (1 << c)) {
+        firstRow = (firstRow < 0) ? r : firstRow;
+        lastRow = r;
+        firstCol = (c < firstCol) ? c : firstCol;
+        lastCol = (c > lastCol) ? c : lastCol;
+      }
+    }
+  }
+  if (firstRow < 0) {
+    return; //nothing in sight: no update of the map yet
+  }
+
+  char message[ViewMessageSize];
+  int length = snprintf(message, sizeof(message), "VIEW %d %d %d %d ", top + firstRow,
+                        left + firstCol, lastRow - firstRow + 1, lastCol - firstCol + 1);
+  int nibble = 0, bits = 0;
+  for (int r = firstRow; r <= lastRow; r++) {
+    for (int c = firstCol; c <= lastCol; c++) {
+      nibble = (nibble << 1) | ((sight[r] >> c) & 1);
+      if (++bits == 4) {
+        message[length++] = "0123456789abcdef"[nibble];
+        nibble = bits = 0;
+      }
+    }
+  }
+  if (bits > 0) {
+    message[length++] = "0123456789abcdef"[nibble << (4 - bits)];
+  }
+
+  //what the player's map shows in sight, where it is not the terrain
+  char** playerMap = getPlayerMap(player);
+  for (int r = firstRow; r <= lastRow; r++) {
+    for (int c = firstCol; c <= lastCol; c++) {
+      int row = top + r, col = left + c;
+      if ((sight[r] & (1 << c)) && playerMap[row][col] != getCellTerrain(game->map, row, col)) {
+        length += snprintf(message + length, sizeof(message) - length, " %c %d %d",
+                           playerMap[row][col], row, col);
+      }
+    }
+  }
+  message[length] = '\0';
+  game->sink.send(game->sink.arg, getPlayerAddress(player), message);
+}
+
+/*
+ * Initializes the player map based on their starting visible region;
+ * grid, if not NULL, is a player map the size of this map to reuse
+ */
+static char**
+initializePlayerMap(game_t* game, int row, int col, char** grid)
+{
+  int numRows = getNumRows(game->map);
+  int numCols = getNumCols(game->map);
+
+  //an empty grid: every cell a space (represents an empty map)
+  bool reused = (grid != NULL);
+  if (reused) {
+    memset(grid[0], ' ', numRows * numCols); //a frame grid's rows are end to end
+  } else {
+    grid = newFrameGrid(numRows, numCols, ' ');
+  }
+  if (grid == NULL) {
+    fprintf(stderr, "Error initializing new grid\n");
+    return NULL;
+  }
+
+  //set the player's initial visible region
+  int** visibleRegion = getVisibleRegion(game->map, row, col);
+  if (visibleRegion == NULL) {
+    fprintf(stderr, "Error retrieving visible region\n");
+    if (!reused) {
+      deleteFrameGrid(grid);
+      return NULL;
+    }
+    return grid; //the next display fills it in
+  }
+  int size = 0;
+  for (int row = 0; visibleRegion[row][0] != -1; row++) {
+    int visibleRow = visibleRegion[row][0];
+    int visibleCol = visibleRegion[row][1];
+    grid[visibleRow][visibleCol] = getCellType(game->map, visibleRow, visibleCol);
+    size++;
+  }
+  delete2DIntArr(visibleRegion, size+1);
+  return grid;
+}
+
+/*
+ * Add a spectator to the list (if not already watching) and send them
+ * everything needed to start watching
+ */
+static void
+spectatorJoin(game_t* game, addr_t address, bool binary)
+{
+  int spectator = findSpectator(game, address);
+  if (spectator < 0) {
+    //grow the list when it is full
+    if (game->numSpectators == game->spectatorCapacity) {
+      int capacity = (game->spectatorCapacity == 0) ? 4 : 2 * game->spectatorCapacity;
+      addr_t* spectators = realloc(game->spectators, capacity * sizeof(addr_t));
+      bool* spectatorBinary = realloc(game->spectatorBinary, capacity * sizeof(bool));
+      if (spectators != NULL) {
+        game->spectators = spectators;
+      }
+      if (spectatorBinary != NULL) {
+        game->spectatorBinary = spectatorBinary;
+      }
+      if (spectators == NULL || spectatorBinary == NULL) {
+        fprintf(stderr, "Error growing spectator list\n");
+        return;
+      }
+      game->spectatorCapacity = capacity;
+    }
+    spectator = game->numSpectators++;
+    game->spectators[spectator] = address;
+  }
+  game->spectatorBinary[spectator] = binary;
+
+  sendFields(game, address, binary, WIRE_OK, (long long[]) { 'A' });
+  sendGrid(game, address, binary);
+  sendStartingGold(game, address, binary);
+
+  //the newcomer gets a frame right away; the others already have it
+  game->sink.sendFrame(game->sink.arg, &address, 1, getGameFrame(game->map),
+                       getFrameLength(game->map));
+}
+
+/*
+ * Return the index of the spectator with this address, or -1
+ */
+static int
+findSpectator(game_t* game, addr_t address)
+{
+  for (int i = 0; i < game->numSpectators; i++) {
+    if (message_eqAddr(game->spectators[i], address)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Create a new player and add it to the array of players;
+ * returns NULL if the game is full, or has no free spot to spawn in
+ */
+static player_t*
+playerJoin(game_t* game, addr_t address, char* name)
+{
+  //create the player and add them to the game
+  player_t* newPlayer;
+  int currentNumPlayers = game->currentNumPlayers;
+  if (currentNumPlayers < MaxPlayers) {
+    //initialize player's information: the ID is the index in players
+    int id = currentNumPlayers;
+
+    //spawn the player
+    int row, col;
+    if (!randomRoomCell(game, &row, &col)) {
+      return NULL; //nowhere left to stand
+    }
+
+    //create player map
+    char** playerMap = initializePlayerMap(game, row, col, NULL);
+    if (playerMap == NULL) {
+      return NULL;
+    }
+    //initialize the player
+    newPlayer = player_new(id, game->map, playerMap, 0, name, row, col, address);
+    if (newPlayer == NULL) {
+      fprintf(stderr, "Error initializing player\n");
+      deleteFrameGrid(playerMap);
+      return NULL;
+    }
+    setPlayerSession(newPlayer, newSession());
+
+    // add player to array of players after their setup is done
+    game->players[currentNumPlayers] = newPlayer;
+    game->currentNumPlayers++;
+    indexPlayer(game, newPlayer);
+    spawnPlayer(game, newPlayer, row, col);
+  } else {
+    //space is full
+    return NULL;
+  }
+  return newPlayer;
+}
+
+/*
+ * Pick a free room cell at random; false if there is none
+ */
+static bool
+randomRoomCell(game_t* game, int* row, int* col)
+{
+  int** roomCells = getRoomCells(game->map);
+  if (roomCells == NULL) {
+    return false;
+  }
+  // get number of room cells
+  int numRoomCells = 0;
+  while (roomCells[numRoomCells][0] != -1) {
+    numRoomCells++;
+  }
+  if (numRoomCells > 0) {
+    int randomCell = rand() % numRoomCells;
+    *row = roomCells[randomCell][0];
+    *col = roomCells[randomCell][1];
+  }
+  delete2DIntArr(roomCells, numRoomCells+1);
+  return numRoomCells > 0;
+}
+
+/*
+ * Check if a player exists, if they do then return that player
+ * (the first to join from the address); looked up in the index
+ */
+static player_t*
+checkPlayerJoined(game_t* game, addr_t address)
+{
+  unsigned int hash = (address.sin_addr.s_addr * 2654435761u) ^ address.sin_port;
+  for (int slot = hash & (IndexSize - 1); ; slot = (slot + 1) & (IndexSize - 1)) {
+    int id = game->index[slot];
+    if (id < 0) {
+      return NULL;
+    }
+    if (message_eqAddr(getPlayerAddress(game->players[id]), address)) {
+      return game->players[id];
+    }
+  }
+}
+
+/*
+ * Add a player to the index of players by address; it never fills,
+ * having twice the room of MaxPlayers
+ */
+static void
+indexPlayer(game_t* game, player_t* player)
+{
+  addr_t address = getPlayerAddress(player);
+  unsigned int hash = (address.sin_addr.s_addr * 2654435761u) ^ address.sin_port;
+  int slot = hash & (IndexSize - 1);
+  while (game->index[slot] >= 0) {
+    slot = (slot + 1) & (IndexSize - 1);
+  }
+  game->index[slot] = getPlayerID(player);
+}
+
+/*
+ * Add a player to the active list and to the square they stand in
+ */
+static void
+activatePlayer(game_t* game, player_t* player)
+{
+  int id = getPlayerID(player);
+  game->slots[id].activeSlot = game->numActive;
+  game->active[game->numActive++] = id;
+  game->slots[id].bucket = -1;
+  placeInBucket(game, player);
+}
+
+/*
+ * Take a player out of the active list and their square
+ */
+static void
+deactivatePlayer(game_t* game, player_t* player)
+{
+  int id = getPlayerID(player);
+  int activeSlot = game->slots[id].activeSlot;
+  if (activeSlot < 0) {
+    return;
+  }
+  //fill the hole with the last one; order does not matter
+  int last = game->active[--game->numActive];
+  game->active[activeSlot] = last;
+  game->slots[last].activeSlot = activeSlot;
+  game->slots[id].activeSlot = -1;
+  removeFromBucket(game, id);
+}
+
+/*
+ * Move an active player to the list of the square they now stand in,
+ * if it is not the one they were in
+ */
+static void
+placeInBucket(game_t* game, player_t* player)
+{
+  int id = getPlayerID(player);
+  playerSlot_t* slot = &game->slots[id];
+  if (slot->activeSlot < 0) {
+    return;
+  }
+  int bucket = (getPlayerRow(player) / BucketSize) * bucketColumns(game)
+               + getPlayerCol(player) / BucketSize;
+  if (bucket == slot->bucket) {
+    return;
+  }
+  removeFromBucket(game, id);
+  slot->bucket = bucket;
+  slot->prev = -1;
+  slot->next = game->buckets[bucket];
+  if (slot->next >= 0) {
+    game->slots[slot->next].prev = id;
+  }
+  game->buckets[bucket] = id;
+}
+
+/*
+ * Unlink a player from their square's list, if they are in one
+ */
+static void
+removeFromBucket(game_t* game, int id)
+{
+  playerSlot_t* slot = &game->slots[id];
+  if (slot->bucket < 0) {
+    return;
+  }
+  if (slot->prev >= 0) {
+    game->slots[slot->prev].next = slot->next;
+  } else {
+    game->buckets[slot->bucket] = slot->next;
+  }
+  if (slot->next >= 0) {
+    game->slots[slot->next].prev = slot->prev;
+  }
+  slot->bucket = -1;
+}
+
+/*
+ * Squares across a row of the current map
+ */
+static int
+bucketColumns(game_t* game)
+{
+  return (getNumCols(game->map) + BucketSize - 1) / BucketSize;
+}
+
+/*
+ * Empty the address index, active list and squares
+ */
+static void
+clearPlayerLookups(game_t* game)
+{
+  for (int slot = 0; slot < IndexSize; slot++) {
+    game->index[slot] = -1;
+  }
+  for (int bucket = 0; bucket < game->bucketCapacity; bucket++) {
+    game->buckets[bucket] = -1;
+  }
+  game->numActive = 0;
+  game->numTouched = 0;
+  game->touchedAll = false;
+}
+
+/*
+ * Build the address index, active list and squares afresh from the
+ * players, after they were renumbered or restored
+ */
+static void
+rebuildPlayerLookups(game_t* game)
+{
+  clearPlayerLookups(game);
+  for (int id = 0; id < game->currentNumPlayers; id++) {
+    player_t* player = game->players[id];
+    game->slots[id].activeSlot = -1;
+    game->slots[id].bucket = -1;
+    game->slots[id].displayPass = 0;
+    indexPlayer(game, player);
+    if (getPlayerActive(player)) {
+      activatePlayer(game, player);
+    }
+  }
+}
+
+/*
+ * Removes player from map and makes their status inactive
+ */
+static void
+playerQuit(game_t* game, player_t* player)
+{
+  //a player who already quit is no longer on the map (someone else
+  //may stand where they were), so is only told again
+  if (getPlayerActive(player)) {
+    //remove player from map
+    int playerRow = getPlayerRow(player);
+    int playerCol = getPlayerCol(player);
+
+    //turns the playerID back to the terrain
+    restoreCell(game->map, playerRow, playerCol);
+    touchCell(game, playerRow, playerCol);
+
+    //make player inactive
+    deactivatePlayer(game, player);
+    setPlayerInactive(player);
+    markPlayerDirty(game, player, playerRow, playerRow);
+
+    //update the vision of the ACTIVE players who saw them go
+    updateNearbyVision(game);
+  }
+
+  //send quit message to client
+  addr_t playerAddress = getPlayerAddress(player);
+  game->sink.send(game->sink.arg, playerAddress, "QUIT Thanks for playing!");
+}
+
+/*
+ * Remove spectator and send quit message
+ */
+static void
+spectatorQuit(game_t* game, int index) {
+  addr_t spectatorAddress = game->spectators[index];
+  game->sink.send(game->sink.arg, spectatorAddress, "QUIT Thanks for watching!");
+
+  //fill the hole with the last spectator; order does not matter
+  game->numSpectators--;
+  game->spectators[index] = game->spectators[game->numSpectators];
+  game->spectatorBinary[index] = game->spectatorBinary[game->numSpectators];
+}
+
+/*
+ * Sends the summary of the game to the clients, tells the spectators
+ * the game is over, and marks it over. In a persistent game the summary
+ * is a ROUND message instead of a QUIT, and goes to the spectators too,
+ * since everyone stays for the next round
+ */
+static void
+sendGameSummary(game_t* game)
+{
+  //a line of at most 50 bytes for each player
+  char* gameOverMessage = malloc(50 + 50 * game->currentNumPlayers);
+  if (gameOverMessage == NULL) {
+    fprintf(stderr, "Error allocating memory to message\n");
+    game->over = true;
+    return;
+  }
+  strcpy(gameOverMessage, game->persistent ? "ROUND GAME OVER:\n" : "QUIT GAME OVER:\n");
+
+  //create the messsage
+  char buffer[50];
+  int offset = strlen(gameOverMessage);
+  for (int i = 0; i < game->currentNumPlayers; i++) {
+    player_t* player = game->players[i];
+    char playerID = getCharacterID(player);
+    int playerGold = getPlayerGold(player);
+    char* playerName = getPlayerName(player);
+    int len = snprintf(buffer, sizeof(buffer), "%c          %d %s\n", playerID, playerGold, playerName);
+    if (len >= (int) sizeof(buffer)) {
+      len = sizeof(buffer) - 1; // only what fit
+    }
+    strcpy(gameOverMessage + offset, buffer); // append the line
+    offset += len; // move offset over for next append
+  }
+  //send the message to active players
+  for (int i = 0; i < game->numActive; i++) {
+    player_t* player = game->players[game->active[i]];
+    game->sink.send(game->sink.arg, getPlayerAddress(player), gameOverMessage);
+  }
+
+  //tell the spectators the game is over
+  if (game->persistent) {
+    sendToSpectators(game, gameOverMessage);
+  } else {
+    sendToSpectators(game, "QUIT Thanks for watching!");
+  }
+  free(gameOverMessage);
+  game->over = true;
+}
+
+/*
+ * Starts the next round in place, on the next map of the rotation:
+ * new gold, and every player still in the game respawned with no gold
+ * (under a new ID if players before them quit). Players and spectators
+ * stay connected and get the start of the round, as if just joined.
+ * Nothing is reallocated but the player maps of a map of another size
+ */
+static void
+startRound(game_t* game)
+{
+  //the sink may still refer to the player maps, which are about to change
+  if (game->sink.flush != NULL) {
+    game->sink.flush(game->sink.arg);
+  }
+
+  GameMap_t* oldMap = game->map;
+  game->map = game->maps[game->round % game->numMaps];
+  game->round++;
+  resetGameGrid(game->map);
+  bool sameSize = (getNumRows(game->map) == getNumRows(oldMap)
+                   && getNumCols(game->map) == getNumCols(oldMap));
+  if (!distributeGold(game)) {
+    game->numGoldPiles = 0;
+    game->goldRemaining = 0; //nothing to play for; the next gold collected never comes
+  }
+
+  //players who quit are gone for good; the rest move up, keeping ID == index
+  clearPlayerLookups(game); //each is put back as they respawn
+  int numPlayers = 0;
+  for (int i = 0; i < game->currentNumPlayers; i++) {
+    player_t* player = game->players[i];
+    int row, col;
+    if (!getPlayerActive(player) || !randomRoomCell(game, &row, &col)) {
+      if (getPlayerActive(player)) {
+        game->sink.send(game->sink.arg, getPlayerAddress(player), "QUIT Game is full: no more players can join.");
+      }
+      player_delete(player);
+      continue;
+    }
+    char** grid = initializePlayerMap(game, row, col, sameSize ? getPlayerMap(player) : NULL);
+    if (grid == NULL) {
+      game->sink.send(game->sink.arg, getPlayerAddress(player), "QUIT Game is full: no more players can join.");
+      player_delete(player);
+      continue;
+    }
+    resetPlayer(player, numPlayers, game->map, grid, row, col);
+    game->players[numPlayers++] = player;
+    spawnPlayer(game, player, row, col);
+  }
+  for (int i = numPlayers; i < game->currentNumPlayers; i++) {
+    game->players[i] = NULL;
+  }
+  game->currentNumPlayers = numPlayers;
+  rebuildPlayerLookups(game);
+  game->over = false;
+  markAllDirty(game); //another map, and players under new IDs
+
+  //everyone starts over as if just joined
+  for (int i = 0; i < game->currentNumPlayers; i++) {
+    sendPlayerStart(game, game->players[i]);
+  }
+  updateCurrentPlayerVision(game);
+  for (int i = 0; i < game->numSpectators; i++) {
+    spectatorJoin(game, game->spectators[i], game->spectatorBinary[i]);
+  }
+  game->spectatorFramePending = false;
+}
+
+/*
+ * Take up what a player's client offers on the lines after its PLAY or
+ * RESUME: binary framing, and building its display (see wire.h)
+ */
+static void
+takeOffers(player_t* player, const char* offers)
+{
+  setPlayerBinary(player, wire_offered(offers, wire_OfferBinary));
+  setPlayerOverlay(player, wire_offered(offers, wire_OfferOverlay));
+}
+
+/*
+ * Send a player the start of a round: "OK id", GRID and GOLD_REMAINING
+ */
+static void
+sendPlayerStart(game_t* game, player_t* player)
+{
+  addr_t playerAddress = getPlayerAddress(player);
+  bool binary = getPlayerBinary(player);
+  sendFields(game, playerAddress, binary, WIRE_OK, (long long[]) { getCharacterID(player) });
+  sendGrid(game, playerAddress, binary);
+  sendStartingGold(game, playerAddress, binary);
+}
+
+/*
+ * A fresh session token, never 0: from /dev/urandom, so it cannot be
+ * guessed, or from rand() if that cannot be read
+ */
+static unsigned long long
+newSession(void)
+{
+  unsigned long long session = 0;
+  FILE* fp = fopen("/dev/urandom", "r");
+  if (fp != NULL) {
+    if (fread(&session, sizeof(session), 1, fp) != 1) {
+      session = 0;
+    }
+    fclose(fp);
+  }
+  while (session == 0) {
+    session = ((unsigned long long) rand() << 32) ^ (unsigned long long) rand();
+  }
+  return session;
+}
+
+/*
+ * "RESUME token": give the player with that session (still in the game)
+ * back to the client at address, moving the player there if it is new,
+ * and send everything a client needs to pick up playing, as the client
+ * offers to take it (offers: the message, see takeOffers)
+ */
+static void
+resumeSession(game_t* game, addr_t address, unsigned long long session, const char* offers)
+{
+  for (int i = 0; i < game->currentNumPlayers; i++) {
+    player_t* player = game->players[i];
+    if (session == 0 || getPlayerSession(player) != session || !getPlayerActive(player)) {
+      continue;
+    }
+    if (!message_eqAddr(getPlayerAddress(player), address)) {
+      if (checkPlayerJoined(game, address) != NULL) {
+        game->sink.send(game->sink.arg, address, "ERROR already playing from this address");
+        return;
+      }
+      setPlayerAddress(player, address);
+      rebuildPlayerLookups(game); //to find the player at the new address
+    }
+    //a client starting out plays from its first display, then takes GOLD
+    takeOffers(player, offers);
+    markPlayerDirty(game, player, getPlayerRow(player), getPlayerRow(player));
+    sendPlayerStart(game, player);
+    sendDisplay(game, player);
+    sendFields(game, address, getPlayerBinary(player), WIRE_GOLD,
+               (long long[]) { 0, getPlayerGold(player), game->goldRemaining });
+    return;
+  }
+  game->sink.send(game->sink.arg, address, "QUIT Unknown session: no such player in this game.");
+}
+
+/*
+ * numRows * numCols of the largest map of the rotation
+ */
+static size_t
+snapshotMaxCells(game_t* game)
+{
+  size_t maxCells = 0;
+  for (int i = 0; i < game->numMaps; i++) {
+    size_t cells = (size_t) getNumRows(game->maps[i]) * getNumCols(game->maps[i]);
+    if (cells > maxCells) {
+      maxCells = cells;
+    }
+  }
+  return maxCells;
+}
+
+/*
+ * Bytes in a slot of a snapshot with room for maxCells, rounded up so
+ * the next slot starts aligned
+ */
+static size_t
+snapshotSlotSize(size_t maxCells)
+{
+  size_t size = sizeof(snapshotGame_t)
+                + MaxPlayers * sizeof(snapshotPlayer_t)
+                + SnapshotSpectators * sizeof(addr_t)
+                + GoldMaxNumPiles * sizeof(goldPile_t)
+                + maxCells;
+  return (size + 7) & ~(size_t) 7;
+}
+
+/*
+ * Bytes in a snapshot file with room for maxCells and the maps of
+ * playerRoom players; false if it would be more than SnapshotMaxBytes
+ */
+static bool
+snapshotFileSize(size_t maxCells, int playerRoom, size_t* size)
+{
+  //each slot has the game grid and playerRoom maps; the rest is small
+  size_t grids = 2 * (1 + (size_t) playerRoom);
+  size_t rest = sizeof(snapshotHeader_t) + 2 * (snapshotSlotSize(0) + 7);
+  if (maxCells > (SnapshotMaxBytes - rest) / grids) {
+    return false;
+  }
+  *size = sizeof(snapshotHeader_t) + 2 * snapshotSlotSize(maxCells)
+          + 2 * (size_t) playerRoom * maxCells;
+  return true;
+}
+
+/*
+ * Make room in the snapshot for the maps of numPlayers players, doubling
+ * what it has (up to MaxPlayers): the file grows at its end and is
+ * mapped again. False, with the old mapping kept, if it cannot
+ */
+static bool
+growSnapshot(game_t* game, int numPlayers)
+{
+  snapshotHeader_t* header = (snapshotHeader_t*) game->snapshot;
+  int room = header->playerRoom;
+  while (room < numPlayers) {
+    room = (2 * room < MaxPlayers) ? 2 * room : MaxPlayers;
+  }
+  size_t size;
+  if (!snapshotFileSize(header->maxCells, room, &size)
+      || ftruncate(game->snapshotFd, size) != 0) {
+    return false;
+  }
+  char* snapshot = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        game->snapshotFd, 0);
+  if (snapshot == MAP_FAILED) {
+    return false;
+  }
+  munmap(game->snapshot, game->snapshotSize);
+  game->snapshot = snapshot;
+  game->snapshotSize = size;
+  ((snapshotHeader_t*) snapshot)->playerRoom = room;
+  return true;
+}
+
+/*
+ * Does everything a slot puts on the map lie on it? Every player in the
+ * map, and each active one on a room or passage cell; every gold pile in
+ * the map; and no purse or pile below zero. A file damaged or edited by
+ * hand could say otherwise, and the players' positions index the grids
+ */
+static bool
+snapshotPlacesValid(GameMap_t* map, snapshotSlot_t from)
+{
+  snapshotGame_t* state = from.game;
+  for (int i = 0; i < state->currentNumPlayers; i++) {
+    snapshotPlayer_t* saved = &from.players[i];
+    if (saved->gold < 0) {
+      return false;
+    }
+    char terrain = getCellTerrain(map, saved->row, saved->col); //'\0' if out of the map
+    if (terrain == '\0' || (saved->active && terrain != '.' && terrain != '#')) {
+      return false;
+    }
+  }
+  for (int i = 0; i < state->numGoldPiles; i++) {
+    goldPile_t* pile = &from.goldPiles[i];
+    if (getCellTerrain(map, pile->row, pile->col) == '\0' || pile->amount < 0) {
+      return false;
+    }
+  }
+  return state->goldRemaining >= 0;
+}
+
+/*
+ * Find the parts of a slot of the game's snapshot; in this order each
+ * part starts aligned for its type
+ */
+static snapshotSlot_t
+snapshotSlot(game_t* game, int slot)
+{
+  snapshotHeader_t* header = (snapshotHeader_t*) game->snapshot;
+  char* part = game->snapshot + sizeof(snapshotHeader_t) + (size_t) slot * header->slotSize;
+  snapshotSlot_t parts;
+  parts.game = (snapshotGame_t*) part;
+  part += sizeof(snapshotGame_t);
+  parts.players = (snapshotPlayer_t*) part;
+  part += MaxPlayers * sizeof(snapshotPlayer_t);
+  parts.spectators = (addr_t*) part;
+  part += SnapshotSpectators * sizeof(addr_t);
+  parts.goldPiles = (goldPile_t*) part;
+  part += GoldMaxNumPiles * sizeof(goldPile_t);
+  parts.gameGrid = part;
+  parts.playerMaps = game->snapshot + sizeof(snapshotHeader_t) + 2 * header->slotSize
+                    + (size_t) slot * header->maxCells;
+  return parts;
+}
+
+/*
+ * Copy length bytes only if they differ, so unchanged snapshot pages
+ * are left clean
+ */
+static void
+copyChanged(char* to, const char* from, size_t length)
+{
+  if (length > 0 && memcmp(to, from, length) != 0) {
+    memcpy(to, from, length);
+  }
+}
+
+/*
+ * Stop keeping a snapshot, unmapping the file (its last checkpoint stays)
+ */
+static void
+detachSnapshot(game_t* game)
+{
+  if (game->snapshot != NULL) {
+    munmap(game->snapshot, game->snapshotSize);
+    game->snapshot = NULL;
+    game->snapshotSize = 0;
+  }
+  if (game->snapshotFd >= 0) {
+    close(game->snapshotFd);
+    game->snapshotFd = -1;
+  }
+}
+
+/*
+ * Clean up the game by freeing any allocated memory; see gamecore.h
+ */
+void
+game_delete(game_t* game)
+{
+  if (game == NULL) {
+    return;
+  }
+  //the sink may still refer to the player maps; send it before they go
+  if (game->sink.flush != NULL) {
+    game->sink.flush(game->sink.arg);
+  }
+
+  //the snapshot ends with the game as it is now (over, if it is)
+  game_checkpoint(game);
+  detachSnapshot(game);
+
+  //free any dynamically allocated data for each player that joined the game and the player itself
+  if (game->players != NULL) {
+    for (int i = 0; i < game->currentNumPlayers; i++) {
+      player_t* player = game->players[i];
+      if (player != NULL) {
+        player_delete(player);
+      }
+    }
+    free(game->players);
+    free(game->spectators);
+    free(game->spectatorBinary);
+  }
+  free(game->slots);
+  free(game->index);
+  free(game->active);
+  free(game->buckets);
+  free(game->touched);
+  free(game->dirtyRows);
+
+  //free the gold piles
+  free(game->goldPiles);
+
+  //free the maps of the rotation
+  if (game->maps != NULL) {
+    for (int i = 0; i < game->numMaps; i++) {
+      deleteGameMap(game->maps[i]);
+    }
+    free(game->maps);
+  }
+
+  //free the game itself
+  free(game);
+}
@@ -0,0 +1,163 @@
+/*
+ * Game core - the rules of the 'nuggets' game, without the network.
+ *
+ * A game_t holds everything about one game: the map, gold, players and
+ * spectators. It is driven by the protocol's client messages
+ * (game_handleMessage) and answers through a sink the caller provides,
+ * so the server can send over UDP while a benchmark or fuzzer just
+ * counts, all in memory.
+ *
+ * Author: Jaysen Quan, Dartmouth CS 50, Winter 2024
+ */
+
+#ifndef __GAMECORE_H__
+#define __GAMECORE_H__
+
+#include <stdbool.h>
+#include "../support/message.h"
+
+typedef struct game game_t;
+
+/*
+ * Where a game's messages go. The game calls these as it runs:
+ *   send: one text message for one client
+ *   sendBytes: one binary message (see wire.h) for one client that
+ *     asked for them; it is length bytes, and may hold NULs
+ *   sendFrame: a DISPLAY message for count clients; frame is not a
+ *     string (length bytes) and belongs to the game: it stays valid
+ *     until the game changes it (see message_sendFrame)
+ *   flush: frames are about to be freed; send anything still
+ *     referring to one (may be NULL if nothing is held)
+ * arg is passed to each, untouched.
+ */
+typedef struct gameSink {
+  void* arg;
+  void (*send)(void* arg, const addr_t to, const char* message);
+  void (*sendBytes)(void* arg, const addr_t to, const char* message, int length);
+  void (*sendFrame)(void* arg, const addr_t to[], int count,
+                    const char* frame, int length);
+  void (*flush)(void* arg);
+} gameSink_t;
+
+/*
+ * Create a game on the map in mapFile, with gold spread at random (by
+ * rand(), so seed with srand first). spectatorFps caps the spectator
+ * frame rate; 0 means no cap.
+ *
+ * Returns the game, or NULL (after logging why) if the map cannot be
+ * loaded or memory allocated. Caller later calls game_delete.
+ */
+game_t* game_new(char* mapFile, float spectatorFps, gameSink_t sink);
+
+/*
+ * Load another map into the game's rotation (see game_setPersistent).
+ * The map given to game_new comes first, then these, in the order added.
+ *
+ * Returns false (after logging why) if the map cannot be loaded.
+ */
+bool game_addMap(game_t* game, char* mapFile);
+
+/*
+ * Whether the game goes on when all the gold is collected (default
+ * false). A persistent game sends everyone "ROUND GAME OVER:" and the
+ * summary instead of QUIT, then at once starts a new round in place,
+ * on the next map of the rotation: the players still connected (and
+ * the spectators) are carried over and sent OK, GRID and GOLD_REMAINING
+ * again, as if they had just joined.
+ */
+void game_setPersistent(game_t* game, bool persistent);
+
+/*
+ * The round being played, counting from 1.
+ */
+int game_round(game_t* game);
+
+/*
+ * Has a player joined the game from this address (even if they quit)?
+ */
+bool game_isPlayer(game_t* game, const addr_t address);
+
+/*
+ * Carry out a message from a client at address from: PLAY, SPECTATE,
+ * KEY, GOTO or RESUME, answering through the sink. A player who joins
+ * is sent "SESSION token" after the start of the round; "RESUME token"
+ * gives that player back to a client, at any address, as it was.
+ * A PLAY, SPECTATE or RESUME whose second line is "BINARY" asks for
+ * binary framing (see wire.h): the client is then sent in binary the
+ * messages that have a binary form.
+ *
+ * Returns true once the game is over (all gold collected; everyone has
+ * been sent the summary), after which no more messages should be given.
+ * A persistent game is never over.
+ */
+bool game_handleMessage(game_t* game, const addr_t from, const char* message);
+
+/*
+ * Carry out a binary message (see wire.h) of length bytes from a client
+ * at address from: KEY or GOTO, as game_handleMessage would the text.
+ * Returns as game_handleMessage.
+ */
+bool game_handleBinary(game_t* game, const addr_t from, const char* message, int length);
+
+/*
+ * Call when the game has been quiet for game_spectatorInterval seconds;
+ * sends any spectator frame the frame-rate cap held back.
+ */
+void game_tick(game_t* game);
+
+/*
+ * Least seconds between spectator frames; 0 if there is no cap.
+ */
+float game_spectatorInterval(game_t* game);
+
+/*
+ * Keep a snapshot of the game in the file at path (created, or
+ * replaced), so a server that crashes can carry on with game_resume.
+ * The file is memory-mapped: each game_checkpoint writes only what
+ * changed into it, with no system calls, and the kernel takes it to
+ * disk in its own time. port (where the server listens) is kept with
+ * it, for a resumed server to listen there again. The file has room for
+ * a few players' maps at first, and grows as more join.
+ *
+ * Returns false (after logging why) if the file cannot be made, or would
+ * be too big for a file with every player on the largest map.
+ */
+bool game_snapshot(game_t* game, const char* path, int port);
+
+/*
+ * Call at a tick boundary (say, after each batch of messages) to
+ * checkpoint the game into its snapshot, if it has one and anything has
+ * happened since the last checkpoint. A checkpoint is either wholly in
+ * the file or not at all, whenever the server stops.
+ */
+void game_checkpoint(game_t* game);
+
+/*
+ * The port recorded in the snapshot file at path; 0 if it cannot be
+ * read or is not a snapshot.
+ */
+int game_snapshotPort(const char* path);
+
+/*
+ * Carry on the game in the snapshot file at path, from its last
+ * checkpoint, and keep checkpointing into it. The game must have been
+ * made, like the one in the snapshot, with the same maps in the same
+ * order. Players, their gold and what they have seen, the gold piles
+ * and the spectators are all restored; the players keep their addresses
+ * and sessions, and each connected client is sent its gold and display,
+ * so a client still running just carries on.
+ *
+ * Returns false (after logging why) if the file is not a snapshot of a
+ * game on these maps (including one placing a player or gold off the map,
+ * or a player on a wall), that game is over, or memory cannot be allocated;
+ * the game is then not to be played (only deleted).
+ */
+bool game_resume(game_t* game, const char* path);
+
+/*
+ * Flush the sink, take a last checkpoint (see game_snapshot), and free
+ * everything the game allocated.
+ */
+void game_delete(game_t* game);
+
+#endif // __GAMECORE_H__
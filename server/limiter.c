@@ -0,0 +1,171 @@
+/*
+ * Limiter - per-address token buckets; see limiter.h
+ *
+ * Author: Jaysen Quan, Dartmouth CS 50, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../support/message.h"
+#include "limiter.h"
+
+static const int NumBuckets = 4096;  // table size; a power of two
+static const int Ways = 8;           // places an address may be kept in, from its hash
+
+/****************** local types *********************/
+typedef struct bucket {
+  addr_t address;
+  bool used;                   // does this place hold an address?
+  bool limited;                // has this address been refused?
+  float tokens;                // as of `seen`
+  double seen;                 // when the address was last heard from (seconds)
+} bucket_t;
+
+struct limiter {
+  float rate;                  // tokens a second
+  float burst;                 // most tokens a bucket holds
+  bucket_t* buckets;           // NumBuckets of them, by address
+  bucket_t* hosts;             // NumBuckets more, by host (the port is 0)
+};
+
+//function prototypes
+static bool takeTokens(limiter_t* limiter, bucket_t* bucket, double time, float cost);
+static bucket_t* findBucket(limiter_t* limiter, bucket_t* table, const addr_t address,
+                            double now);
+static double now(void);
+
+/*
+ * Create a limiter; see limiter.h
+ */
+limiter_t*
+limiter_new(float rate, float burst)
+{
+  limiter_t* limiter = malloc(sizeof(limiter_t));
+  if (limiter == NULL) {
+    return NULL;
+  }
+  limiter->rate = rate;
+  limiter->burst = burst;
+  limiter->buckets = calloc(NumBuckets, sizeof(bucket_t));
+  limiter->hosts = calloc(NumBuckets, sizeof(bucket_t));
+  if (limiter->buckets == NULL || limiter->hosts == NULL) {
+    limiter_delete(limiter);
+    return NULL;
+  }
+  return limiter;
+}
+
+/*
+ * Take cost tokens from an address's bucket if it has them; see limiter.h
+ */
+bool
+limiter_allow(limiter_t* limiter, const addr_t from, float cost)
+{
+  double time = now();
+  return takeTokens(limiter, findBucket(limiter, limiter->buckets, from, time),
+                    time, cost);
+}
+
+/*
+ * Take cost tokens from a host's bucket if it has them; see limiter.h
+ */
+bool
+limiter_allowHost(limiter_t* limiter, const addr_t from, float cost)
+{
+  double time = now();
+  addr_t host = from;
+  host.sin_port = 0;
+  return takeTokens(limiter, findBucket(limiter, limiter->hosts, host, time),
+                    time, cost);
+}
+
+/*
+ * Addresses held that were refused at least once; see limiter.h
+ */
+int
+limiter_numLimited(limiter_t* limiter)
+{
+  int limited = 0;
+  for (int i = 0; i < NumBuckets; i++) {
+    if (limiter->buckets[i].used && limiter->buckets[i].limited) {
+      limited++;
+    }
+    if (limiter->hosts[i].used && limiter->hosts[i].limited) {
+      limited++;
+    }
+  }
+  return limited;
+}
+
+/*
+ * Free the limiter; see limiter.h
+ */
+void
+limiter_delete(limiter_t* limiter)
+{
+  if (limiter != NULL) {
+    free(limiter->buckets);
+    free(limiter->hosts);
+    free(limiter);
+  }
+}
+
+/*
+ * Top up a bucket for the time since it was last heard from, then take
+ * cost tokens from it if it has them
+ */
+static bool
+takeTokens(limiter_t* limiter, bucket_t* bucket, double time, float cost)
+{
+  float tokens = bucket->tokens + (time - bucket->seen) * limiter->rate;
+  bucket->tokens = (tokens < limiter->burst) ? tokens : limiter->burst;
+  bucket->seen = time;
+  if (bucket->tokens < cost) {
+    bucket->limited = true;
+    return false;
+  }
+  bucket->tokens -= cost;
+  return true;
+}
+
+/*
+ * The bucket of an address in a table: one of the Ways places after its
+ * hash. An address not there takes a free place, or else the place of
+ * the one heard from longest ago, and starts with a full bucket
+ */
+static bucket_t*
+findBucket(limiter_t* limiter, bucket_t* table, const addr_t address, double time)
+{
+  unsigned int hash = (address.sin_addr.s_addr * 2654435761u) ^ address.sin_port;
+  bucket_t* oldest = NULL;
+  for (int way = 0; way < Ways; way++) {
+    bucket_t* bucket = &table[(hash + way) & (NumBuckets - 1)];
+    if (bucket->used && message_eqAddr(bucket->address, address)) {
+      return bucket;
+    }
+    if (oldest == NULL || (oldest->used && (!bucket->used || bucket->seen < oldest->seen))) {
+      oldest = bucket;
+    }
+  }
+  oldest->address = address;
+  oldest->used = true;
+  oldest->limited = false;
+  oldest->tokens = limiter->burst;
+  oldest->seen = time;
+  return oldest;
+}
+
+/*
+ * Seconds on the monotonic clock
+ */
+static double
+now(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
@@ -0,0 +1,62 @@
+/*
+ * Limiter - per-address token buckets, to keep any one client from
+ * taking more than its share of the server.
+ *
+ * Each address has a bucket of up to `burst` tokens, refilled at `rate`
+ * tokens a second; a message costs some tokens, and is refused when the
+ * bucket has too few. Buckets are kept in a fixed-size table, so a flood
+ * from many (maybe forged) addresses cannot grow it: when an address
+ * needs a place, the one seen longest ago gives up its own, which costs
+ * nothing once its bucket has had time to fill up again.
+ *
+ * A new address starts with a full bucket, so a sender that picks a new
+ * port for each message would never run short. Each host (IP address,
+ * any port) has a bucket too, in a table of its own, for senders the
+ * caller does not know yet: see limiter_allowHost.
+ *
+ * Author: Jaysen Quan, Dartmouth CS 50, Winter 2024
+ */
+
+#ifndef __LIMITER_H__
+#define __LIMITER_H__
+
+#include <stdbool.h>
+#include "../support/message.h"
+
+typedef struct limiter limiter_t;
+
+/*
+ * Create a limiter giving each address `rate` tokens a second, up to
+ * `burst` at a time (an address not seen before starts with a full
+ * bucket). rate and burst must be positive.
+ *
+ * Returns the limiter, or NULL if memory cannot be allocated.
+ * Caller later calls limiter_delete.
+ */
+limiter_t* limiter_new(float rate, float burst);
+
+/*
+ * Take cost tokens from the bucket of the address from, if it has them.
+ *
+ * Returns true if it did (let the message through), false if the
+ * bucket has fewer than cost (drop the message); nothing is taken then.
+ */
+bool limiter_allow(limiter_t* limiter, const addr_t from, float cost);
+
+/*
+ * As limiter_allow, but from the bucket of the host of from, which all
+ * its ports share; for a sender not known to be a client.
+ */
+bool limiter_allowHost(limiter_t* limiter, const addr_t from, float cost);
+
+/*
+ * Addresses and hosts refused at least once, of those the limiter still holds.
+ */
+int limiter_numLimited(limiter_t* limiter);
+
+/*
+ * Free the limiter.
+ */
+void limiter_delete(limiter_t* limiter);
+
+#endif // __LIMITER_H__
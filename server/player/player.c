@@ -16,9 +16,10 @@
 #include <ctype.h>
 
 typedef struct player {
-  char characterID;
+  int id; //index in the game's players; unique, unlike characterID
+  char characterID; //the letter the player is drawn as
   GameMap_t* gameMap; //store a pointer to the map object of the entire game
-  char* stealMessage;
+  int stolen; //gold that changed hands in the last theft the player was part of
   char** playerMap;
   int gold;
   char* name;
@@ -26,12 +27,22 @@ typedef struct player {
   int col;
   addr_t playerAddress;
   bool active;
+  unsigned long long session; //token the player's client can come back with
+  bool binary; //does the player's client take binary framing (see wire.h)?
+  int seenRow, seenCol; //where the player was at the last update of their map; -1 if unknown
+  bool overlay; //does the player's client build its display from TERRAIN and VIEW?
+  unsigned short sight[2 * SightRadius + 1]; //cells in sight at the last update, a row of bits
+                                             //each, around (seenRow, seenCol)
+  int* discovered; //cells (row * numCols + col) of terrain first seen since takeDiscovered
+  int numDiscovered;
+  int discoveredCapacity;
+  bool rediscover; //takeDiscovered gives all the terrain the player knows, not just the new
 } player_t;
 
 //function prototypes
-player_t* player_new(char ID, GameMap_t* map, char** grid, int gold, char* name, int row, int col, addr_t address);
+player_t* player_new(int id, GameMap_t* map, char** grid, int gold, char* name, int row, int col, addr_t address);
 void player_delete(player_t* player);
-player_t* getPlayerByID(player_t** players, char ID);
+player_t* getPlayerByID(player_t** players, int id);
 char* getPlayerName(player_t* player);
 int getPlayerGold(player_t* player);
 char** getPlayerMap(player_t* player);
@@ -39,13 +50,26 @@ int getPlayerRow(player_t* player);
 int getPlayerCol(player_t* player);
 addr_t getPlayerAddress(player_t* player);
 bool getPlayerActive(player_t* player);
-char* getStealMessage(player_t*player);
+int getStolenGold(player_t* player);
 void setPlayerInactive(player_t* player);
-void updateGoldDisplay(player_t* player, int pileAmount, int goldRemaining);
+void setPlayerAddress(player_t* player, addr_t address);
+unsigned long long getPlayerSession(player_t* player);
+void setPlayerSession(player_t* player, unsigned long long session);
+bool getPlayerBinary(player_t* player);
+void setPlayerBinary(player_t* player, bool binary);
+bool getPlayerOverlay(player_t* player);
+void setPlayerOverlay(player_t* player, bool overlay);
+const unsigned short* getPlayerSight(player_t* player, int* row, int* col);
+int takeDiscovered(player_t* player, const int** cells);
+static void discover(player_t* player, int cell);
+static int compareCells(const void* a, const void* b);
+void resetPlayer(player_t* player, int id, GameMap_t* map, char** grid, int row, int col);
 void addGold(player_t* player, int amount);
 void stealGold(player_t* player1, player_t* player2, int goldRemaining);
 void updatePlayerPosition(player_t* player);
 char getCharacterID(player_t* player);
+int getPlayerID(player_t* player);
+char getGlyphForID(int id);
 int moveDownRight(player_t* player, player_t** players, int goldRemaining);
 int moveDownLeft(player_t* player, player_t** players, int goldRemaining);
 int moveUpRight(player_t* player, player_t** players, int goldRemaining);
@@ -58,13 +82,14 @@ int moveRight(player_t* player, player_t** players, int goldRemaining);
 /*
  * Initializes a player and their data
  */
-player_t* player_new(char ID, GameMap_t* map, char** grid, int gold, char* name, int row, int col, addr_t address)
+player_t* player_new(int id, GameMap_t* map, char** grid, int gold, char* name, int row, int col, addr_t address)
 {
   player_t* player = malloc(sizeof(player_t));
   if (player == NULL) {
     return NULL;
   }
-  player->characterID = ID;
+  player->id = id;
+  player->characterID = getGlyphForID(id);
   player->gameMap = map;
   player->playerMap = grid;
   player->gold = gold;
@@ -73,7 +98,17 @@ player_t* player_new(char ID, GameMap_t* map, char** grid, int gold, char* name,
   player->col = col;
   player->playerAddress = address;
   player->active = true;
-  player->stealMessage = NULL;
+  player->stolen = 0;
+  player->session = 0;
+  player->binary = false;
+  player->seenRow = -1;
+  player->seenCol = -1;
+  player->overlay = false;
+  memset(player->sight, 0, sizeof(player->sight));
+  player->discovered = NULL;
+  player->numDiscovered = 0;
+  player->discoveredCapacity = 0;
+  player->rediscover = true;
   return player;
 }
 
@@ -87,9 +122,10 @@ void player_delete(player_t* player)
     player->name = NULL;
   }
   if (player->playerMap != NULL) {
-    deleteGrid(player->playerMap, getNumRows(player->gameMap));
+    deleteFrameGrid(player->playerMap);
     player->playerMap = NULL;
   }
+  free(player->discovered);
   free(player);
 }
 
@@ -148,16 +184,14 @@ getPlayerCol(player_t* player)
 }
 
 /*
- * Returns a player based on their ID
+ * Returns a player based on their ID (their index in players)
  */
-player_t* getPlayerByID(player_t** players, char ID)
+player_t* getPlayerByID(player_t** players, int id)
 {
-  char index = ID - 'A';
-  player_t* returner = players[(int)index];
-  if(returner != NULL){
-    return returner;
+  if (id < 0) {
+    return NULL;
   }
-  return NULL;
+  return players[id];
 }
 
 /*
@@ -170,9 +204,9 @@ getPlayerActive(player_t* player)
   return player->active;  
 }
 
-char*
-getStealMessage(player_t* player) {
-  return player->stealMessage;
+int
+getStolenGold(player_t* player) {
+  return player->stolen;
 }
 
 /*
@@ -184,18 +218,6 @@ addGold(player_t* player, int amount)
   player->gold += amount;
 }
 
-/*
- * Update the player's banner to reflect changes in gold 
- */
-void
-updateGoldDisplay(player_t* player, int pileAmount, int goldRemaining)
-{
-  char* goldMessage = malloc(50 * sizeof(char)); 
-  sprintf(goldMessage, "GOLD %d %d %d", pileAmount, player->gold, goldRemaining);
-  message_send(player->playerAddress, goldMessage);
-  free(goldMessage);
-}
-
 /*
  * Steal gold from another player when swapping places with them
  * player1 is the player stealing the gold 
@@ -219,13 +241,9 @@ void stealGold(player_t* player1, player_t* player2, int goldRemaining)
   player1->gold = player1->gold + stolen;
   player2->gold = player2->gold - stolen;
 
-  //set steal messages
-  char* stealMessage = malloc(50 * sizeof(char));
-  sprintf(stealMessage, "STOLEN %c %c %d %d %d", player2->characterID, player1->characterID, stolen, player1->gold, goldRemaining);
-  player1->stealMessage = stealMessage;
-  sprintf(stealMessage, "STOLEN %c %c %d %d %d", player2->characterID, player1->characterID, stolen, player2->gold, goldRemaining);
-  //send player2's message, player 1 message is sent in server
-  message_send(player2->playerAddress, stealMessage);
+  //the server tells both sides (see getStolenGold)
+  player1->stolen = stolen;
+  player2->stolen = stolen;
 }
 
 /*
@@ -246,9 +264,19 @@ updatePlayerPosition(player_t* player)
   int playerRow = player->row;
   int playerCol = player->col;
   
-  //replace all seen parts of the map with terrain 
-  for (int row = 0; row < numRows; row++) {
-    for (int col = 0; col < numCols; col++) {
+  //replace all seen parts of the map with terrain; players and gold
+  //were only ever put within sight of where the player last was, so
+  //only there, if we know where that was
+  int firstRow = 0, lastRow = numRows - 1;
+  int firstCol = 0, lastCol = numCols - 1;
+  if (player->seenRow >= 0) {
+    firstRow = (player->seenRow > SightRadius) ? player->seenRow - SightRadius : 0;
+    lastRow = (player->seenRow + SightRadius < numRows) ? player->seenRow + SightRadius : numRows - 1;
+    firstCol = (player->seenCol > SightRadius) ? player->seenCol - SightRadius : 0;
+    lastCol = (player->seenCol + SightRadius < numCols) ? player->seenCol + SightRadius : numCols - 1;
+  }
+  for (int row = firstRow; row <= lastRow; row++) {
+    for (int col = firstCol; col <= lastCol; col++) {
       if (grid[row][col] != ' ') {
         grid[row][col] = getCellTerrain(player->gameMap, row, col);
       }
@@ -261,15 +289,25 @@ updatePlayerPosition(player_t* player)
     printf("can't move there\n");
     return;
   }
+  //and note what they see, and terrain they had not seen, for an overlay
+  memset(player->sight, 0, sizeof(player->sight));
   int size = 0;
   for (int row = 0; visibleRegion[row][0] != -1; row++) {
     int visibleRow = visibleRegion[row][0];
     int visibleCol = visibleRegion[row][1];
+    if (player->overlay && !player->rediscover && grid[visibleRow][visibleCol] == ' '
+        && getCellTerrain(player->gameMap, visibleRow, visibleCol) != ' ') {
+      discover(player, visibleRow * numCols + visibleCol);
+    }
     grid[visibleRow][visibleCol] = getCellType(player->gameMap, visibleRow, visibleCol);
+    player->sight[visibleRow - playerRow + SightRadius] |= 1 << (visibleCol - playerCol + SightRadius);
     size++;
   }
-  //set the player's location
+  //set the player's location, which they see too
   grid[playerRow][playerCol] = '@';
+  player->sight[SightRadius] |= 1 << SightRadius;
+  player->seenRow = playerRow;
+  player->seenCol = playerCol;
   delete2DIntArr(visibleRegion, size+1);
 }
       
@@ -281,6 +319,22 @@ char getCharacterID(player_t* player)
   return player->characterID;
 }
 
+/*
+ * Returns a player's numeric ID
+ */
+int getPlayerID(player_t* player)
+{
+  return player->id;
+}
+
+/*
+ * The letter for a player ID: A to Z, then round again
+ */
+char getGlyphForID(int id)
+{
+  return 'A' + id % 26;
+}
+
 /*
  * Sets a player's active status to inactive 
  */
@@ -289,6 +343,159 @@ void setPlayerInactive(player_t* player)
   player->active = false;
 }
 
+/*
+ * Moves a player to a new address (their client came back from elsewhere)
+ */
+void setPlayerAddress(player_t* player, addr_t address)
+{
+  player->playerAddress = address;
+}
+
+/*
+ * Returns a player's session token, 0 if none
+ */
+unsigned long long getPlayerSession(player_t* player)
+{
+  return player->session;
+}
+
+/*
+ * Sets a player's session token
+ */
+void setPlayerSession(player_t* player, unsigned long long session)
+{
+  player->session = session;
+}
+
+/*
+ * Returns whether the player's client takes binary framing
+ */
+bool getPlayerBinary(player_t* player)
+{
+  return player->binary;
+}
+
+/*
+ * Sets whether the player's client takes binary framing
+ */
+void setPlayerBinary(player_t* player, bool binary)
+{
+  player->binary = binary;
+}
+
+/*
+ * Returns whether the player's client builds its display from TERRAIN
+ * and VIEW
+ */
+bool getPlayerOverlay(player_t* player)
+{
+  return player->overlay;
+}
+
+/*
+ * Sets whether the player's client builds its display from TERRAIN and
+ * VIEW; a client just starting one knows no terrain yet
+ */
+void setPlayerOverlay(player_t* player, bool overlay)
+{
+  player->overlay = overlay;
+  player->numDiscovered = 0;
+  player->rediscover = true;
+}
+
+/*
+ * Returns the cells the player saw at the last update of their map: bit
+ * c of row r is the cell (*row + r, *col + c)
+ */
+const unsigned short* getPlayerSight(player_t* player, int* row, int* col)
+{
+  *row = player->seenRow - SightRadius;
+  *col = player->seenCol - SightRadius;
+  return player->sight;
+}
+
+/*
+ * Gives the terrain cells the player has seen for the first time since
+ * the last call (or all they know, after a new map or setPlayerOverlay),
+ * in order, and forgets them; returns how many
+ */
+int takeDiscovered(player_t* player, const int** cells)
+{
+  if (player->rediscover) {
+    //everything known: every cell of the map that is not blank
+    char** grid = player->playerMap;
+    int numRows = getNumRows(player->gameMap);
+    int numCols = getNumCols(player->gameMap);
+    player->rediscover = false;
+    player->numDiscovered = 0;
+    for (int row = 0; row < numRows; row++) {
+      for (int col = 0; col < numCols; col++) {
+        if (grid[row][col] != ' ' && getCellTerrain(player->gameMap, row, col) != ' ') {
+          discover(player, row * numCols + col);
+        }
+      }
+    }
+  } else {
+    qsort(player->discovered, player->numDiscovered, sizeof(int), compareCells);
+  }
+  int count = player->numDiscovered;
+  *cells = player->discovered;
+  player->numDiscovered = 0;
+  return count;
+}
+
+/*
+ * Notes a cell of terrain the player has not been sent; if there is no
+ * room to, all they know will be sent instead
+ */
+static void discover(player_t* player, int cell)
+{
+  if (player->numDiscovered == player->discoveredCapacity) {
+    int capacity = (player->discoveredCapacity == 0) ? 128 : 2 * player->discoveredCapacity;
+    int* discovered = realloc(player->discovered, capacity * sizeof(int));
+    if (discovered == NULL) {
+      player->rediscover = true;
+      return;
+    }
+    player->discovered = discovered;
+    player->discoveredCapacity = capacity;
+  }
+  player->discovered[player->numDiscovered++] = cell;
+}
+
+/*
+ * Orders cells for qsort
+ */
+static int compareCells(const void* a, const void* b)
+{
+  return *(const int*) a - *(const int*) b;
+}
+
+/*
+ * Starts a player over for a new round, on a new map (or the same one
+ * reset) with a new ID and position, and no gold
+ * The player takes ownership of grid; a different old grid is freed
+ */
+void resetPlayer(player_t* player, int id, GameMap_t* map, char** grid, int row, int col)
+{
+  if (player->playerMap != NULL && player->playerMap != grid) {
+    deleteFrameGrid(player->playerMap);
+  }
+  player->playerMap = grid;
+  player->id = id;
+  player->characterID = getGlyphForID(id);
+  player->gameMap = map;
+  player->gold = 0;
+  player->row = row;
+  player->col = col;
+  player->seenRow = -1;
+  player->seenCol = -1;
+  player->stolen = 0;
+  memset(player->sight, 0, sizeof(player->sight));
+  player->numDiscovered = 0;
+  player->rediscover = true; //a new map, known only from the new grid
+}
+
 /*
  * Moves a player down and right
  * Returns 0 if regular movement, 1 if the player stepped on gold,
@@ -303,26 +510,26 @@ int moveDownRight(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row +1, player->col +1) == '#' ||
           getCellType(player->gameMap, player->row +1, player->col +1) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row +1, player->col +1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row +1, player->col +1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row +1;
         player->col = player->col +1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row +1, player->col+1))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row +1, player->col +1));
+      else if((0 <= getCellOccupant(player->gameMap, player->row +1, player->col+1))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row +1, player->col +1));
         int tempRow = player->row;
         int tempCol = player->col;
         player->row = player2->row;
         player->col = player2->col;
         player2->row = tempRow;
         player2->col = tempCol;
-        setCellType(player->gameMap, player->characterID, player->row, (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row, (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row, (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row, (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row +1, player-> col+1) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row+1, player->col +1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row+1, player->col +1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row+1;
         player->col = player->col +1;
@@ -349,26 +556,26 @@ int moveDownLeft(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row +1, player->col -1) == '#' ||
           getCellType(player->gameMap, player->row +1, player->col -1) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row +1, player->col -1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row +1, player->col -1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row +1;
         player->col = player->col -1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row +1, player->col-1))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row +1, player->col -1));
+      else if((0 <= getCellOccupant(player->gameMap, player->row +1, player->col-1))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row +1, player->col -1));
         int tempRow = player->row;
         int tempCol = player->col;
         player->row = player2->row;
         player->col = player2->col;
         player2->row = tempRow;
         player2->col = tempCol;
-        setCellType(player->gameMap, player->characterID, player->row  , (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row  , (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row  , (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row  , (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row +1, player-> col-1) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row+1, player->col -1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row+1, player->col -1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row+1;
         player->col = player->col -1;
@@ -395,26 +602,26 @@ int moveUpRight(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row -1, player->col +1) == '#' ||
           getCellType(player->gameMap, player->row -1, player->col +1) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row -1, player->col +1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row -1, player->col +1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row -1;
         player->col = player->col +1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row -1, player->col+1))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row - 1, player->col +1));
+      else if((0 <= getCellOccupant(player->gameMap, player->row -1, player->col+1))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row - 1, player->col +1));
         int tempRow = player->row;
         int tempCol = player->col;
         player->row = player2->row;
         player->col = player2->col;
         player2->row = tempRow;
         player2->col = tempCol;
-        setCellType(player->gameMap, player->characterID, player->row , (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row , (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row , (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row , (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row -1, player-> col+1) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row-1, player->col +1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row-1, player->col +1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row-1;
         player->col = player->col +1;
@@ -441,26 +648,26 @@ int moveUpLeft(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row -1, player->col -1) == '#' ||
           getCellType(player->gameMap, player->row -1, player->col -1) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row -1, player->col -1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row -1, player->col -1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row -1;
         player->col = player->col -1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row -1, player->col-1))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row - 1, player->col -1));
+      else if((0 <= getCellOccupant(player->gameMap, player->row -1, player->col-1))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row - 1, player->col -1));
         int tempRow = player->row;
         int tempCol = player->col;
         player->row = player2->row;
         player->col = player2->col;
         player2->row = tempRow;
         player2->col = tempCol;
-        setCellType(player->gameMap, player->characterID, player->row, (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row , (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row, (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row , (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row -1, player-> col-1) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row-1, player->col -1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row-1, player->col -1);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row-1;
         player->col = player->col -1;
@@ -487,22 +694,22 @@ int moveUp(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row -1, player->col) == '#' ||
           getCellType(player->gameMap, player->row -1, player->col) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row -1, player->col);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row -1, player->col);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row -1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row -1, player->col))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row - 1, player->col));
+      else if((0 <= getCellOccupant(player->gameMap, player->row -1, player->col))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row - 1, player->col));
         int tempRow = player->row;
         player->row = player2->row;
         player2->row = tempRow;
-        setCellType(player->gameMap, player->characterID, player->row , (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row , (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row , (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row , (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row -1, player-> col) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row-1, player->col);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row-1, player->col);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row-1;
         flag = 1;
@@ -528,22 +735,22 @@ int moveDown(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row +1, player->col) == '#' ||
           getCellType(player->gameMap, player->row +1, player->col) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row +1, player->col);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row +1, player->col);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row +1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row +1, player->col))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row + 1, player->col));
+      else if((0 <= getCellOccupant(player->gameMap, player->row +1, player->col))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row + 1, player->col));
         int tempRow = player->row;
         player->row = player2->row;
         player2->row = tempRow;
-        setCellType(player->gameMap, player->characterID, player->row , (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row , (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row , (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row , (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row +1, player-> col) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row+1, player->col);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row+1, player->col);
         restoreCell(player->gameMap, player->row, player->col);
         player->row = player->row+1;
         flag = 1;
@@ -569,22 +776,22 @@ int moveLeft(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row, player->col-1) == '#' ||
           getCellType(player->gameMap, player->row, player->col-1) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row, player->col-1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row, player->col-1);
         restoreCell(player->gameMap, player->row, player->col);
         player->col = player->col - 1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row, player->col-1))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row, player->col-1));
+      else if((0 <= getCellOccupant(player->gameMap, player->row, player->col-1))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row, player->col-1));
         int tempRow = player->col;
         player->col = player2->col;
         player2->col = tempRow;
-        setCellType(player->gameMap, player->characterID, player->row , (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row , (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row , (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row , (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row, player->col-1) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row, player->col-1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row, player->col-1);
         restoreCell(player->gameMap, player->row, player->col);
         player->col = player->col-1;
         flag = 1;
@@ -610,22 +817,22 @@ int moveRight(player_t* player, player_t** players, int goldRemaining)
     if(getPlayerActive(player)){
       if(getCellType(player->gameMap, player->row, player->col+1) == '#' ||
           getCellType(player->gameMap, player->row, player->col+1) == '.'){
-        setCellType(player->gameMap, player->characterID, player->row , player->col+1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row , player->col+1);
         restoreCell(player->gameMap, player->row, player->col);
         player->col = player->col + 1;
       }
-      else if(isalpha(getCellType(player->gameMap, player->row , player->col+1))){
-        player_t* player2 = getPlayerByID(players, getCellType(player->gameMap, player->row , player->col+1));
+      else if((0 <= getCellOccupant(player->gameMap, player->row , player->col+1))){
+        player_t* player2 = getPlayerByID(players, getCellOccupant(player->gameMap, player->row , player->col+1));
         int tempRow = player->col;
         player->col = player2->col;
         player2->col = tempRow;
-        setCellType(player->gameMap, player->characterID, player->row , (player->col));
-        setCellType(player->gameMap, player2->characterID, player2->row , (player2->col));
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row , (player->col));
+        setCellOccupant(player->gameMap, player2->id, player2->characterID, player2->row , (player2->col));
         stealGold(player, player2, goldRemaining);
         flag = 2;
       }
       else if(getCellType(player->gameMap, player->row, player-> col+1) == '*'){
-        setCellType(player->gameMap, player->characterID, player->row, player->col+1);
+        setCellOccupant(player->gameMap, player->id, player->characterID, player->row, player->col+1);
         restoreCell(player->gameMap, player->row, player->col);
         player->col = player->col+1;
         flag = 1;
@@ -13,8 +13,11 @@ typedef struct player player_t;
 
 /*
  * Creates a new player with specified information
+ * id is the player's index in the game's players; it is drawn as the
+ * letter getGlyphForID(id)
+ * The player takes ownership of grid, which must come from newFrameGrid
  */
-player_t* player_new(char ID, GameMap_t* map, char** grid, int gold, char* name, int row, int col, addr_t playerAddress);
+player_t* player_new(int id, GameMap_t* map, char** grid, int gold, char* name, int row, int col, addr_t playerAddress);
 
 /*
  * Deletes the contents of a player, frees the player struct itself
@@ -51,9 +54,10 @@ int getPlayerGold(player_t* player);
  */
 addr_t getPlayerAddress(player_t* player);
 /*
- * Returns a player based on their ID
+ * Returns a player based on their ID (their index in players),
+ * or NULL if id is negative (as for a cell with no one on it)
  */
-player_t* getPlayerByID(player_t** players, char ID);
+player_t* getPlayerByID(player_t** players, int id);
 
 /*
  * Returns whether a player is active or not
@@ -62,22 +66,73 @@ player_t* getPlayerByID(player_t** players, char ID);
 bool getPlayerActive(player_t* player);
 
 /*
- * Returns the "stealMessage"
- * This is used because when a player steals gold from another player,
- * We also need to send that update to the spectator, which is accessed in the server
- * The server uses this function to get the message to send to the spectator
+ * Returns the gold that changed hands in the last theft this player was
+ * part of, as thief or victim (0 if none yet this round)
+ * When a player steals gold from another player, both get a STOLEN message
+ * (with their own gold), and the stealer's also goes to the spectators
  */
-char* getStealMessage(player_t* player);
+int getStolenGold(player_t* player);
 /*
  * Set's a player's status to inactive
  */
 void setPlayerInactive(player_t* player);
 
 /*
- * Update's a player's banner to reflect changes in gold
+ * Moves a player to a new address, for a client that came back from
+ * another one (see getPlayerSession)
  */
+void setPlayerAddress(player_t* player, addr_t address);
 
-void updateGoldDisplay(player_t* player, int pileAmount, int goldRemaining);
+/*
+ * Returns the session token of a player, which its client can give to
+ * be taken back as that player; 0 if none has been set
+ */
+unsigned long long getPlayerSession(player_t* player);
+
+/*
+ * Sets a player's session token
+ */
+void setPlayerSession(player_t* player, unsigned long long session);
+
+/*
+ * Whether the player's client takes binary framing (see wire.h); false
+ * until set
+ */
+bool getPlayerBinary(player_t* player);
+void setPlayerBinary(player_t* player, bool binary);
+
+/*
+ * Whether the player's client builds its display itself, from the
+ * terrain it has been sent (TERRAIN) and what is in sight (VIEW); false
+ * until set. Setting it starts the client over knowing no terrain
+ */
+bool getPlayerOverlay(player_t* player);
+void setPlayerOverlay(player_t* player, bool overlay);
+
+/*
+ * Returns the cells the player saw at the last update of their map, as
+ * 2 * SightRadius + 1 rows of bits: bit c of row r is whether the cell
+ * (*row + r, *col + c) was in sight
+ */
+const unsigned short* getPlayerSight(player_t* player, int* row, int* col);
+
+/*
+ * For a player whose client builds its display (getPlayerOverlay): sets
+ * *cells to the terrain cells (row * numCols + col), in order, that the
+ * player has seen since the last call and so the client does not have;
+ * after a new map, or setPlayerOverlay, that is all the player knows
+ * Returns how many there are; the player keeps the array, and reuses it
+ * at the next update of their map
+ */
+int takeDiscovered(player_t* player, const int** cells);
+
+/*
+ * Starts a player over for a new round: new ID (and so letter), map,
+ * position, no gold
+ * The player takes ownership of grid (from newFrameGrid); if it is not
+ * the player's current map, the old one is freed
+ */
+void resetPlayer(player_t* player, int id, GameMap_t* map, char** grid, int row, int col);
 
 /*
  * Adds gold to a player
@@ -87,6 +142,7 @@ void addGold(player_t* player, int amount);
 
 /*
  * Method for when one player steals gold from another
+ * player1 is the stealer; both remember how much (see getStolenGold)
  */
 
 void stealGold(player_t* player1, player_t* player2, int goldRemaining);
@@ -98,11 +154,23 @@ void stealGold(player_t* player1, player_t* player2, int goldRemaining);
 void updatePlayerPosition(player_t* player);
 
 /*
- * Returns a player's character ID 
+ * Returns a player's character ID: the letter it is drawn as, which
+ * other players in a big game may share (see getPlayerID)
  */
 
 char getCharacterID(player_t* player);
 
+/*
+ * Returns a player's numeric ID, unique in its game
+ */
+int getPlayerID(player_t* player);
+
+/*
+ * The letter a player with this ID is drawn as: A to Z, then A to Z
+ * again, since the display has only the letters for players
+ */
+char getGlyphForID(int id);
+
 /*
  * Moves a player down and right
  * Returns 0 if regular movement, 1 if the player stepped on gold,
@@ -1,889 +1,475 @@
 /*
  * Server - This module acts as the server for the 
  * 'nuggets' game. 
- * It allows up to 26 players and 1 spectator at a time
+ * It allows up to 500 players and any number of spectators at a time.
+ * The game itself is in the game core (gamecore.h); the server
+ * carries its messages over the network
  * 
  * Author: Jaysen Quan, Dartmouth CS 50, Winter 2024
  */
 
+#define _POSIX_C_SOURCE 200809L // for sigaction
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <strings.h>
-#include <time.h>
 #include <unistd.h>
+#include <signal.h>
 
 #include "../support/message.h"
-#include "../gamemap/gamemap.h"
-#include "player/player.h"
-
-static const int MaxPlayers = 27;      // maximum number of players (includes spectator)
-static const int GoldTotal = 250;      // amount of gold in the game
-static const int GoldMinNumPiles = 10; // minimum number of gold piles
-static const int GoldMaxNumPiles = 30; // maximum number of gold piles
+#include "../support/wire.h"
+#include "../support/log.h"
+#include "../gamemap/file.h"
+#include "gamecore.h"
+#include "limiter.h"
+
+static const float SpectatorFps = 30;  // default cap on spectator frames per second
+static const float Rate = 100;         // default messages a second from one address
+static const float InvalidCost = 10;   // what a message that is no command counts as
+static const int MaxKeyMerge = 100;    // most steps in one KEY (the game's MaxKeyRepeat)
+static const float StatsCheck = 0.25;  // seconds between looks for a SIGUSR1
+static const int LogTruncate = 200;    // bytes of a string kept in the --log file
 
 /****************** local types *********************/
-typedef struct goldPile {
-  int row;
-  int col;
-  int amount;
-} goldPile_t;
-
-typedef struct game {
-  int currentNumPlayers;
-  int numGoldPiles;
-  int goldRemaining; 
-  player_t** players;
-  goldPile_t** goldPiles;
-  GameMap_t* map;
-  bool spectatorActive;
-} game_t;
-
-//global types
-game_t* game;
+typedef struct server {
+  game_t* game;
+  limiter_t* limiter;          // NULL if there is no rate limit
+  // a step ("KEY k") held back, to go to the game with the same steps
+  // right after it, from the same client, as one "KEY k count"
+  addr_t stepFrom;
+  char stepKey;
+  int steps;                   // 0 if none is held
+  // counts, for the operator (see printStats)
+  long received;               // messages
+  long dropped;                // commands over a client's rate
+  long rejected;               // messages that are no command, over the rate
+  long merged;                 // steps sent to the game as part of another
+} server_t;
+
+// set by SIGUSR1: print the counts at the stats timer's next call
+static volatile sig_atomic_t statsRequested = 0;
 
 //function prototypes
-void initializeGame();
+static void parseArgs(int argc, char* argv[], char** mapFile, float* spectatorFps,
+                      bool* persistent, char** rotationFile,
+                      char** snapshotFile, bool* resume, float* rate,
+                      int* busyPoll, int* cpu, char** logName, int* logLevel);
+static bool loadRotation(game_t* game, const char* rotationFile);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
-void updateSpectatorDisplay();
-void removeSpectator();
-void distributeGold();
-void sendStartingGold(player_t* player);
-void collectGold(player_t* player);
-void sendGoldUpdate(player_t* player, int pileAmount);
-void spawnGold(int rol, int col);
-void spawnPlayer(player_t* player, int row, int col);
-void callCommand(player_t* player, char key);
-void sendGrid(player_t* player, bool isSpectator);
-void sendDisplay(player_t* player, bool isSpectator);
-char** initializePlayerMap(int row, int col);
-void updateCurrentPlayerVision();
-player_t* spectatorJoin(addr_t address, char* name);
-player_t* playerJoin(addr_t address, char* name);
-player_t* checkPlayerJoined(addr_t address);
-void playerQuit(player_t* player);
-void spectatorQuit(player_t* spectator);
-void sendGameSummary();
-void cleanUpGame();
+static bool handleTimeout(void* arg);
+static bool handleStatsTimer(void* arg);
+static bool isCommand(const char* message);
+static bool isStep(const char* message, char* key);
+static bool sendSteps(server_t* server);
+static void requestStats(int signal);
+static void printStats(server_t* server);
+static void sinkSend(void* arg, const addr_t to, const char* message);
+static void sinkSendBytes(void* arg, const addr_t to, const char* message, int length);
+static void sinkSendFrame(void* arg, const addr_t to[], int count,
+                          const char* frame, int length);
+static void sinkFlush(void* arg);
 
 int 
 main(int argc, char* argv[])
 { 
   // check arguments
-  const char* program = argv[0];
   char* mapFile = NULL;
-  if (argc == 2) { // argv[1] is the map
-    mapFile = argv[1];
-    srand(getpid());
-  } else if (argc == 3) { // argv[2] is the seed
-    mapFile = argv[1];
-    int randSeed;
-    char extra;
-    if (sscanf(argv[2], "%d%c", &randSeed, &extra) != 1) {
-      return 3; //bad commandline
+  float spectatorFps = SpectatorFps;
+  bool persistent = false;
+  char* rotationFile = NULL;
+  char* snapshotFile = NULL;
+  bool resume = false;
+  float rate = Rate;
+  int busyPoll = 0;
+  int cpu = -1;
+  char* logName = NULL;
+  int logLevel = LOG_INFO;
+  parseArgs(argc, argv, &mapFile, &spectatorFps, &persistent, &rotationFile,
+            &snapshotFile, &resume, &rate, &busyPoll, &cpu, &logName, &logLevel);
+
+  // with --log, the message module logs into the file through a
+  // background thread, so the loop only copies each record into
+  // memory (see log_async)
+  FILE* logOut = NULL;
+  if (logName != NULL) {
+    if ((logOut = fopen(logName, "a")) == NULL) {
+      fprintf(stderr, "Could not open %s for logging\n", logName);
+      return 3; // bad commandline
+    }
+    log_setLevel(logLevel);
+    if (!log_async(LogTruncate)) {
+      fprintf(stderr, "Could not start the log writer; logging as it happens\n");
     }
-    srand(randSeed);
-  } else {
-    fprintf(stderr, "usage: %s mapFile [seed]\n", program);
-    return 3; // bad commandline
   }
 
-  // initialize the message module (without logging)
-  int myPort = message_init(NULL);
+  // initialize the message module (logging only with --log); a resumed
+  // server listens where the clients of its game know to find it, and
+  // clients on this host may share memory with it
+  int port = 0;
+  if (resume && (port = game_snapshotPort(snapshotFile)) == 0) {
+    fprintf(stderr, "%s is not a snapshot\n", snapshotFile);
+    return 4; // failure to set up the game
+  }
+  int myPort = message_initShared(logOut, port);
   if (myPort == 0) {
     return 2; // failure to initialize message module
   } else {
     printf("serverPort=%d\n", myPort);
   }
 
-  initializeGame(mapFile);
+  // a dedicated host can give a core to answering sooner
+  if ((busyPoll > 0 || cpu >= 0) && !message_busyPoll(busyPoll, cpu)) {
+    fprintf(stderr, "Could not set up all of --busy-poll and --cpu; going on without\n");
+  }
 
-  // Loop, waiting for input or for messages; provide callback functions.
-  // We use the 'arg' parameter to carry a pointer to 'server'.
-  bool ok = message_loop(NULL, 0, NULL, NULL, handleMessage);
+  // the game answers over the network
+  gameSink_t sink = { NULL, sinkSend, sinkSendBytes, sinkSendFrame, sinkFlush };
+  game_t* game = game_new(mapFile, spectatorFps, sink);
+  if (game == NULL || (rotationFile != NULL && !loadRotation(game, rotationFile))) {
+    game_delete(game);
+    message_done();
+    return 4; // failure to set up the game
+  }
+  game_setPersistent(game, persistent);
+
+  // carry on the game in the snapshot, or start keeping one
+  if (snapshotFile != NULL
+      && !(resume ? game_resume(game, snapshotFile)
+                  : game_snapshot(game, snapshotFile, myPort))) {
+    game_delete(game);
+    message_done();
+    return 4; // failure to set up the game
+  }
+
+  // each client gets rate messages a second, and a second's worth at once
+  server_t server = { .game = game };
+  if (rate > 0 && (server.limiter = limiter_new(rate, rate)) == NULL) {
+    fprintf(stderr, "Could not allocate the rate limiter\n");
+    game_delete(game);
+    message_done();
+    return 4; // failure to set up the game
+  }
+
+  // SIGUSR1 asks for the counts; the message loop carries on through it,
+  // and a timer prints them soon after
+  struct sigaction action = { .sa_handler = requestStats };
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+  if (message_timerAdd(StatsCheck, StatsCheck, handleStatsTimer, &server) == 0) {
+    fprintf(stderr, "Could not set the stats timer\n");
+    limiter_delete(server.limiter);
+    game_delete(game);
+    message_done();
+    return 4; // failure to set up the game
+  }
 
-  // shut down the message module
+  // Loop, waiting for input or for messages; provide callback functions.
+  // The timeout lets a spectator frame held back by the frame-rate cap
+  // go out once the game goes quiet.
+  // The loop ends when the game is over; a persistent game never is.
+  float timeout = game_spectatorInterval(game);
+  bool ok = message_loop(&server, timeout, timeout > 0 ? handleTimeout : NULL,
+                         NULL, handleMessage);
+  printStats(&server);
+
+  // free the game, then shut down the message module and the log
+  limiter_delete(server.limiter);
+  game_delete(game);
   message_done();
+  if (logOut != NULL) {
+    log_syncDone();   // the writer is done with the file
+    fclose(logOut);
+  }
   
   return ok? 0 : 1; // status code depends on result of message_loop
 }
 
 /*
- * Initialize the main elements of the game 
+ * Parse the command line:
+ *   [--spectator-fps N] [--persist] [--rotation FILE]
+ *   [--snapshot FILE | --resume FILE] [--rate N]
+ *   [--busy-poll MICROSECONDS] [--cpu N] [--log FILE] [--log-level N]
+ *   mapFile [seed]
+ * --rotation implies --persist; --resume carries on the game in FILE
+ * (given the same maps), and keeps snapshotting into it; --rate 0
+ * lifts the limit on messages a second from one address; --busy-poll
+ * spins that long for a message before sleeping, and --cpu pins the
+ * server to a CPU (see message_busyPoll); --log appends the message
+ * module's log to FILE, up to level N (0 errors to 3 every payload,
+ * default 1; see log.h)
+ * Seeds the random-number generator; exits on a bad command line.
  */
-void 
-initializeGame(char* mapFile) 
+static void
+parseArgs(int argc, char* argv[], char** mapFile, float* spectatorFps,
+          bool* persistent, char** rotationFile,
+          char** snapshotFile, bool* resume, float* rate,
+          int* busyPoll, int* cpu, char** logName, int* logLevel)
 {
-  if (mapFile == NULL) {
-    fprintf(stderr, "mapFile is NULL");
-    exit(3); // bad commandline
-  }
-  game = malloc(sizeof(game_t));
-  if (game == NULL) {
-    fprintf(stderr, "Error allocating memory for game\n");
-    return;
-  }
-  game->map = loadMapFile(mapFile);
-  if (game->map == NULL) {
-    fprintf(stderr, "Error loading map\n");
-    return;
-  }
-  game->players = malloc(MaxPlayers * sizeof(player_t*));
-  if (game->players == NULL) {
-    fprintf(stderr, "Error creating player array\n");
-    return;
-  }
-  //initialize all players as null
-  for (int i = 0; i < MaxPlayers; i++) {
-    game->players[i] = NULL;
-  }   
-  game->currentNumPlayers = 0;
-  game->spectatorActive = false;
-  distributeGold();
-}
+  const char* program = argv[0];
+  int arg = 1;
 
-/* 
- * Handles incoming messages from the client 
- */
-static bool
-handleMessage(void* arg, const addr_t from, const char* message)
-{
-  char command[20]; //store the command
-  char name[30]; //store the player name
-
-  player_t* player;
-  if (sscanf(message, "PLAY %s", name) == 1) {
-    char* playerName = malloc(30 * sizeof(char));
-    strcpy(playerName, name);
-    player = playerJoin(from, playerName); 
-    addr_t playerAddress = getPlayerAddress(player);
-    char playerID = getCharacterID(player);
-    
-    //send "OK [playerID]" message to client
-    char* okMessage = malloc(10 * sizeof(char)); //used to store message that contains client's charID (sent to client)
-    sprintf(okMessage, "OK %c", playerID);
-    message_send(playerAddress, okMessage);
-    
-    //Send info to clients and update all active player information
-    sendGrid(player, false);
-    sendStartingGold(player);
-    updateCurrentPlayerVision();
-    updateSpectatorDisplay();
-    free(okMessage);
-  } else if (sscanf(message, "KEY %s", command) == 1) {
-    player = checkPlayerJoined(from); 
-    if (player == NULL) {
-      //if the spectator is in the game and none of the players sent the message,
-      //we know the messaage game from the spectator
-      if (game->spectatorActive) {
-        player = game->players[MaxPlayers-1];
-      } else {
-        return false; //don't do anything -- keep running
-      }
-    }
-    char key = command[0];
-    callCommand(player, key);
-  } else if (strcmp(message, "SPECTATE") == 0) {
-    // check if there is already a spectator in the game
-    // if so, remove them before adding the new one 
-    if (game->spectatorActive) {
-      removeSpectator();
+  // options come first
+  while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+    char extra;
+    if (strcmp(argv[arg], "--spectator-fps") == 0 && arg + 1 < argc
+        && sscanf(argv[arg+1], "%f%c", spectatorFps, &extra) == 1
+        && *spectatorFps >= 0) {
+      arg += 2;
+    } else if (strcmp(argv[arg], "--persist") == 0) {
+      *persistent = true;
+      arg++;
+    } else if (strcmp(argv[arg], "--rotation") == 0 && arg + 1 < argc) {
+      *rotationFile = argv[arg+1];
+      *persistent = true;
+      arg += 2;
+    } else if ((strcmp(argv[arg], "--snapshot") == 0 || strcmp(argv[arg], "--resume") == 0)
+               && arg + 1 < argc && *snapshotFile == NULL) {
+      *resume = (strcmp(argv[arg], "--resume") == 0);
+      *snapshotFile = argv[arg+1];
+      arg += 2;
+    } else if (strcmp(argv[arg], "--rate") == 0 && arg + 1 < argc
+               && sscanf(argv[arg+1], "%f%c", rate, &extra) == 1
+               && *rate >= 0) {
+      arg += 2;
+    } else if (strcmp(argv[arg], "--busy-poll") == 0 && arg + 1 < argc
+               && sscanf(argv[arg+1], "%d%c", busyPoll, &extra) == 1
+               && *busyPoll >= 0) {
+      arg += 2;
+    } else if (strcmp(argv[arg], "--cpu") == 0 && arg + 1 < argc
+               && sscanf(argv[arg+1], "%d%c", cpu, &extra) == 1
+               && *cpu >= 0) {
+      arg += 2;
+    } else if (strcmp(argv[arg], "--log") == 0 && arg + 1 < argc) {
+      *logName = argv[arg+1];
+      arg += 2;
+    } else if (strcmp(argv[arg], "--log-level") == 0 && arg + 1 < argc
+               && sscanf(argv[arg+1], "%d%c", logLevel, &extra) == 1
+               && *logLevel >= LOG_ERROR && *logLevel <= LOG_TRACE) {
+      arg += 2;
+    } else {
+      fprintf(stderr, "usage: %s [--spectator-fps N] [--persist] [--rotation FILE] [--snapshot FILE | --resume FILE] [--rate N] [--busy-poll MICROSECONDS] [--cpu N] [--log FILE] [--log-level N] mapFile [seed]\n", program);
+      exit(3); // bad commandline
     }
-    char* spectatorName = malloc(strlen("SPECTATOR")+1 * sizeof(char));
-    strcpy(spectatorName, "SPECTATOR");
-    player = spectatorJoin(from, spectatorName);
-    addr_t spectatorAddress = getPlayerAddress(player);
-    message_send(spectatorAddress, "OK A");
-    sendGrid(player, true);
-    sendStartingGold(player);
-    sendDisplay(player, true);
-  } else {
-    char invalidMessage[100];
-    sprintf(invalidMessage, "Invalid message format: %s", message);
-    message_send(from, invalidMessage);
   }
-  //server keeps running
-  return false;
-}
 
-/*
- * Switch statement that calls command based on the client's input
- */
-void callCommand(player_t* player, char key) 
-{ 
-  int atGold = 0;
-  switch (key) {
-    case 'Q':
-      //check if its the spectator
-      if (game->spectatorActive) {
-        player_t* spectator = game->players[MaxPlayers-1];
-        addr_t spectatorAddress = getPlayerAddress(spectator);
-        addr_t playerAddress = getPlayerAddress(player);
-        if (message_eqAddr(playerAddress, spectatorAddress)) {
-          spectatorQuit(spectator);
-        }
-      } else {
-        playerQuit(player);
-      }
-      break;
-    case 'h':
-      atGold = moveLeft(player, game->players, game->goldRemaining);    
-      break;
-    case 'l':
-      atGold = moveRight(player, game->players, game->goldRemaining);
-      break;
-    case 'j':
-      atGold = moveDown(player, game->players, game->goldRemaining);
-      break;
-    case 'k':
-      atGold = moveUp(player, game->players, game->goldRemaining);
-      break;
-    case 'y':
-      atGold = moveUpLeft(player, game->players, game->goldRemaining);
-      break;
-    case 'u':
-      atGold = moveUpRight(player, game->players, game->goldRemaining);
-      break;
-    case 'b':
-      atGold = moveDownLeft(player, game->players, game->goldRemaining);
-      break;
-    case 'n':
-      atGold = moveDownRight(player, game->players, game->goldRemaining);
-      break;
-    case 'H':
-      while(true) {
-        atGold = moveLeft(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-      break;
-    case 'L':
-      while(true) {
-        atGold = moveRight(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-     break;
-    case 'J':
-      while(true) {
-        atGold = moveDown(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-      break;
-    case 'K':
-      while(true) {
-        atGold = moveUp(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-      break;
-    case 'Y':
-      while(true) {
-        atGold = moveUpLeft(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-      break;
-    case 'U':
-      while(true) {
-        atGold = moveUpRight(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-      break;
-    case 'B':
-      while(true) {
-        atGold = moveDownLeft(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-      break;
-    case 'N':
-      while(true) {
-        atGold = moveDownRight(player, game->players, game->goldRemaining);
-        if (atGold == 1) {
-          collectGold(player);
-        } else if (atGold == 3) {
-          break;
-        }
-      }
-      break;    
-    default: 
-      printf("not a valid command\n");
-      break;
-  }
-  //if atGold == 1, then a player picked up gold
-  if (atGold == 1) {
-    collectGold(player);
-  //if atGold == 2, a player has stolen gold
-  } else if (atGold == 2) {
-    //get the player's steal message (in case we need to send it to the spectator if they are active)
-    char* playerStealMessage = getStealMessage(player);
-    if (playerStealMessage != NULL) {
-      addr_t playerAddress = getPlayerAddress(player);
-      message_send(playerAddress, playerStealMessage);
-      //check if the spectator is in the game, if so send them the message
-      if (game->spectatorActive) {
-        player_t* spectator = game->players[MaxPlayers-1];
-        addr_t spectatorAddress = getPlayerAddress(spectator);
-        message_send(spectatorAddress, playerStealMessage);
-      }
-      free(playerStealMessage);
+  if (argc - arg == 1) { // argv[arg] is the map
+    *mapFile = argv[arg];
+    srand(getpid());
+  } else if (argc - arg == 2) { // argv[arg+1] is the seed
+    *mapFile = argv[arg];
+    int randSeed;
+    char extra;
+    if (sscanf(argv[arg+1], "%d%c", &randSeed, &extra) != 1) {
+      exit(3); //bad commandline
     }
-  }
-  //only send to client if a movement command was called 
-  if (key != 'Q') {
-    updateCurrentPlayerVision();
-    updateSpectatorDisplay();
+    srand(randSeed);
+  } else {
+    fprintf(stderr, "usage: %s [--spectator-fps N] [--persist] [--rotation FILE] [--snapshot FILE | --resume FILE] [--rate N] [--busy-poll MICROSECONDS] [--cpu N] [--log FILE] [--log-level N] mapFile [seed]\n", program);
+    exit(3); // bad commandline
   }
 }
 
 /*
- * Update the spectator's display
+ * Preload the maps listed in rotationFile, one path per line (blank
+ * lines skipped), to follow mapFile in the rotation; false if the file
+ * or any map in it cannot be read
  */
-void
-updateSpectatorDisplay() 
+static bool
+loadRotation(game_t* game, const char* rotationFile)
 {
-  //send update to spectator
-  if (game->spectatorActive) {
-    player_t* spectator = game->players[MaxPlayers-1];
-    sendDisplay(spectator, true);
+  FILE* fp = fopen(rotationFile, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "Could not open rotation file %s\n", rotationFile);
+    return false;
+  }
+  bool ok = true;
+  char* line;
+  while (ok && (line = file_readLine(fp)) != NULL) {
+    if (line[0] != '\0') {
+      ok = game_addMap(game, line);
+    }
+    free(line);
   }
+  fclose(fp);
+  return ok;
 }
 
 /* 
- * If another client joins as a spectator, kick the old one
- */
-void
-removeSpectator() 
-{
-  player_t* currSpectator = game->players[MaxPlayers-1];
-  spectatorQuit(currSpectator);
-}
-
-/*
- * Randomly distributes the gold throughout the map
+ * Handles incoming messages from the client; true ends the loop, once
+ * the game is over. A client over its rate is dropped before the game
+ * sees it (and one sending what is no command at all, sooner), and
+ * steps queued up in one batch go to the game together. A sender that
+ * has not joined as a player is charged to its host, not its address,
+ * so a new port for each message gets it nothing
  */
-void distributeGold() 
+static bool
+handleMessage(void* arg, const addr_t from, const char* message)
 {
-  //generate random number of gold piles
-  game->numGoldPiles = GoldMinNumPiles + rand() % (GoldMaxNumPiles - GoldMinNumPiles + 1);
-  game->goldPiles = malloc(game->numGoldPiles * sizeof(goldPile_t*));
-
-  //reservoir sampling
-  //get valid "room" (.) cells 
-  int** roomCells = getRoomCells(game->map);
-  int size = 0;
-  // get number of room cells
-  for (size = 0; roomCells[size][0] != -1; size++) {
-  }
-  if (size < game->numGoldPiles) {
-    fprintf(stderr, "not enough room cells to distribute gold\n");
-    return;
-  }
-  // reservoir sampling to get indices
-  int* indices = malloc(game->numGoldPiles * sizeof(int));
-  if (indices == NULL) {
-    fprintf(stderr, "distributeGold memory allocation failed\n");
-    return;
-  }
-  //set the indices to temp placeholder i
-  for (int i = 0; i < game->numGoldPiles; i++) {
-    indices[i] = i;
-  }
-  //update each index with a random number
-  for (int i = game->numGoldPiles; i < size; i++) {
-    int j = rand() % (i + 1);
-
-    if (j < game->numGoldPiles) {
-        indices[j] = i;
+  server_t* server = arg;
+  bool over = false;
+  char key;
+  server->received++;
+
+  bool command = isCommand(message);
+  float cost = command ? 1 : InvalidCost;
+  if (server->limiter != NULL
+      && !(game_isPlayer(server->game, from)
+           ? limiter_allow(server->limiter, from, cost)
+           : limiter_allowHost(server->limiter, from, cost))) {
+    if (command) {
+      server->dropped++;
+    } else {
+      server->rejected++;
     }
-  }
-
-  // go through indices and spawn gold piles at roomCells[indices[i]] = (row, col)
-  for (int i = 0; i < game->numGoldPiles; i++) {
-    int roomCellIndex = indices[i];
-    int row = roomCells[roomCellIndex][0];
-    int col = roomCells[roomCellIndex][1];
-
-    //create the goldpile object
-    goldPile_t* goldPile = malloc(sizeof(goldPile_t));
-    if (goldPile != NULL) {
-      goldPile->amount = 0;
-      goldPile->row = row;
-      goldPile->col = col;
-      game->goldPiles[i] = goldPile;
+  } else if (isStep(message, &key)) {
+    if (server->steps > 0 && server->steps < MaxKeyMerge
+        && key == server->stepKey && message_eqAddr(from, server->stepFrom)) {
+      server->steps++;
+      server->merged++;
+    } else {
+      over = sendSteps(server);
+      server->stepFrom = from;
+      server->stepKey = key;
+      server->steps = 1;
     }
-
-    //update the map
-    spawnGold(row, col);
+  } else if (wire_isBinary(message, message_length())) {
+    over = sendSteps(server)
+      || game_handleBinary(server->game, from, message, message_length());
+  } else {
+    over = sendSteps(server) || game_handleMessage(server->game, from, message);
   }
 
-  // distribute the gold fairly
-  // for every piece of gold, randomly choose
-  // a pile to put it in
-  game->goldRemaining = GoldTotal;
-  for (int i = 0; i < GoldTotal; i++) {
-    int index = rand() % game->numGoldPiles;
-    goldPile_t* goldPile = game->goldPiles[index];
-    goldPile->amount++;
+  // the end of a batch is a tick: let go of any step held, and checkpoint
+  if (!message_pending()) {
+    over = sendSteps(server) || over;
+    game_checkpoint(server->game);
   }
-
-  free(indices);
-  delete2DIntArr(roomCells, size+1);
+  return over;
 }
 
 /*
- * Send the starting amount of gold to client
+ * The game has been quiet for a frame interval; send any spectator
+ * frame the frame-rate cap held back
  */
-void 
-sendStartingGold(player_t* player)
+static bool
+handleTimeout(void* arg)
 {
-  addr_t playerAddress = getPlayerAddress(player);
-  char* startingGoldMessage = malloc(30 * sizeof(char));
-  sprintf(startingGoldMessage, "GOLD_REMAINING %d", game->goldRemaining);
-  message_send(playerAddress, startingGoldMessage);
-  free(startingGoldMessage);
+  server_t* server = arg;
+  game_tick(server->game);
+  //server keeps running
+  return false;
 }
 
 /*
- * Method that updates the player's gold and gold remaining
- * when a player picks up gold
+ * Every StatsCheck seconds: print the counts, if SIGUSR1 asked for them
  */
-void 
-collectGold(player_t* player) 
+static bool
+handleStatsTimer(void* arg)
 {
-  //loop through the piles to see which one was collected
-  int row = getPlayerRow(player);
-  int col = getPlayerCol(player);
-
-  for (int i = 0; i < game->numGoldPiles; i++) {
-    goldPile_t* goldPile = game->goldPiles[i];
-    int pileAmount = goldPile->amount;
-    int goldRow = goldPile->row;
-    int goldCol = goldPile->col;
-    if (row == goldRow && col == goldCol) {
-      addGold(player, pileAmount); //update player gold amount 
-      int currPlayerGold = getPlayerGold(player);
-      game->goldRemaining -= pileAmount;
-      sendGoldUpdate(player, pileAmount);
-      //check if the spectator is present, if so we need to update their banner
-      char* goldMessage = malloc(50 * sizeof(char)); 
-      if (goldMessage == NULL) {
-        fprintf(stderr, "Error allocating memory to message\n");
-        return;
-      }
-      if (game->spectatorActive) {
-        char playerID = getCharacterID(player);
-        sprintf(goldMessage, "SPECTATOR_GOLD %c %d %d %d", playerID, pileAmount, currPlayerGold, game->goldRemaining);
-        player_t* spectator = game->players[MaxPlayers-1];
-        addr_t spectatorAddress = getPlayerAddress(spectator);
-        message_send(spectatorAddress, goldMessage);
-      }  
-      free(goldMessage); 
-      //check if all piles have been collected
-      //if so, game is over, send the summary
-      if (game->goldRemaining == 0) {
-        sendGameSummary();
-      }
-      break;
-    }
-  }
-}
-
-/*
- * Updates all player's displays to reflect any gold changes 
- */
-void
-sendGoldUpdate(player_t* player, int pileAmount) 
-{ 
-  for (int i = 0; i < game->currentNumPlayers; i++) {
-    player_t* otherPlayer = game->players[i];
-    bool otherPlayerActive = getPlayerActive(otherPlayer);
-    if (otherPlayerActive) {
-      addr_t playerAddress = getPlayerAddress(player);
-      addr_t otherPlayerAddress = getPlayerAddress(otherPlayer);
-      //if the player matches otherPlayer, we want to send pileAmount
-      if (message_eqAddr(playerAddress, otherPlayerAddress)) {
-        updateGoldDisplay(player, pileAmount, game->goldRemaining);
-        //otherwise we just want to update gold remaining
-      } else {
-        updateGoldDisplay(otherPlayer, 0, game->goldRemaining);
-      }
-    }
+  if (statsRequested) {
+    printStats(arg);
   }
+  return false;
 }
 
 /*
- * Given a row and col, put gold on the map
- * We assume that row col are valid "room cells" that are within
- * the bounds of the map
- */
-void
-spawnGold(int row, int col) 
-{
-  // get the current map
-  setCellType(game->map, '*', row, col);
-}
-
-/*
- * Spawns a player at a specified row, col
- * Puts their ID on the gameGrid, and puts '@' on 
- * their map
+ * Does the message look like a client's command, text or binary? Only
+ * its start is checked; the game checks the rest
  */
-void
-spawnPlayer(player_t* player, int row, int col) 
+static bool
+isCommand(const char* message)
 {
-  char id = getCharacterID(player);
-  setCellType(game->map, id, row, col);
-  char** playerMap = getPlayerMap(player);
-  playerMap[row][col] = '@';
+  return wire_isBinary(message, message_length())
+    || strncmp(message, "KEY ", 4) == 0
+    || strncmp(message, "GOTO ", 5) == 0
+    || strncmp(message, "PLAY ", 5) == 0
+    || strncmp(message, "RESUME ", 7) == 0
+    || strncmp(message, "SPECTATE", 8) == 0;
 }
 
 /*
- * Sends the size of the grid to the client
+ * Is the message a single step, "KEY k" with k one of the move keys?
+ * If so, k is put in key
  */
-void
-sendGrid(player_t* player, bool isSpectator) 
+static bool
+isStep(const char* message, char* key)
 {
-  //send the grid size to client
-  char* sizeMessage = malloc(30 * sizeof(char));
-  if (sizeMessage == NULL) {
-    fprintf(stderr, "Error allocating memory to message\n");
-    return;
+  if (strncmp(message, "KEY ", 4) == 0 && message[4] != '\0'
+      && message[5] == '\0' && strchr("hjklyubn", message[4]) != NULL) {
+    *key = message[4];
+    return true;
   }
-  int numRows = getNumRows(game->map);
-  int numCols = getNumCols(game->map);
-  //printf("%d %d", numRows, numCols); //testing
-  /*
-  if (isSpectator) {
-    sprintf(sizeMessage, "SPECTATOR_GRID %d %d", numRows, numCols);
-  } else {
-    sprintf(sizeMessage, "GRID %d %d", numRows, numCols);
-  }
-  */
-  sprintf(sizeMessage, "GRID %d %d", numRows, numCols);
-  addr_t address = getPlayerAddress(player);
-  message_send(address, sizeMessage);
-  free(sizeMessage);
+  return false;
 }
 
 /*
- * This function is specifically used to call all
- * existing players to update their vision whenever a new 
- * player joins or when a player quits.
+ * Give the game the steps held back, if any, as one KEY message;
+ * true once the game is over
  */
-void
-updateCurrentPlayerVision()
+static bool
+sendSteps(server_t* server)
 {
-  for (int i = 0; i < game->currentNumPlayers; i++) {
-    player_t* player = game->players[i];
-    bool playerActive = getPlayerActive(player);
-    if (playerActive) {
-      sendDisplay(player, false);
-    }
-  }
-}
-
-/*
- * Sends the map to the client (player)
- */
-void 
-sendDisplay(player_t* player, bool isSpectator)
-{   
-  //update the player's position on the map
-  if (isSpectator == false) {
-    updatePlayerPosition(player);
+  if (server->steps == 0) {
+    return false;
   }
-
-  int numRows = getNumRows(game->map);
-  int numCols = getNumCols(game->map);
-  addr_t address = getPlayerAddress(player);
-
-  char** grid; 
-  if (isSpectator == false) {
-    grid = getPlayerMap(player);
+  char message[16];
+  if (server->steps == 1) {
+    sprintf(message, "KEY %c", server->stepKey);
   } else {
-    grid = getGameGrid(game->map);
-  }
-  int size = strlen("DISPLAY\n") + numRows * numCols + 1;
-  char* gridMessage = malloc(size * sizeof(char));
-  if (gridMessage == NULL) {
-    return;
+    sprintf(message, "KEY %c %d", server->stepKey, server->steps);
   }
-  strcpy(gridMessage, "DISPLAY\n");
-  //concatenate the map to the gridMessage
-  int pos = strlen(gridMessage);
-  for (int i = 0; i < numRows; i++) {
-    for (int j = 0; j < numCols; j++) {
-      gridMessage[pos++] = grid[i][j];
-    }
-  }
-  gridMessage[pos] = '\0';
-  message_send(address, gridMessage);
-
-  //free memory
-  free(gridMessage);
+  server->steps = 0;
+  return game_handleMessage(server->game, server->stepFrom, message);
 }
 
 /*
- * Initializes the player map based on their starting visible region
+ * SIGUSR1: ask for the counts (printed by the stats timer, as a
+ * signal handler may not print)
  */
-char**
-initializePlayerMap(int row, int col) 
+static void
+requestStats(int signal)
 {
-  int numRows = getNumRows(game->map);
-  int numCols = getNumCols(game->map);
-
-  //create an empty grid
-  char** grid = malloc(numRows * sizeof(char*));
-  if (grid == NULL) {
-    fprintf(stderr, "Error initializing new grid\n");
-    return NULL;
-  }
-
-  //set every row, col in grid to a space (represents an empty map)
-  for (int row = 0; row < numRows; row++) {
-    grid[row] = malloc(numCols * sizeof(char));
-    memset(grid[row], ' ', numCols);
-  }
-  
-  //set the player's initial visible region
-  int** visibleRegion = getVisibleRegion(game->map, row, col);
-  if (visibleRegion == NULL) {
-    fprintf(stderr, "Error retrieving visible region\n");
-    return NULL;
-  }
-  int size = 0;
-  for (int row = 0; visibleRegion[row][0] != -1; row++) {
-    int visibleRow = visibleRegion[row][0];
-    int visibleCol = visibleRegion[row][1];
-    grid[visibleRow][visibleCol] = getCellType(game->map, visibleRow, visibleCol);
-    size++;
-  }
-  delete2DIntArr(visibleRegion, size+1);
-  return grid;
+  statsRequested = 1;
 }
 
 /*
- * Create a spectator
+ * Print the message counts to stderr
  */
-
-player_t* 
-spectatorJoin(addr_t address, char* name)
+static void
+printStats(server_t* server)
 {
-  //check if a specatator has already joined
-  if (game->spectatorActive) {
-    return NULL;
-  }
-  player_t* spectator; 
-  //initialize spectator's information
-  spectator = player_new('A', game->map, NULL, 0, name, 0, 0, address);
-  if (spectator == NULL) {
-    fprintf(stderr, "Error initializing spectator\n");
-    return NULL;
-  }
-  game->players[MaxPlayers-1] = spectator; //put them at the end of the array
-  game->spectatorActive = true;
-  return spectator;
+  statsRequested = 0;
+  fprintf(stderr, "received %ld, merged %ld, dropped %ld over rate, "
+          "rejected %ld not commands, %d addresses limited\n",
+          server->received, server->merged, server->dropped, server->rejected,
+          server->limiter == NULL ? 0 : limiter_numLimited(server->limiter));
 }
 
 /*
- * Create a new player and add it to the array of players
+ * The game's sink: its messages go out through the message module,
+ * bundled per incoming message by message_loop
  */
-
-player_t*
-playerJoin(addr_t address, char* name) 
+static void
+sinkSend(void* arg, const addr_t to, const char* message)
 {
-  //create the player and add them to the game
-  player_t* newPlayer;
-  int currentNumPlayers = game->currentNumPlayers;
-  if (currentNumPlayers < MaxPlayers-1) {
-    //initialize player's information
-    char id = 'A' + game->currentNumPlayers;
-
-    //spawn the player 
-    int** roomCells = getRoomCells(game->map);
-    // get number of room cells
-    int numRoomCells = 0;
-    while (roomCells[numRoomCells][0] != -1) {
-      numRoomCells++;
-    }
-
-    int randomCell = rand() % numRoomCells;
-
-    //get row and col for index the player is spawned at 
-    int row = roomCells[randomCell][0];
-    int col = roomCells[randomCell][1];
-
-    //create player map
-    char** playerMap = initializePlayerMap(row, col);
-    //initialize the player
-    newPlayer = player_new(id, game->map, playerMap, 0, name, row, col, address);
-    if (newPlayer == NULL) {
-      fprintf(stderr, "Error initializing player\n");
-      return NULL;
-    }
-    spawnPlayer(newPlayer, row, col);
-    delete2DIntArr(roomCells, numRoomCells+1);
-
-    // add player to array of players after their setup is done
-    game->players[currentNumPlayers] = newPlayer; 
-    game->currentNumPlayers++;
-  } else {
-    //space is full
-    return NULL;
-  }
-  return newPlayer;
-}
-
-/*
- * Check if a player exists, if they do then return that player
- */
-
-player_t* 
-checkPlayerJoined(addr_t address) 
-{
-  //check if a player has already joined the game
-  for (int i = 0; i < game->currentNumPlayers; i++) {
-    player_t* player = game->players[i];
-    addr_t playerAddress = getPlayerAddress(player);
-    if (message_eqAddr(playerAddress, address)) {
-      return player;
-    }
-  }
-  return NULL;
+  message_send(to, message);
 }
 
-/*
- * Removes player from map and makes their status inactive
- */
-void
-playerQuit(player_t* player) 
+static void
+sinkSendBytes(void* arg, const addr_t to, const char* message, int length)
 {
-  //remove player from map
-  int playerRow = getPlayerRow(player);
-  int playerCol = getPlayerCol(player);
-
-  //turns the playerID back to the terrain
-  restoreCell(game->map, playerRow, playerCol); 
-
-  //make player inactive
-  setPlayerInactive(player);
-
-  //update all the ACTIVE player's vision to reflect the chang
-  updateCurrentPlayerVision();
-
-  //send quit message to client 
-  addr_t playerAddress = getPlayerAddress(player);
-  message_send(playerAddress, "QUIT Thanks for playing!");
-}
-
-/* 
- * Remove spectator and send quit message
- */
-void
-spectatorQuit(player_t* spectator) {
-  game->spectatorActive = false;
-
-  addr_t spectatorAddress = getPlayerAddress(spectator);
-  message_send(spectatorAddress, "QUIT Thanks for watching!");
-  player_delete(spectator);
+  message_sendn(to, message, length);
 }
 
-/* 
- * Sends the summary of the game to the clients 
- */
-void
-sendGameSummary() 
+static void
+sinkSendFrame(void* arg, const addr_t to[], int count,
+              const char* frame, int length)
 {
-  char* gameOverMessage = malloc(1000 * sizeof(char));
-  strcpy(gameOverMessage, "QUIT GAME OVER:\n");
-  
-  //create the messsage
-  char buffer[25];
-  int offset = strlen(gameOverMessage);
-  for (int i = 0; i < game->currentNumPlayers; i++) {
-    player_t* player = game->players[i];
-    char playerID = getCharacterID(player);
-    int playerGold = getPlayerGold(player);
-    char* playerName = getPlayerName(player);
-    int len = sprintf(buffer, "%c          %d %s\n", playerID, playerGold, playerName);
-    strcpy(gameOverMessage + offset, buffer); // append the line
-    offset += len; // move offset over for next append
-  }
-  //send the message to active players
-  for (int i = 0; i < game->currentNumPlayers; i++) {
-    player_t* player = game->players[i];
-    bool playerActive = getPlayerActive(player);
-    addr_t playerAddress = getPlayerAddress(player);
-    if (playerActive) {
-      message_send(playerAddress, gameOverMessage);
-    }
-  }
-  free(gameOverMessage);
-  cleanUpGame();
+  message_sendFrame(to, count, frame, length);
 }
 
-/*
- * Clean up the game by freeing any allocated memory
- */
-void
-cleanUpGame() 
+static void
+sinkFlush(void* arg)
 {
-  //free any dynamically allocated data for each player that joined the game and the player itself
-  for (int i = 0; i < game->currentNumPlayers; i++) {
-    player_t* player = game->players[i];
-    if (player != NULL) {
-      player_delete(player);
-    }
-  }
-
-  //free the spectator if they are in the game
-  if(game->spectatorActive) {
-    player_t* spectator = game->players[MaxPlayers-1];
-    spectatorQuit(spectator);
-  }
-
-  free(game->players);
-  
-  //free the gold piles
-  for (int i = 0; i < game->numGoldPiles; i++) {
-    if (game->goldPiles[i] != NULL) {
-      free(game->goldPiles[i]);
-    }
-  }
-  free(game->goldPiles);
-
-  //free the gameMap
-  deleteGameMap(game->map);
-
-  //free the game itself
-  free(game);
-
-  //shut down message module and exit 
-  message_done();
-  exit(0);
+  message_flush();
 }
@@ -0,0 +1,194 @@
+/*
+ * simbench - a headless simulation harness for the game core.
+ * It runs many games side by side, all in memory: simulated players
+ * join and send random keys straight to game_handleMessage, with no
+ * sockets and no clients, and the game's messages are only counted.
+ * It reports how many moves per second the game core carries out.
+ *
+ * usage: ./simbench mapFile [players [moves [seed [perGame]]]]
+ *   players: simulated players (default 1000)
+ *   moves: keys sent in all, to players picked at random (default 100000)
+ *   seed: for the random-number generator (default 1)
+ *   perGame: players to a game (default 26, at most the game's limit)
+ *
+ * The games are persistent: when a round's gold is all collected, the
+ * next round starts in place with the same players.
+ *
+ * Author: Jaysen Quan, Dartmouth CS 50, Winter 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "../support/message.h"
+#include "gamecore.h"
+
+static const int PlayersPerGame = 26;     // default players to a game, one per letter
+static const int FirstPort = 10000;       // simulated players are 127.0.0.1:FirstPort+i
+static const char Keys[] = "hjklyubn";    // keys players pick from: single steps
+
+/****************** local types *********************/
+typedef struct counts {
+  long messages;   // messages the games sent, one per recipient
+  long bytes;      // bytes in them
+} counts_t;
+
+//function prototypes
+static void parseArgs(int argc, char* argv[], char** mapFile,
+                      int* numPlayers, long* numMoves, int* perGame);
+static void joinPlayers(game_t* game, const addr_t* addresses, int count);
+static double now(void);
+static void countSend(void* arg, const addr_t to, const char* message);
+static void countSendBytes(void* arg, const addr_t to, const char* message, int length);
+static void countSendFrame(void* arg, const addr_t to[], int count,
+                           const char* frame, int length);
+
+int
+main(int argc, char* argv[])
+{
+  char* mapFile = NULL;
+  int numPlayers = 1000;
+  long numMoves = 100000;
+  int perGame = PlayersPerGame;
+  parseArgs(argc, argv, &mapFile, &numPlayers, &numMoves, &perGame);
+
+  //one address per simulated player
+  addr_t* addresses = calloc(numPlayers, sizeof(addr_t));
+  int numGames = (numPlayers + perGame - 1) / perGame;
+  game_t** games = calloc(numGames, sizeof(game_t*));
+  if (addresses == NULL || games == NULL) {
+    fprintf(stderr, "Error allocating memory for the simulation\n");
+    return 2;
+  }
+  for (int i = 0; i < numPlayers; i++) {
+    addresses[i].sin_family = AF_INET;
+    addresses[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addresses[i].sin_port = htons(FirstPort + i);
+  }
+
+  //every game counts into the same place
+  counts_t counts = { 0, 0 };
+  gameSink_t sink = { &counts, countSend, countSendBytes, countSendFrame, NULL };
+
+  //start the games and let everyone join
+  for (int g = 0; g < numGames; g++) {
+    int first = g * perGame;
+    int count = (numPlayers - first < perGame) ? numPlayers - first : perGame;
+    games[g] = game_new(mapFile, 0, sink);
+    if (games[g] == NULL) {
+      return 4; // failure to set up a game
+    }
+    game_setPersistent(games[g], true);
+    joinPlayers(games[g], &addresses[first], count);
+  }
+
+  //random keys from random players, timed
+  char key[] = "KEY k";
+  double start = now();
+  for (long move = 0; move < numMoves; move++) {
+    int player = rand() % numPlayers;
+    int g = player / perGame;
+    key[4] = Keys[rand() % (sizeof(Keys) - 1)];
+    game_handleMessage(games[g], addresses[player], key);
+  }
+  double seconds = now() - start;
+
+  //rounds finished, over all games
+  long rounds = 0;
+  for (int g = 0; g < numGames; g++) {
+    rounds += game_round(games[g]) - 1;
+  }
+
+  printf("players %d games %d moves %ld seconds %.3f moves/sec %.0f\n",
+         numPlayers, numGames, numMoves, seconds,
+         (seconds > 0) ? numMoves / seconds : 0);
+  printf("messages %ld bytes %ld rounds %ld\n",
+         counts.messages, counts.bytes, rounds);
+
+  for (int g = 0; g < numGames; g++) {
+    game_delete(games[g]);
+  }
+  free(games);
+  free(addresses);
+  return 0;
+}
+
+/*
+ * Parse the command line: mapFile [players [moves [seed [perGame]]]]
+ * Seeds the random-number generator; exits on a bad command line.
+ */
+static void
+parseArgs(int argc, char* argv[], char** mapFile, int* numPlayers, long* numMoves,
+          int* perGame)
+{
+  unsigned int seed = 1;
+  char extra;
+  if (argc < 2 || argc > 6
+      || (argc > 2 && (sscanf(argv[2], "%d%c", numPlayers, &extra) != 1 || *numPlayers < 1))
+      || (argc > 3 && (sscanf(argv[3], "%ld%c", numMoves, &extra) != 1 || *numMoves < 0))
+      || (argc > 4 && sscanf(argv[4], "%u%c", &seed, &extra) != 1)
+      || (argc > 5 && (sscanf(argv[5], "%d%c", perGame, &extra) != 1 || *perGame < 1))) {
+    fprintf(stderr, "usage: %s mapFile [players [moves [seed [perGame]]]]\n", argv[0]);
+    exit(3); // bad commandline
+  }
+  *mapFile = argv[1];
+  srand(seed);
+}
+
+/*
+ * Send PLAY for each address to the game
+ */
+static void
+joinPlayers(game_t* game, const addr_t* addresses, int count)
+{
+  char play[20];
+  for (int i = 0; i < count; i++) {
+    sprintf(play, "PLAY p%d", i);
+    game_handleMessage(game, addresses[i], play);
+  }
+}
+
+/*
+ * Seconds on the monotonic clock
+ */
+static double
+now(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * The simulation's sink: count what would have been sent
+ */
+static void
+countSend(void* arg, const addr_t to, const char* message)
+{
+  counts_t* counts = arg;
+  counts->messages++;
+  counts->bytes += strlen(message);
+}
+
+static void
+countSendBytes(void* arg, const addr_t to, const char* message, int length)
+{
+  counts_t* counts = arg;
+  counts->messages++;
+  counts->bytes += length;
+}
+
+static void
+countSendFrame(void* arg, const addr_t to[], int count,
+               const char* frame, int length)
+{
+  counts_t* counts = arg;
+  counts->messages += count;
+  counts->bytes += (long)count * length;
+}
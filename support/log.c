@@ -1,15 +1,67 @@
-/* 
+/*
  * log module - a simple way to log messages to a file
- * 
+ *
  * David Kotz, May 2019
  */
 
+#define _POSIX_C_SOURCE 200809L // for nanosleep
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/errno.h>
 #include "log.h"
 
+/**************** file-local constants ****************/
+#define LogPayloadBytes 240             // string bytes carried by one record
+#define LogRingSlots 4096               // records in the ring; a power of 2
+static const long LogIdleNanos = 1000000; // writer sleep when ring is empty
+
+/**************** file-local types ****************/
+/* One fixed-size record in the ring. A string longer than one payload is
+ * carried by consecutive records; the first says how many there are.
+ */
+typedef struct logRecord {
+  FILE* fp;             // where to write it
+  const char* format;   // printf format; must outlive the record
+  char kind;            // 's', 'd', 'c', 'v', 'e' like the flog_x functions
+  int num;              // the 'd' number, 'c' character, or 'e' errno
+  int parts;            // records used by this message (first record only)
+  int length;           // payload bytes in this record
+  int truncated;        // string bytes not copied (first record only)
+  char payload[LogPayloadBytes];
+} logRecord_t;
+
+/**************** global variables ****************/
+int flog_level = LOG_TRACE;   // threshold for the LOG_x macros; see log.h
+
+/**************** file-local global variables ****************/
+/* The ring is single-producer, single-consumer: the program's logging thread
+ * only advances 'head', and the background writer only advances 'tail'.
+ * Both count records ever written, so head - tail is the number queued.
+ */
+static logRecord_t ring[LogRingSlots];
+static atomic_size_t head = 0;         // next slot the producer fills
+static atomic_size_t tail = 0;         // next slot the writer reads
+static atomic_size_t flushed = 0;      // slots before this are in the file
+static atomic_int dropped = 0;         // records lost because ring was full
+static atomic_bool stopping = false;   // asks the writer to drain and exit
+static bool async = false;             // is the writer thread running?
+static int truncateBytes = 0;          // cut strings longer than this, if > 0
+static pthread_t writer;
+
+/**************** local functions ****************/
+static bool enqueue(FILE* fp, char kind, const char* format,
+                    int num, const char* str);
+static void* writeRecords(void* arg);
+static void writeOne(FILE* fp, char kind, const char* format,
+                     int num, const char* str);
+static void waitForWriter(void);
+
 /**************** flog_init ****************/
 /* Initialize the logging module.
  */
@@ -18,8 +70,60 @@ void flog_init(FILE* fp)
   flog_v(fp, "START OF LOG");
 }
 
+/**************** flog_setLevel ****************/
+/*
+ * Set the threshold used by the LOG_x macros in every file.
+ */
+void
+flog_setLevel(int level)
+{
+  flog_level = level;
+}
+
+/**************** flog_async ****************/
+/*
+ * Start the background writer; later flog_x calls only enqueue records.
+ * See log.h for detailed description.
+ */
+bool
+flog_async(int truncate)
+{
+  truncateBytes = truncate;
+  if (async) {
+    return true;
+  }
+  atomic_store(&stopping, false);
+  if (pthread_create(&writer, NULL, writeRecords, NULL) != 0) {
+    return false;
+  }
+  async = true;
+
+  // make sure whatever is queued reaches the file even if we exit() directly
+  static bool registered = false;
+  if (!registered) {
+    atexit(flog_syncDone);
+    registered = true;
+  }
+  return true;
+}
+
+/**************** flog_syncDone ****************/
+/*
+ * Drain the ring, stop the writer, and go back to synchronous logging.
+ */
+void
+flog_syncDone(void)
+{
+  if (!async) {
+    return;
+  }
+  atomic_store(&stopping, true);
+  pthread_join(writer, NULL);
+  async = false;
+}
+
 /**************** flog_s ****************/
-/* 
+/*
  * log a string to the logfile, if logging is enabled.
  * The string `format` can reference '%s' to incorporate `str`.
  */
@@ -27,6 +131,10 @@ void
 flog_s(FILE* fp, const char* format, const char* str)
 {
   if (fp != NULL && format != NULL && str != NULL) {
+    if (async) {
+      enqueue(fp, 's', format, 0, str);
+      return;
+    }
     fprintf(fp, format, str);
     fputc('\n', fp);
     fflush(fp);
@@ -34,7 +142,7 @@ flog_s(FILE* fp, const char* format, const char* str)
 }
 
 /**************** flog_d ****************/
-/* 
+/*
  * log an integer to the logfile, if logging is enabled.
  * The string `format` can reference '%d' to incorporate `num`.
  */
@@ -42,6 +150,10 @@ void
 flog_d(FILE* fp, const char* format, const int num)
 {
   if (fp != NULL && format != NULL) {
+    if (async) {
+      enqueue(fp, 'd', format, num, NULL);
+      return;
+    }
     fprintf(fp, format, num);
     fputc('\n', fp);
     fflush(fp);
@@ -49,7 +161,7 @@ flog_d(FILE* fp, const char* format, const int num)
 }
 
 /**************** flog_c ****************/
-/* 
+/*
  * log a character to the logfile, if logging is enabled.
  * The string `format` can reference '%c' to incorporate `ch`.
  */
@@ -57,6 +169,10 @@ void
 flog_c(FILE* fp, const char* format, const char ch)
 {
   if (fp != NULL && format != NULL) {
+    if (async) {
+      enqueue(fp, 'c', format, ch, NULL);
+      return;
+    }
     fprintf(fp, format, ch);
     fputc('\n', fp);
     fflush(fp);
@@ -64,13 +180,17 @@ flog_c(FILE* fp, const char* format, const char ch)
 }
 
 /**************** flog_v ****************/
-/* 
+/*
  * log a message to the logfile, if logging is enabled.
  */
 void
 flog_v(FILE* fp, const char* str)
 {
   if (fp != NULL && str != NULL) {
+    if (async) {
+      enqueue(fp, 'v', NULL, 0, str);
+      return;
+    }
     fputs(str, fp);
     fputc('\n', fp);
     fflush(fp);
@@ -78,7 +198,7 @@ flog_v(FILE* fp, const char* str)
 }
 
 /**************** flog_e ****************/
-/* 
+/*
  * log an error to the logfile, if logging is enabled.
  * Expects the global variable errno (sys/errno.h) to indicate the error,
  * so this is best used immediately after a system call.
@@ -87,17 +207,171 @@ void
 flog_e(FILE* fp, const char* str)
 {
   if (fp != NULL && str != NULL) {
+    if (async) {
+      // capture errno now; it will have changed by the time we write
+      enqueue(fp, 'e', NULL, errno, str);
+      return;
+    }
     fprintf(fp, "%s: %s\n", str, strerror(errno));
     fflush(fp);
   }
 }
 
 /**************** flog_done ****************/
-/* 
- * Done with logging.  Notes this, then disables logging. 
+/*
+ * Done with logging.  Notes this, then disables logging.
+ * When asynchronous, waits until the note is written, so the caller
+ * may close the file as soon as we return.
  */
 void
 flog_done(FILE* fp)
 {
   flog_v(fp, "END OF LOG");
+  if (async && fp != NULL) {
+    waitForWriter();
+  }
+}
+
+/**************** enqueue ****************/
+/*
+ * Copy one log call into the ring; never blocks.
+ * Returns false, and counts the loss, if the ring lacks room.
+ */
+static bool
+enqueue(FILE* fp, char kind, const char* format, int num, const char* str)
+{
+  // how much of the string to copy, and how many records it needs
+  int length = 0;
+  int truncated = 0;
+  if (str != NULL) {
+    length = strlen(str);
+    if (truncateBytes > 0 && length > truncateBytes) {
+      truncated = length - truncateBytes;
+      length = truncateBytes;
+    }
+  }
+  int parts = (length + LogPayloadBytes - 1) / LogPayloadBytes;
+  if (parts == 0) {
+    parts = 1;
+  }
+
+  size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  size_t t = atomic_load_explicit(&tail, memory_order_acquire);
+  if (LogRingSlots - (h - t) < (size_t)parts) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    return false;
+  }
+
+  // fill the records, then publish them all at once
+  for (int i = 0; i < parts; i++) {
+    logRecord_t* rec = &ring[(h + i) & (LogRingSlots - 1)];
+    int offset = i * LogPayloadBytes;
+    int n = length - offset;
+    if (n > LogPayloadBytes) {
+      n = LogPayloadBytes;
+    }
+    rec->fp = fp;
+    rec->format = format;
+    rec->kind = kind;
+    rec->num = num;
+    rec->parts = parts;
+    rec->length = n;
+    rec->truncated = truncated;
+    if (n > 0) {
+      memcpy(rec->payload, str + offset, n);
+    }
+  }
+  atomic_store_explicit(&head, h + parts, memory_order_release);
+  return true;
+}
+
+/**************** writeRecords ****************/
+/*
+ * Body of the background writer: format and write queued records,
+ * flushing whenever the ring runs dry; exit once asked and drained.
+ */
+static void*
+writeRecords(void* arg)
+{
+  // room to reassemble the largest string a full ring could hold
+  static char text[LogRingSlots * LogPayloadBytes + 1];
+  FILE* lastFP = NULL;
+  const struct timespec idle = { 0, LogIdleNanos };
+
+  while (true) {
+    size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+    size_t h = atomic_load_explicit(&head, memory_order_acquire);
+
+    if (t == h) {
+      // nothing queued: flush what we wrote, then sleep or quit
+      if (lastFP != NULL) {
+        fflush(lastFP);
+        lastFP = NULL;
+      }
+      atomic_store_explicit(&flushed, t, memory_order_release);
+      if (atomic_load(&stopping)) {
+        break;
+      }
+      nanosleep(&idle, NULL);
+      continue;
+    }
+
+    logRecord_t* rec = &ring[t & (LogRingSlots - 1)];
+    int lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0) {
+      fprintf(rec->fp, "log: %d records dropped (ring full)\n", lost);
+    }
+
+    // reassemble the string carried by this record and its continuations
+    int length = 0;
+    for (int i = 0; i < rec->parts; i++) {
+      logRecord_t* part = &ring[(t + i) & (LogRingSlots - 1)];
+      memcpy(text + length, part->payload, part->length);
+      length += part->length;
+    }
+    text[length] = '\0';
+
+    writeOne(rec->fp, rec->kind, rec->format, rec->num, text);
+    if (rec->truncated > 0) {
+      fprintf(rec->fp, "log: (%d more bytes truncated)\n", rec->truncated);
+    }
+    if (lastFP != NULL && lastFP != rec->fp) {
+      fflush(lastFP);
+    }
+    lastFP = rec->fp;
+
+    atomic_store_explicit(&tail, t + rec->parts, memory_order_release);
+  }
+  return NULL;
+}
+
+/**************** writeOne ****************/
+/*
+ * Format one record exactly as the synchronous flog_x would have.
+ */
+static void
+writeOne(FILE* fp, char kind, const char* format, int num, const char* str)
+{
+  switch (kind) {
+    case 's': fprintf(fp, format, str); break;
+    case 'd': fprintf(fp, format, num); break;
+    case 'c': fprintf(fp, format, (char)num); break;
+    case 'v': fputs(str, fp); break;
+    case 'e': fprintf(fp, "%s: %s", str, strerror(num)); break;
+  }
+  fputc('\n', fp);
+}
+
+/**************** waitForWriter ****************/
+/*
+ * Wait until the writer has written and flushed everything queued so far.
+ */
+static void
+waitForWriter(void)
+{
+  const struct timespec idle = { 0, LogIdleNanos };
+  size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  while (atomic_load_explicit(&flushed, memory_order_acquire) < h) {
+    nanosleep(&idle, NULL);
+  }
 }
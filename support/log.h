@@ -15,6 +15,12 @@
  * by multiple source files within a single program, *each* such file has
  * its own logging fp and thus can independently control whether to log and
  * where to log.
+ *
+ * Hot paths should use the LOG_x(level, ...) macros instead of log_x; they
+ * skip the call, *and the evaluation of its arguments*, when the file is not
+ * logging or the level is above the threshold set by log_setLevel().
+ * After log_async() the log_x functions only copy their arguments into a
+ * lock-free ring buffer, and a background thread formats and writes them.
  * 
  * David Kotz, May 2019
  */
@@ -24,6 +30,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 /*********** file-local global variable ****************/
 /* Here is an example of a judicious use of a global variable.
@@ -37,6 +44,62 @@
  */
 static FILE* logFP = NULL;
 
+/*********** log levels ****************/
+/* Each LOG_x macro names the level of its message; messages above the
+ * current threshold are skipped. The threshold is shared by the whole
+ * program and defaults to LOG_TRACE, i.e., everything is logged.
+ */
+typedef enum {
+  LOG_ERROR = 0,  // failures
+  LOG_INFO  = 1,  // occasional events (startup, shutdown, joins)
+  LOG_DEBUG = 2,  // per-message summaries
+  LOG_TRACE = 3,  // per-message payloads
+} log_level_t;
+
+extern int flog_level;
+static inline bool log_enabled(int level)
+{ return logFP != NULL && level <= flog_level; }
+/* log_enabled: would a message at this level be logged from this file?
+ * Use it to guard any costly work done only to produce a log message.
+ */
+
+#define LOG_S(level, f, s) do { if (log_enabled(level)) log_s(f, s); } while (0)
+#define LOG_D(level, f, n) do { if (log_enabled(level)) log_d(f, n); } while (0)
+#define LOG_C(level, f, c) do { if (log_enabled(level)) log_c(f, c); } while (0)
+#define LOG_V(level, str)  do { if (log_enabled(level)) log_v(str); } while (0)
+#define LOG_E(level, str)  do { if (log_enabled(level)) log_e(str); } while (0)
+/* LOG_x: like log_x below, but only when log_enabled(level);
+ * otherwise the arguments are not even evaluated. Example:
+ *   LOG_D(LOG_DEBUG, "message has %d lines", numLines(message));
+ */
+
+void flog_setLevel(int level);
+static inline void log_setLevel(int level) { flog_setLevel(level); }
+/* log_setLevel: set the threshold for the LOG_x macros, for all files.
+ */
+
+bool flog_async(int truncate);
+static inline bool log_async(int truncate) { return flog_async(truncate); }
+/* log_async: switch the whole program to asynchronous logging.
+ * Later log_x calls copy their arguments into fixed-size records in a
+ * lock-free ring buffer and return; a background thread does the formatting
+ * and writing. If truncate > 0, string arguments longer than truncate bytes
+ * are cut short, and the log notes how many bytes were dropped.
+ * Returns false (and stays synchronous) if the thread cannot be started.
+ * Caller expectations:
+ *   all log_x calls come from one thread (the ring has a single producer);
+ *   format strings are string literals, because they are used after the
+ *   call returns;
+ *   records are dropped, and counted, rather than blocking when the ring is
+ *   full. The writer is stopped and drained at exit, or by log_syncDone().
+ */
+
+void flog_syncDone(void);
+static inline void log_syncDone(void) { flog_syncDone(); }
+/* log_syncDone: write everything queued, stop the background thread,
+ * and return to synchronous logging.
+ */
+
 /*********** logging-related functions ****************/
 /* Module users should call the inline log_x functions; these simply provide
  * the logFP to the flog_x functions that are coded in log.c.
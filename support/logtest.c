@@ -0,0 +1,186 @@
+/*
+ * logtest - unit test of the log module's asynchronous ring
+ *
+ * Logs through log_async into a pipe and checks what comes out:
+ * a string longer than one record, put back together; a string cut
+ * short by the truncation limit, and the note saying so; and a burst
+ * logged while the writer is stuck on a full pipe, which fills the
+ * ring, so some records are dropped, and counted in the log.
+ *
+ * usage: ./logtest    (exit status 0 if all checks pass)
+ */
+
+#define _POSIX_C_SOURCE 200809L // for fdopen, nanosleep
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "log.h"
+
+/**************** file-local constants ****************/
+#define LongBytes 1000        // a string that needs several records
+#define Truncate 300          // the limit for the truncation check
+#define Burst 20000           // far more records than the ring holds
+
+/**************** file-local types ****************/
+typedef struct output {
+  int fd;                     // read end of the pipe
+  char* text;                 // everything read from it
+  size_t length;
+  size_t capacity;
+} output_t;
+
+/**************** file-local global variables ****************/
+static int failures = 0;
+
+/**************** local functions ****************/
+static void* readAll(void* arg);
+static void check(const bool ok, const char* what);
+static int countLines(const char* text, const char* prefix);
+
+int
+main(void)
+{
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("logtest: pipe");
+    return 2;
+  }
+  FILE* fp = fdopen(fds[1], "w");
+  if (fp == NULL) {
+    perror("logtest: fdopen");
+    return 2;
+  }
+  log_init(fp);
+  if (!log_async(0)) {
+    fprintf(stderr, "logtest: could not start the writer\n");
+    return 2;
+  }
+
+  // a long string goes as several records, and comes out whole
+  char longString[LongBytes + 1];
+  memset(longString, 'x', LongBytes);
+  longString[LongBytes] = '\0';
+  log_s("long %s", longString);
+
+  // with a limit, the rest is dropped and the log says how much
+  log_async(Truncate);
+  log_s("cut %s", longString);
+
+  // nobody reads the pipe yet, so the writer blocks once it is full, and
+  // the burst overflows the ring behind it
+  for (int i = 0; i < Burst; i++) {
+    log_d("burst %d", i);
+  }
+
+  // now read it all, and log once more so the count of drops is written
+  output_t out = { fds[0], NULL, 0, 0 };
+  pthread_t reader;
+  pthread_create(&reader, NULL, readAll, &out);
+  const struct timespec pause = { 0, 200 * 1000000L };
+  nanosleep(&pause, NULL);
+  log_v("after the burst");
+  log_done();
+  log_syncDone();
+  fclose(fp);
+  pthread_join(reader, NULL);
+
+  // the long string, whole
+  char expected[LongBytes + 16];
+  sprintf(expected, "long %s\n", longString);
+  check(strstr(out.text, expected) != NULL, "a long string is put back together");
+
+  // the cut one, and the note
+  sprintf(expected, "cut %.*s\n", Truncate, longString);
+  check(strstr(out.text, expected) != NULL, "a string is cut at the limit");
+  sprintf(expected, "log: (%d more bytes truncated)\n", LongBytes - Truncate);
+  check(strstr(out.text, expected) != NULL, "the log notes the bytes truncated");
+
+  // the burst: some lost, counted, and what is left is in order
+  int written = countLines(out.text, "burst ");
+  int dropped = 0;
+  const char* note = strstr(out.text, "log: ");
+  while (note != NULL) {
+    int n;
+    if (sscanf(note, "log: %d records dropped", &n) == 1) {
+      dropped += n;
+    }
+    note = strstr(note + 1, "log: ");
+  }
+  check(written > 0 && written < Burst, "a full ring drops records");
+  check(written + dropped == Burst, "every dropped record is counted");
+  int last = -1;
+  bool inOrder = true;
+  for (const char* line = strstr(out.text, "burst "); line != NULL;
+       line = strstr(line + 1, "\nburst ")) {
+    int i;
+    if (sscanf(line + (*line == '\n'), "burst %d", &i) == 1) {
+      inOrder = inOrder && i > last;
+      last = i;
+    }
+  }
+  check(inOrder, "records come out in order");
+  check(strstr(out.text, "after the burst\nEND OF LOG\n") != NULL,
+        "logging carries on after the ring was full");
+
+  free(out.text);
+  printf("logtest: %s\n", failures == 0 ? "all passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
+
+/**************** readAll ****************/
+/* Read the pipe to its end, keeping everything. */
+static void*
+readAll(void* arg)
+{
+  output_t* out = arg;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(out->fd, buf, sizeof(buf))) > 0) {
+    if (out->length + n + 1 > out->capacity) {
+      out->capacity = 2 * (out->length + n + 1);
+      out->text = realloc(out->text, out->capacity);
+    }
+    memcpy(out->text + out->length, buf, n);
+    out->length += n;
+  }
+  if (out->text == NULL) {
+    out->text = calloc(1, 1);
+  }
+  out->text[out->length] = '\0';
+  close(out->fd);
+  return NULL;
+}
+
+/**************** check ****************/
+/* Report one check. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+/**************** countLines ****************/
+/* How many lines start with the prefix? */
+static int
+countLines(const char* text, const char* prefix)
+{
+  int count = 0;
+  int length = strlen(prefix);
+  for (const char* line = text; line != NULL; line = strchr(line, '\n')) {
+    if (*line == '\n') {
+      line++;
+    }
+    if (strncmp(line, prefix, length) == 0) {
+      count++;
+    }
+  }
+  return count;
+}
@@ -13,6 +13,8 @@
  * David Kotz - May 2019
  */
 
+#define _GNU_SOURCE    // for sendmmsg, accept4, memfd_create and sched_setaffinity
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -23,6 +25,18 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
 #include <math.h>
 #include "message.h"
 #include "log.h"
@@ -35,6 +49,51 @@
 static const int MinPort = 1024;
 static const int MaxPort = 65535;
 
+// most datagrams handed to the kernel in one sendmmsg call
+#define BatchSize 64
+
+// most datagrams message_loop takes from the socket before looking at stdin again
+#define MaxDrain 256
+
+// first line of a datagram carrying several messages; see message_bundleBegin
+#define BundleHeader "BUNDLE\n"
+#define BundleHeaderLength 7
+
+/* A message too long for one datagram goes as fragments, each a datagram
+ *   FRAGMENT id index count
+ *   bytes...
+ * carrying FragmentBytes of the message (the last carries the rest).
+ * The id is the sender's, and grows by one with each fragmented message.
+ */
+#define FragmentHeader "FRAGMENT "
+#define FragmentHeaderLength 9
+#define FragmentBytes 60000
+#define MaxFragments 64       // so a message is at most about 3.8 MB
+#define MaxAssemblies 8       // senders whose fragments we reassemble at once
+#define StaleIds 64           // ids this far behind the newest are late fragments
+
+// receive buffer we ask for, so the fragments of a message fit in it together
+#define ReceiveBufferBytes (4 * 1024 * 1024)
+
+// the shared-memory transport; see the peer type below
+#define SharedName "message-%d"       // abstract Unix socket of a UDP port
+#define RingBytes (1024 * 1024)       // a power of 2, well over message_MaxBytes
+#define RingWrap 0xffffffffu          // record length that means "go to the start"
+#define ConfirmHeader "SHARED "       // datagram with the nonce that confirms a port
+#define ConfirmHeaderLength 7
+#define PeerRetryMicros 5000000       // a local peer not sharing memory is tried again after this
+
+/* Timers wait in a hierarchical timing wheel: WheelLevels levels of
+ * WheelSlots slots, a slot of level 0 being one tick (a millisecond) and
+ * a slot of each level above as long as all of the level below it.
+ */
+#define WheelBits 6
+#define WheelSlots (1 << WheelBits)
+#define WheelMask (WheelSlots - 1)
+#define WheelLevels 4                 // so the wheel reaches about 4.6 hours
+#define TimerIndexBits 20             // a timer's id: its generation, then index + 1
+#define MaxTimerSeconds 1e9           // longer delays and periods are cut to this
+
 /**************** file-local global variables ****************/
 /* This is an example of a judicious use of a global variable.
  * This module provides init() and done() functions that allow it
@@ -48,8 +107,214 @@ static const int MaxPort = 65535;
  */
 static int ourSocket = 0;     // socket on which to receive messages
 
+/* While bundling, messages are not sent right away; each recipient has an
+ * outbox that collects them, to go out as one datagram when the bundle ends.
+ * An outbox is a list of segments: a "length\n" prefix, then the message,
+ * for each message. Copied bytes live in the outbox's arena; frames are
+ * referenced in place. Outboxes keep their memory from bundle to bundle.
+ */
+typedef struct segment {
+  const char* frame;  // the caller's frame buffer, or NULL if in the arena
+  int offset;         // where the bytes start in the arena (frame == NULL)
+  int length;         // 0 if superseded by a later frame
+} segment_t;
+
+typedef struct outbox {
+  addr_t to;                // recipient
+  char* arena;              // copied prefixes and messages
+  int arenaLength;
+  int arenaCapacity;
+  segment_t* segments;      // prefix, message, prefix, message, ...
+  int numSegments;
+  int segmentCapacity;
+  int count;                // live messages queued
+  int bytes;                // size of the bundle so far, header included
+} outbox_t;
+
+static bool bundleHasMore = false;   // is message_loop amid delivering a bundle?
+static int messageLength = 0;        // bytes in the message being handled
+static int drainRemaining = 0;       // datagrams message_loop may still take this wakeup
+static int bundleDepth = 0;          // > 0 while bundling
+static float loopTimeout = 0.0;      // message_loop's current timeout
+static int spinMicros = 0;           // how long message_loop spins before it blocks
+static outbox_t* outboxes = NULL;    // the first numOutboxes are in use
+static int numOutboxes = 0;
+static int outboxCapacity = 0;
+static int* outboxSlots = NULL;      // hash of address: outbox index + 1, or 0
+static int numSlots = 0;             // a power of 2
+static struct iovec* iovecs = NULL;  // scratch for message_flush
+static int iovecCapacity = 0;
+
+/* A message arriving in fragments is put together in its sender's assembly.
+ * Each sender has one message in progress: a fragment of a newer message
+ * drops whatever is left of the older one, since only the newest frame
+ * matters. An assembly keeps its buffer for the sender's next message.
+ */
+typedef struct assembly {
+  addr_t from;              // sender
+  bool inUse;
+  unsigned int id;          // of the message in progress, or last completed
+  int count;                // fragments in it
+  int received;             // fragments arrived so far; == count when complete
+  int length;               // bytes in it, once the last fragment arrives
+  char* buf;                // the message, fragment i at i * FragmentBytes
+  int capacity;
+  bool have[MaxFragments];  // which fragments have arrived
+} assembly_t;
+
+static unsigned int nextFragmentId = 0;      // for the next fragmented message
+static assembly_t assemblies[MaxAssemblies];
+static int nextEviction = 0;                 // assembly to reuse when all are in use
+
+/* With message_initShared, two processes on this host talk through memory
+ * they share instead of through the kernel's UDP stack. The first to send
+ * connects to the other's Unix socket, named for its UDP port, and hands
+ * over (SCM_RIGHTS) a memfd with a ring for each direction and an eventfd
+ * for each side to be woken by. Each side checks (SO_PEERCRED) that the
+ * other runs as our user. The port the connecting side sends with them is
+ * only a claim: the other sends a nonce by UDP to that port (a datagram
+ * ConfirmHeader nonce), and the connecting side, on getting it from the
+ * port it connected to, echoes it over the socket; until then both go on
+ * by UDP. After that the socket only tells each side when the other has
+ * gone. A ring holds records: a 4-byte length, the bytes and a '\0',
+ * padded to 4 bytes. The memory stays writable by the peer, so the reader
+ * checks each record and copies it out before handing it to the handler.
+ * A full ring drops the message, as UDP would.
+ * A reader sets `sleeping` before it waits, and only then does a writer
+ * ring its eventfd, so a busy pair makes no system calls at all.
+ */
+typedef struct ring {
+  _Atomic uint32_t head;     // bytes ever written; stored only by the writer
+  char headLine[60];         // (head and tail on separate cache lines)
+  _Atomic uint32_t tail;     // bytes ever read; stored only by the reader
+  _Atomic int sleeping;      // is the reader waiting in select?
+  char tailLine[56];
+  char data[RingBytes];
+} ring_t;
+
+typedef struct peer {
+  addr_t addr;               // its UDP address, by which callers name it
+  int conn;                  // Unix socket to it; -1 if reached by UDP
+  int wake;                  // eventfd it waits on; -1 until set up
+  int wait;                  // eventfd we wait on; -1 until set up
+  ring_t* rings;             // the shared memory; NULL until set up
+  ring_t* in;                // the ring we read; NULL until confirmed
+  ring_t* out;               // the ring we write; NULL until confirmed
+  int port;                  // the UDP port it claims, until confirmed
+  uint64_t nonce;            // we sent to that port; 0 if none is awaited
+  uint64_t retryAt;          // if we connected and it is not sharing, when to try again
+  int nextSame;              // next peer in its bucket of peerTable; -1 if none
+} peer_t;
+
+static bool sharedEnabled = false;   // did message_initShared set it up?
+static int sharedPort = 0;           // our UDP port, which names us to peers
+static int sharedListener = -1;      // Unix socket local peers connect to
+static peer_t* peers = NULL;         // local addresses we have met
+static int numPeers = 0;
+static int peerCapacity = 0;
+static int* peerTable = NULL;        // by hash of address: first peer, -1 if none
+                                     // (2 * peerCapacity buckets)
+static ring_t* drainingRing = NULL;  // ring message_loop is delivering from
+static uint32_t drainingNext = 0;    // where the record after this one starts
+
+/* A timer is in the slot of the wheel for when it is due: in level 0 if
+ * due within WheelSlots ticks, else in the first level that reaches that
+ * far. Each time level 0 goes round, the next slot of level 1 is emptied
+ * into the levels below, and so on up; so adding or cancelling a timer is
+ * a link in or out of one list, and a tick that passes touches only the
+ * timers due then. Links are timer index + 1, or 0 for none, as are the
+ * slots, so zeroed memory is an empty wheel.
+ */
+typedef struct loopTimer {
+  uint64_t expires;                // tick it is due
+  uint64_t period;                 // ticks between calls; 0 if one-shot
+  bool (*handleTimer)(void* arg);
+  void* arg;
+  int slot;                        // where in the wheel; -1 if not in use
+  int prev;                        // neighbours in its slot
+  int next;                        // (or the next free timer)
+  int generation;                  // bumped at each reuse, so an old id is stale
+} loopTimer_t;
+
+static loopTimer_t* timers = NULL;   // all of them, in use or free
+static int timerCapacity = 0;
+static int freeTimers = 0;           // first free timer
+static int numTimers = 0;            // timers in the wheel
+static int wheel[WheelLevels * WheelSlots]; // first timer in each slot
+static uint64_t wheelNow = 0;        // last tick whose timers have run
+#ifdef UNIT_TEST
+static bool clockMocked = false;     // --selftest sets the time itself
+static uint64_t mockedMicros = 0;
+#endif
+
+/**************** local functions ****************/
+static int spin(const int nfds, fd_set* rfds, const bool watchRings,
+                struct timeval* timerp, bool* ringsReady);
+static void sendDatagrams(struct mmsghdr* msgs, const int count);
+static void sendFragments(const addr_t to[], const int count,
+                          const char* message, const int length);
+static bool queue(const addr_t to, const char* message, const int length,
+                  const bool isFrame);
+static outbox_t* findOutbox(const addr_t to);
+static bool growSlots(void);
+static bool addSegment(outbox_t* box, const char* frame,
+                       const char* bytes, const int length);
+static void sendOutbox(outbox_t* box);
+static int fillIovecs(outbox_t* box, struct iovec* iov);
+static bool receiveAll(void* arg,
+                       bool (*handleMessage)(void* arg, const addr_t from,
+                                             const char* message));
+static bool deliver(void* arg, const addr_t from, char* buf, int nbytes,
+                    bool (*handleMessage)(void* arg, const addr_t from,
+                                          const char* message));
+static bool deliverBundle(void* arg, const addr_t from, char* buf, int nbytes,
+                          bool (*handleMessage)(void* arg, const addr_t from,
+                                                const char* message));
+static bool deliverFragment(void* arg, const addr_t from, char* buf, int nbytes,
+                            bool (*handleMessage)(void* arg, const addr_t from,
+                                                  const char* message));
+static assembly_t* findAssembly(const addr_t from);
+static socklen_t sharedAddress(const int port, struct sockaddr_un* name);
+static peer_t* sharedPeer(const addr_t to);
+static peer_t* addPeer(const addr_t addr);
+static void hashPeers(void);
+static int peerBucket(const addr_t addr);
+static void connectPeer(peer_t* peer);
+static bool sameUser(const int conn);
+static addr_t loopbackAddr(const int port);
+static void acceptPeer(void);
+static bool takeOver(peer_t* peer);
+static bool confirmPeer(peer_t* peer);
+static void answerPeer(const addr_t from, const char* datagram);
+static void removePeer(const int index);
+static bool sendShared(const struct msghdr* hdr);
+static bool sharedSleep(void);
+static bool sharedPending(void);
+static void sharedWake(void);
+static bool receiveShared(void* arg, fd_set* rfds,
+                          bool (*handleMessage)(void* arg, const addr_t from,
+                                                const char* message));
+static uint64_t nowMicros(void);
+static uint64_t toTicks(const float seconds);
+static void timerInsert(const int t);
+static void timerUnlink(const int t);
+static void timerFree(const int t);
+static long timerWait(void);
+static bool timerRun(void);
+
 /***********************************************************************/
 /**************** message_init ****************/
+/* 
+ * Set up a socket on any free port; see message_initPort.
+ * See message.h for detailed description.
+ */
+int
+message_init(FILE* logFP)
+{
+  return message_initPort(logFP, 0);
+}
+
+/**************** message_initPort ****************/
 /* 
  * Set up a socket on which to receive messages; return the port number.
  * Invariant: ourSocket = 0 if we return with error, else ourSocket > 0.
@@ -57,7 +322,7 @@ static int ourSocket = 0;     // socket on which to receive messages
  * See message.h for detailed description.
  */
 int
-message_init(FILE* logFP)
+message_initPort(FILE* logFP, const int port)
 {
   log_init(logFP);
 
@@ -75,11 +340,11 @@ message_init(FILE* logFP)
     return 0;
   }
 
-  // Name socket using wildcards
+  // Name socket using wildcards, and the port asked for (0 = any)
   struct sockaddr_in self;  // our address
   self.sin_family = AF_INET;
   self.sin_addr.s_addr = INADDR_ANY;
-  self.sin_port = 0;
+  self.sin_port = htons(port);
   if (bind(ourSocket, (struct sockaddr *) &self, sizeof(self))) {
     log_e("message_init: binding socket name");
     close(ourSocket);
@@ -96,10 +361,53 @@ message_init(FILE* logFP)
     return 0;
   }
   // extract our port number
-  int port = ntohs(self.sin_port);
-  log_d("message_init: ready at port '%d'", port);
+  int ourPort = ntohs(self.sin_port);
+  log_d("message_init: ready at port '%d'", ourPort);
+
+  // room for the fragments of a large message to wait together;
+  // the kernel may grant less (net.core.rmem_max), which is no error
+  int receiveBuffer = ReceiveBufferBytes;
+  if (setsockopt(ourSocket, SOL_SOCKET, SO_RCVBUF,
+                 &receiveBuffer, sizeof(receiveBuffer)) < 0) {
+    log_e("message_init: enlarging the receive buffer");
+  }
+
+  // a restarted sender should not reuse the ids its receivers last saw
+  nextFragmentId = (unsigned int) time(NULL) ^ ((unsigned int) getpid() << 16);
+
+  return ourPort;
+}
+
+/**************** message_initShared ****************/
+/* 
+ * Set up a socket as message_initPort, and listen for local peers
+ * that would share memory with us.
+ * See message.h for detailed description.
+ */
+int
+message_initShared(FILE* logFP, const int port)
+{
+  int ourPort = message_initPort(logFP, port);
+  if (ourPort == 0) {
+    return 0;
+  }
+  sharedEnabled = true;
+  sharedPort = ourPort;
 
-  return port;
+  struct sockaddr_un name;
+  socklen_t nameLength = sharedAddress(ourPort, &name);
+  sharedListener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sharedListener < 0
+      || bind(sharedListener, (struct sockaddr *) &name, nameLength) < 0
+      || listen(sharedListener, SOMAXCONN) < 0) {
+    // we can still share memory with peers that listen
+    log_e("message_initShared: listening for local peers");
+    if (sharedListener >= 0) {
+      close(sharedListener);
+    }
+    sharedListener = -1;
+  }
+  return ourPort;
 }
 
 /**************** message_noAddr ****************/
@@ -244,25 +552,534 @@ numLines(const char* string)
  */
 void
 message_send(const addr_t to, const char* message)
+{
+  if (message == NULL) {
+    log_v("message_send: called with null message");
+    return; // error in usage of this function.
+  }
+  message_sendn(to, message, strlen(message));
+}
+
+/**************** message_sendn ****************/
+/* 
+ * Send a message of known length to the correspondent address.
+ * See message.h for detailed description.
+ */
+void
+message_sendn(const addr_t to, const char* message, const int length)
 {
   if (ourSocket == 0) {
-    log_v("message_send: called before message_init");
+    log_v("message_sendn: called before message_init");
     return; // error in usage of this function.
   }
-  if (message == NULL) {
-    log_v("message_send: called with null message");
+  if (message == NULL || length < 0) {
+    log_v("message_sendn: called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
+  if (bundleDepth > 0 && queue(to, message, length, false)) {
+    return; // it goes out with the bundle
+  }
+  if (length > message_MaxBytes - 1) {
+    sendFragments(&to, 1, message, length);
+    return;
+  }
+  struct iovec iov = { (void*) message, length };
+  struct msghdr hdr = { .msg_name = (void*) &to, .msg_iov = &iov, .msg_iovlen = 1 };
+  if (sendShared(&hdr)) {
+    return; // it went into the peer's ring
+  }
+  if (sendto(ourSocket, message, length, 0,
              (struct sockaddr *) &to, sizeof(to)) < 0) {
-    log_e("message_send: error sending to datagram socket");
+    log_e("message_sendn: error sending to datagram socket");
   } else {
-    log_s("message_send: TO %s", message_stringAddr(to));
-    log_d("message_send: %d lines:", numLines(message));
-    log_s("%s", message);
+    LOG_S(LOG_DEBUG, "message_sendn: TO %s", message_stringAddr(to));
+    LOG_D(LOG_TRACE, "message_sendn: %d lines:", numLines(message));
+    LOG_S(LOG_TRACE, "%s", message);
+  }
+}
+
+/**************** message_sendBatch ****************/
+/* 
+ * Send one string message to each of the correspondent addresses.
+ * See message.h for detailed description.
+ */
+void
+message_sendBatch(const addr_t to[], const int count, const char* message)
+{
+  if (message == NULL) {
+    log_v("message_sendBatch: called with null message");
+    return; // error in usage of this function.
+  }
+  message_sendBatchn(to, count, message, strlen(message));
+}
+
+/**************** message_sendBatchn ****************/
+/* 
+ * Send one message of known length to each of the correspondent addresses.
+ * See message.h for detailed description.
+ */
+void
+message_sendBatchn(const addr_t to[], const int count,
+                   const char* message, const int length)
+{
+  if (ourSocket == 0) {
+    log_v("message_sendBatchn: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (message == NULL || length < 0 || (to == NULL && count > 0)) {
+    log_v("message_sendBatchn: called with null message or addresses");
+    return; // error in usage of this function.
+  }
+
+  if (bundleDepth > 0) {
+    for (int i = 0; i < count; i++) {
+      if (!queue(to[i], message, length, false)) {
+        message_sendn(to[i], message, length);
+      }
+    }
+    return; // it goes out with the bundle
+  }
+  if (length > message_MaxBytes - 1) {
+    sendFragments(to, count, message, length);
+    return;
+  }
+
+  // every datagram shares the one buffer; only the address differs
+  struct iovec iov = { (void*) message, length };
+  struct mmsghdr msgs[BatchSize];
+
+  for (int first = 0; first < count; first += BatchSize) {
+    int n = count - first;
+    if (n > BatchSize) {
+      n = BatchSize;
+    }
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for (int i = 0; i < n; i++) {
+      msgs[i].msg_hdr.msg_name = (void*) &to[first + i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addr_t);
+      msgs[i].msg_hdr.msg_iov = &iov;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    sendDatagrams(msgs, n);
+  }
+  LOG_S(LOG_TRACE, "%s", message);
+}
+
+/**************** message_sendFrame ****************/
+/* 
+ * Send a frame to each of the correspondent addresses, by reference
+ * when bundling.
+ * See message.h for detailed description.
+ */
+void
+message_sendFrame(const addr_t to[], const int count,
+                  const char* frame, const int length)
+{
+  if (bundleDepth == 0) {
+    message_sendBatchn(to, count, frame, length);
+    return;
+  }
+  if (frame == NULL || length < 0 || (to == NULL && count > 0)) {
+    log_v("message_sendFrame: called with null frame or addresses");
+    return; // error in usage of this function.
+  }
+  for (int i = 0; i < count; i++) {
+    if (!queue(to[i], frame, length, true)) {
+      message_sendn(to[i], frame, length);
+    }
+  }
+}
+
+/**************** message_bundleBegin ****************/
+/* 
+ * Start (or nest) a bundle: hold outgoing messages until it ends.
+ * See message.h for detailed description.
+ */
+void
+message_bundleBegin(void)
+{
+  bundleDepth++;
+}
+
+/**************** message_bundleEnd ****************/
+/* 
+ * End a bundle; the outermost end sends what was held.
+ * See message.h for detailed description.
+ */
+void
+message_bundleEnd(void)
+{
+  if (bundleDepth == 0) {
+    log_v("message_bundleEnd: called without message_bundleBegin");
+    return; // error in usage of this function.
+  }
+  if (--bundleDepth == 0) {
+    message_flush();
   }
 }
 
+/**************** message_flush ****************/
+/* 
+ * Send every outbox as one datagram per recipient, and empty them all.
+ * See message.h for detailed description.
+ */
+void
+message_flush(void)
+{
+  if (numOutboxes == 0) {
+    return;
+  }
+
+  // each outbox needs its segments, plus one for the bundle header
+  int needed = numOutboxes;
+  for (int i = 0; i < numOutboxes; i++) {
+    needed += outboxes[i].numSegments;
+  }
+  if (needed > iovecCapacity) {
+    struct iovec* newIovecs = realloc(iovecs, needed * sizeof(struct iovec));
+    if (newIovecs == NULL) {
+      // no room to gather them all; send them one at a time instead
+      for (int i = 0; i < numOutboxes; i++) {
+        sendOutbox(&outboxes[i]);
+      }
+      needed = 0;
+    } else {
+      iovecs = newIovecs;
+      iovecCapacity = needed;
+    }
+  }
+
+  if (needed > 0) {
+    struct mmsghdr msgs[BatchSize];
+    int used = 0;
+    for (int first = 0; first < numOutboxes; first += BatchSize) {
+      int n = numOutboxes - first;
+      if (n > BatchSize) {
+        n = BatchSize;
+      }
+      memset(msgs, 0, n * sizeof(struct mmsghdr));
+      for (int i = 0; i < n; i++) {
+        outbox_t* box = &outboxes[first + i];
+        msgs[i].msg_hdr.msg_name = (void*) &box->to;
+        msgs[i].msg_hdr.msg_namelen = sizeof(addr_t);
+        msgs[i].msg_hdr.msg_iov = &iovecs[used];
+        msgs[i].msg_hdr.msg_iovlen = fillIovecs(box, &iovecs[used]);
+        used += msgs[i].msg_hdr.msg_iovlen;
+      }
+      sendDatagrams(msgs, n);
+    }
+  }
+
+  // empty the outboxes, keeping their memory for the next bundle
+  for (int i = 0; i < numOutboxes; i++) {
+    outboxes[i].arenaLength = 0;
+    outboxes[i].numSegments = 0;
+    outboxes[i].count = 0;
+  }
+  numOutboxes = 0;
+  memset(outboxSlots, 0, numSlots * sizeof(int));
+}
+
+/**************** sendDatagrams ****************/
+/*
+ * Hand prepared datagrams to the kernel in as few calls as it allows,
+ * skipping any that fails, as message_send would.
+ */
+static void
+sendDatagrams(struct mmsghdr* msgs, const int count)
+{
+  for (int first = 0; first < count; ) {
+    // datagrams to peers sharing memory go into their rings; the rest,
+    // up to the next such, go to the kernel together
+    int end = first;
+    while (end < count && !sendShared(&msgs[end].msg_hdr)) {
+      end++;
+    }
+    while (first < end) {
+      int sent = sendmmsg(ourSocket, msgs + first, end - first, 0);
+      if (sent <= 0) {
+        log_e("message: error sending to datagram socket");
+        sent = 1;
+      } else {
+        LOG_D(LOG_DEBUG, "message: sent %d datagrams", sent);
+      }
+      first += sent;
+    }
+    first = end + 1;
+  }
+}
+
+/**************** sendFragments ****************/
+/*
+ * Send a message too long for one datagram to each address, as fragments;
+ * see FragmentHeader. Each fragment is handed to the kernel for all
+ * recipients at once, its bytes straight from the caller's buffer.
+ */
+static void
+sendFragments(const addr_t to[], const int count,
+              const char* message, const int length)
+{
+  int numFragments = (length + FragmentBytes - 1) / FragmentBytes;
+  if (numFragments > MaxFragments) {
+    log_d("message: a %d-byte message is too long to send", length);
+    return;
+  }
+  unsigned int id = nextFragmentId++;
+
+  char header[64];
+  struct iovec iov[2];
+  struct mmsghdr msgs[BatchSize];
+  for (int index = 0; index < numFragments; index++) {
+    int offset = index * FragmentBytes;
+    int bytes = length - offset;
+    if (bytes > FragmentBytes) {
+      bytes = FragmentBytes;
+    }
+    int headerLength = sprintf(header, FragmentHeader "%u %d %d\n",
+                               id, index, numFragments);
+    iov[0] = (struct iovec) { header, headerLength };
+    iov[1] = (struct iovec) { (void*) (message + offset), bytes };
+
+    for (int first = 0; first < count; first += BatchSize) {
+      int n = count - first;
+      if (n > BatchSize) {
+        n = BatchSize;
+      }
+      memset(msgs, 0, n * sizeof(struct mmsghdr));
+      for (int i = 0; i < n; i++) {
+        msgs[i].msg_hdr.msg_name = (void*) &to[first + i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addr_t);
+        msgs[i].msg_hdr.msg_iov = iov;
+        msgs[i].msg_hdr.msg_iovlen = 2;
+      }
+      sendDatagrams(msgs, n);
+    }
+  }
+  LOG_D(LOG_DEBUG, "message: sent a message as %d fragments", numFragments);
+}
+
+/**************** queue ****************/
+/*
+ * Add one message to its recipient's outbox; a frame is referenced,
+ * and replaces an earlier reference to the same frame.
+ * Returns false if it could not be queued, and the caller should send it now.
+ */
+static bool
+queue(const addr_t to, const char* message, const int length, const bool isFrame)
+{
+  char prefix[12];
+  int prefixLength = sprintf(prefix, "%d\n", length);
+  outbox_t* box = findOutbox(to);
+  if (box == NULL) {
+    return false;
+  }
+  if (BundleHeaderLength + prefixLength + length > message_MaxBytes - 1) {
+    // too big to bundle; what was queued before it must go out first
+    sendOutbox(box);
+    return false;
+  }
+
+  if (isFrame) {
+    // the recipient needs only the newest copy of a frame
+    for (int i = 1; i < box->numSegments; i += 2) {
+      segment_t* old = &box->segments[i];
+      if (old->frame == message && old->length > 0) {
+        box->bytes -= box->segments[i-1].length + old->length;
+        box->segments[i-1].length = 0;
+        old->length = 0;
+        box->count--;
+      }
+    }
+  }
+
+  // send what we have first if this would overflow the datagram
+  if (box->bytes + prefixLength + length > message_MaxBytes - 1) {
+    sendOutbox(box);
+  }
+
+  if (!addSegment(box, NULL, prefix, prefixLength)) {
+    return false;
+  }
+  if (!addSegment(box, isFrame ? message : NULL, message, length)) {
+    box->numSegments--; // take back the prefix
+    box->bytes -= prefixLength;
+    return false;
+  }
+  box->count++;
+  return true;
+}
+
+/**************** findOutbox ****************/
+/*
+ * Return the outbox for this address, starting one if needed; NULL if
+ * out of memory.
+ */
+static outbox_t*
+findOutbox(const addr_t to)
+{
+  if (2 * (numOutboxes + 1) > numSlots && !growSlots()) {
+    return NULL;
+  }
+
+  unsigned int hash = (to.sin_addr.s_addr * 2654435761u) ^ to.sin_port;
+  for (int slot = hash & (numSlots - 1); ; slot = (slot + 1) & (numSlots - 1)) {
+    int index = outboxSlots[slot] - 1;
+    if (index >= 0) {
+      if (message_eqAddr(outboxes[index].to, to)) {
+        return &outboxes[index];
+      }
+      continue;
+    }
+
+    // not there; start a new outbox in this slot
+    if (numOutboxes == outboxCapacity) {
+      int newCapacity = (outboxCapacity == 0) ? 16 : 2 * outboxCapacity;
+      outbox_t* newOutboxes = realloc(outboxes, newCapacity * sizeof(outbox_t));
+      if (newOutboxes == NULL) {
+        return NULL;
+      }
+      memset(newOutboxes + outboxCapacity, 0,
+             (newCapacity - outboxCapacity) * sizeof(outbox_t));
+      outboxes = newOutboxes;
+      outboxCapacity = newCapacity;
+    }
+    outbox_t* box = &outboxes[numOutboxes];
+    box->to = to;
+    box->bytes = BundleHeaderLength;
+    outboxSlots[slot] = ++numOutboxes;
+    return box;
+  }
+}
+
+/**************** growSlots ****************/
+/*
+ * Double the address hash, keeping it at most half full.
+ * Returns false if out of memory.
+ */
+static bool
+growSlots(void)
+{
+  int newNumSlots = (numSlots == 0) ? 32 : 2 * numSlots;
+  int* newSlots = calloc(newNumSlots, sizeof(int));
+  if (newSlots == NULL) {
+    return false;
+  }
+  for (int index = 0; index < numOutboxes; index++) {
+    addr_t to = outboxes[index].to;
+    unsigned int hash = (to.sin_addr.s_addr * 2654435761u) ^ to.sin_port;
+    int slot = hash & (newNumSlots - 1);
+    while (newSlots[slot] != 0) {
+      slot = (slot + 1) & (newNumSlots - 1);
+    }
+    newSlots[slot] = index + 1;
+  }
+  free(outboxSlots);
+  outboxSlots = newSlots;
+  numSlots = newNumSlots;
+  return true;
+}
+
+/**************** addSegment ****************/
+/*
+ * Append a segment to an outbox: a reference to `frame` if it is not
+ * NULL, otherwise a copy of `bytes` in the arena.
+ * Returns false if out of memory.
+ */
+static bool
+addSegment(outbox_t* box, const char* frame, const char* bytes, const int length)
+{
+  if (box->numSegments == box->segmentCapacity) {
+    int newCapacity = (box->segmentCapacity == 0) ? 16 : 2 * box->segmentCapacity;
+    segment_t* newSegments = realloc(box->segments, newCapacity * sizeof(segment_t));
+    if (newSegments == NULL) {
+      return false;
+    }
+    box->segments = newSegments;
+    box->segmentCapacity = newCapacity;
+  }
+  segment_t* segment = &box->segments[box->numSegments];
+  segment->frame = frame;
+  segment->offset = box->arenaLength;
+  segment->length = length;
+
+  if (frame == NULL) {
+    if (box->arenaLength + length > box->arenaCapacity) {
+      int newCapacity = (box->arenaCapacity == 0) ? 256 : 2 * box->arenaCapacity;
+      while (newCapacity < box->arenaLength + length) {
+        newCapacity *= 2;
+      }
+      char* newArena = realloc(box->arena, newCapacity);
+      if (newArena == NULL) {
+        return false;
+      }
+      box->arena = newArena;
+      box->arenaCapacity = newCapacity;
+    }
+    memcpy(box->arena + box->arenaLength, bytes, length);
+    box->arenaLength += length;
+  }
+  box->numSegments++;
+  box->bytes += length;
+  return true;
+}
+
+/**************** sendOutbox ****************/
+/*
+ * Send one outbox right away, and empty it (it stays in use).
+ */
+static void
+sendOutbox(outbox_t* box)
+{
+  if (box->count > 0) {
+    struct iovec iov[box->numSegments + 1];
+    struct mmsghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_hdr.msg_name = (void*) &box->to;
+    msg.msg_hdr.msg_namelen = sizeof(addr_t);
+    msg.msg_hdr.msg_iov = iov;
+    msg.msg_hdr.msg_iovlen = fillIovecs(box, iov);
+    sendDatagrams(&msg, 1);
+  }
+  box->arenaLength = 0;
+  box->numSegments = 0;
+  box->count = 0;
+  box->bytes = BundleHeaderLength;
+}
+
+/**************** fillIovecs ****************/
+/*
+ * Describe an outbox's datagram: a lone message goes as itself, several
+ * go as a bundle. Adjacent arena segments share one iovec.
+ * Returns the number of iovecs filled; at most numSegments + 1.
+ */
+static int
+fillIovecs(outbox_t* box, struct iovec* iov)
+{
+  int n = 0;
+  bool single = (box->count == 1);
+  if (!single) {
+    iov[n++] = (struct iovec) { BundleHeader, BundleHeaderLength };
+  }
+  bool lastInArena = false;  // does iov[n-1] point into the arena?
+  for (int i = 0; i < box->numSegments; i++) {
+    segment_t* segment = &box->segments[i];
+    if (segment->length == 0 || (single && i % 2 == 0)) {
+      continue; // superseded, or the prefix of a lone message
+    }
+    if (segment->frame != NULL) {
+      iov[n++] = (struct iovec) { (void*) segment->frame, segment->length };
+      lastInArena = false;
+    } else if (lastInArena && (char*) iov[n-1].iov_base + iov[n-1].iov_len
+                              == box->arena + segment->offset) {
+      iov[n-1].iov_len += segment->length;
+    } else {
+      iov[n++] = (struct iovec) { box->arena + segment->offset, segment->length };
+      lastInArena = true;
+    }
+  }
+  return n;
+}
+
 /**************** message_loop ****************/
 /* 
  * Loop forever, calling handler functions for stdin or socket,
@@ -284,7 +1101,8 @@ message_loop(void* arg, const float timeout,
   }
 
   // check parameters
-  if (handleTimeout == NULL && handleInput == NULL && handleMessage == NULL) {
+  if (handleTimeout == NULL && handleInput == NULL && handleMessage == NULL
+      && numTimers == 0) {
     log_v("message_loop called with all handlers null");
     return false; // error in usage of this function.
   }
@@ -297,14 +1115,11 @@ message_loop(void* arg, const float timeout,
     return false; // error in usage of this function.
   }
 
-  // set up for timeouts, if desired
+  // set up for timeouts, if desired; handlers may change the timeout
   struct timeval* timerp = NULL; // stays null if no timeout desired
   struct timeval  timer;          // timerp = &timer if timeout desired
-  struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
-  if (timeout > 0.0) {
-    timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
-  }
+  loopTimeout = timeout;
+  uint64_t idleSince = nowMicros(); // the timeout counts from here
 
   // loop until error or some handler indicates time to quit looping
   while (true) {
@@ -322,15 +1137,61 @@ message_loop(void* arg, const float timeout,
       FD_SET(ourSocket, &rfds); // monitor the socket
       nfds = ourSocket+1;       // highest-numbered fd in rfds
     }
-    if (timeout > 0.0) {      // is timeout desired?
-      timer = timeoutval;     // set the timer to the timeout value
+    bool watchRings = (handleMessage != NULL && sharedEnabled);
+    if (watchRings) {
+      // and the local peers: new ones, ones gone, and wakeups from the rest
+      if (sharedListener >= 0) {
+        FD_SET(sharedListener, &rfds);
+        nfds = (sharedListener >= nfds) ? sharedListener+1 : nfds;
+      }
+      for (int i = 0; i < numPeers; i++) {
+        if (peers[i].conn >= 0) {
+          FD_SET(peers[i].conn, &rfds);
+          nfds = (peers[i].conn >= nfds) ? peers[i].conn+1 : nfds;
+        }
+        if (peers[i].wait >= 0) {
+          FD_SET(peers[i].wait, &rfds);
+          nfds = (peers[i].wait >= nfds) ? peers[i].wait+1 : nfds;
+        }
+      }
+    }
+    // wait until the timeout, counted from the last input or message,
+    // runs out, or the next timer is due
+    long wait = timerWait();  // microseconds; -1 if there is no timer
+    if (loopTimeout > 0.0) {  // is timeout desired?
+      uint64_t now = nowMicros();
+      uint64_t deadline = idleSince + (uint64_t)(loopTimeout * 1000000);
+      long idle = (deadline > now) ? (long)(deadline - now) : 0;
+      if (wait < 0 || idle < wait) {
+        wait = idle;
+      }
+    }
+    if (wait >= 0) {
+      timer.tv_sec  = wait / 1000000;  // set the timer to the wait
+      timer.tv_usec = wait % 1000000;
       timerp = &timer;        // pass that timer to select
     } else {
       timerp = NULL;          // no timeout is desired
     }
 
-    // Wait for input on either source
-    int select_response = select(nfds, &rfds, NULL, NULL, timerp);
+    // Wait for input on either source, after spinning for it in busy-poll
+    // mode; a local peer may have left messages in shared memory instead
+    bool ringsReady = false;
+    int select_response = 0;
+    if (spinMicros > 0) {
+      select_response = spin(nfds, &rfds, watchRings, timerp, &ringsReady);
+    }
+    if (select_response == 0 && !ringsReady) {
+      if (watchRings && sharedSleep()) {
+        ringsReady = true;    // no waiting, then
+        timer.tv_sec = timer.tv_usec = 0;
+        timerp = &timer;
+      }
+      select_response = select(nfds, &rfds, NULL, NULL, timerp);
+      if (watchRings) {
+        sharedWake();
+      }
+    }
     // note: 'rfds' updated
     
     if (select_response < 0) {
@@ -343,56 +1204,1253 @@ message_loop(void* arg, const float timeout,
 	log_e("message_loop: select()");
 	return false; // error
       }
-    } else if (select_response == 0) {
-      // timeout occurred
-      log_v("message_loop: select() timed out");
-      if (handleTimeout != NULL && (*handleTimeout)(arg)) {
-        break; // handler says to exit loop 
+    } else if (select_response == 0 && !ringsReady) {
+      // timeout occurred, unless a timer woke us first
+      if (handleTimeout != NULL
+          && nowMicros() >= idleSince + (uint64_t)(loopTimeout * 1000000)) {
+        LOG_V(LOG_TRACE, "message_loop: select() timed out");
+        message_bundleBegin();
+        bool done = (*handleTimeout)(arg);
+        message_bundleEnd();
+        idleSince = nowMicros();
+        if (done) {
+          break; // handler says to exit loop 
+        }
+      }
+    } else {
+      // some data is ready on either source, or both, or in shared memory
+
+      if (FD_ISSET(0, &rfds)) {
+        // stdin has input ready
+        LOG_V(LOG_TRACE, "message_loop: input ready on stdin");
+        if (handleInput != NULL) {
+          message_bundleBegin();
+          bool done = (*handleInput)(arg);
+          message_bundleEnd();
+          if (done) {
+            break; // handler says to exit loop 
+          }
+        }
+      }
+      if (FD_ISSET(ourSocket, &rfds)) {
+        // socket has input ready
+        LOG_V(LOG_TRACE, "message_loop: message ready on socket");
+        if (handleMessage != NULL && receiveAll(arg, handleMessage)) {
+          break; // handler says to exit loop 
+        }
+      }
+      if (handleMessage != NULL && sharedEnabled
+          && receiveShared(arg, &rfds, handleMessage)) {
+        break; // handler says to exit loop 
+      }
+      idleSince = nowMicros();
+    }
+
+    // then whatever timers have come due
+    if (numTimers > 0 && timerRun()) {
+      break; // handler says to exit loop 
+    }
+  }
+  return true;
+}
+
+/**************** spin ****************/
+/*
+ * Busy-poll mode: look for input without sleeping until some comes, or
+ * spinMicros pass, or the timer (charged for the time spent) runs out.
+ * Returns what select last returned, with rfds as it left them, and
+ * whether a ring has messages; if nothing came, 0, with rfds as given.
+ */
+static int
+spin(const int nfds, fd_set* rfds, const bool watchRings,
+     struct timeval* timerp, bool* ringsReady)
+{
+  long budget = spinMicros;
+  if (timerp != NULL && timerp->tv_sec * 1000000L + timerp->tv_usec < budget) {
+    budget = timerp->tv_sec * 1000000L + timerp->tv_usec;
+  }
+  fd_set watched = *rfds;
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long spent = 0;
+  do {
+    struct timeval zero = { 0, 0 };
+    *rfds = watched;
+    int ready = select(nfds, rfds, NULL, NULL, &zero);
+    *ringsReady = watchRings && sharedPending();
+    if (ready != 0 || *ringsReady) {
+      return ready;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    spent = (now.tv_sec - start.tv_sec) * 1000000L
+      + (now.tv_nsec - start.tv_nsec) / 1000;
+  } while (spent < budget);
+
+  *rfds = watched;
+  if (timerp != NULL) {
+    long left = timerp->tv_sec * 1000000L + timerp->tv_usec - spent;
+    left = (left > 0) ? left : 0;
+    timerp->tv_sec = left / 1000000;
+    timerp->tv_usec = left % 1000000;
+  }
+  return 0;
+}
+
+/**************** receiveAll ****************/
+/*
+ * Receive and handle every datagram queued on the socket (up to
+ * MaxDrain), so a burst reaches the handler as one batch.
+ * Returns true if the handler says to exit the loop.
+ */
+static bool
+receiveAll(void* arg,
+           bool (*handleMessage)(void* arg, const addr_t from, const char* message))
+{
+  char buf[message_MaxBytes]; // buffer for reading data from socket
+  bool done = false;
+
+  // replies to the whole batch are bundled together
+  message_bundleBegin();
+  for (drainRemaining = MaxDrain; drainRemaining > 0 && !done; ) {
+    drainRemaining--;
+    struct sockaddr_in sender;     // sender of this message
+    struct sockaddr *senderp = (struct sockaddr *) &sender;
+    socklen_t senderlen = sizeof(sender);  // must pass address to length
+    int nbytes = recvfrom(ourSocket, buf, message_MaxBytes-1, 
+                          MSG_DONTWAIT, senderp, &senderlen);
+    if (nbytes < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        // error, ignore it
+        log_e("message_loop: receiving from socket");
+      }
+      break; // drained
+    }
+
+    buf[nbytes] = '\0';     // null terminate message string
+    // where was it from?
+    if (sender.sin_family != AF_INET) {
+      // ignore it
+      log_d("message_loop: non-Internet family %d\n", sender.sin_family);
+      continue;
+    }
+    // record it
+    LOG_S(LOG_DEBUG, "message_loop: FROM %s", message_stringAddr(sender));
+    LOG_D(LOG_TRACE, "message_loop: %d lines:", numLines(buf));
+    LOG_S(LOG_TRACE, "%s", buf);
+
+    // a nonce for a local peer we connected to is not for the handler
+    if (sharedEnabled && strncmp(buf, ConfirmHeader, ConfirmHeaderLength) == 0) {
+      answerPeer(sender, buf);
+      continue;
+    }
+
+    // handle it, once the whole of a fragmented message is here
+    if (strncmp(buf, FragmentHeader, FragmentHeaderLength) == 0) {
+      done = deliverFragment(arg, sender, buf, nbytes, handleMessage);
+    } else {
+      done = deliver(arg, sender, buf, nbytes, handleMessage);
+    }
+  }
+  drainRemaining = 0;
+  message_bundleEnd();
+  return done;
+}
+
+/**************** message_busyPoll ****************/
+/* 
+ * Trade a CPU for latency: spin before blocking, busy-poll the device
+ * queue, and stay on one CPU.
+ * See message.h for detailed description.
+ */
+bool
+message_busyPoll(const int spinMicroseconds, const int cpu)
+{
+  if (ourSocket == 0) {
+    log_v("message_busyPoll: called before message_init");
+    return false; // error in usage of this function.
+  }
+  if (spinMicroseconds < 0) {
+    log_v("message_busyPoll: needs a spin of 0 microseconds or more");
+    return false; // error in usage of this function.
+  }
+  spinMicros = spinMicroseconds;
+
+  bool ok = true;
+  // the kernel may refuse more than net.core.busy_read without CAP_NET_ADMIN
+  if (setsockopt(ourSocket, SOL_SOCKET, SO_BUSY_POLL,
+                 &spinMicros, sizeof(spinMicros)) < 0) {
+    log_e("message_busyPoll: setting SO_BUSY_POLL");
+    ok = false;
+  }
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpus);
+    }
+    if (cpu >= CPU_SETSIZE || sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+      log_e("message_busyPoll: pinning to the CPU");
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/**************** message_setTimeout ****************/
+/* 
+ * Change the timeout of the running message_loop.
+ * See message.h for detailed description.
+ */
+void
+message_setTimeout(const float timeout)
+{
+  if (timeout <= 0.0 || loopTimeout <= 0.0) {
+    log_v("message_setTimeout: needs timeout > 0 and a loop with a timeout handler");
+    return;
+  }
+  loopTimeout = timeout;
+}
+
+/**************** message_timerAdd ****************/
+/* 
+ * Have message_loop call a function after a delay, and every period
+ * after that if one is given.
+ * See message.h for detailed description.
+ */
+int
+message_timerAdd(const float delay, const float period,
+                 bool (*handleTimer)(void* arg), void* arg)
+{
+  if (handleTimer == NULL || delay < 0.0 || period < 0.0) {
+    log_v("message_timerAdd: needs a handler, and delay and period >= 0");
+    return 0; // error in usage of this function.
+  }
+  if (freeTimers == 0) {
+    // none free: double the pool, and chain the new ones as free
+    int capacity = (timerCapacity == 0) ? 16 : timerCapacity * 2;
+    loopTimer_t* grown = NULL;
+    if (capacity >= (1 << TimerIndexBits)
+        || (grown = realloc(timers, capacity * sizeof(loopTimer_t))) == NULL) {
+      log_v("message_timerAdd: no room for another timer");
+      return 0;
+    }
+    for (int t = timerCapacity; t < capacity; t++) {
+      grown[t].slot = -1;
+      grown[t].generation = 0;
+      grown[t].next = (t + 1 < capacity) ? t + 2 : 0;
+    }
+    freeTimers = timerCapacity + 1;
+    timers = grown;
+    timerCapacity = capacity;
+  }
+
+  // an empty wheel may have stood still; it catches up at once. Counting
+  // from the tick after now, the timer is never called early
+  uint64_t now = nowMicros() / 1000;
+  if (numTimers == 0) {
+    wheelNow = now;
+  }
+  now++;
+  int t = freeTimers - 1;
+  loopTimer_t* timer = &timers[t];
+  freeTimers = timer->next;
+  timer->expires = now + toTicks(delay);
+  timer->period = (period > 0.0) ? toTicks(period) : 0;
+  timer->handleTimer = handleTimer;
+  timer->arg = arg;
+  timerInsert(t);
+  numTimers++;
+  return (timer->generation << TimerIndexBits) | (t + 1);
+}
+
+/**************** message_timerCancel ****************/
+/* 
+ * Stop a timer before it is called (again).
+ * See message.h for detailed description.
+ */
+bool
+message_timerCancel(const int timer)
+{
+  int t = (timer & ((1 << TimerIndexBits) - 1)) - 1;
+  if (timer <= 0 || t < 0 || t >= timerCapacity || timers[t].slot < 0
+      || timers[t].generation != (timer >> TimerIndexBits)) {
+    return false; // long gone, or never was
+  }
+  timerUnlink(t);
+  timerFree(t);
+  return true;
+}
+
+/**************** nowMicros ****************/
+/* Microseconds on the monotonic clock. */
+static uint64_t
+nowMicros(void)
+{
+#ifdef UNIT_TEST
+  if (clockMocked) {
+    return mockedMicros;
+  }
+#endif
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**************** toTicks ****************/
+/* Ticks in a delay or period, rounded up, and at least one. It is first
+ * rounded to the microsecond, so that the float's error (0.010 is a bit
+ * over) does not make a tick more. */
+static uint64_t
+toTicks(const float seconds)
+{
+  uint64_t micros = (seconds < MaxTimerSeconds ? seconds : MaxTimerSeconds) * 1e6 + 0.5;
+  uint64_t ticks = (micros + 999) / 1000;
+  return (ticks > 0) ? ticks : 1;
+}
+
+/**************** timerInsert ****************/
+/*
+ * Link a timer into the slot for when it is due, reckoned from wheelNow;
+ * one due now (only while the wheel refills level 0) goes in the slot of
+ * this tick, about to run, and one due past the wheel's reach goes as far
+ * as it does, to be put back in from there.
+ */
+static void
+timerInsert(const int t)
+{
+  loopTimer_t* timer = &timers[t];
+  uint64_t delta = (timer->expires > wheelNow) ? timer->expires - wheelNow : 0;
+  int level = 0;
+  while (level < WheelLevels - 1 && (delta >> (WheelBits * (level + 1))) != 0) {
+    level++;
+  }
+  int shift = WheelBits * level;
+  int index;
+  if (delta == 0) {
+    index = wheelNow & WheelMask;
+  } else if ((delta >> (WheelBits * WheelLevels)) != 0) {
+    index = ((wheelNow >> shift) + WheelMask) & WheelMask;
+  } else {
+    index = (timer->expires >> shift) & WheelMask;
+  }
+
+  int slot = level * WheelSlots + index;
+  timer->slot = slot;
+  timer->prev = 0;
+  timer->next = wheel[slot];
+  if (wheel[slot] != 0) {
+    timers[wheel[slot] - 1].prev = t + 1;
+  }
+  wheel[slot] = t + 1;
+}
+
+/**************** timerUnlink ****************/
+/* Take a timer out of its slot; it stays in use. */
+static void
+timerUnlink(const int t)
+{
+  loopTimer_t* timer = &timers[t];
+  if (timer->prev != 0) {
+    timers[timer->prev - 1].next = timer->next;
+  } else {
+    wheel[timer->slot] = timer->next;
+  }
+  if (timer->next != 0) {
+    timers[timer->next - 1].prev = timer->prev;
+  }
+}
+
+/**************** timerFree ****************/
+/* Put an unlinked timer on the free list, making its id stale. */
+static void
+timerFree(const int t)
+{
+  loopTimer_t* timer = &timers[t];
+  timer->slot = -1;
+  timer->generation = (timer->generation + 1) & ((1 << (31 - TimerIndexBits)) - 1);
+  timer->next = freeTimers;
+  freeTimers = t + 1;
+  numTimers--;
+}
+
+/**************** timerWait ****************/
+/*
+ * Microseconds until the first timer may be due (0 if one is overdue),
+ * or -1 if there is none. Level 0 knows to the tick; a slot above is
+ * reckoned from its start, so the loop may wake early, never late.
+ */
+static long
+timerWait(void)
+{
+  if (numTimers == 0) {
+    return -1;
+  }
+  uint64_t due = UINT64_MAX;
+  for (int level = 0; level < WheelLevels; level++) {
+    int shift = WheelBits * level;
+    uint64_t current = wheelNow >> shift;
+    for (int k = 1; k <= WheelSlots; k++) {
+      if (wheel[level * WheelSlots + ((current + k) & WheelMask)] != 0) {
+        if (((current + k) << shift) < due) {
+          due = (current + k) << shift;
+        }
+        break;
+      }
+    }
+  }
+  uint64_t now = nowMicros();
+  return (due * 1000 > now) ? (long) (due * 1000 - now) : 0;
+}
+
+/**************** timerRun ****************/
+/*
+ * Turn the wheel up to now, calling each timer as its tick comes; a
+ * periodic timer is put back in first, a period on, skipping calls the
+ * loop was too late for. Returns true if a handler says to end the loop.
+ */
+static bool
+timerRun(void)
+{
+  uint64_t target = nowMicros() / 1000;
+  bool done = false;
+  while (!done && wheelNow < target) {
+    if (numTimers == 0) {
+      wheelNow = target;  // nothing to call on the way
+      break;
+    }
+    wheelNow++;
+    if ((wheelNow & WheelMask) == 0) {
+      // level 0 went round: refill it from the next slot of level 1, and
+      // that level from the one above when it goes round too
+      for (int level = 1; level < WheelLevels; level++) {
+        int index = (wheelNow >> (WheelBits * level)) & WheelMask;
+        int t = wheel[level * WheelSlots + index];
+        wheel[level * WheelSlots + index] = 0;
+        while (t != 0) {
+          int next = timers[t - 1].next;
+          timerInsert(t - 1);
+          t = next;
+        }
+        if (index != 0) {
+          break;
+        }
+      }
+    }
+
+    // a handler may add or cancel timers, this one included
+    int t;
+    while (!done && (t = wheel[wheelNow & WheelMask]) != 0) {
+      loopTimer_t* timer = &timers[t - 1];
+      bool (*handleTimer)(void* arg) = timer->handleTimer;
+      void* arg = timer->arg;
+      timerUnlink(t - 1);
+      if (timer->period > 0) {
+        timer->expires += timer->period;
+        if (timer->expires <= target) {
+          timer->expires += ((target - timer->expires) / timer->period + 1) * timer->period;
+        }
+        timerInsert(t - 1);
+      } else {
+        timerFree(t - 1);
+      }
+      message_bundleBegin();
+      done = (*handleTimer)(arg);
+      message_bundleEnd();
+    }
+  }
+  return done;
+}
+
+/**************** message_pending ****************/
+/* 
+ * Are more messages from the same datagram still to be handled?
+ * See message.h for detailed description.
+ */
+bool
+message_pending(void)
+{
+  if (bundleHasMore) {
+    return true;
+  }
+  if (drainingRing != NULL) {
+    // another record after this one in the ring?
+    return atomic_load_explicit(&drainingRing->head, memory_order_acquire)
+      != drainingNext;
+  }
+  // while draining, peek to see whether another datagram is waiting
+  char byte;
+  return drainRemaining > 0
+    && recv(ourSocket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) >= 0;
+}
+
+/**************** message_length ****************/
+/* 
+ * How many bytes are in the message being handled?
+ * See message.h for detailed description.
+ */
+int
+message_length(void)
+{
+  return messageLength;
+}
+
+/**************** deliver ****************/
+/*
+ * Pass a received message to the handler, or each message bundled in it.
+ * `buf` holds nbytes, and must have room for buf[nbytes] = '\0'.
+ * Returns true if the handler says to exit the loop.
+ */
+static bool
+deliver(void* arg, const addr_t from, char* buf, int nbytes,
+        bool (*handleMessage)(void* arg, const addr_t from,
+                              const char* message))
+{
+  if (strncmp(buf, BundleHeader, BundleHeaderLength) == 0) {
+    return deliverBundle(arg, from, buf, nbytes, handleMessage);
+  }
+  buf[nbytes] = '\0';
+  messageLength = nbytes;
+  bool done = (*handleMessage)(arg, from, buf);
+  messageLength = 0;
+  return done;
+}
+
+/**************** deliverBundle ****************/
+/*
+ * Pass each message of a bundle to the handler, in order, as a string.
+ * Each is terminated in place, so `buf` must have room for buf[nbytes].
+ * Returns true if the handler says to exit the loop.
+ */
+static bool
+deliverBundle(void* arg, const addr_t from, char* buf, int nbytes,
+              bool (*handleMessage)(void* arg, const addr_t from,
+                                    const char* message))
+{
+  char* end = buf + nbytes;
+  char* p = buf + BundleHeaderLength;
+  while (p < end) {
+    char* newline;
+    long length = strtol(p, &newline, 10);
+    if (newline == p || *newline != '\n' || length < 0
+        || length > end - (newline + 1)) {
+      log_v("message_loop: malformed bundle; ignoring the rest of it");
+      return false;
+    }
+    char* message = newline + 1;
+    char* next = message + length;
+    char saved = *next;   // the next length prefix, or buf[nbytes]
+    *next = '\0';
+    bundleHasMore = (next < end);
+    messageLength = length;
+    bool done = (*handleMessage)(arg, from, message);
+    messageLength = 0;
+    bundleHasMore = false;
+    *next = saved;
+    if (done) {
+      return true;
+    }
+    p = next;
+  }
+  return false;
+}
+
+/**************** deliverFragment ****************/
+/*
+ * Put a fragment into its sender's assembly, and deliver the message
+ * when it is whole. A fragment of a newer message drops the rest of an
+ * incomplete older one; late fragments of older messages are ignored.
+ * Returns true if the handler says to exit the loop.
+ */
+static bool
+deliverFragment(void* arg, const addr_t from, char* buf, int nbytes,
+                bool (*handleMessage)(void* arg, const addr_t from,
+                                      const char* message))
+{
+  unsigned int id;
+  int index, count, headerLength = 0;
+  // (the bytes may start with whitespace, which "\n" in a format would skip)
+  if (sscanf(buf, FragmentHeader "%u %d %d%n", &id, &index, &count,
+             &headerLength) != 3 || buf[headerLength++] != '\n'
+      || count < 1 || count > MaxFragments || index < 0 || index >= count) {
+    log_v("message_loop: malformed fragment; ignoring it");
+    return false;
+  }
+  int bytes = nbytes - headerLength;
+  if ((index < count - 1) ? (bytes != FragmentBytes)
+                          : (bytes < 1 || bytes > FragmentBytes)) {
+    log_v("message_loop: fragment of the wrong size; ignoring it");
+    return false;
+  }
+
+  assembly_t* assembly = findAssembly(from);
+  if (assembly->inUse && id != assembly->id) {
+    unsigned int behind = assembly->id - id;
+    if (behind <= StaleIds) {
+      return false; // a late fragment of a message we are past
+    }
+    if (assembly->received < assembly->count) {
+      log_d("message_loop: dropping a message missing %d fragments",
+            assembly->count - assembly->received);
+    }
+    assembly->inUse = false;
+  }
+  if (!assembly->inUse) {
+    // the first fragment to arrive of a new message
+    int needed = count * FragmentBytes + 1;
+    if (needed > assembly->capacity) {
+      char* newBuf = realloc(assembly->buf, needed);
+      if (newBuf == NULL) {
+        log_v("message_loop: no memory to reassemble a message");
+        return false;
+      }
+      assembly->buf = newBuf;
+      assembly->capacity = needed;
+    }
+    assembly->from = from;
+    assembly->inUse = true;
+    assembly->id = id;
+    assembly->count = count;
+    assembly->received = 0;
+    assembly->length = 0;
+    memset(assembly->have, 0, sizeof(assembly->have));
+  } else if (count != assembly->count || assembly->have[index]) {
+    return false; // inconsistent, or a duplicate (maybe of a completed message)
+  }
+
+  memcpy(assembly->buf + index * FragmentBytes, buf + headerLength, bytes);
+  assembly->have[index] = true;
+  assembly->received++;
+  if (index == count - 1) {
+    assembly->length = index * FragmentBytes + bytes;
+  }
+  if (assembly->received < count) {
+    return false;
+  }
+  LOG_D(LOG_DEBUG, "message_loop: reassembled a message of %d fragments", count);
+  return deliver(arg, from, assembly->buf, assembly->length, handleMessage);
+}
+
+/**************** findAssembly ****************/
+/*
+ * Return the sender's assembly; if it has none, one not in use, or else
+ * the next in turn is taken from another sender.
+ */
+static assembly_t*
+findAssembly(const addr_t from)
+{
+  assembly_t* unused = NULL;
+  for (int i = 0; i < MaxAssemblies; i++) {
+    if (!assemblies[i].inUse) {
+      if (unused == NULL) {
+        unused = &assemblies[i];
+      }
+    } else if (message_eqAddr(assemblies[i].from, from)) {
+      return &assemblies[i];
+    }
+  }
+  if (unused == NULL) {
+    unused = &assemblies[nextEviction];
+    nextEviction = (nextEviction + 1) % MaxAssemblies;
+    unused->inUse = false;
+  }
+  return unused;
+}
+
+/**************** sharedAddress ****************/
+/*
+ * Fill in the name of the Unix socket of the process with this UDP port,
+ * in the abstract namespace (so there is no file to clean up).
+ * Returns the length of the name.
+ */
+static socklen_t
+sharedAddress(const int port, struct sockaddr_un* name)
+{
+  memset(name, 0, sizeof(*name));
+  name->sun_family = AF_UNIX;
+  int length = snprintf(name->sun_path + 1, sizeof(name->sun_path) - 1,
+                        SharedName, port);
+  return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+/**************** sharedPeer ****************/
+/*
+ * Return the peer sharing memory with us at this address, connecting to
+ * it on the first message to a local address; NULL if it is reached by
+ * UDP. A local peer that did not take up sharing is tried again once
+ * its entry has expired.
+ */
+static peer_t*
+sharedPeer(const addr_t to)
+{
+  if (!sharedEnabled || (ntohl(to.sin_addr.s_addr) >> 24) != IN_LOOPBACKNET) {
+    return NULL; // not on this host
+  }
+  int expired = -1;
+  if (numPeers > 0) {
+    for (int i = peerTable[peerBucket(to)]; i >= 0; i = peers[i].nextSame) {
+      if (message_eqAddr(peers[i].addr, to)) {
+        if (peers[i].out != NULL) {
+          return &peers[i];
+        }
+        if (peers[i].retryAt == 0 || nowMicros() < peers[i].retryAt) {
+          return NULL; // not sharing, or not yet confirmed
+        }
+        expired = i;
+      }
+    }
+  }
+  if (expired >= 0) {
+    removePeer(expired);
+  }
+  peer_t* peer = addPeer(to);
+  if (peer != NULL) {
+    peer->retryAt = nowMicros() + PeerRetryMicros;
+    connectPeer(peer);
+  }
+  return NULL; // by UDP until it confirms our port
+}
+
+/**************** addPeer ****************/
+/*
+ * Add a peer, reached by UDP until it is set up; NULL if out of memory.
+ * When the array is full, expired peers go first. Moves the others, so
+ * earlier pointers into `peers` go stale.
+ */
+static peer_t*
+addPeer(const addr_t addr)
+{
+  if (numPeers == peerCapacity) {
+    uint64_t now = nowMicros();
+    for (int i = numPeers - 1; i >= 0; i--) {
+      if (peers[i].retryAt != 0 && now >= peers[i].retryAt) {
+        removePeer(i);
+      }
+    }
+  }
+  if (numPeers == peerCapacity) {
+    int capacity = (peerCapacity == 0) ? 8 : 2 * peerCapacity;
+    peer_t* newPeers = realloc(peers, capacity * sizeof(peer_t));
+    if (newPeers == NULL) {
+      return NULL;
+    }
+    peers = newPeers;
+    int* newTable = realloc(peerTable, 2 * capacity * sizeof(int));
+    if (newTable == NULL) {
+      return NULL;
+    }
+    peerTable = newTable;
+    peerCapacity = capacity;
+  }
+  peer_t* peer = &peers[numPeers++];
+  *peer = (peer_t) { addr, -1, -1, -1, NULL, NULL, NULL, 0, 0, 0, -1 };
+  hashPeers();
+  return peer;
+}
+
+/**************** hashPeers ****************/
+/* Put every peer in its bucket of peerTable again, after peers change. */
+static void
+hashPeers(void)
+{
+  for (int i = 0; i < 2 * peerCapacity; i++) {
+    peerTable[i] = -1;
+  }
+  for (int i = 0; i < numPeers; i++) {
+    int bucket = peerBucket(peers[i].addr);
+    peers[i].nextSame = peerTable[bucket];
+    peerTable[bucket] = i;
+  }
+}
+
+/**************** peerBucket ****************/
+/* The bucket of peerTable for an address. Local peers differ only in
+ * port, often by one, so it is the port's low bits that must spread. */
+static int
+peerBucket(const addr_t addr)
+{
+  unsigned int hash = (ntohl(addr.sin_addr.s_addr) * 2654435761u) ^ ntohs(addr.sin_port);
+  return hash & (2 * peerCapacity - 1);
+}
+
+/**************** connectPeer ****************/
+/*
+ * Connect to a local peer's Unix socket and hand it our shared memory and
+ * eventfds, with our UDP port, so it knows who we are; the rings are used
+ * once answerPeer has confirmed that port. If it is not listening, is not
+ * our user, or anything fails, the peer stays one reached by UDP.
+ */
+static void
+connectPeer(peer_t* peer)
+{
+  struct sockaddr_un name;
+  socklen_t nameLength = sharedAddress(ntohs(peer->addr.sin_port), &name);
+  int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (conn < 0 || connect(conn, (struct sockaddr *) &name, nameLength) < 0) {
+    if (conn >= 0) {
+      close(conn);
+    }
+    return; // nobody sharing memory there
+  }
+  if (!sameUser(conn)) {
+    // anyone can bind a name in the abstract namespace
+    log_v("message: a local peer's socket is not our user's; using UDP");
+    close(conn);
+    return;
+  }
+
+  int memory = memfd_create("message", MFD_CLOEXEC);
+  int wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int wait = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ring_t* rings = MAP_FAILED;
+  if (memory >= 0 && ftruncate(memory, 2 * sizeof(ring_t)) == 0) {
+    rings = mmap(NULL, 2 * sizeof(ring_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, memory, 0);
+  }
+
+  bool ok = (rings != MAP_FAILED && wake >= 0 && wait >= 0
+             && conn < FD_SETSIZE && wait < FD_SETSIZE);
+  if (ok) {
+    int fds[3] = { memory, wake, wait };
+    union {
+      char buf[CMSG_SPACE(sizeof(fds))];
+      struct cmsghdr align;
+    } control;
+    struct iovec iov = { &sharedPort, sizeof(sharedPort) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = control.buf,
+                          .msg_controllen = sizeof(control.buf) };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    ok = (sendmsg(conn, &msg, MSG_NOSIGNAL) == sizeof(sharedPort));
+  }
+  if (memory >= 0) {
+    close(memory); // the mapping keeps it
+  }
+  if (!ok) {
+    log_v("message: cannot share memory with a local peer; using UDP");
+    if (rings != MAP_FAILED) {
+      munmap(rings, 2 * sizeof(ring_t));
+    }
+    close(conn);
+    if (wake >= 0) {
+      close(wake);
+    }
+    if (wait >= 0) {
+      close(wait);
+    }
+    return;
+  }
+
+  peer->conn = conn;
+  peer->wake = wake;
+  peer->wait = wait;
+  peer->rings = rings;
+}
+
+/**************** sameUser ****************/
+/* Is the process at the other end of this Unix socket our user? */
+static bool
+sameUser(const int conn)
+{
+  struct ucred cred;
+  socklen_t length = sizeof(cred);
+  return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0
+    && length == sizeof(cred) && cred.uid == geteuid();
+}
+
+/**************** loopbackAddr ****************/
+/* The address of a UDP port on this host, as a local peer sends from it. */
+static addr_t
+loopbackAddr(const int port)
+{
+  addr_t addr = message_noAddr();
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  return addr;
+}
+
+/**************** acceptPeer ****************/
+/*
+ * Accept a local peer's connection, if it is our user's; it is set up by
+ * takeOver once what it hands over arrives.
+ */
+static void
+acceptPeer(void)
+{
+  int conn = accept4(sharedListener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (conn < 0) {
+    return;
+  }
+  if (!sameUser(conn)) {
+    log_v("message: refusing a local peer that is not our user");
+    close(conn);
+    return;
+  }
+  peer_t* peer = (conn < FD_SETSIZE) ? addPeer(message_noAddr()) : NULL;
+  if (peer == NULL) {
+    close(conn);
+    return;
+  }
+  peer->conn = conn;
+}
+
+/**************** takeOver ****************/
+/*
+ * Take the shared memory and eventfds a connecting peer hands over, and
+ * send a nonce to the UDP port it claims, for confirmPeer to check.
+ * Returns false, having closed whatever arrived, if they are not as expected.
+ */
+static bool
+takeOver(peer_t* peer)
+{
+  int port = 0;
+  int fds[3] = { -1, -1, -1 };
+  int numFds = 0;
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { &port, sizeof(port) };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = control.buf,
+                        .msg_controllen = sizeof(control.buf) };
+  ssize_t nbytes = recvmsg(peer->conn, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  // keep the first three fds that came, however they came, and close the rest
+  for (struct cmsghdr* cmsg = (nbytes >= 0) ? CMSG_FIRSTHDR(&msg) : NULL;
+       cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (int i = 0; i < count; i++, numFds++) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        if (numFds < 3) {
+          fds[numFds] = fd;
+        } else {
+          close(fd);
+        }
+      }
+    }
+  }
+  if (nbytes != sizeof(port) || numFds != 3 || (msg.msg_flags & MSG_CTRUNC)) {
+    for (int i = 0; i < 3; i++) {
+      if (fds[i] >= 0) {
+        close(fds[i]);
       }
-    } else if (select_response > 0) {
-      // some data is ready on either source, or both
+    }
+    return false;
+  }
 
-      if (FD_ISSET(0, &rfds)) {
-        // stdin has input ready
-        log_v("message_loop: input ready on stdin");
-        if (handleInput != NULL && (*handleInput)(arg)) {
-          break; // handler says to exit loop 
+  struct stat status;
+  ring_t* rings = MAP_FAILED;
+  if (fstat(fds[0], &status) == 0 && status.st_size >= (off_t) (2 * sizeof(ring_t))) {
+    rings = mmap(NULL, 2 * sizeof(ring_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fds[0], 0);
+  }
+  close(fds[0]);
+
+  // only the process with that UDP port gets the nonce, to echo it back
+  uint64_t nonce = 0;
+  bool ok = (rings != MAP_FAILED && port > 0 && port <= MaxPort && fds[1] < FD_SETSIZE
+             && getrandom(&nonce, sizeof(nonce), 0) == sizeof(nonce) && nonce != 0);
+  if (ok) {
+    char confirm[ConfirmHeaderLength + 17];
+    int length = sprintf(confirm, ConfirmHeader "%016" PRIx64, nonce);
+    addr_t to = loopbackAddr(port);
+    ok = (sendto(ourSocket, confirm, length, 0,
+                 (struct sockaddr *) &to, sizeof(to)) == length);
+  }
+  if (!ok) {
+    if (rings != MAP_FAILED) {
+      munmap(rings, 2 * sizeof(ring_t));
+    }
+    close(fds[1]);
+    close(fds[2]);
+    return false;
+  }
+
+  peer->wait = fds[1];
+  peer->wake = fds[2];
+  peer->rings = rings;
+  peer->port = port;
+  peer->nonce = nonce;
+  return true;
+}
+
+/**************** confirmPeer ****************/
+/*
+ * Read the nonce a peer echoes over its socket and, if it is the one sent
+ * to the port it claims, take it as that port's and read its ring.
+ * Returns false if it is not.
+ */
+static bool
+confirmPeer(peer_t* peer)
+{
+  uint64_t answer = 0;
+  if (recv(peer->conn, &answer, sizeof(answer), MSG_DONTWAIT) != sizeof(answer)
+      || answer != peer->nonce) {
+    log_v("message: a local peer did not confirm the port it claims; ignoring it");
+    return false;
+  }
+  // it sends from our loopback address, with its own port
+  peer->addr = loopbackAddr(peer->port);
+  peer->in = &peer->rings[0];
+  peer->out = &peer->rings[1];
+  peer->nonce = 0;
+  hashPeers();
+  LOG_S(LOG_DEBUG, "message: sharing memory with %s", message_stringAddr(peer->addr));
+  return true;
+}
+
+/**************** answerPeer ****************/
+/*
+ * A local peer we handed memory to sent a nonce from its UDP port: echo it
+ * over the socket, and from now on write to it through the ring.
+ * A nonce from anywhere else is ignored.
+ */
+static void
+answerPeer(const addr_t from, const char* datagram)
+{
+  uint64_t nonce;
+  if ((ntohl(from.sin_addr.s_addr) >> 24) != IN_LOOPBACKNET
+      || sscanf(datagram + ConfirmHeaderLength, "%16" SCNx64, &nonce) != 1) {
+    return;
+  }
+  for (int i = 0; i < numPeers; i++) {
+    peer_t* peer = &peers[i];
+    if (peer->rings != NULL && peer->out == NULL && peer->nonce == 0
+        && peer->addr.sin_port == from.sin_port) {
+      if (send(peer->conn, &nonce, sizeof(nonce), MSG_DONTWAIT | MSG_NOSIGNAL)
+          == sizeof(nonce)) {
+        peer->out = &peer->rings[0];
+        peer->in = &peer->rings[1];
+        peer->retryAt = 0;
+        LOG_S(LOG_DEBUG, "message: sharing memory with %s",
+              message_stringAddr(peer->addr));
+      }
+      return;
+    }
+  }
+}
+
+/**************** removePeer ****************/
+/*
+ * Let go of a peer, moving the last one into its place.
+ */
+static void
+removePeer(const int index)
+{
+  peer_t* peer = &peers[index];
+  if (peer->rings != NULL) {
+    munmap(peer->rings, 2 * sizeof(ring_t));
+  }
+  if (peer->conn >= 0) {
+    close(peer->conn);
+  }
+  if (peer->wake >= 0) {
+    close(peer->wake);
+  }
+  if (peer->wait >= 0) {
+    close(peer->wait);
+  }
+  peers[index] = peers[--numPeers];
+  hashPeers();
+}
+
+/**************** sendShared ****************/
+/*
+ * Write a datagram into the ring of the peer it is for, if that peer
+ * shares memory with us, waking the peer if it waits.
+ * Returns false if the datagram is for UDP instead.
+ */
+static bool
+sendShared(const struct msghdr* hdr)
+{
+  peer_t* peer = sharedPeer(*(addr_t*) hdr->msg_name);
+  if (peer == NULL) {
+    return false;
+  }
+  ring_t* ring = peer->out;
+  uint32_t length = 0;
+  for (int i = 0; i < (int) hdr->msg_iovlen; i++) {
+    length += hdr->msg_iov[i].iov_len;
+  }
+  uint32_t size = (4 + length + 1 + 3) & ~3u;  // the record, padded
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  uint32_t at = head & (RingBytes - 1);
+  uint32_t skip = (RingBytes - at < size) ? RingBytes - at : 0;
+  if ((head - tail) + skip + size > RingBytes) {
+    LOG_S(LOG_DEBUG, "message: ring to %s is full; dropping a message",
+          message_stringAddr(peer->addr));
+    return true; // as if lost on the way
+  }
+  if (skip > 0) {
+    uint32_t wrap = RingWrap;
+    memcpy(ring->data + at, &wrap, 4);
+    at = 0;
+  }
+  memcpy(ring->data + at, &length, 4);
+  char* p = ring->data + at + 4;
+  for (int i = 0; i < (int) hdr->msg_iovlen; i++) {
+    memcpy(p, hdr->msg_iov[i].iov_base, hdr->msg_iov[i].iov_len);
+    p += hdr->msg_iov[i].iov_len;
+  }
+  *p = '\0';
+  atomic_store(&ring->head, head + skip + size);
+  if (atomic_load(&ring->sleeping)) {
+    uint64_t one = 1;
+    if (write(peer->wake, &one, sizeof(one)) < 0) {
+      log_e("message: waking a local peer");
+    }
+  }
+  LOG_S(LOG_DEBUG, "message: TO %s (shared)", message_stringAddr(peer->addr));
+  return true;
+}
+
+/**************** sharedSleep ****************/
+/*
+ * Tell local peers we are about to wait, so they wake us when they write.
+ * Returns true if one has already written, and we should not wait.
+ */
+static bool
+sharedSleep(void)
+{
+  for (int i = 0; i < numPeers; i++) {
+    ring_t* ring = peers[i].in;
+    if (ring != NULL) {
+      atomic_store(&ring->sleeping, 1);
+    }
+  }
+  // (after setting them, so a write we miss here rings the eventfd)
+  return sharedPending();
+}
+
+/**************** sharedPending ****************/
+/* Has a local peer left messages in our ring? */
+static bool
+sharedPending(void)
+{
+  for (int i = 0; i < numPeers; i++) {
+    ring_t* ring = peers[i].in;
+    if (ring != NULL && atomic_load(&ring->head)
+        != atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** sharedWake ****************/
+/* Tell local peers we are awake, and need no wakeups. */
+static void
+sharedWake(void)
+{
+  for (int i = 0; i < numPeers; i++) {
+    if (peers[i].in != NULL) {
+      atomic_store_explicit(&peers[i].in->sleeping, 0, memory_order_relaxed);
+    }
+  }
+}
+
+/**************** receiveShared ****************/
+/*
+ * Deal with local peers after select: take on new ones, confirm them, let
+ * go of those gone, and handle the messages in every ring (up to MaxDrain
+ * from each), each checked and copied out of the shared memory first.
+ * Returns true if the handler says to exit the loop.
+ */
+static bool
+receiveShared(void* arg, fd_set* rfds,
+              bool (*handleMessage)(void* arg, const addr_t from, const char* message))
+{
+  char record[message_MaxBytes]; // a message, out of the peer's reach
+  if (sharedListener >= 0 && FD_ISSET(sharedListener, rfds)) {
+    acceptPeer();
+  }
+  // (backwards, since removePeer moves the last peer, already seen, into place)
+  for (int i = numPeers - 1; i >= 0; i--) {
+    peer_t* peer = &peers[i];
+    if (peer->conn >= 0 && FD_ISSET(peer->conn, rfds)) {
+      if (peer->rings == NULL) {
+        if (!takeOver(peer)) {
+          removePeer(i);
         }
+      } else if (peer->nonce != 0) {
+        if (!confirmPeer(peer)) {
+          removePeer(i);
+        }
+      } else {
+        // after the handover, the socket says only that the peer has gone
+        LOG_S(LOG_DEBUG, "message: %s no longer shares memory",
+              message_stringAddr(peer->addr));
+        removePeer(i);
       }
-      if (FD_ISSET(ourSocket, &rfds)) {
-        // socket has input ready
-        log_v("message_loop: message ready on socket");
-        struct sockaddr_in sender;     // sender of this message
-        struct sockaddr *senderp = (struct sockaddr *) &sender;
-        socklen_t senderlen = sizeof(sender);  // must pass address to length
-        char buf[message_MaxBytes]; // buffer for reading data from socket
-        int nbytes = recvfrom(ourSocket, buf, message_MaxBytes-1, 
-                              0, senderp, &senderlen);
-        if (nbytes < 0) {
-          // error, ignore it
-          log_e("message_loop: receiving from socket");
-        } else {
-          buf[nbytes] = '\0';     // null terminate message string
-          // where was it from?
-          if (sender.sin_family != AF_INET) {
-            // ignore it
-            log_d("message_loop: non-Internet family %d\n", sender.sin_family);
-          } else {
-	    // record it
-	    log_s("message_loop: FROM %s", message_stringAddr(sender));
-	    log_d("message_loop: %d lines:", numLines(buf));
-	    log_s("%s", buf);
-
-            // handle it
-            if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
-              break; // handler says to exit loop 
-            }
-          }
+    } else if (peer->wait >= 0 && FD_ISSET(peer->wait, rfds)) {
+      uint64_t count;
+      if (read(peer->wait, &count, sizeof(count)) < 0) {
+        log_e("message_loop: reading a wakeup");
+      }
+    }
+  }
+
+  bool done = false;
+  // replies to the whole batch are bundled together
+  message_bundleBegin();
+  for (int i = 0; i < numPeers && !done; i++) {
+    // (handlers may add peers, moving them; keep what we need from this one)
+    ring_t* ring = peers[i].in;
+    addr_t from = peers[i].addr;
+    if (ring == NULL) {
+      continue;
+    }
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (int drained = 0; drained < MaxDrain && !done; drained++) {
+      uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+      uint32_t at = tail & (RingBytes - 1);
+      uint32_t length = RingWrap;
+      if (tail != head) {
+        memcpy(&length, ring->data + at, 4);
+        if (length == RingWrap) {
+          // the rest of the ring is unused; the record is at its start
+          tail += RingBytes - at;
+          at = 0;
+          memcpy(&length, ring->data, 4);
         }
       }
+      if (tail == head) {
+        break; // empty
+      }
+      // the peer can still write the record, so check the copy we deliver
+      bool garbled = (length > (uint32_t) message_MaxBytes - 1
+                      || length > RingBytes - at - 5);
+      if (!garbled) {
+        memcpy(record, ring->data + at + 4, length + 1);
+        garbled = (record[length] != '\0');
+      }
+      if (garbled) {
+        log_v("message_loop: garbled shared memory; dropping what is in it");
+        atomic_store_explicit(&ring->tail, head, memory_order_release);
+        break;
+      }
+      drainingRing = ring;
+      drainingNext = tail + ((4 + length + 1 + 3) & ~3u);
+      LOG_S(LOG_DEBUG, "message_loop: FROM %s (shared)", message_stringAddr(from));
+      if (strncmp(record, FragmentHeader, FragmentHeaderLength) == 0) {
+        done = deliverFragment(arg, from, record, length, handleMessage);
+      } else {
+        done = deliver(arg, from, record, length, handleMessage);
+      }
+      tail = drainingNext;
+      atomic_store_explicit(&ring->tail, tail, memory_order_release);
     }
   }
-  return true;
+  drainingRing = NULL;
+  message_bundleEnd();
+  return done;
 }
 
 /**************** message_done ****************/
@@ -403,6 +2461,45 @@ message_loop(void* arg, const float timeout,
 void
 message_done(void)
 {
+  // send anything still held in a bundle, then give back its memory
+  message_flush();
+  for (int i = 0; i < outboxCapacity; i++) {
+    free(outboxes[i].arena);
+    free(outboxes[i].segments);
+  }
+  free(outboxes);
+  free(outboxSlots);
+  free(iovecs);
+  outboxes = NULL;
+  outboxSlots = NULL;
+  iovecs = NULL;
+  numOutboxes = outboxCapacity = numSlots = iovecCapacity = 0;
+  bundleDepth = 0;
+  spinMicros = 0;
+  free(timers);
+  timers = NULL;
+  timerCapacity = freeTimers = numTimers = 0;
+  memset(wheel, 0, sizeof(wheel));
+  wheelNow = 0;
+  for (int i = 0; i < MaxAssemblies; i++) {
+    free(assemblies[i].buf);
+  }
+  memset(assemblies, 0, sizeof(assemblies));
+  nextEviction = 0;
+  while (numPeers > 0) {
+    removePeer(numPeers - 1);
+  }
+  free(peers);
+  peers = NULL;
+  free(peerTable);
+  peerTable = NULL;
+  peerCapacity = 0;
+  if (sharedListener >= 0) {
+    close(sharedListener);
+    sharedListener = -1;
+  }
+  sharedEnabled = false;
+
   if (ourSocket != 0) {
     close(ourSocket);
     ourSocket = 0;
@@ -437,6 +2534,16 @@ message_done(void)
  *   ./messagetest 2>second.log hostName portNumber
  * 
  * ^D (EOF) to exit either side.
+ *
+ * With the command line
+ *   ./messagetest --selftest
+ * it instead runs checks of its own, with no one to chat with (make test):
+ * fragments handed straight to deliverFragment out of order, lost,
+ * duplicated and late, and whole messages sent to itself as fragments;
+ * then timers, on a clock it sets itself, turning the wheel with
+ * timerRun; then shared memory with itself, set up through its own
+ * Unix socket, and its rings filled, wrapped and garbled by hand.
+ * It exits 0 if all pass.
  */
 
 #ifdef UNIT_TEST
@@ -444,12 +2551,17 @@ message_done(void)
 static bool handleTimeout(void* arg);
 static bool handleInput  (void* arg);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
+static int selftest(void);
 
 int
 main(const int argc, char* argv[])
 {
   addr_t other; // address of the other side of this communication (init below)
 
+  if (argc == 2 && strcmp(argv[1], "--selftest") == 0) {
+    return selftest();
+  }
+
   // initialize the logging module
   log_init(stderr);
 
@@ -579,4 +2691,616 @@ handleMessage(void* arg, const addr_t from, const char* message)
   return false;
 }
 
+/* ************************* --selftest ***************************** */
+
+/* What the test handler was given: how many messages, and the last. */
+typedef struct received {
+  int count;
+  int length;
+  char* message;              // a copy; NULL if none
+} received_t;
+
+/* A timer of the tests: what its handler does, and what it saw. */
+typedef struct testTimer {
+  int id;                     // from message_timerAdd
+  int cancel;                 // a timer id for the handler to cancel; 0 none
+  bool cancelled;             // did that cancel succeed?
+  int calls;
+  uint64_t first, last;       // ticks (ms) of the first and last calls
+} testTimer_t;
+
+static int failures = 0;
+static testTimer_t* called[16]; // by order of call
+static int numCalled = 0;
+static char* fragmentMessage = NULL;  // for sendFragment: the whole message
+static char* fragmentDatagram = NULL; // and one fragment of it
+static int fragmentCapacity = 0;
+
+static void check(const bool ok, const char* what);
+static void fillMessage(char* message, const int length, const unsigned int id);
+static bool sameMessage(const received_t* got, const int length, const unsigned int id);
+static void sendFragment(received_t* got, const addr_t from, const unsigned int id,
+                         const int index, const int count, const int length);
+static bool keepMessage(void* arg, const addr_t from, const char* message);
+static bool quietTimeout(void* arg);
+static void fragmentTests(void);
+static void sendTests(void);
+static void timerTests(void);
+static void sharedTests(void);
+static int sharingPeers(const addr_t addr);
+static peer_t* connectedPeer(const addr_t addr);
+static void writeRecord(ring_t* ring, const uint32_t length, const char* bytes,
+                        const bool terminated);
+static bool recordTimer(void* arg);
+static void turnTo(const uint64_t millis);
+static void stepTo(const uint64_t millis);
+
+/**************** selftest ****************/
+/* Run every check; return the exit status. */
+static int
+selftest(void)
+{
+  fragmentTests();
+  sendTests();
+  timerTests();
+  sharedTests();
+  printf("messagetest: %s\n", failures == 0 ? "all passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
+
+/**************** fragmentTests ****************/
+/* Fragments handed to deliverFragment as if they had arrived, each case
+ * from a sender of its own so the cases do not meet in one assembly. */
+static void
+fragmentTests(void)
+{
+  received_t got = { 0, 0, NULL };
+  addr_t from = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+
+  // out of order, a whole number of fragments long
+  from.sin_port = htons(1001);
+  sendFragment(&got, from, 10, 2, 3, 3 * FragmentBytes);
+  sendFragment(&got, from, 10, 0, 3, 3 * FragmentBytes);
+  check(got.count == 0, "nothing is delivered before the last fragment");
+  sendFragment(&got, from, 10, 1, 3, 3 * FragmentBytes);
+  check(got.count == 1 && sameMessage(&got, 3 * FragmentBytes, 10),
+        "fragments out of order are put back together");
+
+  // and with a short last fragment, arriving first
+  sendFragment(&got, from, 11, 1, 2, FragmentBytes + 5);
+  sendFragment(&got, from, 11, 0, 2, FragmentBytes + 5);
+  check(got.count == 2 && sameMessage(&got, FragmentBytes + 5, 11),
+        "a short last fragment sets the length");
+
+  // a fragment lost: the next message drops the rest of this one, and
+  // the lost one turning up late is ignored
+  from.sin_port = htons(1002);
+  got.count = 0;
+  sendFragment(&got, from, 20, 0, 3, 2 * FragmentBytes + 7);
+  sendFragment(&got, from, 20, 1, 3, 2 * FragmentBytes + 7);
+  sendFragment(&got, from, 21, 0, 2, FragmentBytes + 9);
+  sendFragment(&got, from, 21, 1, 2, FragmentBytes + 9);
+  check(got.count == 1 && sameMessage(&got, FragmentBytes + 9, 21),
+        "a newer message is delivered past an incomplete one");
+  sendFragment(&got, from, 20, 2, 3, 2 * FragmentBytes + 7);
+  check(got.count == 1, "the incomplete message is dropped, not delivered late");
+
+  // duplicates, of a message in progress or of one delivered, and
+  // late fragments of one long past
+  from.sin_port = htons(1003);
+  got.count = 0;
+  sendFragment(&got, from, 30, 0, 2, FragmentBytes + 1);
+  sendFragment(&got, from, 30, 0, 2, FragmentBytes + 1);
+  sendFragment(&got, from, 30, 1, 2, FragmentBytes + 1);
+  check(got.count == 1 && sameMessage(&got, FragmentBytes + 1, 30),
+        "a duplicate fragment is ignored");
+  sendFragment(&got, from, 30, 1, 2, FragmentBytes + 1);
+  sendFragment(&got, from, 30, 0, 2, FragmentBytes + 1);
+  check(got.count == 1, "a duplicate of a delivered message is ignored");
+  sendFragment(&got, from, 29, 0, 1, 100);
+  sendFragment(&got, from, 30 - StaleIds, 0, 1, 100);
+  check(got.count == 1, "a late fragment of an older message is ignored");
+  sendFragment(&got, from, 31, 0, 1, 100);
+  check(got.count == 2 && sameMessage(&got, 100, 31),
+        "the next message after them is delivered");
+
+  // fragments of the wrong size, or out of range, are not taken
+  from.sin_port = htons(1004);
+  got.count = 0;
+  sendFragment(&got, from, 40, 0, 2, FragmentBytes - 1); // first one short
+  sendFragment(&got, from, 40, 0, 2, FragmentBytes + FragmentBytes);
+  sendFragment(&got, from, 40, 1, 2, FragmentBytes + FragmentBytes);
+  check(got.count == 1, "a fragment of the wrong size is ignored");
+  sendFragment(&got, from, 41, 0, MaxFragments + 1, 100);
+  sendFragment(&got, from, 41, 3, 3, 100);
+  check(got.count == 1, "a fragment past MaxFragments, or its count, is ignored");
+
+  // the most fragments a message may have
+  from.sin_port = htons(1005);
+  got.count = 0;
+  for (int index = MaxFragments - 1; index >= 0; index--) {
+    sendFragment(&got, from, 50, index, MaxFragments, MaxFragments * FragmentBytes);
+  }
+  check(got.count == 1 && sameMessage(&got, MaxFragments * FragmentBytes, 50),
+        "a message of MaxFragments fragments is put together");
+  free(got.message);
+  free(fragmentMessage);
+  free(fragmentDatagram);
+}
+
+/**************** sendTests ****************/
+/* Messages sent to ourselves with message_sendn, which fragments them. */
+static void
+sendTests(void)
+{
+  int port = message_init(NULL);
+  if (port == 0) {
+    check(false, "message_init");
+    return;
+  }
+  addr_t self;
+  char portString[16];
+  sprintf(portString, "%d", port);
+  if (!message_setAddr("localhost", portString, &self)) {
+    check(false, "message_setAddr");
+    message_done();
+    return;
+  }
+
+  // a whole number of fragments, then one a byte over MaxFragments
+  // (which is not sent), then one with a short last fragment
+  int lengths[] = { 2 * FragmentBytes, MaxFragments * FragmentBytes + 1, 3 * FragmentBytes / 2 };
+  unsigned int ids[] = { 1, 2, 3 };
+  char* message = malloc(lengths[1]);
+  received_t got = { 0, 0, NULL };
+  if (message == NULL) {
+    check(false, "malloc");
+    message_done();
+    return;
+  }
+  fillMessage(message, lengths[0], ids[0]);
+  message_sendn(self, message, lengths[0]);
+  message_loop(&got, 0.5, quietTimeout, NULL, keepMessage);
+  check(got.count == 1 && sameMessage(&got, lengths[0], ids[0]),
+        "a message of exactly 2 fragments arrives whole");
+
+  fillMessage(message, lengths[1], ids[1]);
+  message_sendn(self, message, lengths[1]);
+  fillMessage(message, lengths[2], ids[2]);
+  message_sendn(self, message, lengths[2]);
+  message_loop(&got, 0.5, quietTimeout, NULL, keepMessage);
+  check(got.count == 2 && sameMessage(&got, lengths[2], ids[2]),
+        "a message over MaxFragments is not sent, and the next one is");
+
+  free(message);
+  free(got.message);
+  message_done();
+}
+
+/**************** timerTests ****************/
+/* Timers on the mocked clock: the clock is set, then timerRun turns the
+ * wheel to it, as message_loop does after each wakeup. */
+static void
+timerTests(void)
+{
+  clockMocked = true;
+  const uint64_t start = 10000;   // ms; any time will do
+  mockedMicros = start * 1000;
+
+  // timers in every level of the wheel, added out of order: each is
+  // called once, in order, never before its delay is up, and (the
+  // clock stepping a tick at a time) at the tick after
+  const float delays[] = { 0.005, 0.001, 300, 0.070, 5, 0.003, 3600 };
+  const int numDelays = sizeof(delays) / sizeof(delays[0]);
+  testTimer_t timer[numDelays];
+  for (int i = 0; i < numDelays; i++) {
+    timer[i] = (testTimer_t) { 0 };
+    timer[i].id = message_timerAdd(delays[i], 0, recordTimer, &timer[i]);
+  }
+  numCalled = 0;
+  stepTo(start + 3700 * 1000);
+  bool once = true, onTime = true, inOrder = true;
+  for (int i = 0; i < numDelays; i++) {
+    uint64_t due = start + (uint64_t) (delays[i] * 1000 + 0.5);
+    once = once && timer[i].calls == 1;
+    onTime = onTime && timer[i].first >= due && timer[i].first <= due + 1;
+  }
+  for (int i = 1; i < numCalled; i++) {
+    inOrder = inOrder && called[i - 1]->first <= called[i]->first;
+  }
+  check(once && numCalled == numDelays, "each one-shot timer is called once");
+  check(onTime, "no timer is called early, or late, across the levels");
+  check(inOrder, "timers are called in the order they are due");
+  check(numTimers == 0 && !message_timerCancel(timer[0].id),
+        "a one-shot timer is gone once called");
+
+  // the loop late: a jump of the clock calls everything due on the way,
+  // in order, each cascaded down through the levels in one timerRun
+  uint64_t now = mockedMicros / 1000;
+  const float laterDelays[] = { 4, 0.2, 90, 0.002 };
+  for (int i = 0; i < 4; i++) {
+    timer[i] = (testTimer_t) { 0 };
+    timer[i].id = message_timerAdd(laterDelays[i], 0, recordTimer, &timer[i]);
+  }
+  numCalled = 0;
+  turnTo(now + 100 * 1000);
+  check(numCalled == 4 && called[0] == &timer[3] && called[1] == &timer[1]
+        && called[2] == &timer[0] && called[3] == &timer[2],
+        "a late loop calls the timers due, in order");
+
+  // delays are whole ticks, not a tick more for a float a bit over
+  check(toTicks(0.001) == 1 && toTicks(0.010) == 10 && toTicks(0.25) == 250
+        && toTicks(0.0001) == 1 && toTicks(0) == 1, "delays are rounded up to ticks");
+
+  // a periodic timer keeps to its schedule, skipping calls it was late for
+  now = mockedMicros / 1000;
+  testTimer_t periodic = { 0 };
+  periodic.id = message_timerAdd(0.010, 0.010, recordTimer, &periodic);
+  stepTo(now + 35);
+  check(periodic.calls == 3, "a periodic timer is called each period");
+  uint64_t first = periodic.first;
+  turnTo(now + 95);
+  check(periodic.calls == 4, "calls the loop was too late for are skipped");
+  stepTo(now + 125);
+  check(periodic.calls == 7 && (periodic.last - first) % toTicks(0.010) == 0,
+        "and the timer carries on, on its schedule");
+
+  // a cancelled timer is never called; its id, and any id used up, is
+  // stale, even once its place is taken by another timer
+  check(message_timerCancel(periodic.id), "a timer can be cancelled");
+  check(!message_timerCancel(periodic.id), "a cancelled id is stale");
+  now = mockedMicros / 1000;
+  testTimer_t reused = { 0 };
+  reused.id = message_timerAdd(0.005, 0, recordTimer, &reused);
+  check(!message_timerCancel(periodic.id) && reused.id != periodic.id,
+        "an id stays stale when its place is reused");
+  check(!message_timerCancel(0) && !message_timerCancel(-1)
+        && !message_timerCancel(1 << 30), "ids never given are refused");
+  stepTo(now + 20);
+  check(periodic.calls == 7 && reused.calls == 1,
+        "only the timer not cancelled is called");
+
+  // from inside a handler: a timer due the same tick, one due later, and
+  // a periodic timer cancelling itself
+  now = mockedMicros / 1000;
+  testTimer_t canceller = { 0 }, sameTick = { 0 }, later = { 0 }, self = { 0 };
+  sameTick.id = message_timerAdd(0.010, 0, recordTimer, &sameTick);
+  later.id = message_timerAdd(0.500, 0, recordTimer, &later);
+  canceller.id = message_timerAdd(0.010, 0, recordTimer, &canceller);
+  self.id = message_timerAdd(0.010, 0.010, recordTimer, &self);
+  self.cancel = self.id;
+  // whichever of the two due together comes first cancels the other
+  canceller.cancel = sameTick.id;
+  sameTick.cancel = later.id;
+  stepTo(now + 1000);
+  check((canceller.calls == 1 && sameTick.calls == 0 && canceller.cancelled)
+        || (sameTick.calls == 1 && canceller.calls == 0),
+        "a handler cancels a timer due the same tick");
+  check(sameTick.calls == 0 ? later.calls == 1 : later.calls == 0,
+        "a handler cancels a timer due later");
+  check(self.calls == 1 && self.cancelled && numTimers == 0,
+        "a periodic timer cancels itself");
+
+  clockMocked = false;
+}
+
+/**************** sharedTests ****************/
+/* Shared memory with ourselves: what we connect to is our own listener,
+ * so one peer entry is each end of the handover. */
+static void
+sharedTests(void)
+{
+  int port = message_initShared(NULL, 0);
+  addr_t self = loopbackAddr(port);
+  if (port == 0 || sharedListener < 0) {
+    check(false, "message_initShared");
+    message_done();
+    return;
+  }
+  received_t got = { 0, 0, NULL };
+  char message[50000];
+
+  // the handshake: the first message goes by UDP, and the nonce that
+  // confirms our port is answered, not handed to the handler
+  fillMessage(message, 100, 1);
+  message_sendn(self, message, 100);
+  check(sharingPeers(self) == 0, "nothing is shared before the port is confirmed");
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 1 && sameMessage(&got, 100, 1),
+        "the first message arrives by UDP, and the nonce is not delivered");
+  check(sharingPeers(self) == 2, "both ends share memory once the nonce is echoed");
+  peer_t* peer = sharedPeer(self);
+  ring_t* ring = (peer != NULL) ? peer->out : NULL;
+  if (ring == NULL) {
+    message_done();
+    free(got.message);
+    return;
+  }
+  uint32_t head = atomic_load(&ring->head);
+  fillMessage(message, 200, 2);
+  message_sendn(self, message, 200);
+  check(atomic_load(&ring->head) == head + 208, "then a message goes into the ring");
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 2 && sameMessage(&got, 200, 2)
+        && atomic_load(&ring->tail) == atomic_load(&ring->head),
+        "and is read out of it");
+
+  // a record too long for the rest of the ring goes at its start, past
+  // a RingWrap, and the byte counts wrap round too
+  atomic_store(&ring->head, 0u - 16);
+  atomic_store(&ring->tail, 0u - 16);
+  fillMessage(message, 20, 3);
+  message_sendn(self, message, 20);
+  uint32_t wrap;
+  memcpy(&wrap, ring->data + RingBytes - 16, 4);
+  check(wrap == RingWrap && atomic_load(&ring->head) == 28,
+        "a record that does not fit before the end wraps to the start");
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 3 && sameMessage(&got, 20, 3) && atomic_load(&ring->tail) == 28,
+        "a wrapped record is read from the start");
+
+  // a full ring drops what does not fit, as UDP would
+  int fits = RingBytes / ((4 + 50000 + 1 + 3) & ~3);
+  got.count = 0;
+  for (int i = 0; i < 2 * fits; i++) {
+    fillMessage(message, 50000, 100 + i);
+    message_sendn(self, message, 50000);
+  }
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == fits && sameMessage(&got, 50000, 100 + fits - 1),
+        "a full ring drops the messages that do not fit");
+
+  // garbled records: no '\0', too long for a message, past the end of
+  // the ring; each drops what is in the ring, and is not delivered
+  got.count = 0;
+  fillMessage(message, 100, 4);
+  writeRecord(ring, 100, message, false);
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 0 && atomic_load(&ring->tail) == atomic_load(&ring->head),
+        "a record without its '\\0' is not delivered");
+  writeRecord(ring, message_MaxBytes, NULL, true);
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 0, "a record longer than a message is not delivered");
+  atomic_store(&ring->head, RingBytes - 16);
+  atomic_store(&ring->tail, RingBytes - 16);
+  writeRecord(ring, 100, NULL, true);
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 0 && atomic_load(&ring->tail) == atomic_load(&ring->head),
+        "a record past the end of the ring is not delivered");
+  fillMessage(message, 100, 5);
+  message_sendn(self, message, 100);
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 1 && sameMessage(&got, 100, 5), "the ring works after garbage");
+
+  // the peer goes (its socket closes): back to UDP until it is set up again
+  removePeer(connectedPeer(self) - peers);
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(sharingPeers(self) == 0, "a peer whose socket closes is let go");
+  got.count = 0;
+  fillMessage(message, 100, 6);
+  message_sendn(self, message, 100);
+  check(sharingPeers(self) == 0, "the next message goes by UDP");
+  message_loop(&got, 0.2, quietTimeout, NULL, keepMessage);
+  check(got.count == 1 && sameMessage(&got, 100, 6) && sharingPeers(self) == 2,
+        "and it arrives, while memory is shared again");
+
+  // a local port with no one sharing is tried again only once it expires
+  int udp = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in other = loopbackAddr(0);
+  socklen_t otherLength = sizeof(other);
+  if (udp >= 0 && bind(udp, (struct sockaddr *) &other, sizeof(other)) == 0
+      && getsockname(udp, (struct sockaddr *) &other, &otherLength) == 0) {
+    mockedMicros = nowMicros();
+    clockMocked = true;
+    message_sendn(other, "x", 1);
+    peer_t* failed = connectedPeer(other);
+    uint64_t retryAt = (failed != NULL) ? failed->retryAt : 0;
+    mockedMicros += PeerRetryMicros - 1;
+    message_sendn(other, "x", 1);
+    failed = connectedPeer(other);
+    check(failed != NULL && failed->retryAt == retryAt,
+          "a local port that does not share is not tried again at once");
+    mockedMicros += 1;
+    message_sendn(other, "x", 1);
+    failed = connectedPeer(other);
+    check(failed != NULL && failed->retryAt == mockedMicros + PeerRetryMicros,
+          "it is tried again once expired");
+    clockMocked = false;
+  }
+  if (udp >= 0) {
+    close(udp);
+  }
+
+  free(got.message);
+  message_done();
+}
+
+/**************** sharingPeers ****************/
+/* How many peers at this address write to us through memory? */
+static int
+sharingPeers(const addr_t addr)
+{
+  int count = 0;
+  for (int i = 0; i < numPeers; i++) {
+    if (message_eqAddr(peers[i].addr, addr) && peers[i].out != NULL) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**************** connectedPeer ****************/
+/* The peer we connected to at this address (not one that connected to
+ * us); NULL if none. */
+static peer_t*
+connectedPeer(const addr_t addr)
+{
+  for (int i = 0; i < numPeers; i++) {
+    if (message_eqAddr(peers[i].addr, addr) && peers[i].port == 0) {
+      return &peers[i];
+    }
+  }
+  return NULL;
+}
+
+/**************** writeRecord ****************/
+/* Write a record into a ring by hand, as a peer could: of any length,
+ * with any bytes (zeros if NULL), and a '\0' after them or not. */
+static void
+writeRecord(ring_t* ring, const uint32_t length, const char* bytes,
+            const bool terminated)
+{
+  uint32_t head = atomic_load(&ring->head);
+  uint32_t at = head & (RingBytes - 1);
+  uint32_t room = RingBytes - at - 4;
+  uint32_t copied = (length < room) ? length : room;
+  memcpy(ring->data + at, &length, 4);
+  if (bytes != NULL) {
+    memcpy(ring->data + at + 4, bytes, copied);
+  } else {
+    memset(ring->data + at + 4, 0, copied);
+  }
+  if (copied < room) {
+    ring->data[at + 4 + copied] = terminated ? '\0' : 'x';
+  }
+  atomic_store(&ring->head, head + ((4 + length + 1 + 3) & ~3u));
+}
+
+/**************** recordTimer ****************/
+/* A test timer is called: note when, and cancel what it is to cancel. */
+static bool
+recordTimer(void* arg)
+{
+  testTimer_t* timer = arg;
+  uint64_t now = mockedMicros / 1000;
+  if (timer->calls++ == 0) {
+    timer->first = now;
+  }
+  timer->last = now;
+  if (numCalled < 16) {
+    called[numCalled++] = timer;
+  }
+  if (timer->cancel != 0) {
+    timer->cancelled = message_timerCancel(timer->cancel);
+    timer->cancel = 0;
+  }
+  return false;
+}
+
+/**************** turnTo ****************/
+/* Set the clock to millis, and turn the wheel there at once. */
+static void
+turnTo(const uint64_t millis)
+{
+  mockedMicros = millis * 1000;
+  timerRun();
+}
+
+/**************** stepTo ****************/
+/* Move the clock to millis a tick at a time, turning the wheel each tick. */
+static void
+stepTo(const uint64_t millis)
+{
+  for (uint64_t tick = mockedMicros / 1000 + 1; tick <= millis; tick++) {
+    turnTo(tick);
+  }
+}
+
+/**************** sendFragment ****************/
+/* Hand deliverFragment one fragment of the test message of this id and
+ * length, as it would arrive; keepMessage notes what is delivered. */
+static void
+sendFragment(received_t* got, const addr_t from, const unsigned int id,
+             const int index, const int count, const int length)
+{
+  if (length > fragmentCapacity) {
+    free(fragmentMessage);
+    free(fragmentDatagram);
+    fragmentCapacity = length;
+    fragmentMessage = malloc(fragmentCapacity);
+    fragmentDatagram = malloc(FragmentBytes + 64);
+    if (fragmentMessage == NULL || fragmentDatagram == NULL) {
+      check(false, "malloc");
+      exit(2);
+    }
+  }
+  char* message = fragmentMessage;
+  char* datagram = fragmentDatagram;
+  fillMessage(message, length, id);
+  int offset = index * FragmentBytes;
+  int bytes = length - offset;
+  if (bytes > FragmentBytes) {
+    bytes = FragmentBytes;
+  } else if (bytes < 0) {
+    bytes = 0;
+  }
+  int headerLength = sprintf(datagram, FragmentHeader "%u %d %d\n", id, index, count);
+  memcpy(datagram + headerLength, message + offset, bytes);
+  deliverFragment(got, from, datagram, headerLength + bytes, keepMessage);
+}
+
+/**************** fillMessage ****************/
+/* The test message of this id: bytes that differ with the offset and
+ * the id (and never start a bundle). */
+static void
+fillMessage(char* message, const int length, const unsigned int id)
+{
+  for (int i = 0; i < length; i++) {
+    message[i] = 'a' + (i + (i / FragmentBytes) * 7 + id) % 26;
+  }
+}
+
+/**************** sameMessage ****************/
+/* Is the last message delivered the test message of this id and length? */
+static bool
+sameMessage(const received_t* got, const int length, const unsigned int id)
+{
+  if (got->message == NULL || got->length != length) {
+    return false;
+  }
+  char* expected = malloc(length);
+  if (expected == NULL) {
+    return false;
+  }
+  fillMessage(expected, length, id);
+  bool same = memcmp(got->message, expected, length) == 0;
+  free(expected);
+  return same;
+}
+
+/**************** keepMessage ****************/
+/* A message was delivered: count it, and keep a copy. */
+static bool
+keepMessage(void* arg, const addr_t from, const char* message)
+{
+  received_t* got = arg;
+  free(got->message);
+  got->length = message_length();
+  got->message = malloc(got->length);
+  if (got->message != NULL) {
+    memcpy(got->message, message, got->length);
+  }
+  got->count++;
+  return false;
+}
+
+/**************** quietTimeout ****************/
+/* Nothing more arrived: the loop is done. */
+static bool
+quietTimeout(void* arg)
+{
+  return true;
+}
+
+/**************** check ****************/
+/* Report one check. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
 #endif // UNIT_TEST
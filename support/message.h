@@ -2,8 +2,12 @@
  * message - a UDP-based messaging module
  *
  * Provides a message-passing abstraction among Internet hosts.  Messages
- * are sent via UDP and are thus limited to UDP packet size, may be lost,
- * and may be reordered, but require no connection setup or teardown.
+ * are sent via UDP and thus may be lost, and may be reordered, but require
+ * no connection setup or teardown.  A message longer than one UDP packet
+ * is sent as fragments and put back together on arrival; if any fragment
+ * is lost, so is the message.  Processes on the same host can instead
+ * talk through shared memory, with the same functions; see
+ * message_initShared.
  * 
  * Typical server sequence looks like this:
  *   message_init(stderr);
@@ -48,6 +52,7 @@ typedef struct sockaddr_in addr_t;
 /****************** constants *********************/
 // Maximum payload size for UDP messages, according to
 // https://en.wikipedia.org/wiki/User_Datagram_Protocol
+// A longer message goes as several of them; see message_sendn.
 static const int message_MaxBytes = 65507;
 
 /****************** global functions *********************/
@@ -64,6 +69,43 @@ static const int message_MaxBytes = 65507;
  */
 int message_init(FILE* logFP);
 
+/******************************************/
+/* message_initPort: initialize the module on a given port.
+ * Caller provides:
+ *   file pointer(fp), passed through to log_init().  May be NULL.
+ *   the port to receive on; 0 for any free port, as message_init.
+ * Function returns:
+ *   port number where messages can be sent; zero on error
+ *   (such as the port being in use).
+ * Caller expectations:
+ *   call message_done() later when all messaging operations complete.
+ * Notes:
+ *   Lets a restarted server come back on the port its clients know.
+ * Logs: information about errors; the port number.
+ */
+int message_initPort(FILE* logFP, const int port);
+
+/******************************************/
+/* message_initShared: initialize the module, sharing memory with local peers.
+ * Caller provides, function returns: as for message_initPort.
+ * Notes:
+ *   Messages to and from another process on this host that also used
+ *   message_initShared go through a ring in memory shared with it, not
+ *   through UDP: message_send, message_loop and the rest work as before,
+ *   and addresses name peers as before. The first message to a loopback
+ *   address (127.x.x.x) sets the sharing up, once the peer has shown it
+ *   runs as our user and answered a nonce sent to its UDP port; until
+ *   then, or if the peer did not use message_initShared, that address is
+ *   reached by UDP as usual, and is tried again after a few seconds.
+ *   A message is copied into the ring, and out again, checked, for the
+ *   handler, since the peer can still write the ring; a busy pair of
+ *   peers makes no system calls to talk.
+ *   If a ring is full, the message is dropped, as UDP may.
+ *   Remote addresses are always reached by UDP.
+ * Logs: as for message_initPort; errors in setting up the sharing.
+ */
+int message_initShared(FILE* logFP, const int port);
+
 /******************************************/
 /* message_noAddr: return an addr_t representing "no address".
  * Logs: nothing.
@@ -133,6 +175,95 @@ const char* message_stringAddr(const addr_t addr);
  */
 void message_send(const addr_t to, const char* message);
 
+/******************************************/
+/* message_sendn: send a message of known length.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   a string containing the message,
+ *   the length of that string.
+ * Function returns: none
+ * Notes:
+ *   The buffer is handed straight to the kernel: no copy, no length scan.
+ *   This suits messages kept ready in a persistent buffer, like DISPLAY frames.
+ *   A message of message_MaxBytes or more goes as fragments, each a datagram
+ *     FRAGMENT id index count
+ *     bytes...
+ *   where id grows by one with each such message from this sender, and
+ *   fragment `index` of `count` carries 60000 bytes of it (the last, the
+ *   rest); messages of over 64 fragments are not sent. message_loop puts
+ *   the fragments back together and hands the handler the whole message.
+ *   A fragment of a newer message from the same sender drops what has
+ *   arrived of an incomplete older one, so a lost fragment costs one frame.
+ * Assumptions, Logs: as for message_send.
+ */
+void message_sendn(const addr_t to, const char* message, const int length);
+
+/******************************************/
+/* message_sendBatch: send the same message to many addresses.
+ * Caller provides:
+ *   an array of valid addresses, and the number of addresses in it,
+ *   a string containing the message.
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Notes:
+ *   The message is encoded once and handed to the kernel for all
+ *   recipients in as few system calls as possible (sendmmsg).
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message.
+ */
+void message_sendBatch(const addr_t to[], const int count, const char* message);
+
+/******************************************/
+/* message_sendBatchn: like message_sendBatch, for a message of known length;
+ * see message_sendn.
+ */
+void message_sendBatchn(const addr_t to[], const int count,
+                        const char* message, const int length);
+
+/******************************************/
+/* message_sendFrame: send a frame, such as a DISPLAY, to many addresses.
+ * Caller provides:
+ *   an array of valid addresses, and the number of addresses in it,
+ *   a string containing the frame, and its length.
+ * Function returns: none
+ * Notes:
+ *   Outside a bundle this is message_sendBatchn.
+ *   Inside a bundle the frame is not copied: the bundle refers to the
+ *   caller's buffer, so the buffer must stay valid, and should hold the
+ *   newest frame, until the bundle is sent. A recipient gets a frame
+ *   buffer at most once per bundle, in the place of the latest send.
+ * Assumptions, Logs: as for message_sendBatch.
+ */
+void message_sendFrame(const addr_t to[], const int count,
+                       const char* frame, const int length);
+
+/******************************************/
+/* message_bundleBegin, message_bundleEnd: bundle outgoing messages.
+ * Between these calls, messages to the same recipient are held and then
+ * sent together, as one datagram, when the outermost bundle ends:
+ *   BUNDLE
+ *   length
+ *   message...length
+ *   message...
+ * where each message's byte count, in decimal, precedes it on its own line.
+ * A recipient with only one message gets it as usual, unbundled.
+ * message_loop receives bundles and passes each message to handleMessage
+ * in turn, so handlers never see one.
+ * Bundles nest; message_loop wraps every handler call in one, so
+ * everything a handler sends goes out as one datagram per recipient.
+ * Logs: errors in usage; errors in sending.
+ */
+void message_bundleBegin(void);
+void message_bundleEnd(void);
+
+/******************************************/
+/* message_flush: send everything held in the bundle now.
+ * The bundle stays open. Use it before freeing a buffer passed to
+ * message_sendFrame, or before exiting from inside a handler.
+ */
+void message_flush(void);
+
 /******************************************/
 /* message_loop: loop, handling input and incoming messages.
  * Caller provides:
@@ -145,15 +276,23 @@ void message_send(const addr_t to, const char* message);
  *   true, in the normal case when the loop ends due to handler return true;
  *   false, when fatal errors indicate we cannot keep looping.
  * Handlers:
- *   handleTimeout: called when time passes without input or message.
+ *   handleTimeout: called when time passes without input or message
+ *     (timers that run meanwhile do not count).
  *   handleInput: should read once from stdin and process it.
  *   handleMessage: provided the address from which the message arrived,
  *     and a string containing the contents of the message. The handler should
  *     realize the string's memory will be reused upon return from the handler.
+ *     A bundle arrives as one call per message it carries; a fragmented
+ *     message, as one call once all its fragments are here.
+ *     Each wakeup drains every datagram queued on the socket (to a limit)
+ *     before returning to select, so a burst is handled as one batch.
  *   All are provided 'arg', passed-through untouched.
+ *   Messages sent by a handler are bundled; see message_bundleBegin.
  *   Handlers should return true to terminate looping, false to keep looping.
  * Notes:
  *   The timeout feature is optional; use timeout=0 and handleTimeout=NULL.
+ *   Timers (see message_timerAdd) run in the loop too; with some added,
+ *   all three handlers may be NULL.
  * Logs:
  *   errors in arguments,
  *   errors in monitoring stdin and/or network,
@@ -166,10 +305,100 @@ bool message_loop(void* arg, const float timeout,
                                         const addr_t from, 
                                         const char* message));
 
+/******************************************/
+/* message_busyPoll: trade a CPU for lower latency in message_loop.
+ * Caller provides:
+ *   how many microseconds message_loop should spin, looking for input
+ *   without sleeping, before it blocks in select (0 not to spin);
+ *   a CPU to pin this process to, or -1 to leave it be.
+ * Function returns:
+ *   true if all of it took effect; false if the socket's SO_BUSY_POLL
+ *   (the kernel polls the device for that long, where it can) or the
+ *   pinning could not be set. The spinning is on even then.
+ * Notes:
+ *   Call after message_init, before message_loop. Waking from select
+ *   costs tens of microseconds; a message that arrives while spinning
+ *   is handled at once. Time spent spinning counts against the loop's
+ *   timeout. Raising SO_BUSY_POLL past net.core.busy_read needs
+ *   CAP_NET_ADMIN, and busy polling in select needs net.core.busy_poll.
+ * Logs: errors in arguments; errors in setting things up.
+ */
+bool message_busyPoll(const int spinMicroseconds, const int cpu);
+
+/******************************************/
+/* message_setTimeout: change the timeout of the running message_loop.
+ * Caller provides:
+ *   the new time duration (in seconds), > 0.
+ * Function returns: nothing.
+ * Notes:
+ *   Called from a handler of a loop started with a timeout handler; takes
+ *   effect from the next wait. Lets a handler ask to be called back sooner
+ *   while it has work put off, and go back to a longer timeout after.
+ */
+void message_setTimeout(const float timeout);
+
+/******************************************/
+/* message_timerAdd: have message_loop call a function later, or regularly.
+ * Caller provides:
+ *   the delay (in seconds) before the first call, >= 0;
+ *   the period (in seconds) between later calls, or 0 for only the one;
+ *   the function, and an arg passed to it untouched.
+ * Function returns:
+ *   an id for message_timerCancel, > 0; 0 on error.
+ * Handler:
+ *   handleTimer returns true to end message_loop, false to keep looping;
+ *   messages it sends are bundled, as with the loop's own handlers.
+ * Notes:
+ *   Call after message_init, before message_loop or from any handler;
+ *   a handler may add or cancel timers, its own included. Timers keep to
+ *   a millisecond, and are held in a hierarchical timing wheel, so adding
+ *   and cancelling take the same time however many there are. A periodic
+ *   timer keeps to its schedule; calls the loop is too busy to make in
+ *   time are skipped, not made in a burst. A timer due while a handler
+ *   runs is called after it. A one-shot timer is gone once called.
+ * Logs: errors in arguments.
+ */
+int message_timerAdd(const float delay, const float period,
+                     bool (*handleTimer)(void* arg), void* arg);
+
+/******************************************/
+/* message_timerCancel: stop a timer before its next call.
+ * Caller provides:
+ *   an id from message_timerAdd.
+ * Function returns:
+ *   true if the timer was stopped; false if there is no such timer
+ *   (a one-shot timer already called, one already cancelled, or 0).
+ */
+bool message_timerCancel(const int timer);
+
+/******************************************/
+/* message_pending: will handleMessage be called again right away?
+ * Function returns:
+ *   true if called from handleMessage while further messages are still to
+ *   be delivered in the same batch: the rest of a bundle, or more datagrams
+ *   already queued on the socket; false otherwise.
+ * Notes:
+ *   Lets a handler put off work, such as redrawing the screen, until the
+ *   last message of a batch.
+ */
+bool message_pending(void);
+
+/******************************************/
+/* message_length: how long is the message being handled?
+ * Function returns:
+ *   when called from handleMessage, the number of bytes in its message,
+ *   not counting the '\0' after them; 0 otherwise.
+ * Notes:
+ *   A binary message may hold NUL bytes (see wire.h), so it ends here,
+ *   not at the first '\0'.
+ */
+int message_length(void);
+
 /******************************************/
 /* message_done: shut down the module.
  * Caller provides: nothing.
  * Function returns: nothing.
+ * Notes: sends anything still held in a bundle first, and drops all timers.
  * Assumptions: 
  *   message_init() had been called earlier.
  *   no message() functions will be called later.
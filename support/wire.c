@@ -0,0 +1,189 @@
+/*
+ * wire - the binary framing of the nuggets protocol
+ *
+ * See wire.h for the framing and for each function.
+ * Every opcode is a row of one table, its name and its fields, so that
+ * encoding, decoding and formatting are each one loop over the fields.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "wire.h"
+
+/**************** file-local constants ****************/
+// bytes before the fields: the opcode, and their length
+#define HeaderBytes 3
+
+/**************** file-local types ****************/
+typedef struct wireFormat {
+  const char* name;     // of the text form
+  const char* fields;   // a letter for each field: c, s, i or t (see wire.h)
+} wireFormat_t;
+
+/**************** file-local global variables ****************/
+static const wireFormat_t formats[wire_NumOps] = {
+  [WIRE_NONE]           = { "", "" },
+  [WIRE_OK]             = { "OK", "c" },
+  [WIRE_GRID]           = { "GRID", "ss" },
+  [WIRE_GOLD_REMAINING] = { "GOLD_REMAINING", "i" },
+  [WIRE_GOLD]           = { "GOLD", "iii" },
+  [WIRE_SPECTATOR_GOLD] = { "SPECTATOR_GOLD", "ciii" },
+  [WIRE_STOLEN]         = { "STOLEN", "cciii" },
+  [WIRE_SEQ]            = { "SEQ", "i" },
+  [WIRE_SESSION]        = { "SESSION", "t" },
+  [WIRE_KEY]            = { "KEY", "csi" },
+  [WIRE_GOTO]           = { "GOTO", "ss" },
+};
+
+/**************** local functions ****************/
+static int fieldWidth(const char kind);
+static void writeNumber(unsigned char* p, const int width, long long value);
+static long long readNumber(const unsigned char* p, const int width);
+
+/**************** wire_isBinary ****************/
+/*
+ * Does the message start with an opcode, and the length of the rest?
+ * See wire.h for detailed description.
+ */
+bool
+wire_isBinary(const char* message, const int length)
+{
+  const unsigned char* p = (const unsigned char*) message;
+  return length >= HeaderBytes && p[0] > WIRE_NONE && p[0] < wire_NumOps
+    && readNumber(p + 1, 2) == length - HeaderBytes;
+}
+
+/**************** wire_offered ****************/
+/*
+ * Is one of the lines after the first of the message the offer?
+ * See wire.h for detailed description.
+ */
+bool
+wire_offered(const char* message, const char* offer)
+{
+  int length = strlen(offer);
+  for (const char* line = strchr(message, '\n'); line != NULL; line = strchr(line, '\n')) {
+    line++;
+    if (strncmp(line, offer, length) == 0 && (line[length] == '\0' || line[length] == '\n')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** wire_encode ****************/
+/*
+ * Write the binary form of a message.
+ * See wire.h for detailed description.
+ */
+int
+wire_encode(char* buf, const wireOp_t op, const long long fields[])
+{
+  if (op <= WIRE_NONE || op >= wire_NumOps) {
+    return 0;
+  }
+  unsigned char* p = (unsigned char*) buf + HeaderBytes;
+  const char* kinds = formats[op].fields;
+  for (int i = 0; kinds[i] != '\0'; i++) {
+    int width = fieldWidth(kinds[i]);
+    writeNumber(p, width, fields[i]);
+    p += width;
+  }
+  int length = (char*) p - buf;
+  buf[0] = op;
+  writeNumber((unsigned char*) buf + 1, 2, length - HeaderBytes);
+  return length;
+}
+
+/**************** wire_format ****************/
+/*
+ * Write the text form of a message.
+ * See wire.h for detailed description.
+ */
+int
+wire_format(char* buf, const wireOp_t op, const long long fields[])
+{
+  if (op <= WIRE_NONE || op >= wire_NumOps) {
+    buf[0] = '\0';
+    return 0;
+  }
+  int length = snprintf(buf, wire_MaxText, "%s", formats[op].name);
+  const char* kinds = formats[op].fields;
+  for (int i = 0; kinds[i] != '\0'; i++) {
+    if (kinds[i] == 'c') {
+      length += snprintf(buf + length, wire_MaxText - length, " %c", (char) fields[i]);
+    } else if (kinds[i] == 't') {
+      length += snprintf(buf + length, wire_MaxText - length, " %016llx",
+                         (unsigned long long) fields[i]);
+    } else {
+      length += snprintf(buf + length, wire_MaxText - length, " %lld", fields[i]);
+    }
+  }
+  return length;
+}
+
+/**************** wire_decode ****************/
+/*
+ * Read a binary message, checking its length against its opcode.
+ * See wire.h for detailed description.
+ */
+wireOp_t
+wire_decode(const char* message, const int length, long long fields[])
+{
+  const unsigned char* p = (const unsigned char*) message;
+  if (!wire_isBinary(message, length)) {
+    return WIRE_NONE;
+  }
+  wireOp_t op = p[0];
+  const unsigned char* end = p + length;
+  p += HeaderBytes;
+  const char* kinds = formats[op].fields;
+  for (int i = 0; kinds[i] != '\0'; i++) {
+    int width = fieldWidth(kinds[i]);
+    if (p + width > end) {
+      return WIRE_NONE;
+    }
+    fields[i] = readNumber(p, width);
+    p += width;
+  }
+  return (p == end) ? op : WIRE_NONE;
+}
+
+/**************** fieldWidth ****************/
+/* Bytes a field of this kind takes. */
+static int
+fieldWidth(const char kind)
+{
+  switch (kind) {
+  case 'c': return 1;
+  case 's': return 2;
+  case 'i': return 4;
+  default:  return 8;
+  }
+}
+
+/**************** writeNumber ****************/
+/* Write the low `width` bytes of value, most significant first. */
+static void
+writeNumber(unsigned char* p, const int width, long long value)
+{
+  unsigned long long bits = value;
+  for (int i = width - 1; i >= 0; i--) {
+    p[i] = bits & 0xff;
+    bits >>= 8;
+  }
+}
+
+/**************** readNumber ****************/
+/* Read `width` bytes, most significant first, as a signed number. */
+static long long
+readNumber(const unsigned char* p, const int width)
+{
+  unsigned long long bits = 0;
+  for (int i = 0; i < width; i++) {
+    bits = (bits << 8) | p[i];
+  }
+  int shift = 64 - 8 * width;
+  return (long long) (bits << shift) >> shift;
+}
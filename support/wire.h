@@ -0,0 +1,120 @@
+/*
+ * wire - the binary framing of the nuggets protocol
+ *
+ * The protocol is text, but the messages that are only a few numbers
+ * (GOLD, STOLEN, KEY, ...) also have a binary form: a one-byte opcode,
+ * a length, and fixed-width fields, which take a table lookup, not a
+ * chain of sscanf and strcmp, to read.
+ *
+ * A client that takes binary framing says so with a line "BINARY" after
+ * its PLAY, SPECTATE or RESUME ("PLAY alice\nBINARY"). The lines after
+ * the first are offers, each a feature the client can take, and a
+ * server ignores any it does not know; "OVERLAY" is the other one (a
+ * player's display as TERRAIN and VIEW; see the server's README).
+ * A server that speaks it then sends that client the messages below in
+ * binary (so an OK, or for a spectator a GRID, in binary is its yes),
+ * and takes KEY and GOTO from it in binary; everything else, DISPLAY,
+ * QUIT, ROUND and ERROR, stays text. A client that never asks, or a
+ * server that never answers in binary, speaks text as always.
+ *
+ * A binary message is
+ *   opcode    1 byte, below ' ', so never the start of a text message
+ *   length    2 bytes: the number of bytes of fields that follow
+ *   fields    each a big-endian, two's-complement integer, 1 byte for a
+ *             letter (glyph or key), 2 for a short, 4 for an int, 8 for
+ *             a session token
+ * Its text form is the message's name, then each field after a space:
+ * a letter as itself, a number in decimal, a token as 16 hex digits.
+ *
+ * Binary messages may hold NUL bytes: a receiver takes their length from
+ * message_length, and a sender sends them with message_sendn.
+ */
+
+#ifndef _WIRE_H_
+#define _WIRE_H_
+
+#include <stdbool.h>
+
+/****************** types *********************/
+/* The opcodes, each with its fields (c letter, s short, i int, t token).
+ * Server to client: */
+typedef enum wireOp {
+  WIRE_NONE = 0,          // not a (well-formed) binary message
+  WIRE_OK,                // c: the player's letter
+  WIRE_GRID,              // ss: rows, columns
+  WIRE_GOLD_REMAINING,    // i: gold left in the game
+  WIRE_GOLD,              // iii: collected, purse, remaining
+  WIRE_SPECTATOR_GOLD,    // ciii: collector, collected, purse, remaining
+  WIRE_STOLEN,            // cciii: victim, thief, amount, purse, remaining
+  WIRE_SEQ,               // i: the tag of a key answered
+  WIRE_SESSION,           // t: the player's session token
+/* Client to server: */
+  WIRE_KEY,               // csi: key, count, tag (-1 for none)
+  WIRE_GOTO,              // ss: row, column (-1 -1 for the nearest gold)
+  wire_NumOps
+} wireOp_t;
+
+/****************** constants *********************/
+// the lines a client adds to PLAY, SPECTATE or RESUME to ask for binary
+// framing, and for its display as an overlay on the terrain it knows
+static const char wire_OfferBinary[] = "BINARY";
+static const char wire_OfferOverlay[] = "OVERLAY";
+
+// most fields in any message
+#define wire_MaxFields 5
+
+// room for any binary message, and for any text form with its '\0'
+static const int wire_MaxBytes = 17;
+static const int wire_MaxText = 80;
+
+/****************** functions *********************/
+
+/******************************************/
+/* wire_isBinary: is this a binary message, by its header?
+ * Caller provides: a message and its length (message_length, for one
+ *   received).
+ * Function returns: true if it starts with an opcode, and the length
+ *   in its header is that of the rest; its fields may still not fit
+ *   the opcode (see wire_decode). Text that starts with a control
+ *   character, a tab or a newline, is not taken for binary.
+ */
+bool wire_isBinary(const char* message, const int length);
+
+/******************************************/
+/* wire_offered: does this PLAY, SPECTATE or RESUME make this offer?
+ * Caller provides: the message, as a string, and the offer (wire_Offer...).
+ * Function returns: true if one of the lines after its first is the offer.
+ */
+bool wire_offered(const char* message, const char* offer);
+
+/******************************************/
+/* wire_encode: write a message in binary.
+ * Caller provides:
+ *   a buffer of at least wire_MaxBytes,
+ *   an opcode, and its fields, in order.
+ * Function returns: the length of the message (not a string), or 0
+ *   for a bad opcode.
+ */
+int wire_encode(char* buf, const wireOp_t op, const long long fields[]);
+
+/******************************************/
+/* wire_format: write the text form of a message.
+ * Caller provides:
+ *   a buffer of at least wire_MaxText,
+ *   an opcode, and its fields, in order.
+ * Function returns: the length of the string written, or 0 for a bad
+ *   opcode (and the buffer holds "").
+ */
+int wire_format(char* buf, const wireOp_t op, const long long fields[]);
+
+/******************************************/
+/* wire_decode: read a binary message.
+ * Caller provides:
+ *   the message and its length (message_length, for one received),
+ *   room for wire_MaxFields fields.
+ * Function returns: the opcode, with its fields filled in, or WIRE_NONE
+ *   if the message is not a binary message whose length fits its opcode.
+ */
+wireOp_t wire_decode(const char* message, const int length, long long fields[]);
+
+#endif // _WIRE_H_
@@ -0,0 +1,200 @@
+/*
+ * wiretest - unit test of the wire module's binary framing
+ *
+ * Every opcode is encoded and decoded again, with the smallest, largest
+ * and -1 values its fields can hold (negative shorts, the -1 tag of a
+ * KEY, whole 8-byte tokens), and must come back the same. Its length
+ * must be the header and the widths of its fields, and any other length,
+ * short or long, or a header that says otherwise, is WIRE_NONE. The text
+ * forms of a few messages are checked as written, and so are offers.
+ *
+ * usage: ./wiretest    (exit status 0 if all checks pass)
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "wire.h"
+
+/**************** file-local constants ****************/
+#define HeaderBytes 3         // opcode and length, as in wire.c
+#define NumValues 3           // of each kind of field: smallest, largest, -1
+
+/**************** file-local types ****************/
+typedef struct opcode {
+  wireOp_t op;
+  const char* name;           // of the text form
+  const char* fields;         // as in wire.h: c letter, s short, i int, t token
+} opcode_t;
+
+/**************** file-local global variables ****************/
+static const opcode_t opcodes[] = {
+  { WIRE_OK, "OK", "c" },
+  { WIRE_GRID, "GRID", "ss" },
+  { WIRE_GOLD_REMAINING, "GOLD_REMAINING", "i" },
+  { WIRE_GOLD, "GOLD", "iii" },
+  { WIRE_SPECTATOR_GOLD, "SPECTATOR_GOLD", "ciii" },
+  { WIRE_STOLEN, "STOLEN", "cciii" },
+  { WIRE_SEQ, "SEQ", "i" },
+  { WIRE_SESSION, "SESSION", "t" },
+  { WIRE_KEY, "KEY", "csi" },
+  { WIRE_GOTO, "GOTO", "ss" },
+};
+static const int numOpcodes = sizeof(opcodes) / sizeof(opcodes[0]);
+
+static int failures = 0;
+
+/**************** local functions ****************/
+static void roundTrip(const opcode_t* opcode, const int which);
+static long long sampleValue(const char kind, const int which);
+static int fieldBytes(const char kind);
+static void checkText(const wireOp_t op, const long long fields[], const char* expected);
+static void check(const bool ok, const char* what, const char* name);
+
+int
+main(void)
+{
+  // the table above must cover every opcode
+  check(numOpcodes == wire_NumOps - 1, "every opcode is tested", "wire_NumOps");
+
+  // every opcode, with each of its values, both ways
+  for (int i = 0; i < numOpcodes; i++) {
+    for (int which = 0; which < NumValues; which++) {
+      roundTrip(&opcodes[i], which);
+    }
+  }
+
+  // no opcode, or past the last, is never written
+  char buf[wire_MaxText];
+  long long fields[wire_MaxFields] = { 0 };
+  check(wire_encode(buf, WIRE_NONE, fields) == 0, "WIRE_NONE is not encoded", "NONE");
+  check(wire_encode(buf, wire_NumOps, fields) == 0, "a bad opcode is not encoded", "NONE");
+  check(wire_format(buf, wire_NumOps, fields) == 0 && buf[0] == '\0',
+        "a bad opcode is formatted as \"\"", "NONE");
+
+  // text is not binary, even when it starts with a tab or a newline,
+  // which are opcodes by value
+  const char* texts[] = { "KEY h", "\tKEY h", "\nKEY h", "\x0a\x00\x02", "" };
+  const int textLengths[] = { 5, 6, 6, 3, 0 };
+  for (int i = 0; i < 5; i++) {
+    check(!wire_isBinary(texts[i], textLengths[i])
+          && wire_decode(texts[i], textLengths[i], fields) == WIRE_NONE,
+          "text is not taken for binary", texts[i]);
+  }
+
+  // the text forms, as a client or the log would show them
+  checkText(WIRE_KEY, (long long[]) { 'h', 1, -1 }, "KEY h 1 -1");
+  checkText(WIRE_GOTO, (long long[]) { -1, -1 }, "GOTO -1 -1");
+  checkText(WIRE_STOLEN, (long long[]) { 'A', 'B', 5, 10, 240 }, "STOLEN A B 5 10 240");
+  checkText(WIRE_SESSION, (long long[]) { 0x0123456789abcdefLL }, "SESSION 0123456789abcdef");
+  checkText(WIRE_SESSION, (long long[]) { -1 }, "SESSION ffffffffffffffff");
+
+  // offers are whole lines after the first
+  check(wire_offered("PLAY alice\nBINARY", wire_OfferBinary), "an offer is found", "BINARY");
+  check(wire_offered("PLAY alice\nBINARY\nOVERLAY", wire_OfferOverlay),
+        "a second offer is found", "OVERLAY");
+  check(!wire_offered("PLAY BINARY", wire_OfferBinary),
+        "the first line is no offer", "PLAY BINARY");
+  check(!wire_offered("PLAY alice\nBINARYX", wire_OfferBinary),
+        "an offer is a whole line", "BINARYX");
+
+  printf("wiretest: %s\n", failures == 0 ? "all passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
+
+/**************** roundTrip ****************/
+/* Encode a message with one set of values, decode it, and check that
+ * every other length of it is refused. */
+static void
+roundTrip(const opcode_t* opcode, const int which)
+{
+  long long fields[wire_MaxFields];
+  int expectedLength = HeaderBytes;
+  for (int i = 0; opcode->fields[i] != '\0'; i++) {
+    fields[i] = sampleValue(opcode->fields[i], which);
+    expectedLength += fieldBytes(opcode->fields[i]);
+  }
+
+  char buf[wire_MaxBytes + 1];
+  int length = wire_encode(buf, opcode->op, fields);
+  check(length == expectedLength && length <= wire_MaxBytes,
+        "the length is the header and the fields", opcode->name);
+  check(wire_isBinary(buf, length), "it is binary", opcode->name);
+
+  long long decoded[wire_MaxFields];
+  bool same = (wire_decode(buf, length, decoded) == opcode->op);
+  for (int i = 0; same && opcode->fields[i] != '\0'; i++) {
+    same = (decoded[i] == fields[i]);
+  }
+  check(same, "it decodes to the same fields", opcode->name);
+
+  // cut short anywhere, or with a byte more, it is not a message
+  bool refused = true;
+  for (int cut = 0; cut < length; cut++) {
+    refused = refused && wire_decode(buf, cut, decoded) == WIRE_NONE;
+  }
+  buf[length] = 0;
+  refused = refused && wire_decode(buf, length + 1, decoded) == WIRE_NONE;
+  check(refused, "a truncated or longer message is WIRE_NONE", opcode->name);
+
+  // nor is one whose header gives another length
+  buf[2]++;
+  check(wire_decode(buf, length, decoded) == WIRE_NONE,
+        "a header of the wrong length is WIRE_NONE", opcode->name);
+  buf[2]--;
+
+  // the text form: the name, then each field
+  char text[wire_MaxText];
+  int textLength = wire_format(text, opcode->op, fields);
+  check(textLength == (int) strlen(text) && strncmp(text, opcode->name, strlen(opcode->name)) == 0
+        && text[strlen(opcode->name)] == (opcode->fields[0] == '\0' ? '\0' : ' '),
+        "the text form starts with its name", opcode->name);
+}
+
+/**************** sampleValue ****************/
+/* The smallest (which 0), largest (1), or -1 (2) value of a kind. */
+static long long
+sampleValue(const char kind, const int which)
+{
+  switch (kind) {
+  case 'c': return (const char[]) { 'A', 'z', '@' }[which];
+  case 's': return (const long long[]) { SHRT_MIN, SHRT_MAX, -1 }[which];
+  case 'i': return (const long long[]) { INT_MIN, INT_MAX, -1 }[which];
+  default:  return (const long long[]) { LLONG_MIN, LLONG_MAX, -1 }[which];
+  }
+}
+
+/**************** fieldBytes ****************/
+/* Bytes a field of this kind takes, by wire.h. */
+static int
+fieldBytes(const char kind)
+{
+  switch (kind) {
+  case 'c': return 1;
+  case 's': return 2;
+  case 'i': return 4;
+  default:  return 8;
+  }
+}
+
+/**************** checkText ****************/
+/* Is the text form of the message as expected? */
+static void
+checkText(const wireOp_t op, const long long fields[], const char* expected)
+{
+  char text[wire_MaxText];
+  wire_format(text, op, fields);
+  check(strcmp(text, expected) == 0, "the text form is", expected);
+}
+
+/**************** check ****************/
+/* Report one check. */
+static void
+check(const bool ok, const char* what, const char* name)
+{
+  if (!ok) {
+    printf("FAIL: %s: %s\n", name, what);
+    failures++;
+  }
+}